@@ -23,7 +23,8 @@
 #define PKT_RCPT_NOTIF_REQ_LEN  3                                               /**< Length (in bytes) of the Packet Receipt Notification Request. */
 #define MAX_PKTS_RCPT_NOTIF_LEN 6                                               /**< Maximum length (in bytes) of the Packets Receipt Notification. */
 #define MAX_RESPONSE_LEN        7                                               /**< Maximum length (in bytes) of the response to a Control Point command. */
-#define MAX_NOTIF_BUFFER_LEN    MAX(MAX_PKTS_RCPT_NOTIF_LEN, MAX_RESPONSE_LEN)  /**< Maximum length (in bytes) of the buffer needed by DFU Service while sending notifications to peer. */
+#define MAX_CTRL_PT_LEN         (247 - 3)                                       /**< Maximum length (in bytes) of the DFU Control Point, readback frames are sized up to the largest ATT MTU. */
+#define MAX_NOTIF_BUFFER_LEN    MAX_CTRL_PT_LEN                                 /**< Maximum length (in bytes) of the buffer needed by DFU Service while sending notifications to peer. */
 
 enum
 {
@@ -35,8 +36,10 @@ enum
     OP_CODE_SYS_RESET          = 6,                                             /**< Value of the Op code field for 'Reset System' command.*/
     OP_CODE_IMAGE_SIZE_REQ     = 7,                                             /**< Value of the Op code field for 'Report received image size' command.*/
     OP_CODE_PKT_RCPT_NOTIF_REQ = 8,                                             /**< Value of the Op code field for 'Request packet receipt notification.*/
+    OP_CODE_READBACK           = 9,                                             /**< Value of the Op code field for 'Flash readback' command.*/
     OP_CODE_RESPONSE           = 16,                                            /**< Value of the Op code field for 'Response.*/
-    OP_CODE_PKT_RCPT_NOTIF     = 17                                             /**< Value of the Op code field for 'Packets Receipt Notification'.*/
+    OP_CODE_PKT_RCPT_NOTIF     = 17,                                            /**< Value of the Op code field for 'Packets Receipt Notification'.*/
+    OP_CODE_READBACK_RESPONSE  = 18                                             /**< Value of the Op code field for 'Readback Response', carrying one readback frame.*/
 };
 
 static bool     m_is_dfu_service_initialized = false;                           /**< Variable to check if the DFU service was initialized by the application.*/
@@ -186,7 +189,7 @@ static uint32_t dfu_ctrl_pt_add(ble_dfu_t * const p_dfu)
     attr_char_value.p_attr_md = &attr_md;
     attr_char_value.init_len  = 0;
     attr_char_value.init_offs = 0;
-    attr_char_value.max_len   = BLE_GATT_ATT_MTU_DEFAULT;
+    attr_char_value.max_len   = MAX_CTRL_PT_LEN;
     attr_char_value.p_value   = NULL;
 
     return sd_ble_gatts_characteristic_add(p_dfu->service_handle,
@@ -375,6 +378,15 @@ static uint32_t on_ctrl_pt_write(ble_dfu_t * p_dfu, ble_gatts_evt_write_t * p_bl
             p_dfu->evt_handler(p_dfu, &ble_dfu_evt);
             break;
 
+        case OP_CODE_READBACK:
+            ble_dfu_evt.ble_dfu_evt_type = BLE_DFU_READBACK;
+
+            ble_dfu_evt.evt.ble_dfu_pkt_write.len    = p_ble_write_evt->len - 1;
+            ble_dfu_evt.evt.ble_dfu_pkt_write.p_data = &(p_ble_write_evt->data[1]);
+
+            p_dfu->evt_handler(p_dfu, &ble_dfu_evt);
+            break;
+
         default:
             // Unsupported op code.
             return ble_dfu_response_send(p_dfu,
@@ -647,3 +659,40 @@ uint32_t ble_dfu_response_send(ble_dfu_t         * p_dfu,
 
     return sd_ble_gatts_hvx(p_dfu->conn_handle, &hvx_params);
 }
+
+
+uint32_t ble_dfu_readback_notify(ble_dfu_t * p_dfu, uint8_t const * p_frame, uint16_t len)
+{
+    if (p_dfu == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if ((p_dfu->conn_handle == BLE_CONN_HANDLE_INVALID) || !m_is_dfu_service_initialized)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    if (len >= MAX_NOTIF_BUFFER_LEN)
+    {
+        return NRF_ERROR_DATA_SIZE;
+    }
+
+    ble_gatts_hvx_params_t hvx_params;
+    uint16_t               index = 0;
+
+    m_notif_buffer[index++] = OP_CODE_READBACK_RESPONSE;
+
+    memcpy(&m_notif_buffer[index], p_frame, len);
+    index += len;
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+
+    hvx_params.handle = p_dfu->dfu_ctrl_pt_handles.value_handle;
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.offset = 0;
+    hvx_params.p_len  = &index;
+    hvx_params.p_data = m_notif_buffer;
+
+    return sd_ble_gatts_hvx(p_dfu->conn_handle, &hvx_params);
+}
@@ -54,7 +54,8 @@ typedef enum
     BLE_DFU_PKT_RCPT_NOTIF_ENABLED,                                     /**< The event indicating that the peer has enabled packet receipt notifications. It is the responsibility of the application to call @ref ble_dfu_pkts_rcpt_notify each time the number of packets indicated by num_of_pkts field in @ref ble_dfu_evt_t is received.*/
     BLE_DFU_PKT_RCPT_NOTIF_DISABLED,                                    /**< The event indicating that the peer has disabled the packet receipt notifications.*/
     BLE_DFU_PACKET_WRITE,                                               /**< The event indicating that the peer has written a value to the 'DFU Packet' characteristic. The data received from the peer will be present in the @ref BLE_DFU_PACKET_WRITE element contained within @ref ble_dfu_evt_t.*/
-    BLE_DFU_BYTES_RECEIVED_SEND                                         /**< The event indicating that the peer is requesting for the number of bytes of firmware data last received by the application. It is the responsibility of the application to call @ref ble_dfu_pkts_rcpt_notify in response to this event. */
+    BLE_DFU_BYTES_RECEIVED_SEND,                                        /**< The event indicating that the peer is requesting for the number of bytes of firmware data last received by the application. It is the responsibility of the application to call @ref ble_dfu_pkts_rcpt_notify in response to this event. */
+    BLE_DFU_READBACK                                                    /**< The event indicating that the peer has requested a flash readback. The request is present in the @ref BLE_DFU_PACKET_WRITE element contained within @ref ble_dfu_evt_t. It is the responsibility of the application to answer with @ref ble_dfu_readback_notify.*/
 } ble_dfu_evt_type_t;
 
 /**@brief   DFU Procedure type.
@@ -234,6 +235,21 @@ uint32_t ble_dfu_bytes_rcvd_report(ble_dfu_t * p_dfu, uint32_t num_of_firmware_b
  */
 uint32_t ble_dfu_pkts_rcpt_notify(ble_dfu_t * p_dfu, uint32_t num_of_firmware_bytes_rcvd);
 
+/**@brief      Function for sending a flash readback frame to the peer.
+ *
+ *             This function will send the frame as a notification of the control point
+ *             characteristic, prefixed by the Readback Response op code.
+ *
+ * @param[in]  p_dfu    Pointer to the DFU service structure.
+ * @param[in]  p_frame  Readback frame.
+ * @param[in]  len      Length of the frame, at most negotiated ATT MTU minus 4.
+ *
+ * @return     NRF_SUCCESS if the DFU Service has successfully requested the SoftDevice to send
+ *             the notification. NRF_ERROR_RESOURCES if the notification queue is full, the frame
+ *             is to be sent again on BLE_GATTS_EVT_HVN_TX_COMPLETE. Otherwise an error code.
+ */
+uint32_t ble_dfu_readback_notify(ble_dfu_t * p_dfu, uint8_t const * p_frame, uint16_t len);
+
 #endif // BLE_DFU_H__
 
 /** @} */
@@ -31,6 +31,8 @@
 #include "app_timer.h"
 
 #include "boards.h"
+#include "dfu_readback.h"
+#include "aes_ctr.h"
 
 #ifdef NRF52840_XXAA
 #include "tusb.h"
@@ -60,6 +62,7 @@ typedef enum
 
 static pstorage_handle_t        m_bootsettings_handle;  /**< Pstorage handle to use for registration and identifying the bootloader module on subsequent calls to the pstorage module for load and store of bootloader setting in flash. */
 static bootloader_status_t      m_update_status;        /**< Current update status for the bootloader module to ensure correct behaviour when updating settings and when update completes. */
+static bootloader_settings_record_t m_settings_record;  /**< Settings record being written, kept until pstorage is done with it. */
 
 APP_TIMER_DEF( _dfu_startup_timer );
 volatile bool dfu_startup_packet_received = false;
@@ -75,6 +78,12 @@ static void pstorage_callback_handler(pstorage_handle_t * p_handle,
                                       uint8_t           * p_data,
                                       uint32_t            data_len)
 {
+    // A settings record or digest has been written, or a log page erased.
+    if ((op_code == PSTORAGE_STORE_OP_CODE) || (op_code == PSTORAGE_CLEAR_OP_CODE))
+    {
+        bootloader_settings_refresh();
+    }
+
     // If we are in BOOTLOADER_SETTINGS_SAVING state and we receive an PSTORAGE_STORE_OP_CODE
     // response then settings has been saved and update has completed.
     if ((m_update_status == BOOTLOADER_SETTINGS_SAVING) && (op_code == PSTORAGE_STORE_OP_CODE))
@@ -127,12 +136,22 @@ static void wait_for_events(void)
     // Event received. Process it from the scheduler.
     app_sched_execute();
 
+    // Hash flash for a digest request one chunk at a time, transport and WDT are serviced in between
+    dfu_readback_task();
+
+#ifdef DFU_AES_KEY_FILE
+    // Keep AES-CTR keystream ahead of encrypted image data
+    aes_ctr_task();
+#endif
+
 #ifdef NRF52840_XXAA
     // skip if usb is not inited ( e.g OTA / finializing sd/bootloader )
     extern bool usb_inited(void);
+    extern void msc_uf2_task(void);
     if ( tusb_inited() )
     {
       tud_task();
+      msc_uf2_task();
       tud_cdc_write_flush();
     }
 #endif
@@ -148,6 +167,23 @@ static void wait_for_events(void)
 }
 
 
+uint32_t bootloader_app_address(void)
+{
+#ifdef DFU_DUAL_BANK
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    if (p_bootloader_settings->app_bank == 1)
+    {
+        return DFU_BANK_1_REGION_START;
+    }
+#endif
+
+    return DFU_BANK_0_REGION_START;
+}
+
+
 bool bootloader_app_is_valid(uint32_t app_addr)
 {
   bootloader_settings_t const * p_bootloader_settings;
@@ -158,6 +194,12 @@ bool bootloader_app_is_valid(uint32_t app_addr)
         return false;
     }
 
+    // Only the application of the active bank is described by bank 0 settings.
+    if (app_addr != bootloader_app_address())
+    {
+        return false;
+    }
+
     bool success = false;
 
     bootloader_util_settings_get(&p_bootloader_settings);
@@ -170,7 +212,7 @@ bool bootloader_app_is_valid(uint32_t app_addr)
         // A stored crc value of 0 indicates that CRC checking is not used.
         if (p_bootloader_settings->bank_0_crc != 0)
         {
-            image_crc = crc16_compute((uint8_t *)DFU_BANK_0_REGION_START,
+            image_crc = crc16_compute((uint8_t *)app_addr,
                                       p_bootloader_settings->bank_0_size,
                                       NULL);
         }
@@ -182,26 +224,188 @@ bool bootloader_app_is_valid(uint32_t app_addr)
 }
 
 
+/**@brief   Function for checking whether the application is on trial.
+ *
+ * @details An application is on trial when the previous one is still available to go back to and
+ *          the new one has not confirmed itself yet.
+ */
+static bool app_trial_pending(bootloader_settings_t const * p_settings)
+{
+    return (p_settings->bank_1 == BANK_VALID_APP) && (p_settings->app_confirmed == EMPTY_FLASH_MASK);
+}
+
+
+/**@brief   Function for counting the starts of the application on trial.
+ */
+static uint32_t app_trial_count(bootloader_settings_t const * p_settings)
+{
+    uint32_t count = 0;
+
+    while ((count < BOOTLOADER_APP_TRIAL_MAX) && (p_settings->app_trial[count] != EMPTY_FLASH_MASK))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+
+/**@brief   Function for validating the previous application kept in the other bank.
+ */
+static bool app_fallback_is_valid(bootloader_settings_t const * p_settings)
+{
+    uint32_t const fallback_addr = (bootloader_app_address() == DFU_BANK_1_REGION_START) ?
+                                   DFU_BANK_0_REGION_START : DFU_BANK_1_REGION_START;
+
+    if ((p_settings->bank_1 != BANK_VALID_APP) ||
+        (p_settings->bank_1_size > DFU_IMAGE_MAX_SIZE_BANKED) ||
+        (*((uint32_t *)fallback_addr) == EMPTY_FLASH_MASK))
+    {
+        return false;
+    }
+
+    // A stored crc value of 0 indicates that CRC checking is not used.
+    if (p_settings->bank_1_crc == 0)
+    {
+        return true;
+    }
+
+    return crc16_compute((uint8_t *)fallback_addr, p_settings->bank_1_size, NULL) == p_settings->bank_1_crc;
+}
+
+
+STATIC_ASSERT(offsetof(bootloader_settings_t, app_digest_size) ==
+              offsetof(bootloader_settings_t, app_digest) + BOOTLOADER_APP_DIGEST_LEN);
+
+/**@brief   Function for dropping the cached application digest when bank 0 is changed.
+ *
+ * @details Digest fields are left erased so that the digest of the new application can later be
+ *          written in place, without erasing the settings page again.
+ */
+static void app_digest_invalidate(bootloader_settings_t * p_settings)
+{
+    memset(p_settings->app_digest, 0xFF, BOOTLOADER_APP_DIGEST_LEN);
+    p_settings->app_digest_size = EMPTY_FLASH_MASK;
+}
+
+
+/**@brief   Function for keeping the cached application digest when bank 0 is unchanged.
+ */
+static void app_digest_keep(bootloader_settings_t * p_settings, bootloader_settings_t const * p_current)
+{
+    memcpy(p_settings->app_digest, p_current->app_digest, BOOTLOADER_APP_DIGEST_LEN);
+    p_settings->app_digest_size = p_current->app_digest_size;
+}
+
+
+/**@brief   Function for starting the trial of the application over.
+ *
+ * @details Trial fields are left erased so that the application can confirm itself and the
+ *          bootloader count its starts without erasing the settings page again.
+ */
+static void app_trial_reset(bootloader_settings_t * p_settings)
+{
+    p_settings->app_confirmed = EMPTY_FLASH_MASK;
+    memset(p_settings->app_trial, 0xFF, sizeof(p_settings->app_trial));
+}
+
+
+/**@brief   Function for writing bootloader settings directly, SoftDevice must not be enabled.
+ *
+ * @details Settings are appended to the settings log, a page is only erased when the log is full
+ *          or compact is requested.
+ */
+static void bootloader_settings_write(bootloader_settings_t const * p_settings, bool compact)
+{
+  uint32_t addr;
+
+  if ( bootloader_settings_record_prepare(p_settings, compact, &m_settings_record, &addr) )
+  {
+    nrf_nvmc_page_erase(addr);
+  }
+
+  nrf_nvmc_write_words(addr, (uint32_t const *) &m_settings_record, sizeof(bootloader_settings_record_t) / 4);
+
+  bootloader_settings_refresh();
+}
+
+
 static void bootloader_settings_save(bootloader_settings_t * p_settings)
 {
+  app_trial_reset(p_settings);
+
   if ( is_ota() )
   {
-    uint32_t err_code = pstorage_clear(&m_bootsettings_handle, sizeof(bootloader_settings_t));
-    APP_ERROR_CHECK(err_code);
+    uint32_t          err_code;
+    pstorage_handle_t handle = m_bootsettings_handle;
+
+    // pstorage clears one page per SOC_MAX_WRITE_SIZE of size, the record size clears one page
+    if ( bootloader_settings_record_prepare(p_settings, false, &m_settings_record, &handle.block_id) )
+    {
+      err_code = pstorage_clear(&handle, sizeof(bootloader_settings_record_t));
+      APP_ERROR_CHECK(err_code);
+    }
 
-    err_code = pstorage_store(&m_bootsettings_handle, (uint8_t *) p_settings, sizeof(bootloader_settings_t), 0);
+    err_code = pstorage_store(&handle, (uint8_t *) &m_settings_record, sizeof(bootloader_settings_record_t), 0);
     APP_ERROR_CHECK(err_code);
   }
   else
   {
-    nrf_nvmc_page_erase(BOOTLOADER_SETTINGS_ADDRESS);
-    nrf_nvmc_write_words(BOOTLOADER_SETTINGS_ADDRESS, (uint32_t *) p_settings, sizeof(bootloader_settings_t) / 4);
+    bootloader_settings_write(p_settings, false);
 
-    pstorage_callback_handler(&m_bootsettings_handle, PSTORAGE_STORE_OP_CODE, NRF_SUCCESS, (uint8_t *) p_settings, sizeof(bootloader_settings_t));
+    pstorage_callback_handler(&m_bootsettings_handle, PSTORAGE_STORE_OP_CODE, NRF_SUCCESS, (uint8_t *) &m_settings_record, sizeof(bootloader_settings_record_t));
   }
 }
 
 
+/**@brief   Function for moving the settings log back to the start of the settings page.
+ *
+ * @details The MBR uses its params page while it copies a new bootloader, and a bootloader
+ *          predating the settings log only reads settings at the start of the settings page.
+ *          The log is moved over page by page so that a reset never leaves it without a record.
+ */
+static void bootloader_settings_home(void)
+{
+    __attribute__((aligned(4))) static bootloader_settings_t settings;
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    while ((uint32_t)p_bootloader_settings != BOOTLOADER_SETTINGS_ADDRESS)
+    {
+        // Fields written in place are carried over as they are.
+        memcpy(&settings, p_bootloader_settings, sizeof(bootloader_settings_t));
+        bootloader_settings_write(&settings, true);
+
+        bootloader_util_settings_get(&p_bootloader_settings);
+    }
+}
+
+
+/**@brief   Function for moving the current settings record out of the MBR params page.
+ *
+ * @details An application may have the MBR use its params page through sd_mbr_command(), which
+ *          would erase a record kept there. The log is moved over to the settings page before the
+ *          application is started, the settings page is only erased when the log had moved off it.
+ */
+static void bootloader_settings_leave_mbr_page(void)
+{
+    __attribute__((aligned(4))) static bootloader_settings_t settings;
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    uint32_t const offset = (uint32_t)p_bootloader_settings - BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS;
+
+    if (offset < CODE_PAGE_SIZE)
+    {
+        // Fields written in place are carried over as they are.
+        memcpy(&settings, p_bootloader_settings, sizeof(bootloader_settings_t));
+        bootloader_settings_write(&settings, true);
+    }
+}
+
+
 void bootloader_dfu_update_process(dfu_update_status_t update_status)
 {
   __attribute__((aligned(4)))  static bootloader_settings_t settings;
@@ -211,10 +415,41 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
 
     if (update_status.status_code == DFU_UPDATE_APP_COMPLETE)
     {
+        uint16_t const app_bank = (update_status.app_image_start == DFU_BANK_1_REGION_START) ? 1 : 0;
+        uint16_t const cur_bank = (bootloader_app_address() == DFU_BANK_1_REGION_START) ? 1 : 0;
+
+        if (app_bank != cur_bank)
+        {
+            // Received into the other bank: current application is kept to go back to, the new
+            // one is started on trial.
+            settings.bank_1      = (p_bootloader_settings->bank_0 == BANK_VALID_APP) ? BANK_VALID_APP :
+                                                                                      BANK_INVALID_APP;
+            settings.bank_1_crc  = p_bootloader_settings->bank_0_crc;
+            settings.bank_1_size = p_bootloader_settings->bank_0_size;
+        }
+        else
+        {
+            // Replaced in place, previous application if any is still in the other bank.
+            settings.bank_1      = (p_bootloader_settings->bank_1 == BANK_VALID_APP) ? BANK_VALID_APP :
+                                                                                      BANK_INVALID_APP;
+            settings.bank_1_crc  = p_bootloader_settings->bank_1_crc;
+            settings.bank_1_size = p_bootloader_settings->bank_1_size;
+        }
+
         settings.bank_0_crc  = update_status.app_crc;
         settings.bank_0_size = update_status.app_size;
         settings.bank_0      = BANK_VALID_APP;
-        settings.bank_1      = BANK_INVALID_APP;
+        settings.app_bank    = app_bank;
+
+        if (update_status.p_app_digest != NULL)
+        {
+            memcpy(settings.app_digest, update_status.p_app_digest, BOOTLOADER_APP_DIGEST_LEN);
+            settings.app_digest_size = update_status.app_size;
+        }
+        else
+        {
+            app_digest_invalidate(&settings);
+        }
 
         m_update_status      = BOOTLOADER_SETTINGS_SAVING;
         bootloader_settings_save(&settings);
@@ -227,10 +462,14 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
                                   update_status.app_size;
         settings.bank_0         = BANK_VALID_SD;
         settings.bank_1         = BANK_INVALID_APP;
+        settings.bank_1_crc     = 0;
+        settings.bank_1_size    = 0;
+        settings.app_bank       = 0;
         settings.sd_image_size  = update_status.sd_size;
         settings.bl_image_size  = update_status.bl_size;
         settings.app_image_size = update_status.app_size;
         settings.sd_image_start = update_status.sd_image_start;
+        app_digest_invalidate(&settings);
 
         m_update_status         = BOOTLOADER_SETTINGS_SAVING;
         bootloader_settings_save(&settings);
@@ -241,9 +480,14 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
         settings.bank_0_crc     = p_bootloader_settings->bank_0_crc;
         settings.bank_0_size    = p_bootloader_settings->bank_0_size;
         settings.bank_1         = BANK_VALID_BOOT;
+        settings.bank_1_crc     = 0;
+        settings.bank_1_size    = 0;
+        settings.app_bank       = p_bootloader_settings->app_bank;
         settings.sd_image_size  = update_status.sd_size;
         settings.bl_image_size  = update_status.bl_size;
         settings.app_image_size = update_status.app_size;
+        settings.sd_image_start = update_status.sd_image_start;
+        app_digest_keep(&settings, p_bootloader_settings);
 
         m_update_status         = BOOTLOADER_SETTINGS_SAVING;
         bootloader_settings_save(&settings);
@@ -255,6 +499,8 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
             settings.bank_0_crc     = 0;
             settings.bank_0_size    = 0;
             settings.bank_0         = BANK_INVALID_APP;
+            settings.app_bank       = 0;
+            app_digest_invalidate(&settings);
         }
         // This handles cases where SoftDevice was not updated, hence bank0 keeps its settings.
         else
@@ -262,9 +508,13 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
             settings.bank_0         = p_bootloader_settings->bank_0;
             settings.bank_0_crc     = p_bootloader_settings->bank_0_crc;
             settings.bank_0_size    = p_bootloader_settings->bank_0_size;
+            settings.app_bank       = p_bootloader_settings->app_bank;
+            app_digest_keep(&settings, p_bootloader_settings);
         }
 
         settings.bank_1         = BANK_INVALID_APP;
+        settings.bank_1_crc     = 0;
+        settings.bank_1_size    = 0;
         settings.sd_image_size  = 0;
         settings.bl_image_size  = 0;
         settings.app_image_size = 0;
@@ -293,6 +543,32 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
         settings.bank_0_size = 0;
         settings.bank_0      = BANK_INVALID_APP;
         settings.bank_1      = p_bootloader_settings->bank_1;
+        settings.bank_1_crc  = p_bootloader_settings->bank_1_crc;
+        settings.bank_1_size = p_bootloader_settings->bank_1_size;
+        settings.app_bank    = p_bootloader_settings->app_bank;
+        app_digest_invalidate(&settings);
+
+        bootloader_settings_save(&settings);
+
+#ifdef NRF52840_XXAA
+        // CURRENT.UF2 and CURRENT.BIN no longer describe an application
+        extern void ghostfat_layout_reset(void);
+        ghostfat_layout_reset();
+#endif
+    }
+    else if (update_status.status_code == DFU_BANK_0_STAGED)
+    {
+        // Recorded before bank 0 is overwritten, installation resumes from here after a reset.
+        settings.bank_0           = BANK_VALID_STAGED;
+        settings.bank_0_crc       = update_status.app_crc;
+        settings.bank_0_size      = update_status.app_size;
+        settings.bank_1           = p_bootloader_settings->bank_1;
+        settings.bank_1_crc       = p_bootloader_settings->bank_1_crc;
+        settings.bank_1_size      = p_bootloader_settings->bank_1_size;
+        settings.app_bank         = p_bootloader_settings->app_bank;
+        settings.staged_init_size = update_status.staged_init_size;
+        settings.staged_flags     = update_status.staged_flags;
+        app_digest_invalidate(&settings);
 
         bootloader_settings_save(&settings);
     }
@@ -307,6 +583,107 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
 }
 
 
+void bootloader_app_digest_save(uint32_t app_size, uint8_t const * p_digest)
+{
+    __attribute__((aligned(4))) static uint8_t entry[BOOTLOADER_APP_DIGEST_LEN + sizeof(uint32_t)];
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    // Only an erased slot can be written, the next settings record starts with it erased again.
+    if (p_bootloader_settings->app_digest_size != EMPTY_FLASH_MASK)
+    {
+        return;
+    }
+
+    memcpy(entry, p_digest, BOOTLOADER_APP_DIGEST_LEN);
+    (void)uint32_encode(app_size, &entry[BOOTLOADER_APP_DIGEST_LEN]);
+
+    // Written in place in the current record, app_digest_size last.
+    if ( is_ota() )
+    {
+        pstorage_handle_t handle = m_bootsettings_handle;
+
+        handle.block_id = (uint32_t) p_bootloader_settings->app_digest;
+
+        uint32_t err_code = pstorage_store(&handle, entry, sizeof(entry), 0);
+        APP_ERROR_CHECK(err_code);
+    }
+    else
+    {
+        nrf_nvmc_write_words((uint32_t) p_bootloader_settings->app_digest, (uint32_t *) entry, sizeof(entry) / 4);
+
+        bootloader_settings_refresh();
+    }
+}
+
+
+void bootloader_app_trial_check(void)
+{
+    __attribute__((aligned(4))) static bootloader_settings_t settings;
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    if (!app_trial_pending(p_bootloader_settings))
+    {
+        return;
+    }
+
+    // Application on trial keeps running until it confirms itself or runs out of starts.
+    if ((app_trial_count(p_bootloader_settings) < BOOTLOADER_APP_TRIAL_MAX) &&
+        bootloader_app_is_valid(bootloader_app_address()))
+    {
+        return;
+    }
+
+    // Nothing to go back to, application on trial is the best there is.
+    if (!app_fallback_is_valid(p_bootloader_settings))
+    {
+        return;
+    }
+
+    // Swap the roles of the banks, the failed application is never started again.
+    memset(&settings, 0xFF, sizeof(settings));
+
+    settings.bank_0         = BANK_VALID_APP;
+    settings.bank_0_crc     = p_bootloader_settings->bank_1_crc;
+    settings.bank_0_size    = p_bootloader_settings->bank_1_size;
+    settings.bank_1         = BANK_INVALID_APP;
+    settings.bank_1_crc     = p_bootloader_settings->bank_0_crc;
+    settings.bank_1_size    = p_bootloader_settings->bank_0_size;
+    settings.app_bank       = (bootloader_app_address() == DFU_BANK_1_REGION_START) ? 0 : 1;
+    settings.sd_image_size  = 0;
+    settings.bl_image_size  = 0;
+    settings.app_image_size = 0;
+    settings.sd_image_start = 0;
+
+    bootloader_settings_write(&settings, false);
+}
+
+
+/**@brief   Function for counting a start of the application on trial.
+ */
+static void app_trial_mark(void)
+{
+    bootloader_settings_t const * p_bootloader_settings;
+
+    bootloader_util_settings_get(&p_bootloader_settings);
+
+    if (app_trial_pending(p_bootloader_settings))
+    {
+        uint32_t const count = app_trial_count(p_bootloader_settings);
+
+        if (count < BOOTLOADER_APP_TRIAL_MAX)
+        {
+            nrf_nvmc_write_word((uint32_t)&p_bootloader_settings->app_trial[count], 0);
+
+            bootloader_settings_refresh();
+        }
+    }
+}
+
+
 uint32_t bootloader_init(void)
 {
     uint32_t                err_code;
@@ -380,6 +757,12 @@ void bootloader_app_start(uint32_t app_addr)
     // can start the application safely.
     APP_ERROR_CHECK ( sd_softdevice_disable() );
 
+    // Record the application may confirm itself in must not be erased by its MBR commands.
+    bootloader_settings_leave_mbr_page();
+
+    // Start of an application on trial is counted, see bootloader_app_trial_check().
+    app_trial_mark();
+
     interrupts_disable();
 
 #if 0 // may need set forward irq
@@ -392,9 +775,9 @@ void bootloader_app_start(uint32_t app_addr)
     sd_mbr_command(&command);
 #endif
 
-    APP_ERROR_CHECK( sd_softdevice_vector_table_base_set(CODE_REGION_1_START) );
+    APP_ERROR_CHECK( sd_softdevice_vector_table_base_set(app_addr) );
 
-    bootloader_util_app_start(CODE_REGION_1_START);
+    bootloader_util_app_start(app_addr);
 }
 
 
@@ -434,6 +817,8 @@ uint32_t bootloader_dfu_sd_update_continue(void)
     err_code = dfu_sd_image_validate();
     APP_ERROR_CHECK(err_code);
 
+    bootloader_settings_home();
+
     err_code = dfu_bl_image_swap();
     APP_ERROR_CHECK(err_code);
 
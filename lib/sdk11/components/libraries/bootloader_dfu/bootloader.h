@@ -32,6 +32,26 @@
  */
 uint32_t bootloader_init(void);
 
+/**@brief Function for getting the start of the application to run.
+ *
+ * @details This is DFU_BANK_0_REGION_START, or the bank selected by bootloader settings with
+ *          DFU_DUAL_BANK. The other bank then receives application updates.
+ *
+ * @return    Address of the region in flash where the application to run is stored.
+ */
+uint32_t bootloader_app_address(void);
+
+/**@brief Function for going back to the previous application when the one on trial failed.
+ *
+ * @details An application received into the other bank is on trial until it clears the
+ *          app_confirmed word of bootloader settings. If it is still unconfirmed after
+ *          BOOTLOADER_APP_TRIAL_MAX starts, or if it is not valid, the previous application is
+ *          restored by swapping the roles of the banks. Nothing is moved in flash.
+ *
+ * @note  Settings are written directly, SoftDevice must not be enabled.
+ */
+void bootloader_app_trial_check(void);
+
 /**@brief Function for validating application region in flash.
  * 
  * @param[in]  app_addr      Address to the region in flash where the application is stored.
@@ -51,7 +71,7 @@ uint32_t bootloader_dfu_start(bool ota, uint32_t timeout_ms);
  *
  * @details This function will disable SoftDevice and all interrupts before jumping to application.
  *          The SoftDevice vector table base for interrupt forwarding will be set the application
- *          address.
+ *          address. A start of an application on trial is counted.
  *
  * @param[in]  app_addr      Address to the region where the application is stored.
  */
@@ -64,6 +84,16 @@ void bootloader_app_start(uint32_t app_addr);
  */
 void bootloader_settings_get(bootloader_settings_t * const p_settings);
 
+/**@brief Function for caching the SHA-256 digest of the application in bootloader settings.
+ *
+ * @details The digest is written to its erased slot in the settings page, it is dropped by the
+ *          next settings save that changes bank 0. Nothing is written if a digest is already cached.
+ *
+ * @param[in]  app_size      Size of the application covered by the digest.
+ * @param[in]  p_digest      SHA-256 digest of the application, BOOTLOADER_APP_DIGEST_LEN bytes.
+ */
+void bootloader_app_digest_save(uint32_t app_size, uint8_t const * p_digest);
+
 /**@brief Function for processing DFU status update.
  *
  * @param[in]  update_status DFU update status.
@@ -12,7 +12,11 @@
 
 #include "bootloader_settings.h"
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <dfu_types.h>
+#include "app_util.h"
+#include "crc16.h"
 
 #if defined ( __CC_ARM )
 
@@ -53,11 +57,204 @@ __root    const uint32_t m_uicr_mbr_params_page_address @ NRF_UICR_MBR_PARAMS_PA
 #endif // defined(NRF52832_XXAA) || defined(NRF52840_XXAA)
 
 
+#define RECORD_SLOT_COUNT   (CODE_PAGE_SIZE / BOOTLOADER_SETTINGS_RECORD_SIZE)  /**< Number of records a log page holds. */
+#define LOG_PAGE_COUNT      2                                                   /**< Number of pages the settings log is spread over. */
+
+STATIC_ASSERT(sizeof(bootloader_settings_record_t) <= BOOTLOADER_SETTINGS_RECORD_SIZE);
+STATIC_ASSERT(offsetof(bootloader_settings_t, bank_1_crc) ==
+              offsetof(bootloader_settings_t, app_digest_size) + sizeof(uint32_t));
+STATIC_ASSERT(offsetof(bootloader_settings_t, staged_init_size) ==
+              offsetof(bootloader_settings_t, app_trial) + BOOTLOADER_APP_TRIAL_MAX * sizeof(uint32_t));
+
+static uint32_t const m_log_pages[LOG_PAGE_COUNT] =
+{
+    BOOTLOADER_SETTINGS_ADDRESS,                    /**< First, it holds the settings of older bootloaders. */
+    BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS              /**< Only used by the MBR while it copies a new bootloader. */
+};
+
+
+static bootloader_settings_record_t const * m_current;         /**< Current record found by the last scan, NULL if there is none. */
+static uint32_t                             m_current_page;    /**< Page of the current record. */
+static uint32_t                             m_current_slot;    /**< Slot of the current record. */
+static bool                                 m_current_valid;   /**< False until the log is scanned and after it is written. */
+
+
+/**@brief Function for getting a record slot of the settings log.
+ */
+static bootloader_settings_record_t const * record_slot(uint32_t page, uint32_t slot)
+{
+    return (bootloader_settings_record_t const *)(m_log_pages[page] + slot * BOOTLOADER_SETTINGS_RECORD_SIZE);
+}
+
+
+/**@brief Function for computing the CRC of a record.
+ *
+ * @details Fields written in place after the record, from app_digest to app_digest_size and from
+ *          app_confirmed to app_trial, are left out.
+ */
+static uint16_t record_crc(bootloader_settings_record_t const * p_record)
+{
+    uint8_t const * p_data = (uint8_t const *)&p_record->settings;
+    uint16_t        crc;
+
+    crc = crc16_compute(p_data, offsetof(bootloader_settings_t, app_digest), NULL);
+
+    crc = crc16_compute(p_data + offsetof(bootloader_settings_t, bank_1_crc),
+                        offsetof(bootloader_settings_t, app_confirmed) -
+                        offsetof(bootloader_settings_t, bank_1_crc),
+                        &crc);
+
+    crc = crc16_compute(p_data + offsetof(bootloader_settings_t, staged_init_size),
+                        offsetof(bootloader_settings_record_t, crc) -
+                        offsetof(bootloader_settings_t, staged_init_size),
+                        &crc);
+
+    return crc;
+}
+
+
+/**@brief Function for checking that a record slot has never been written since its page was erased.
+ */
+static bool record_slot_is_erased(bootloader_settings_record_t const * p_slot)
+{
+    uint32_t const * p_word = (uint32_t const *)p_slot;
+
+    for (uint32_t i = 0; i < BOOTLOADER_SETTINGS_RECORD_SIZE / sizeof(uint32_t); i++)
+    {
+        if (p_word[i] != EMPTY_FLASH_MASK)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**@brief Function for scanning the settings log for its current record.
+ *
+ * @details Records of a page are in sequence order, so each page is searched backwards down to
+ *          its newest valid record. A record cut short by a reset has no magic and is skipped.
+ *
+ * @param[out] p_page Page of the current record, 0 if there is none.
+ * @param[out] p_slot Slot of the current record, 0 if there is none.
+ *
+ * @return Current record, NULL if there is none e.g settings written by an older bootloader.
+ */
+static bootloader_settings_record_t const * record_scan(uint32_t * p_page, uint32_t * p_slot)
+{
+    bootloader_settings_record_t const * p_current = NULL;
+
+    // Settings page if there is no record.
+    *p_page = 0;
+    *p_slot = 0;
+
+    for (uint32_t page = 0; page < LOG_PAGE_COUNT; page++)
+    {
+        for (uint32_t slot = RECORD_SLOT_COUNT; slot-- > 0; )
+        {
+            bootloader_settings_record_t const * p_record = record_slot(page, slot);
+
+            if (p_record->magic != BOOTLOADER_SETTINGS_RECORD_MAGIC)
+            {
+                continue;
+            }
+
+            if ((p_current != NULL) && (p_record->seq <= p_current->seq))
+            {
+                break;
+            }
+
+            if (p_record->crc == record_crc(p_record))
+            {
+                p_current = p_record;
+                *p_page   = page;
+                *p_slot   = slot;
+                break;
+            }
+        }
+    }
+
+    return p_current;
+}
+
+
+/**@brief Function for getting the current record of the settings log.
+ *
+ * @details The log is only scanned again after bootloader_settings_refresh().
+ *
+ * @param[out] p_page Page of the current record.
+ * @param[out] p_slot Slot of the current record.
+ *
+ * @return Current record, NULL if there is none e.g settings written by an older bootloader.
+ */
+static bootloader_settings_record_t const * record_current(uint32_t * p_page, uint32_t * p_slot)
+{
+    if (!m_current_valid)
+    {
+        m_current       = record_scan(&m_current_page, &m_current_slot);
+        m_current_valid = true;
+    }
+
+    *p_page = m_current_page;
+    *p_slot = m_current_slot;
+
+    return m_current;
+}
+
+
+void bootloader_settings_refresh(void)
+{
+    m_current_valid = false;
+}
+
+
 void bootloader_util_settings_get(const bootloader_settings_t ** pp_bootloader_settings)
 {
-    // Read only pointer to bootloader settings in flash. 
-    bootloader_settings_t const * const p_bootloader_settings =
-        (bootloader_settings_t *)&m_boot_settings[0];        
+    uint32_t page;
+    uint32_t slot;
+
+    bootloader_settings_record_t const * p_current = record_current(&page, &slot);
+
+    // Read only pointer to bootloader settings in flash, settings of an older bootloader are at
+    // the start of the settings page.
+    *pp_bootloader_settings = (p_current != NULL) ? &p_current->settings :
+                                                    &record_slot(0, 0)->settings;
+}
+
+
+bool bootloader_settings_record_prepare(bootloader_settings_t const * p_settings,
+                                        bool                          compact,
+                                        bootloader_settings_record_t * p_record,
+                                        uint32_t                    * p_addr)
+{
+    uint32_t page;
+    uint32_t slot;
+
+    bootloader_settings_record_t const * p_current = record_current(&page, &slot);
+
+    memset(p_record, 0xFF, sizeof(bootloader_settings_record_t));
+    memcpy(&p_record->settings, p_settings, sizeof(bootloader_settings_t));
+
+    p_record->seq   = (p_current != NULL) ? (p_current->seq + 1) : 1;
+    p_record->crc   = record_crc(p_record);
+    p_record->magic = BOOTLOADER_SETTINGS_RECORD_MAGIC;
+
+    if (!compact)
+    {
+        // Next slot never written in the current page, the settings page if there is no record yet.
+        for (slot = (p_current != NULL) ? (slot + 1) : 0; slot < RECORD_SLOT_COUNT; slot++)
+        {
+            if (record_slot_is_erased(record_slot(page, slot)))
+            {
+                *p_addr = (uint32_t)record_slot(page, slot);
+                return false;
+            }
+        }
+    }
+
+    // Log is moved over to the other page, the current record is kept until the new one is written.
+    *p_addr = (uint32_t)record_slot((page + 1) % LOG_PAGE_COUNT, 0);
 
-    *pp_bootloader_settings = p_bootloader_settings;
+    return true;
 }
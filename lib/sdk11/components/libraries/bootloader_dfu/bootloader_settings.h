@@ -22,6 +22,7 @@
 #define BOOTLOADER_SETTINGS_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "bootloader_types.h"
 
 /**@brief Function for getting the bootloader settings.
@@ -30,6 +31,31 @@
  */
 void bootloader_util_settings_get(const bootloader_settings_t ** pp_bootloader_settings);
 
+/**@brief Function for having the settings log scanned again for its current record.
+ *
+ * @details The current record is cached, this must be called once a record has been written to
+ *          flash or a log page erased.
+ */
+void bootloader_settings_refresh(void);
+
+/**@brief Function for preparing the record that makes the given settings current.
+ *
+ * @details The record is appended after the current one if its page has room left, otherwise the
+ *          log is moved over to the other page, which must be erased first.
+ *
+ * @param[in]  p_settings Settings to store.
+ * @param[in]  compact    Move the log over to the other page even if the current page has room left.
+ * @param[out] p_record   Record to write, sequence number and CRC filled in.
+ * @param[out] p_addr     Flash address to write the record at.
+ *
+ * @retval     true  if the page at p_addr must be erased before the record is written.
+ * @retval     false if the record is written to erased flash.
+ */
+bool bootloader_settings_record_prepare(bootloader_settings_t const * p_settings,
+                                        bool                          compact,
+                                        bootloader_settings_record_t * p_record,
+                                        uint32_t                    * p_addr);
+
 #endif // BOOTLOADER_SETTINGS_H__
 
 /**@} */
@@ -29,18 +29,28 @@
 
 #define BOOTLOADER_SVC_APP_DATA_PTR_GET 0x02
 
+#define BOOTLOADER_APP_DIGEST_LEN       32  /**< Length of the cached SHA-256 digest of the application. */
+
+#define BOOTLOADER_APP_TRIAL_MAX        3   /**< Number of starts given to an application on trial to confirm itself before the previous application is restored. */
+
 /**@brief DFU Bank state code, which indicates wether the bank contains: A valid image, invalid image, or an erased flash.
   */
 typedef enum
 {
-    BANK_VALID_APP   = 0x01,
-    BANK_VALID_SD    = 0xA5,
-    BANK_VALID_BOOT  = 0xAA,
-    BANK_ERASED      = 0xFE,
-    BANK_INVALID_APP = 0xFF,
+    BANK_VALID_APP    = 0x01,
+    BANK_VALID_STAGED = 0x5A,
+    BANK_VALID_SD     = 0xA5,
+    BANK_VALID_BOOT   = 0xAA,
+    BANK_ERASED       = 0xFE,
+    BANK_INVALID_APP  = 0xFF,
 } bootloader_bank_code_t;
 
 /**@brief Structure holding bootloader settings for application and bank data.
+ *
+ * @note  While bank_0 code is BANK_VALID_STAGED, bank 0 is being installed from the staging region and
+ *        bank_0_size, bank_0_crc describe the staged image as stored there.
+ * @note  With DFU_DUAL_BANK, bank 0 fields describe the application to start, which runs from bank
+ *        app_bank, and bank 1 fields the previous application kept in the other bank for rollback.
  */
 typedef struct
 {
@@ -52,8 +62,40 @@ typedef struct
     uint32_t bl_image_size;   /**< Size of Bootloader image in bank0 if bank_0 code is BANK_VALID_SD. */
     uint32_t app_image_size;  /**< Size of Application image in bank0 if bank_0 code is BANK_VALID_SD. */
     uint32_t sd_image_start;  /**< Location in flash where SoftDevice image is stored for SoftDevice update. */
+    uint8_t  app_digest[BOOTLOADER_APP_DIGEST_LEN]; /**< SHA-256 of the application in bank 0, valid only if app_digest_size matches bank_0_size. */
+    uint32_t app_digest_size; /**< Size covered by app_digest, left erased (0xFFFFFFFF) until the digest is cached. Written last so that a cached digest is never partial. */
+    uint16_t bank_1_crc;      /**< CRC of the previous application kept for rollback if bank_1 code is BANK_VALID_APP. */
+    uint16_t app_bank;        /**< Bank the application described by bank 0 fields runs from, 1 for DFU_BANK_1_REGION_START, bank 0 otherwise (also when erased). The previous application, if any, is in the other bank. */
+    uint32_t bank_1_size;     /**< Size of the previous application kept for rollback if bank_1 code is BANK_VALID_APP. */
+    uint32_t app_confirmed;   /**< Left erased (0xFFFFFFFF) while the application is on trial, cleared by the application once it is known to work. */
+    uint32_t app_trial[BOOTLOADER_APP_TRIAL_MAX]; /**< One word is cleared by the bootloader for every start of an application on trial. */
+    uint16_t staged_init_size; /**< Size of the init packet stored after the staged image if bank_0 code is BANK_VALID_STAGED. */
+    uint16_t staged_flags;    /**< Flags of the staged image, e.g compression, if bank_0 code is BANK_VALID_STAGED. */
 } bootloader_settings_t;
 
+#define BOOTLOADER_SETTINGS_RECORD_MAGIC 0x53474F4C  /**< Marks a complete settings record, written last. */
+#define BOOTLOADER_SETTINGS_RECORD_SIZE  128         /**< Space taken by a settings record in the settings log. */
+
+/**@brief Structure of a record in the bootloader settings log.
+ *
+ * @details Settings are appended as records to the settings page and the MBR params page, the valid
+ *          record with the highest sequence number is current. A page is only erased when the log
+ *          is moved over to the other page.
+ *
+ * @note  Settings come first so that a record at the start of the settings page is also read
+ *        correctly by bootloaders predating the log.
+ * @note  Fields written in place after the record (cached digest, trial and confirm words) are not
+ *        covered by crc.
+ */
+typedef struct
+{
+    bootloader_settings_t settings; /**< Bootloader settings. */
+    uint32_t              seq;      /**< Sequence number, incremented for every record. */
+    uint16_t              crc;      /**< CRC of settings and seq, see bootloader_settings_record_prepare(). */
+    uint16_t              reserved; /**< Left erased. */
+    uint32_t              magic;    /**< BOOTLOADER_SETTINGS_RECORD_MAGIC once the record is complete. */
+} bootloader_settings_record_t;
+
 #endif // BOOTLOADER_TYPES_H__ 
 
 /**@} */
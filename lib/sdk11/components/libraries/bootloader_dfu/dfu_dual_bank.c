@@ -25,19 +25,21 @@
 #include "dfu_init.h"
 #include "sdk_common.h"
 
+#include "boards.h"
+
 static dfu_state_t                  m_dfu_state;                /**< Current DFU state. */
 static uint32_t                     m_image_size;               /**< Size of the image that will be transmitted. */
 
 static dfu_start_packet_t           m_start_packet;             /**< Start packet received for this update procedure. Contains update mode and image sizes information to be used for image transfer. */
-static uint8_t                      m_init_packet[128];         /**< Init packet, can hold CRC, Hash, Signed Hash and similar, for image validation, integrety check and authorization checking. */ 
+static uint8_t                      m_init_packet[144];         /**< Init packet, can hold CRC, Hash, Signed Hash and similar, for image validation, integrety check and authorization checking. */ 
 static uint8_t                      m_init_packet_length;       /**< Length of init packet received. */
 static uint16_t                     m_image_crc;                /**< Calculated CRC of the image received. */
 
 APP_TIMER_DEF(m_dfu_timer_id);                                  /**< Application timer id. */
 static bool                         m_dfu_timed_out = false;    /**< Boolean flag value for tracking DFU timer timeout state. */
 
-static pstorage_handle_t            m_storage_handle_swap;      /**< Pstorage handle for the swap area (bank 1). Bank used when updating an application or bootloader without SoftDevice. */
-static pstorage_handle_t            m_storage_handle_app;       /**< Pstorage handle for the application area (bank 0). Bank used when updating a SoftDevice w/wo bootloader. Handle also used when swapping received application from bank 1 to bank 0. */
+static pstorage_handle_t            m_storage_handle_swap;      /**< Pstorage handle for the bank the application is not running from. Bank used when updating an application or bootloader without SoftDevice. */
+static pstorage_handle_t            m_storage_handle_app;       /**< Pstorage handle for the application area (bank 0). Bank used when updating a SoftDevice w/wo bootloader. */
 static pstorage_handle_t          * mp_storage_handle_active;   /**< Pointer to the pstorage handle for the active bank for receiving of data packets. */
 
 static dfu_callback_t               m_data_pkt_cb;              /**< Callback from DFU Bank module for notification of asynchronous operation such as flash prepare. */
@@ -123,6 +125,35 @@ static uint32_t dfu_timer_restart(void)
 }
 
 
+/**@brief   Function for erasing the flash pages an image will be received into.
+ *
+ * @details Erase is done by pstorage in BLE mode, directly otherwise since SoftDevice is not
+ *          enabled. Upon erase complete a callback will be done in both cases.
+ */
+static void dfu_bank_erase(pstorage_handle_t * p_handle, uint32_t size)
+{
+  if ( is_ota() )
+  {
+    uint32_t err_code;
+    err_code = pstorage_clear(p_handle, size);
+    APP_ERROR_CHECK(err_code);
+  }
+  else
+  {
+    uint32_t page_count = size / CODE_PAGE_SIZE;
+    if ( size % CODE_PAGE_SIZE ) page_count++;
+
+    for ( uint32_t i = 0; i < page_count; i++ )
+    {
+      nrf_nvmc_page_erase(p_handle->block_id + i * CODE_PAGE_SIZE);
+    }
+
+    // invoke complete callback
+    pstorage_callback_handler(p_handle, PSTORAGE_CLEAR_OP_CODE, NRF_SUCCESS, NULL, 0);
+  }
+}
+
+
 /**@brief   Function for preparing of flash before receiving SoftDevice image.
  *
  * @details This function will erase current application area to ensure sufficient amount of
@@ -131,15 +162,12 @@ static uint32_t dfu_timer_restart(void)
  */
 static void dfu_prepare_func_app_erase(uint32_t image_size)
 {
-    uint32_t err_code;
-
     mp_storage_handle_active = &m_storage_handle_app;
 
     // Doing a SoftDevice update thus current application must be cleared to ensure enough space
     // for new SoftDevice.
     m_dfu_state = DFU_STATE_PREPARING;
-    err_code    = pstorage_clear(&m_storage_handle_app, m_image_size);
-    APP_ERROR_CHECK(err_code);
+    dfu_bank_erase(&m_storage_handle_app, m_image_size);
 }
 
 
@@ -151,14 +179,10 @@ static void dfu_prepare_func_app_erase(uint32_t image_size)
  */
 static void dfu_prepare_func_swap_erase(uint32_t image_size)
 {
-    uint32_t err_code;
-
     mp_storage_handle_active = &m_storage_handle_swap;
 
     m_dfu_state = DFU_STATE_PREPARING;
-//    err_code    = pstorage_clear(&m_storage_handle_swap, DFU_IMAGE_MAX_SIZE_BANKED);
-    err_code    = pstorage_clear(&m_storage_handle_swap, image_size);
-    APP_ERROR_CHECK(err_code);
+    dfu_bank_erase(&m_storage_handle_swap, image_size);
 }
 
 
@@ -235,37 +259,26 @@ static uint32_t dfu_activate_sd(void)
 
 /**@brief Function for activating received Application image.
  *
- *  @details This function will move the received application image fram swap (bank 1) to
- *           application area (bank 0).
+ *  @details The application runs from the bank it was received into, nothing is moved in flash.
+ *           The bootloader settings will select that bank and keep the current application to go
+ *           back to, until the new one has confirmed itself.
  *
- * @return NRF_SUCCESS on success. Error code otherwise.
+ * @return NRF_SUCCESS on success.
  */
 static uint32_t dfu_activate_app(void)
 {
-    uint32_t err_code;
-
-    // Erase BANK 0.
-    err_code = pstorage_clear(&m_storage_handle_app, m_start_packet.app_image_size);
-    APP_ERROR_CHECK(err_code);
-
-    err_code = pstorage_store(&m_storage_handle_app,
-                                  (uint8_t *)m_storage_handle_swap.block_id,
-                                  m_start_packet.app_image_size,
-                                  0);
-
-    if (err_code == NRF_SUCCESS)
-    {
-        dfu_update_status_t update_status;
+    dfu_update_status_t update_status;
 
-        memset(&update_status, 0, sizeof(dfu_update_status_t ));
-        update_status.status_code = DFU_UPDATE_APP_COMPLETE;
-        update_status.app_crc     = m_image_crc;
-        update_status.app_size    = m_start_packet.app_image_size;
+    memset(&update_status, 0, sizeof(dfu_update_status_t ));
+    update_status.status_code     = DFU_UPDATE_APP_COMPLETE;
+    update_status.app_crc         = m_image_crc;
+    update_status.app_size        = m_start_packet.app_image_size;
+    update_status.app_image_start = m_storage_handle_swap.block_id;
+    update_status.p_app_digest    = dfu_init_image_digest();
 
-        bootloader_dfu_update_process(update_status);
-    }
+    bootloader_dfu_update_process(update_status);
 
-    return err_code;
+    return NRF_SUCCESS;
 }
 
 
@@ -281,11 +294,13 @@ static uint32_t dfu_activate_bl(void)
 {
     dfu_update_status_t update_status;
 
-    update_status.status_code = DFU_UPDATE_BOOT_COMPLETE;
-    update_status.app_crc     = m_image_crc;
-    update_status.sd_size     = m_start_packet.sd_image_size;
-    update_status.bl_size     = m_start_packet.bl_image_size;
-    update_status.app_size    = m_start_packet.app_image_size;
+    memset(&update_status, 0, sizeof(dfu_update_status_t ));
+    update_status.status_code    = DFU_UPDATE_BOOT_COMPLETE;
+    update_status.app_crc        = m_image_crc;
+    update_status.sd_image_start = m_storage_handle_swap.block_id;
+    update_status.sd_size        = m_start_packet.sd_image_size;
+    update_status.bl_size        = m_start_packet.bl_image_size;
+    update_status.app_size       = m_start_packet.app_image_size;
 
     bootloader_dfu_update_process(update_status);
 
@@ -310,7 +325,10 @@ uint32_t dfu_init(void)
 
     m_storage_handle_app.block_id  = DFU_BANK_0_REGION_START;
     m_storage_handle_swap          = m_storage_handle_app;
-    m_storage_handle_swap.block_id = DFU_BANK_1_REGION_START;
+
+    // Images are received into the bank the application is not running from.
+    m_storage_handle_swap.block_id = (bootloader_app_address() == DFU_BANK_1_REGION_START) ?
+                                     DFU_BANK_0_REGION_START : DFU_BANK_1_REGION_START;
 
     // Create the timer to monitor the activity by the peer doing the firmware update.
     err_code = app_timer_create(&m_dfu_timer_id,
@@ -460,11 +478,28 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
 
             p_data = (uint32_t *)p_packet->params.data_packet.p_data_packet;
 
-            err_code = pstorage_store(mp_storage_handle_active,
-                                          (uint8_t *)p_data,
-                                          data_length,
-                                          m_data_received);
-            VERIFY_SUCCESS(err_code);
+            // Encrypted image is deciphered in place, flash and integrity check get plain text.
+            // Keystream is out of step after a failure, the rest of the image is refused.
+            err_code = dfu_init_image_decrypt((uint8_t *)p_data, data_length);
+            if (err_code != NRF_SUCCESS)
+            {
+                m_data_received = 0xFFFFFFFF;
+
+                return err_code;
+            }
+
+            if ( is_ota() )
+            {
+              err_code = pstorage_store(mp_storage_handle_active, (uint8_t *)p_data, data_length, m_data_received);
+              VERIFY_SUCCESS(err_code);
+            }
+            else
+            {
+              flash_nrf5x_write(mp_storage_handle_active->block_id + m_data_received, p_data, data_length, false);
+              pstorage_callback_handler(mp_storage_handle_active, PSTORAGE_STORE_OP_CODE, NRF_SUCCESS, (uint8_t *) p_data, data_length);
+            }
+
+            dfu_init_image_update((uint8_t *)p_data, data_length);
 
             m_data_received += data_length;
 
@@ -475,8 +510,10 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
             }
             else
             {
-                // The entire image has been received. Return NRF_SUCCESS.
-                err_code = NRF_SUCCESS;
+              if ( !is_ota() ) flash_nrf5x_flush(false);
+
+              // The entire image has been received. Return NRF_SUCCESS.
+              err_code = NRF_SUCCESS;
             }
             break;
 
@@ -561,6 +598,19 @@ uint32_t dfu_init_pkt_handle(dfu_update_packet_t * p_packet)
 }
 
 
+/**@brief Function for checking that a received application is linked to run from its bank.
+ *
+ * @details Reset handler of the application vector table must be within the received image.
+ */
+static bool dfu_app_image_is_linked(uint32_t bank_start)
+{
+    uint32_t const reset_handler = ((uint32_t const *)bank_start)[1];
+
+    return (m_image_size > 2 * sizeof(uint32_t)) &&
+           (reset_handler >= bank_start) && (reset_handler < bank_start + m_image_size);
+}
+
+
 uint32_t dfu_image_validate()
 {
     uint32_t err_code;
@@ -587,6 +637,13 @@ uint32_t dfu_image_validate()
                                                      m_image_size);
                     VERIFY_SUCCESS(err_code);
 
+                    // Application runs from the bank it is received into, it must be linked for it.
+                    if (IS_UPDATING_APP(m_start_packet) &&
+                        !dfu_app_image_is_linked(mp_storage_handle_active->block_id))
+                    {
+                        return NRF_ERROR_INVALID_DATA;
+                    }
+
                     m_dfu_state = DFU_STATE_WAIT_4_ACTIVATE;
                 }
             }
@@ -758,9 +815,10 @@ uint32_t dfu_bl_image_swap(void)
 
     if (bootloader_settings.bl_image_size != 0)
     {
-        uint32_t bl_image_start = (bootloader_settings.sd_image_size == 0) ?
-                                  DFU_BANK_1_REGION_START :
-                                  bootloader_settings.sd_image_start + 
+        // Bootloader image follows the SoftDevice image if any, in bank 0 if location is not known.
+        uint32_t bl_image_start = (bootloader_settings.sd_image_start == 0) ?
+                                  DFU_BANK_0_REGION_START :
+                                  bootloader_settings.sd_image_start +
                                   bootloader_settings.sd_image_size;
 
         sd_mbr_cmd.command               = SD_MBR_COMMAND_COPY_BL;
@@ -782,8 +840,9 @@ uint32_t dfu_bl_image_validate(void)
 
     if (bootloader_settings.bl_image_size != 0)
     {
-        uint32_t bl_image_start = (bootloader_settings.sd_image_size == 0) ?
-                                  DFU_BANK_1_REGION_START :
+        // Bootloader image follows the SoftDevice image if any, in bank 0 if location is not known.
+        uint32_t bl_image_start = (bootloader_settings.sd_image_start == 0) ?
+                                  DFU_BANK_0_REGION_START :
                                   bootloader_settings.sd_image_start +
                                   bootloader_settings.sd_image_size;
 
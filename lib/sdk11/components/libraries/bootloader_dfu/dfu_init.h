@@ -102,9 +102,34 @@ typedef struct
  *                                  (signing).
  * @retval NRF_ERROR_INVALID_LENGTH If the size of the init packet is not within the limits of 
  *                                  the init packet handler.
+ * @retval NRF_ERROR_INTERNAL       If deciphering of an encrypted image could not be started.
  */
 uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uint8_t image_type);
 
+/**@brief DFU call for deciphering image data in place as it is received.
+ *
+ * @details  Does nothing unless the init packet announced an encrypted image. Data must be provided
+ *           in order and before it is written to flash or fed to \ref dfu_init_image_update.
+ *
+ * @param[in,out] p_data Pointer to the received image data.
+ * @param[in]     length Length of the data.
+ *
+ * @retval NRF_SUCCESS        If the data is deciphered, or needs no deciphering.
+ * @retval NRF_ERROR_INTERNAL If the keystream could not be generated, data must be discarded.
+ */
+uint32_t dfu_init_image_decrypt(uint8_t * p_data, uint32_t length);
+
+/**@brief DFU call for feeding image data to the integrity check as it is received.
+ *
+ * @details  CRC16 and SHA-256 of the image are updated in the time otherwise spent waiting for the
+ *           next packet, so that \ref dfu_init_postvalidate does not read the image again.
+ *           Data must be provided in order, after the init packet has been pre-validated.
+ *
+ * @param[in] p_data     Pointer to the received image data.
+ * @param[in] length     Length of the data.
+ */
+void dfu_init_image_update(uint8_t const * p_data, uint32_t length);
+
 /**@brief DFU postvalidate call for post-checking the received image using the init packet.
  *
  * @details  Post-validation can verify the integrity check the firmware image received before 
@@ -118,6 +143,8 @@ uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uin
  * 
  * @param[in] p_image    Pointer to the received image. The init data provided in the call 
  *                       \ref dfu_init_prevalidate will be used for validating the image.
+ *                       Unused, the image is checked as it is received through
+ *                       \ref dfu_init_image_update.
  * @param[in] image_len  Length of the image data.
  *
  * @retval NRF_SUCCESS             If the post-validation succeeded, that meant the integrity of the
@@ -129,6 +156,15 @@ uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uin
  */
 uint32_t dfu_init_postvalidate(uint8_t * p_image, uint32_t image_len);
 
+/**@brief Function for getting the SHA-256 of the received image.
+ *
+ * @details  Only valid after \ref dfu_init_postvalidate has succeeded, whether the init packet
+ *           carried a hash or a CRC.
+ *
+ * @return   Pointer to the 32 byte digest.
+ */
+uint8_t const * dfu_init_image_digest(void);
+
 #endif // DFU_INIT_H__
 
 /**@} */
@@ -31,7 +31,7 @@ static dfu_state_t                  m_dfu_state;                /**< Current DFU
 static uint32_t                     m_image_size;               /**< Size of the image that will be transmitted. */
 
 static dfu_start_packet_t           m_start_packet;             /**< Start packet received for this update procedure. Contains update mode and image sizes information to be used for image transfer. */
-static uint8_t                      m_init_packet[64];          /**< Init packet, can hold CRC, Hash, Signed Hash and similar, for image validation, integrety check and authorization checking. */ 
+static uint8_t                      m_init_packet[144];         /**< Init packet, can hold CRC, Hash, Signed Hash and similar, for image validation, integrety check and authorization checking. */ 
 static uint8_t                      m_init_packet_length;       /**< Length of init packet received. */
 static uint16_t                     m_image_crc;                /**< Calculated CRC of the image received. */
 
@@ -236,9 +236,10 @@ static uint32_t dfu_activate_app(void)
     dfu_update_status_t update_status;
 
     memset(&update_status, 0, sizeof(dfu_update_status_t ));
-    update_status.status_code = DFU_UPDATE_APP_COMPLETE;
-    update_status.app_crc     = m_image_crc;
-    update_status.app_size    = m_start_packet.app_image_size;
+    update_status.status_code  = DFU_UPDATE_APP_COMPLETE;
+    update_status.app_crc      = m_image_crc;
+    update_status.app_size     = m_start_packet.app_image_size;
+    update_status.p_app_digest = dfu_init_image_digest();
 
     bootloader_dfu_update_process(update_status);
 
@@ -258,11 +259,12 @@ static uint32_t dfu_activate_bl(void)
 {
     dfu_update_status_t update_status;
 
-    update_status.status_code = DFU_UPDATE_BOOT_COMPLETE;
-    update_status.app_crc     = m_image_crc;
-    update_status.sd_size     = m_start_packet.sd_image_size;
-    update_status.bl_size     = m_start_packet.bl_image_size;
-    update_status.app_size    = m_start_packet.app_image_size;
+    update_status.status_code    = DFU_UPDATE_BOOT_COMPLETE;
+    update_status.app_crc        = m_image_crc;
+    update_status.sd_image_start = DFU_BANK_0_REGION_START;
+    update_status.sd_size        = m_start_packet.sd_image_size;
+    update_status.bl_size        = m_start_packet.bl_image_size;
+    update_status.app_size       = m_start_packet.app_image_size;
 
     bootloader_dfu_update_process(update_status);
 
@@ -426,6 +428,16 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
 
             p_data = (uint32_t *)p_packet->params.data_packet.p_data_packet;
 
+            // Encrypted image is deciphered in place, flash and integrity check get plain text.
+            // Keystream is out of step after a failure, the rest of the image is refused.
+            err_code = dfu_init_image_decrypt((uint8_t *)p_data, data_length);
+            if (err_code != NRF_SUCCESS)
+            {
+                m_data_received = 0xFFFFFFFF;
+
+                return err_code;
+            }
+
             if ( is_ota() )
             {
               err_code = pstorage_store(mp_storage_handle_active, (uint8_t *)p_data, data_length, m_data_received);
@@ -437,6 +449,8 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
               pstorage_callback_handler(mp_storage_handle_active, PSTORAGE_STORE_OP_CODE, NRF_SUCCESS, (uint8_t *) p_data, data_length);
             }
 
+            dfu_init_image_update((uint8_t *)p_data, data_length);
+
             m_data_received += data_length;
 
             if (m_data_received != m_image_size)
@@ -731,9 +745,10 @@ uint32_t dfu_bl_image_swap(void)
 
     if (bootloader_settings.bl_image_size != 0)
     {
-        uint32_t bl_image_start = (bootloader_settings.sd_image_size == 0) ?
+        // Bootloader image follows the SoftDevice image if any, in bank 0 if location is not known.
+        uint32_t bl_image_start = (bootloader_settings.sd_image_start == 0) ?
                                   DFU_BANK_0_REGION_START :
-                                  bootloader_settings.sd_image_start + 
+                                  bootloader_settings.sd_image_start +
                                   bootloader_settings.sd_image_size;
 
         sd_mbr_cmd.command               = SD_MBR_COMMAND_COPY_BL;
@@ -755,7 +770,8 @@ uint32_t dfu_bl_image_validate(void)
 
     if (bootloader_settings.bl_image_size != 0)
     {
-        uint32_t bl_image_start = (bootloader_settings.sd_image_size == 0) ?
+        // Bootloader image follows the SoftDevice image if any, in bank 0 if location is not known.
+        uint32_t bl_image_start = (bootloader_settings.sd_image_start == 0) ?
                                   DFU_BANK_0_REGION_START :
                                   bootloader_settings.sd_image_start +
                                   bootloader_settings.sd_image_size;
@@ -32,6 +32,7 @@
 #include "hci_mem_pool.h"
 #include "bootloader.h"
 #include "dfu_ble_svc_internal.h"
+#include "dfu_readback.h"
 #include "nrf_delay.h"
 #include "sdk_common.h"
 
@@ -108,6 +109,9 @@ static dfu_ble_peer_data_t  m_ble_peer_data;
 static bool                 m_ble_peer_data_valid    = false;                                        /**< True if BLE Peer data has been exchanged from application. */
 static uint32_t             m_direct_adv_cnt         = APP_DIRECTED_ADV_TIMEOUT;                     /**< Counter of direct advertisements. */
 static uint8_t            * mp_final_packet;                                                         /**< Pointer to final data packet received. When callback for succesful packet handling is received from dfu bank handling a transfer complete response can be sent to peer. */
+static uint16_t             m_att_mtu                = BLE_GATT_ATT_MTU_DEFAULT;                     /**< ATT MTU of the current connection, readback frames fill a whole notification. */
+static uint8_t              m_readback_frame[BLEGATT_ATT_MTU_MAX - 4];                               /**< Readback frame waiting for room in the SoftDevice notification queue. Space is left for ATT header and op code. */
+static uint16_t             m_readback_frame_len     = 0;                                            /**< Length of the pending readback frame, 0 if none. */
 
 
 static ble_gap_addr_t      const * m_whitelist[1];                                                  /**< List of peers in whitelist (only one) */
@@ -520,6 +524,40 @@ static void on_dfu_pkt_write(ble_dfu_t * p_dfu, ble_dfu_evt_t * p_evt)
     }
 }
 
+/**@brief     Function for sending readback frames until the SoftDevice notification queue is full.
+ *
+ * @details   Sending is resumed on BLE_GATTS_EVT_HVN_TX_COMPLETE.
+ */
+static void readback_notify(void)
+{
+    while (true)
+    {
+        if (m_readback_frame_len == 0)
+        {
+            m_readback_frame_len = dfu_readback_next(m_readback_frame, m_att_mtu - 4);
+            if (m_readback_frame_len == 0)
+            {
+                return;
+            }
+        }
+
+        uint32_t err_code = ble_dfu_readback_notify(&m_dfu, m_readback_frame, m_readback_frame_len);
+        if (err_code == NRF_ERROR_RESOURCES)
+        {
+            return;
+        }
+
+        m_readback_frame_len = 0;
+
+        if (err_code != NRF_SUCCESS)
+        {
+            dfu_readback_abort();
+            return;
+        }
+    }
+}
+
+
 /**@brief     Function for the Device Firmware Update Service event handler.
  *
  * @details   This function will be called for all Device Firmware Update Service events which
@@ -609,6 +647,13 @@ static void on_dfu_evt(ble_dfu_t * p_dfu, ble_dfu_evt_t * p_evt)
             APP_ERROR_CHECK(err_code);
             break;
 
+        case BLE_DFU_READBACK:
+            dfu_readback_request(p_evt->evt.ble_dfu_pkt_write.p_data, p_evt->evt.ble_dfu_pkt_write.len,
+                                 readback_notify);
+            m_readback_frame_len = 0;
+            readback_notify();
+            break;
+
         default:
             // Unsupported event received from DFU Service. Ignore.
             break;
@@ -746,6 +791,7 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
         case BLE_GAP_EVT_CONNECTED:
             m_conn_handle    = p_ble_evt->evt.gap_evt.conn_handle;
             m_is_advertising = false;
+            m_att_mtu        = BLE_GATT_ATT_MTU_DEFAULT;
             break;
 
         case BLE_GAP_EVT_DISCONNECTED:
@@ -773,6 +819,8 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
 
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
 
+            dfu_readback_abort();
+            m_readback_frame_len = 0;
             break;
 
         case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
@@ -903,9 +951,14 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
           uint16_t att_mtu = MIN(p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu, BLEGATT_ATT_MTU_MAX);
           ADALOG("GAP", "ATT MTU is changed to %d", att_mtu);
           APP_ERROR_CHECK( sd_ble_gatts_exchange_mtu_reply(m_conn_handle, att_mtu) );
+          m_att_mtu = MAX(att_mtu, BLE_GATT_ATT_MTU_DEFAULT);
         }
         break;
 
+        case BLE_GATTS_EVT_HVN_TX_COMPLETE:
+            readback_notify();
+            break;
+
         default:
             // No implementation needed.
             break;
@@ -20,8 +20,11 @@
 #include "app_timer.h"
 #include "app_scheduler.h"
 #include "boards.h"
+#include "bootloader.h"
+#include "dfu_readback.h"
 
 #define MAX_BUFFERS          4u                                                      /**< Maximum number of buffers that can be received queued without being consumed. */
+#define READBACK_FRAME_MAX   (HCI_TX_BUF_SIZE - 4u - 2u - sizeof(uint32_t))          /**< Maximum readback frame: TX buffer less HCI packet header, CRC and packet type field. */
 
 /**
  * defgroup Data Packet Queue Access Operation Macros
@@ -70,6 +73,7 @@ typedef struct
 } dfu_data_queue_t;
 
 static dfu_data_queue_t      m_data_queue;                                           /**< Received-data packet queue. */
+static bool                  m_readback_tx_busy;                                     /**< A readback frame is waiting to be acknowledged by the host. */
 
 /**@brief Initializes an element of the data buffer queue.
  *
@@ -191,6 +195,75 @@ static void dfu_cb_handler(uint32_t packet, uint32_t result, uint8_t * p_data)
 }
 
 
+/**@brief Function for sending the next readback frame to the host, if any.
+ *
+ * @details Only one frame is in flight, the next one is sent once the host has acknowledged it.
+ */
+static void readback_send_next(void * p_event_data, uint16_t event_size)
+{
+    uint8_t * p_tx_buffer;
+
+    if (m_readback_tx_busy || (NRF_SUCCESS != hci_transport_tx_alloc(&p_tx_buffer)))
+    {
+        return;
+    }
+
+    uint16_t const frame_len = dfu_readback_next(&p_tx_buffer[sizeof(uint32_t)], READBACK_FRAME_MAX);
+
+    if (frame_len == 0)
+    {
+        (void)hci_transport_tx_free();
+        return;
+    }
+
+    (void)uint32_encode(READBACK_PACKET, p_tx_buffer);
+
+    if (NRF_SUCCESS == hci_transport_pkt_write(p_tx_buffer, frame_len + sizeof(uint32_t)))
+    {
+        m_readback_tx_busy = true;
+    }
+    else
+    {
+        (void)hci_transport_tx_free();
+        dfu_readback_abort();
+    }
+}
+
+
+/**@brief Function for sending a readback response once it has been computed, e.g. a digest.
+ */
+static void readback_ready_handler(void)
+{
+    readback_send_next(NULL, 0);
+}
+
+
+/**@brief Function for handling the TX done event of the transport layer.
+ *
+ * @details Called in interrupt context, next frame is read from flash by the scheduler.
+ */
+static void readback_tx_done_handler(hci_transport_tx_done_result_t result)
+{
+    if (!m_readback_tx_busy)
+    {
+        return;
+    }
+
+    m_readback_tx_busy = false;
+    (void)hci_transport_tx_free();
+
+    if (result == HCI_TRANSPORT_TX_DONE_SUCCESS)
+    {
+        (void)app_sched_event_put(NULL, 0, readback_send_next);
+    }
+    else
+    {
+        // Host stopped acknowledging, drop the request.
+        dfu_readback_abort();
+    }
+}
+
+
 static void process_dfu_packet(void * p_event_data, uint16_t event_size)
 {
     uint32_t              retval;
@@ -209,7 +282,15 @@ static void process_dfu_packet(void * p_event_data, uint16_t event_size)
                 packet = &m_data_queue.data_packet[index];
                 if (INVALID_PACKET != packet->packet_type)
                 {
-                    switch (DATA_QUEUE_ELEMENT_GET_PTYPE(index))
+                    uint32_t packet_type = DATA_QUEUE_ELEMENT_GET_PTYPE(index);
+
+                    // Verify only mode never writes flash, image packets are dropped.
+                    if (is_verify_only() && (packet_type != READBACK_PACKET) && (packet_type != STOP_DATA_PACKET))
+                    {
+                        packet_type = INVALID_PACKET;
+                    }
+
+                    switch (packet_type)
                     {
                         case DATA_PACKET:
                             (void)dfu_data_pkt_handle(packet);
@@ -230,7 +311,22 @@ static void process_dfu_packet(void * p_event_data, uint16_t event_size)
                             led_state(STATE_WRITING_STARTED);
                             break;
 
+                        case READBACK_PACKET:
+                            dfu_readback_request((uint8_t *)packet->params.data_packet.p_data_packet,
+                                                 packet->params.data_packet.packet_length * sizeof(uint32_t),
+                                                 readback_ready_handler);
+                            readback_send_next(NULL, 0);
+                            break;
+
                         case STOP_DATA_PACKET:
+                            if (is_verify_only())
+                            {
+                                // Host is done, leave bootloader and start the unchanged application.
+                                dfu_update_status_t update_status = { .status_code = DFU_RESET };
+                                bootloader_dfu_update_process(update_status);
+                                return;
+                            }
+
                             (void)dfu_image_validate();
                             (void)dfu_image_activate();
 
@@ -300,6 +396,11 @@ uint32_t dfu_transport_serial_update_start(void)
     err_code = hci_transport_evt_handler_reg(rpc_transport_event_handler);
     APP_ERROR_CHECK(err_code);
 
+    // Register callback to send readback frames one after another.
+    m_readback_tx_busy = false;
+    err_code = hci_transport_tx_done_register(readback_tx_done_handler);
+    APP_ERROR_CHECK(err_code);
+
     return NRF_SUCCESS;
 }
 
@@ -308,6 +409,7 @@ uint32_t dfu_transport_serial_close(void)
 {
     // Remove all buffered packets.
     data_queue_flush();
+    dfu_readback_abort();
 
     return hci_transport_close();
 }
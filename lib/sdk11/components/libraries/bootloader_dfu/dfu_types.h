@@ -35,7 +35,9 @@
 #define NRF_UICR_MBR_PARAMS_PAGE_ADDRESS    (NRF_UICR_BASE + 0x18)      /**< Register where the mbr params page is stored in the UICR register. (Only in use in nRF52 MBR).*/
 #endif                                                              
 
+#ifndef CODE_REGION_1_START // host builds have no SoftDevice to read its size from
 #define CODE_REGION_1_START                 SD_SIZE_GET(MBR_SIZE)       /**< This field should correspond to the size of Code Region 0, (which is identical to Start of Code Region 1), found in UICR.CLEN0 register. This value is used for compile safety, as the linker will fail if application expands into bootloader. Runtime, the bootloader will use the value found in UICR.CLEN0. */
+#endif
 #define SOFTDEVICE_REGION_START             MBR_SIZE                    /**< This field should correspond to start address of the bootloader, found in UICR.RESERVED, 0x10001014, register. This value is used for sanity check, so the bootloader will fail immediately if this value differs from runtime value. The value is used to determine max application size for updating. */
 #define CODE_PAGE_SIZE                      0x1000                      /**< Size of a flash codepage. Used for size of the reserved flash space in the bootloader region. Will be runtime checked against NRF_UICR->CODEPAGESIZE to ensure the region is correct. */
 
@@ -82,6 +84,7 @@
 #define START_PACKET                    0x03                                                            /**< Packet identifies for the Data Start Packet. */
 #define DATA_PACKET                     0x04                                                            /**< Packet identifies for a Data Packet. */
 #define STOP_DATA_PACKET                0x05                                                            /**< Packet identifies for the Data Stop Packet. */
+#define READBACK_PACKET                 0x06                                                            /**< Packet identifies for a flash readback request, answered with readback frames of the same packet type. Used by serial transport only. */
 
 #define DFU_UPDATE_SD                   0x01                                                            /**< Bit field indicating update of SoftDevice is ongoing. */
 #define DFU_UPDATE_BL                   0x02                                                            /**< Bit field indicating update of bootloader is ongoing. */
@@ -132,6 +135,7 @@ typedef enum
     DFU_UPDATE_SD_SWAPPED,                                                                              /**< Status update of SoftDevice update complete. Note that this solely indicates that a new SoftDevice has been received and stored in bank 0 and 1. */
     DFU_UPDATE_BOOT_COMPLETE,                                                                           /**< Status update complete.*/
     DFU_BANK_0_ERASED,                                                                                  /**< Status bank 0 erased.*/
+    DFU_BANK_0_STAGED,                                                                                  /**< Status bank 0 about to be installed from an image staged by the application.*/
     DFU_TIMEOUT,                                                                                        /**< Status timeout.*/
     DFU_RESET                                                                                           /**< Status Reset to indicate current update procedure has been aborted and system should reset. */
 } dfu_update_status_code_t;
@@ -146,6 +150,10 @@ typedef struct
     uint32_t                 bl_size;                                                                   /**< Size of the recieved BootLoader. */
     uint32_t                 app_size;                                                                  /**< Size of the recieved Application. */
     uint32_t                 sd_image_start;                                                            /**< Location in flash where the received SoftDevice image is stored. */
+    uint32_t                 app_image_start;                                                           /**< Location in flash where the received Application is stored, bank 0 unless DFU_BANK_1_REGION_START. */
+    uint8_t const *          p_app_digest;                                                              /**< SHA-256 of the received Application if known, cached in bootloader settings. NULL otherwise. */
+    uint16_t                 staged_init_size;                                                          /**< Size of the init packet stored after the staged image, if DFU_BANK_0_STAGED. */
+    uint16_t                 staged_flags;                                                              /**< Flags of the staged image, if DFU_BANK_0_STAGED. */
 } dfu_update_status_t;
 
 /**@brief Update complete handler type. */
@@ -59,12 +59,38 @@ typedef struct {
   uint8_t ep_in;
   uint8_t ep_out;
 
+  uint8_t rx_idx; // buffer currently queued for OUT transfer
+
+  // OUT transfers are double buffered: one is received while application processes the other
+  CFG_TUSB_MEM_ALIGN uint8_t epout_buf[2][CFG_TUD_CUSTOM_BUFSIZE];
+  CFG_TUSB_MEM_ALIGN uint8_t epin_buf[CFG_TUD_CUSTOM_EPSIZE];
 } cusd_interface_t;
 
-static cusd_interface_t _cusd_itf;
+CFG_TUSB_MEM_SECTION static cusd_interface_t _cusd_itf;
+
+//--------------------------------------------------------------------+
+// APPLICATION API
+//--------------------------------------------------------------------+
+bool tud_custom_mounted(void)
+{
+  return tud_mounted() && _cusd_itf.ep_in && _cusd_itf.ep_out;
+}
+
+bool tud_custom_write(void const* buffer, uint32_t bufsize)
+{
+  cusd_interface_t* p_itf = &_cusd_itf;
+
+  TU_VERIFY( tud_custom_mounted() && (bufsize <= CFG_TUD_CUSTOM_EPSIZE) );
+  TU_VERIFY( !dcd_edpt_busy(TUD_OPT_RHPORT, p_itf->ep_in) ); // skip if previous transfer not complete
+
+  memcpy(p_itf->epin_buf, buffer, bufsize);
+  TU_ASSERT( dcd_edpt_xfer(TUD_OPT_RHPORT, p_itf->ep_in, p_itf->epin_buf, bufsize) );
+
+  return true;
+}
 
 /*------------------------------------------------------------------*/
-/* FUNCTION DECLARATION
+/* USBD Driver API
  *------------------------------------------------------------------*/
 void cusd_init(void)
 {
@@ -83,25 +109,57 @@ bool cusd_open(uint8_t rhport, tusb_desc_interface_t const * p_desc_itf, uint16_
 
   (*p_len) = sizeof(tusb_desc_interface_t) + 2*sizeof(tusb_desc_endpoint_t);
 
-  // TODO Prepare for incoming data
-//  TU_ASSERT( dcd_edpt_xfer(rhport, p_itf->ep_out, (uint8_t*) &p_msc->cbw, sizeof(msc_cbw_t)) );
+  // Prepare for incoming data
+  p_itf->rx_idx = 0;
+  TU_ASSERT( dcd_edpt_xfer(rhport, p_itf->ep_out, p_itf->epout_buf[0], CFG_TUD_CUSTOM_BUFSIZE) );
 
   return true;
 }
 
 bool cusd_control_request(uint8_t rhport, tusb_control_request_t const * p_request)
 {
+  (void) rhport;
+  (void) p_request;
+
   return false;
 }
 
+bool cusd_control_request_complete(uint8_t rhport, tusb_control_request_t const * p_request)
+{
+  (void) rhport;
+  (void) p_request;
+
+  return true;
+}
+
 bool cusd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t event, uint32_t xferred_bytes)
 {
+  (void) event;
+
+  cusd_interface_t* p_itf = &_cusd_itf;
+
+  if ( ep_addr == p_itf->ep_in )
+  {
+    if ( tud_custom_tx_complete_cb ) tud_custom_tx_complete_cb();
+    return true;
+  }
+
+  uint8_t const* rx_buf = p_itf->epout_buf[p_itf->rx_idx];
+
+  // queue next transfer into the other buffer before handing this one to application
+  p_itf->rx_idx ^= 1;
+  TU_ASSERT( dcd_edpt_xfer(rhport, p_itf->ep_out, p_itf->epout_buf[p_itf->rx_idx], CFG_TUD_CUSTOM_BUFSIZE) );
+
+  if ( tud_custom_rx_cb ) tud_custom_rx_cb(rx_buf, xferred_bytes);
+
   return true;
 }
 
 void cusd_reset(uint8_t rhport)
 {
+  (void) rhport;
 
+  tu_varclr(&_cusd_itf);
 }
 
 #endif
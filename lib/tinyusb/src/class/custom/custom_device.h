@@ -42,6 +42,20 @@
 #include "common/tusb_common.h"
 #include "device/usbd.h"
 
+//--------------------------------------------------------------------+
+// Class Driver Configuration
+//--------------------------------------------------------------------+
+
+// Size of each of the two OUT transfer buffers, a transfer ends with a short packet
+// (or zero length packet) from host or when the buffer is full.
+#ifndef CFG_TUD_CUSTOM_BUFSIZE
+#define CFG_TUD_CUSTOM_BUFSIZE   512
+#endif
+
+#ifndef CFG_TUD_CUSTOM_EPSIZE
+#define CFG_TUD_CUSTOM_EPSIZE    64
+#endif
+
 //--------------------------------------------------------------------+
 // APPLICATION API (Multiple Root Ports)
 // Should be used only with MCU that support more than 1 ports
@@ -51,12 +65,22 @@
 // APPLICATION API (Single Port)
 // Should be used with MCU supporting only 1 USB port for code simplicity
 //--------------------------------------------------------------------+
+bool tud_custom_mounted (void);
 
+// Send up to CFG_TUD_CUSTOM_EPSIZE bytes on IN endpoint, false if previous one is not complete
+bool tud_custom_write   (void const* buffer, uint32_t bufsize);
 
 //--------------------------------------------------------------------+
 // APPLICATION CALLBACK API (WEAK is optional)
 //--------------------------------------------------------------------+
 
+// Invoked when a transfer is received on OUT endpoint. Next transfer is already queued into
+// the other buffer, so data is only valid until this callback returns.
+ATTR_WEAK void tud_custom_rx_cb(uint8_t const* buffer, uint32_t bufsize);
+
+// Invoked when data sent by tud_custom_write() is complete, the next one can be written
+ATTR_WEAK void tud_custom_tx_complete_cb(void);
+
 //--------------------------------------------------------------------+
 // USBD-CLASS DRIVER API
 //--------------------------------------------------------------------+
@@ -64,7 +88,7 @@
 
 void cusd_init(void);
 bool cusd_open(uint8_t rhport, tusb_desc_interface_t const * itf_desc, uint16_t *p_length);
-bool cusd_control_request_st(uint8_t rhport, tusb_control_request_t const * p_request);
+bool cusd_control_request(uint8_t rhport, tusb_control_request_t const * p_request);
 bool cusd_control_request_complete (uint8_t rhport, tusb_control_request_t const * p_request);
 bool cusd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t event, uint32_t xferred_bytes);
 void cusd_reset(uint8_t rhport);
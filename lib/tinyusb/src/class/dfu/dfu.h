@@ -0,0 +1,152 @@
+/**************************************************************************/
+/*!
+    @file     dfu.h
+    @author   hathach (tinyusb.org)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2018, hathach (tinyusb.org)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    This file is part of the tinyusb stack.
+*/
+/**************************************************************************/
+
+#ifndef _TUSB_DFU_H_
+#define _TUSB_DFU_H_
+
+#include "common/tusb_common.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// USB Device Firmware Upgrade 1.1
+//--------------------------------------------------------------------+
+
+/// DFU Interface Subclass and Protocol
+enum
+{
+  DFU_SUBCLASS             = 0x01,
+  DFU_PROTOCOL_RUNTIME     = 0x01,
+  DFU_PROTOCOL_DFU_MODE    = 0x02
+};
+
+/// DFU Functional Descriptor type
+enum
+{
+  DFU_DESC_FUNCTIONAL = 0x21
+};
+
+/// DFU Class Specific Requests
+typedef enum
+{
+  DFU_REQUEST_DETACH    = 0,
+  DFU_REQUEST_DNLOAD    = 1,
+  DFU_REQUEST_UPLOAD    = 2,
+  DFU_REQUEST_GETSTATUS = 3,
+  DFU_REQUEST_CLRSTATUS = 4,
+  DFU_REQUEST_GETSTATE  = 5,
+  DFU_REQUEST_ABORT     = 6
+} dfu_request_t;
+
+/// DFU Device States
+typedef enum
+{
+  APP_IDLE                = 0,
+  APP_DETACH              = 1,
+  DFU_IDLE                = 2,
+  DFU_DNLOAD_SYNC         = 3,
+  DFU_DNBUSY              = 4,
+  DFU_DNLOAD_IDLE         = 5,
+  DFU_MANIFEST_SYNC       = 6,
+  DFU_MANIFEST            = 7,
+  DFU_MANIFEST_WAIT_RESET = 8,
+  DFU_UPLOAD_IDLE         = 9,
+  DFU_ERROR               = 10
+} dfu_state_code_t;
+
+/// DFU Device Status
+typedef enum
+{
+  DFU_STATUS_OK              = 0x00,
+  DFU_STATUS_ERR_TARGET      = 0x01,
+  DFU_STATUS_ERR_FILE        = 0x02,
+  DFU_STATUS_ERR_WRITE       = 0x03,
+  DFU_STATUS_ERR_ERASE       = 0x04,
+  DFU_STATUS_ERR_CHECK_ERASED= 0x05,
+  DFU_STATUS_ERR_PROG        = 0x06,
+  DFU_STATUS_ERR_VERIFY      = 0x07,
+  DFU_STATUS_ERR_ADDRESS     = 0x08,
+  DFU_STATUS_ERR_NOTDONE     = 0x09,
+  DFU_STATUS_ERR_FIRMWARE    = 0x0A,
+  DFU_STATUS_ERR_VENDOR      = 0x0B,
+  DFU_STATUS_ERR_USBR        = 0x0C,
+  DFU_STATUS_ERR_POR         = 0x0D,
+  DFU_STATUS_ERR_UNKNOWN     = 0x0E,
+  DFU_STATUS_ERR_STALLEDPKT  = 0x0F
+} dfu_status_code_t;
+
+/// DFU Functional Descriptor
+typedef struct ATTR_PACKED
+{
+  uint8_t  bLength;
+  uint8_t  bDescriptorType;
+
+  struct ATTR_PACKED
+  {
+    uint8_t can_download              : 1;
+    uint8_t can_upload                : 1;
+    uint8_t manifestation_tolerant    : 1;
+    uint8_t will_detach               : 1;
+    uint8_t reserved                  : 4;
+  } bmAttributes;
+
+  uint16_t wDetachTimeOut;
+  uint16_t wTransferSize;
+  uint16_t bcdDFUVersion;
+} dfu_desc_func_t;
+
+TU_VERIFY_STATIC( sizeof(dfu_desc_func_t) == 9, "size is not correct");
+
+/// Response of DFU_GETSTATUS request
+typedef struct ATTR_PACKED
+{
+  uint8_t bStatus;
+  uint8_t bwPollTimeout[3];
+  uint8_t bState;
+  uint8_t iString;
+} dfu_status_t;
+
+TU_VERIFY_STATIC( sizeof(dfu_status_t) == 6, "size is not correct");
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_DFU_H_ */
@@ -0,0 +1,293 @@
+/**************************************************************************/
+/*!
+    @file     dfu_device.c
+    @author   hathach (tinyusb.org)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2018, hathach (tinyusb.org)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    This file is part of the tinyusb stack.
+*/
+/**************************************************************************/
+
+#include "tusb_option.h"
+
+#if (TUSB_OPT_DEVICE_ENABLED && CFG_TUD_DFU)
+
+#define _TINY_USB_SOURCE_FILE_
+
+#include "common/tusb_common.h"
+#include "dfu_device.h"
+#include "device/usbd_pvt.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+
+/*------------------------------------------------------------------*/
+/* VARIABLE DECLARATION
+ *------------------------------------------------------------------*/
+typedef struct {
+  uint8_t  itf_num;
+  uint8_t  state;
+  uint8_t  status;
+  bool     pending;     // block write or manifestation is deferred to tud_task()
+
+  uint16_t block_num;
+  uint16_t length;
+
+  CFG_TUSB_MEM_ALIGN uint8_t buf[CFG_TUD_DFU_TRANSFER_SIZE];
+} dfud_interface_t;
+
+CFG_TUSB_MEM_SECTION static dfud_interface_t _dfud_itf;
+
+/*------------------------------------------------------------------*/
+/* FUNCTION DECLARATION
+ *------------------------------------------------------------------*/
+
+// Request is not allowed in current state: stall and go to error state
+static bool dfud_stall(dfud_interface_t* p_dfu)
+{
+  p_dfu->state  = DFU_ERROR;
+  p_dfu->status = DFU_STATUS_ERR_STALLEDPKT;
+  return false;
+}
+
+// Write downloaded block or manifest image, deferred after GETSTATUS response is sent
+// so that host waits for bwPollTimeout instead of the status stage
+static void dfud_process(void* param)
+{
+  (void) param;
+  dfud_interface_t* p_dfu = &_dfud_itf;
+
+  p_dfu->pending = false;
+
+  if ( p_dfu->state == DFU_DNBUSY )
+  {
+    if ( !tud_dfu_download_cb || tud_dfu_download_cb(p_dfu->block_num, p_dfu->buf, p_dfu->length) )
+    {
+      p_dfu->state = DFU_DNLOAD_IDLE;
+    }else
+    {
+      p_dfu->state  = DFU_ERROR;
+      p_dfu->status = DFU_STATUS_ERR_WRITE;
+    }
+  }
+  else if ( p_dfu->state == DFU_MANIFEST )
+  {
+    if ( !tud_dfu_manifest_cb || tud_dfu_manifest_cb() )
+    {
+      // not manifestation tolerant: application resets device
+      p_dfu->state = DFU_MANIFEST_WAIT_RESET;
+    }else
+    {
+      p_dfu->state  = DFU_ERROR;
+      p_dfu->status = DFU_STATUS_ERR_FIRMWARE;
+    }
+  }
+}
+
+void dfud_init(void)
+{
+  tu_varclr(&_dfud_itf);
+  _dfud_itf.state = DFU_IDLE;
+}
+
+bool dfud_open(uint8_t rhport, tusb_desc_interface_t const * p_desc_itf, uint16_t *p_len)
+{
+  (void) rhport;
+
+  TU_VERIFY(DFU_SUBCLASS == p_desc_itf->bInterfaceSubClass);
+
+  dfud_interface_t* p_dfu = &_dfud_itf;
+
+  p_dfu->itf_num = p_desc_itf->bInterfaceNumber;
+  p_dfu->state   = DFU_IDLE;
+  p_dfu->status  = DFU_STATUS_OK;
+
+  // Interface followed by functional descriptor
+  uint8_t const* p_desc = tu_desc_next(p_desc_itf);
+  (*p_len) = sizeof(tusb_desc_interface_t);
+
+  if ( DFU_DESC_FUNCTIONAL == tu_desc_type(p_desc) )
+  {
+    (*p_len) += tu_desc_len(p_desc);
+  }
+
+  return true;
+}
+
+bool dfud_control_request(uint8_t rhport, tusb_control_request_t const * p_request)
+{
+  dfud_interface_t* p_dfu = &_dfud_itf;
+
+  TU_VERIFY(p_request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS);
+
+  switch ( p_request->bRequest )
+  {
+    case DFU_REQUEST_DNLOAD:
+      if ( (p_dfu->state != DFU_IDLE) && (p_dfu->state != DFU_DNLOAD_IDLE) ) return dfud_stall(p_dfu);
+
+      if ( p_request->wLength == 0 )
+      {
+        // end of download, only valid after at least one block
+        if ( p_dfu->state != DFU_DNLOAD_IDLE ) return dfud_stall(p_dfu);
+
+        p_dfu->state = DFU_MANIFEST_SYNC;
+        usbd_control_xfer(rhport, p_request, NULL, 0);
+      }
+      else
+      {
+        if ( p_request->wLength > CFG_TUD_DFU_TRANSFER_SIZE ) return dfud_stall(p_dfu);
+
+        p_dfu->block_num = p_request->wValue;
+        p_dfu->length    = p_request->wLength;
+
+        // state moves to DFU_DNLOAD_SYNC once data stage is complete
+        usbd_control_xfer(rhport, p_request, p_dfu->buf, p_request->wLength);
+      }
+    break;
+
+    case DFU_REQUEST_UPLOAD:
+    {
+      if ( (p_dfu->state != DFU_IDLE) && (p_dfu->state != DFU_UPLOAD_IDLE) ) return dfud_stall(p_dfu);
+
+      uint16_t const xact_len = tu_min16(p_request->wLength, CFG_TUD_DFU_TRANSFER_SIZE);
+      uint16_t const len = tud_dfu_upload_cb ? tud_dfu_upload_cb(p_request->wValue, p_dfu->buf, xact_len) : 0;
+
+      // short frame ends upload
+      p_dfu->state = (len < p_request->wLength) ? DFU_IDLE : DFU_UPLOAD_IDLE;
+      usbd_control_xfer(rhport, p_request, p_dfu->buf, len);
+    }
+    break;
+
+    case DFU_REQUEST_GETSTATUS:
+    {
+      uint32_t timeout = 0;
+
+      if ( p_dfu->state == DFU_DNLOAD_SYNC )
+      {
+        p_dfu->state = DFU_DNBUSY;
+        if ( tud_dfu_poll_timeout_cb ) timeout = tud_dfu_poll_timeout_cb(DFU_DNBUSY, p_dfu->block_num, p_dfu->buf, p_dfu->length);
+      }
+      else if ( p_dfu->state == DFU_MANIFEST_SYNC )
+      {
+        p_dfu->state = DFU_MANIFEST;
+        if ( tud_dfu_poll_timeout_cb ) timeout = tud_dfu_poll_timeout_cb(DFU_MANIFEST, 0, NULL, 0);
+      }
+
+      dfu_status_t resp =
+      {
+        .bStatus       = p_dfu->status,
+        .bwPollTimeout = { (uint8_t) timeout, (uint8_t) (timeout >> 8), (uint8_t) (timeout >> 16) },
+        .bState        = p_dfu->state,
+        .iString       = 0
+      };
+
+      usbd_control_xfer(rhport, p_request, &resp, sizeof(resp));
+    }
+    break;
+
+    case DFU_REQUEST_CLRSTATUS:
+      if ( p_dfu->state != DFU_ERROR ) return dfud_stall(p_dfu);
+
+      p_dfu->state  = DFU_IDLE;
+      p_dfu->status = DFU_STATUS_OK;
+      usbd_control_xfer(rhport, p_request, NULL, 0);
+    break;
+
+    case DFU_REQUEST_GETSTATE:
+      usbd_control_xfer(rhport, p_request, &p_dfu->state, 1);
+    break;
+
+    case DFU_REQUEST_ABORT:
+      if ( (p_dfu->state == DFU_DNBUSY) || (p_dfu->state == DFU_MANIFEST) ) return dfud_stall(p_dfu);
+
+      p_dfu->state = DFU_IDLE;
+      usbd_control_xfer(rhport, p_request, NULL, 0);
+    break;
+
+    case DFU_REQUEST_DETACH:
+      // already in DFU mode, nothing to detach from
+      usbd_control_xfer(rhport, p_request, NULL, 0);
+    break;
+
+    default: return dfud_stall(p_dfu);
+  }
+
+  return true;
+}
+
+bool dfud_control_request_complete(uint8_t rhport, tusb_control_request_t const * p_request)
+{
+  (void) rhport;
+
+  dfud_interface_t* p_dfu = &_dfud_itf;
+
+  if ( p_request->bmRequestType_bit.type != TUSB_REQ_TYPE_CLASS ) return true;
+
+  if ( p_request->bRequest == DFU_REQUEST_DNLOAD )
+  {
+    // block is received
+    if ( p_request->wLength && (p_dfu->state == DFU_IDLE || p_dfu->state == DFU_DNLOAD_IDLE) )
+    {
+      p_dfu->state = DFU_DNLOAD_SYNC;
+    }
+  }
+  else if ( p_request->bRequest == DFU_REQUEST_GETSTATUS )
+  {
+    // status is sent, process block or manifestation while host waits for bwPollTimeout
+    if ( !p_dfu->pending && (p_dfu->state == DFU_DNBUSY || p_dfu->state == DFU_MANIFEST) )
+    {
+      p_dfu->pending = true;
+      usbd_defer_func(dfud_process, NULL, false);
+    }
+  }
+
+  return true;
+}
+
+bool dfud_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t event, uint32_t xferred_bytes)
+{
+  // DFU only uses control endpoint
+  (void) rhport;
+  (void) ep_addr;
+  (void) event;
+  (void) xferred_bytes;
+
+  return true;
+}
+
+void dfud_reset(uint8_t rhport)
+{
+  (void) rhport;
+  dfud_init();
+}
+
+#endif
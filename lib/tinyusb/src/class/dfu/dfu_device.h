@@ -0,0 +1,97 @@
+/**************************************************************************/
+/*!
+    @file     dfu_device.h
+    @author   hathach (tinyusb.org)
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2018, hathach (tinyusb.org)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    This file is part of the tinyusb stack.
+*/
+/**************************************************************************/
+
+#ifndef _TUSB_DFU_DEVICE_H_
+#define _TUSB_DFU_DEVICE_H_
+
+#include "common/tusb_common.h"
+#include "device/usbd.h"
+#include "dfu.h"
+
+//--------------------------------------------------------------------+
+// Class Driver Configuration
+//--------------------------------------------------------------------+
+
+// Must match wTransferSize of the functional descriptor
+#ifndef CFG_TUD_DFU_TRANSFER_SIZE
+#define CFG_TUD_DFU_TRANSFER_SIZE   512
+#endif
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+//--------------------------------------------------------------------+
+// APPLICATION CALLBACK API (WEAK is optional)
+//--------------------------------------------------------------------+
+
+// Invoked on GETSTATUS when a downloaded block (state DFU_DNBUSY) or manifestation (state DFU_MANIFEST)
+// is about to be processed. Return time in ms that host should wait before polling status again.
+ATTR_WEAK uint32_t tud_dfu_poll_timeout_cb(uint8_t state, uint16_t block_num, uint8_t const* data, uint16_t length);
+
+// Invoked from tud_task() after the GETSTATUS response is sent, to write a downloaded block.
+// Return false if write failed.
+ATTR_WEAK bool tud_dfu_download_cb(uint16_t block_num, uint8_t const* data, uint16_t length);
+
+// Invoked from tud_task() when host ended download with zero length DNLOAD.
+// Return false if image is not valid.
+ATTR_WEAK bool tud_dfu_manifest_cb(void);
+
+// Invoked on UPLOAD, fill data up to length and return number of bytes.
+// Returning less than length ends the upload.
+ATTR_WEAK uint16_t tud_dfu_upload_cb(uint16_t block_num, uint8_t* data, uint16_t length);
+
+//--------------------------------------------------------------------+
+// USBD-CLASS DRIVER API
+//--------------------------------------------------------------------+
+#ifdef _TINY_USB_SOURCE_FILE_
+
+void dfud_init(void);
+bool dfud_open(uint8_t rhport, tusb_desc_interface_t const * itf_desc, uint16_t *p_length);
+bool dfud_control_request(uint8_t rhport, tusb_control_request_t const * p_request);
+bool dfud_control_request_complete (uint8_t rhport, tusb_control_request_t const * p_request);
+bool dfud_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t event, uint32_t xferred_bytes);
+void dfud_reset(uint8_t rhport);
+
+#endif
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _TUSB_DFU_DEVICE_H_ */
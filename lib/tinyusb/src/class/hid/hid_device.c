@@ -52,8 +52,13 @@
 // MACRO CONSTANT TYPEDEF
 //--------------------------------------------------------------------+
 
-// Max report len is keyboard's one with 8 byte + 1 byte report id
+// Max report len is keyboard's one with 8 byte + 1 byte report id,
+// application with larger generic reports must define CFG_TUD_HID_BUFSIZE
+#ifdef CFG_TUD_HID_BUFSIZE
+#define REPORT_BUFSIZE      CFG_TUD_HID_BUFSIZE
+#else
 #define REPORT_BUFSIZE      12
+#endif
 
 
 #define ITF_IDX_BOOT_KBD   0
@@ -65,6 +70,7 @@ typedef struct
 {
   uint8_t itf_num;
   uint8_t ep_in;
+  uint8_t ep_out; // optional, 0 if interface has IN endpoint only
 
   uint8_t idle_rate; // in unit of 4 ms TODO removed
   bool    boot_protocol;
@@ -73,6 +79,7 @@ typedef struct
   uint8_t const * desc_report;
 
   CFG_TUSB_MEM_ALIGN uint8_t report_buf[REPORT_BUFSIZE];
+  CFG_TUSB_MEM_ALIGN uint8_t epout_buf[REPORT_BUFSIZE];
 
   // callbacks
   uint16_t (*get_report_cb) (uint8_t report_id, hid_report_type_t type, uint8_t* buffer, uint16_t reqlen);
@@ -125,7 +132,7 @@ bool tud_hid_generic_ready(void)
 
 bool tud_hid_generic_report(uint8_t report_id, void const* report, uint8_t len)
 {
-  TU_VERIFY( tud_hid_generic_ready() && (len < REPORT_BUFSIZE) );
+  TU_VERIFY( tud_hid_generic_ready() && (len + (report_id ? 1 : 0) <= REPORT_BUFSIZE) );
 
   hidd_interface_t * p_hid = &_hidd_itf[ITF_IDX_GENERIC];
 
@@ -324,8 +331,8 @@ bool hidd_open(uint8_t rhport, tusb_desc_interface_t const * desc_itf, uint16_t
 {
   uint8_t const *p_desc = (uint8_t const *) desc_itf;
 
-  // TODO support HID OUT Endpoint
-  TU_ASSERT(desc_itf->bNumEndpoints == 1);
+  // Interrupt IN endpoint and an optional Interrupt OUT endpoint
+  TU_ASSERT(desc_itf->bNumEndpoints == 1 || desc_itf->bNumEndpoints == 2);
 
   //------------- HID descriptor -------------//
   p_desc = tu_desc_next(p_desc);
@@ -391,12 +398,34 @@ bool hidd_open(uint8_t rhport, tusb_desc_interface_t const * desc_itf, uint16_t
   }
 
   TU_ASSERT(p_hid->desc_report);
-  TU_ASSERT(dcd_edpt_open(rhport, desc_edpt));
+
+  for(uint8_t i=0; i<desc_itf->bNumEndpoints; i++)
+  {
+    TU_ASSERT(TUSB_DESC_ENDPOINT == desc_edpt->bDescriptorType);
+    TU_ASSERT(dcd_edpt_open(rhport, desc_edpt));
+
+    if ( tu_edpt_dir(desc_edpt->bEndpointAddress) == TUSB_DIR_IN )
+    {
+      p_hid->ep_in = desc_edpt->bEndpointAddress;
+    }else
+    {
+      p_hid->ep_out = desc_edpt->bEndpointAddress;
+    }
+
+    desc_edpt = (tusb_desc_endpoint_t const *) tu_desc_next(desc_edpt);
+  }
+
+  TU_ASSERT(p_hid->ep_in);
 
   p_hid->itf_num   = desc_itf->bInterfaceNumber;
-  p_hid->ep_in     = desc_edpt->bEndpointAddress;
   p_hid->desc_len  = desc_hid->wReportLength;
 
+  // Prepare for incoming report
+  if ( p_hid->ep_out )
+  {
+    TU_ASSERT( dcd_edpt_xfer(rhport, p_hid->ep_out, p_hid->epout_buf, sizeof(p_hid->epout_buf)) );
+  }
+
   *p_len = sizeof(tusb_desc_interface_t) + sizeof(tusb_hid_descriptor_hid_t) + desc_itf->bNumEndpoints*sizeof(tusb_desc_endpoint_t);
 
   return true;
@@ -512,7 +541,23 @@ bool hidd_control_request_complete(uint8_t rhport, tusb_control_request_t const
 
 bool hidd_xfer_cb(uint8_t rhport, uint8_t ep_addr, xfer_result_t event, uint32_t xferred_bytes)
 {
-  // nothing to do
+  (void) event;
+
+  // Only generic interface reports its transfers to application
+  hidd_interface_t * p_hid = &_hidd_itf[ITF_IDX_GENERIC];
+
+  if ( ep_addr == p_hid->ep_out )
+  {
+    if ( tud_hid_generic_out_cb ) tud_hid_generic_out_cb(p_hid->epout_buf, (uint16_t) xferred_bytes);
+
+    // Report is consumed, prepare for next one
+    TU_ASSERT( dcd_edpt_xfer(rhport, p_hid->ep_out, p_hid->epout_buf, sizeof(p_hid->epout_buf)) );
+  }
+  else if ( ep_addr == p_hid->ep_in )
+  {
+    if ( tud_hid_generic_report_complete_cb ) tud_hid_generic_report_complete_cb();
+  }
+
   return true;
 }
 
@@ -73,6 +73,14 @@ bool tud_hid_generic_report(uint8_t report_id, void const* report, uint8_t len);
 uint16_t tud_hid_generic_get_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen);
 void     tud_hid_generic_set_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize);
 
+/** Callback invoked when a report is received on the generic interface's OUT endpoint.
+ * \note  buffer is re-used for the next report once this callback returns
+ */
+ATTR_WEAK void tud_hid_generic_out_cb(uint8_t const* report, uint16_t len);
+
+/// Callback invoked when the report queued by tud_hid_generic_report() is sent to host
+ATTR_WEAK void tud_hid_generic_report_complete_cb(void);
+
 //--------------------------------------------------------------------+
 // KEYBOARD API
 //--------------------------------------------------------------------+
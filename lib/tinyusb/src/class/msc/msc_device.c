@@ -86,11 +86,14 @@ typedef struct {
 CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static mscd_interface_t _mscd_itf = { 0 };
 CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t _mscd_buf[CFG_TUD_MSC_BUFSIZE];
 
+static tud_msc_segment_t _mscd_segs[CFG_TUD_MSC_READ_SEGMENTS];
+
 //--------------------------------------------------------------------+
 // INTERNAL OBJECT & FUNCTION DECLARATION
 //--------------------------------------------------------------------+
 static void proc_read10_cmd(uint8_t rhport, mscd_interface_t* p_msc);
 static void proc_write10_cmd(uint8_t rhport, mscd_interface_t* p_msc);
+static int32_t read10_gather(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t bufsize);
 
 static inline uint32_t rdwr10_get_lba(uint8_t const command[])
 {
@@ -570,7 +573,14 @@ static void proc_read10_cmd(uint8_t rhport, mscd_interface_t* p_msc)
   int32_t nbytes = (int32_t) tu_min32(sizeof(_mscd_buf), p_cbw->total_bytes-p_msc->xferred_len);
 
   // Application can consume smaller bytes
-  nbytes = tud_msc_read10_cb(p_cbw->lun, lba, p_msc->xferred_len % block_sz, _mscd_buf, (uint32_t) nbytes);
+  if ( tud_msc_read10_segments_cb )
+  {
+    nbytes = read10_gather(p_cbw->lun, lba, p_msc->xferred_len % block_sz, (uint32_t) nbytes);
+  }
+  else
+  {
+    nbytes = tud_msc_read10_cb(p_cbw->lun, lba, p_msc->xferred_len % block_sz, _mscd_buf, (uint32_t) nbytes);
+  }
 
   if ( nbytes < 0 )
   {
@@ -592,6 +602,32 @@ static void proc_read10_cmd(uint8_t rhport, mscd_interface_t* p_msc)
   }
 }
 
+// Assemble segments from application into class buffer, this is the only copy of READ10 data
+static int32_t read10_gather(uint8_t lun, uint32_t lba, uint32_t offset, uint32_t bufsize)
+{
+  int32_t count = tud_msc_read10_segments_cb(lun, lba, offset, _mscd_segs, CFG_TUD_MSC_READ_SEGMENTS, bufsize);
+  if ( count <= 0 ) return count;
+
+  uint32_t nbytes = 0;
+  for(int32_t i=0; (i < count) && (nbytes < bufsize); i++)
+  {
+    uint32_t const len = tu_min32(_mscd_segs[i].len, bufsize - nbytes);
+
+    if ( _mscd_segs[i].buffer )
+    {
+      memcpy(_mscd_buf + nbytes, _mscd_segs[i].buffer, len);
+    }
+    else
+    {
+      memset(_mscd_buf + nbytes, 0, len);
+    }
+
+    nbytes += len;
+  }
+
+  return (int32_t) nbytes;
+}
+
 static void proc_write10_cmd(uint8_t rhport, mscd_interface_t* p_msc)
 {
   msc_cbw_t const * p_cbw = &p_msc->cbw;
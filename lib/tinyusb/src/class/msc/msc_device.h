@@ -71,6 +71,11 @@ TU_VERIFY_STATIC(CFG_TUD_MSC_BUFSIZE < UINT16_MAX, "Size is not correct");
   #error CFG_TUD_MSC_PRODUCT_REV 4-byte string must be defined
 #endif
 
+// Maximum number of segments returned by tud_msc_read10_segments_cb() at once
+#ifndef CFG_TUD_MSC_READ_SEGMENTS
+  #define CFG_TUD_MSC_READ_SEGMENTS   32
+#endif
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -107,6 +112,33 @@ bool tud_msc_set_sense(uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, u
  */
 int32_t tud_msc_read10_cb (uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize);
 
+/// Segment of READ10 response data, a NULL buffer means \a len bytes of zero
+typedef struct
+{
+  void const* buffer;
+  uint32_t    len;
+} tud_msc_segment_t;
+
+/**
+ * Optional scatter/gather variant of \ref tud_msc_read10_cb. If implemented, it takes precedence: application
+ * describes the response data as a list of segments (e.g header templates, pointers into flash) and tinyusb
+ * assembles them directly into its transfer buffer, saving application from copying into an intermediate buffer.
+ * \param[in]   lun           Logical unit number
+ * \param[in]   lba           Logical Block Address to be read
+ * \param[in]   offset        Byte offset from LBA
+ * \param[out]  segments      Segment list which application need to update with the response data.
+ * \param[in]   max_segments  Capacity of \a segments
+ * \param[in]   bufsize       Requested bytes
+ *
+ * \return      Number of segments filled. Segments may cover less than \a bufsize, tinyusb will transfer
+ *              this amount first and invoked this again for remaining data.
+ *
+ * \retval      zero        Indicate application is not ready yet to response e.g disk I/O is not complete.
+ * \retval      negative    Indicate error, same as \ref tud_msc_read10_cb
+ */
+ATTR_WEAK int32_t tud_msc_read10_segments_cb (uint8_t lun, uint32_t lba, uint32_t offset,
+                                              tud_msc_segment_t segments[], uint8_t max_segments, uint32_t bufsize);
+
 /**
  * Callback invoked when received \ref SCSI_CMD_WRITE_10 command
  * \param[in]   lun         Logical unit number
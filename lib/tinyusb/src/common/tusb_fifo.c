@@ -137,6 +137,8 @@ uint16_t tu_fifo_read_n (tu_fifo_t* f, void * p_buffer, uint16_t count)
 {
   if( tu_fifo_empty(f) ) return 0;
 
+  tu_fifo_lock(f);
+
   /* Limit up to fifo's count */
   if ( count > f->count ) count = f->count;
 
@@ -144,17 +146,18 @@ uint16_t tu_fifo_read_n (tu_fifo_t* f, void * p_buffer, uint16_t count)
    * case 1: ....RxxxxW.......
    * case 2: xxxxxW....Rxxxxxx
    */
-//  uint16_t index2upper = tu_min16(count, f->count-f->rd_idx);
+  uint16_t const upper = tu_min16(count, f->depth - f->rd_idx);
 
   uint8_t* p_buf = (uint8_t*) p_buffer;
-  uint16_t len = 0;
-  while( (len < count) && tu_fifo_read(f, p_buf) )
-  {
-    len++;
-    p_buf += f->item_size;
-  }
+  memcpy(p_buf, f->buffer + (f->rd_idx * f->item_size), upper * f->item_size);
+  memcpy(p_buf + (upper * f->item_size), f->buffer, (count - upper) * f->item_size);
+
+  f->rd_idx = (f->rd_idx + count) % f->depth;
+  f->count -= count;
 
-  return len;
+  tu_fifo_unlock(f);
+
+  return count;
 }
 
 /******************************************************************************/
@@ -246,16 +249,127 @@ uint16_t tu_fifo_write_n (tu_fifo_t* f, const void * p_data, uint16_t count)
 {
   if ( count == 0 ) return 0;
 
+  tu_fifo_lock(f);
+
   uint8_t const* p_buf = (uint8_t const*) p_data;
+  uint16_t len = count;
 
-  uint16_t len = 0;
-  while( (len < count) && tu_fifo_write(f, p_buf) )
+  if ( !f->overwritable )
+  {
+    len = tu_min16(count, tu_fifo_remaining(f));
+  }
+  else if ( count > f->depth )
+  {
+    // only the last 'depth' items would survive, skip the others
+    p_buf    += (count - f->depth) * f->item_size;
+    f->wr_idx = (f->wr_idx + count - f->depth) % f->depth;
+    len       = f->depth;
+  }
+
+  /* Could copy up to 2 portions if queue is wrapped around */
+  uint16_t const upper = tu_min16(len, f->depth - f->wr_idx);
+
+  memcpy(f->buffer + (f->wr_idx * f->item_size), p_buf, upper * f->item_size);
+  memcpy(f->buffer, p_buf + (upper * f->item_size), (len - upper) * f->item_size);
+
+  f->wr_idx = (f->wr_idx + len) % f->depth;
+
+  if ( f->count + len >= f->depth )
+  {
+    // overwritten oldest items (if any), keep the full state (rd == wr && len = size)
+    f->count  = f->depth;
+    f->rd_idx = f->wr_idx;
+  }
+  else
   {
-    len++;
-    p_buf += f->item_size;
+    f->count += len;
   }
 
-  return len;
+  tu_fifo_unlock(f);
+
+  // overwritable fifo always accepts all items
+  return f->overwritable ? count : len;
+}
+
+/******************************************************************************/
+/*!
+    @brief Get the linear (non wrapped around) part of the FIFO that can be
+    read directly, e.g as a DMA source. Consume it with tu_fifo_advance_read().
+
+    @param[in]  f
+                Pointer to the FIFO buffer to manipulate
+    @param[out] pp_data
+                Pointer to the first readable item
+
+    @returns number of items that can be read from *pp_data
+*/
+/******************************************************************************/
+uint16_t tu_fifo_get_linear_read(tu_fifo_t* f, void const ** pp_data)
+{
+  *pp_data = f->buffer + (f->rd_idx * f->item_size);
+  return tu_min16(f->count, f->depth - f->rd_idx);
+}
+
+/******************************************************************************/
+/*!
+    @brief Remove items previously read via tu_fifo_get_linear_read()
+
+    @param[in]  f
+                Pointer to the FIFO buffer to manipulate
+    @param[in]  n
+                Number of items consumed
+*/
+/******************************************************************************/
+void tu_fifo_advance_read(tu_fifo_t* f, uint16_t n)
+{
+  tu_fifo_lock(f);
+
+  if ( n > f->count ) n = f->count;
+  f->rd_idx = (f->rd_idx + n) % f->depth;
+  f->count -= n;
+
+  tu_fifo_unlock(f);
+}
+
+/******************************************************************************/
+/*!
+    @brief Get the linear (non wrapped around) free part of the FIFO that can
+    be written directly, e.g as a DMA destination. Commit it with
+    tu_fifo_advance_write().
+
+    @param[in]  f
+                Pointer to the FIFO buffer to manipulate
+    @param[out] pp_data
+                Pointer to the first free item
+
+    @returns number of items that can be written to *pp_data
+*/
+/******************************************************************************/
+uint16_t tu_fifo_get_linear_write(tu_fifo_t* f, void ** pp_data)
+{
+  *pp_data = f->buffer + (f->wr_idx * f->item_size);
+  return tu_min16(tu_fifo_remaining(f), f->depth - f->wr_idx);
+}
+
+/******************************************************************************/
+/*!
+    @brief Add items previously written via tu_fifo_get_linear_write()
+
+    @param[in]  f
+                Pointer to the FIFO buffer to manipulate
+    @param[in]  n
+                Number of items written
+*/
+/******************************************************************************/
+void tu_fifo_advance_write(tu_fifo_t* f, uint16_t n)
+{
+  tu_fifo_lock(f);
+
+  if ( n > tu_fifo_remaining(f) ) n = tu_fifo_remaining(f);
+  f->wr_idx = (f->wr_idx + n) % f->depth;
+  f->count += n;
+
+  tu_fifo_unlock(f);
 }
 
 /******************************************************************************/
@@ -106,6 +106,12 @@ uint16_t tu_fifo_read_n  (tu_fifo_t* f, void * p_buffer, uint16_t count);
 
 bool     tu_fifo_peek_at (tu_fifo_t* f, uint16_t pos, void * p_buffer);
 
+// Zero-copy access to the contiguous part of the FIFO
+uint16_t tu_fifo_get_linear_read  (tu_fifo_t* f, void const ** pp_data);
+void     tu_fifo_advance_read     (tu_fifo_t* f, uint16_t n);
+uint16_t tu_fifo_get_linear_write (tu_fifo_t* f, void ** pp_data);
+void     tu_fifo_advance_write    (tu_fifo_t* f, uint16_t n);
+
 static inline bool tu_fifo_peek(tu_fifo_t* f, void * p_buffer)
 {
   return tu_fifo_peek_at(f, 0, p_buffer);
@@ -87,7 +87,8 @@ typedef struct ATTR_ALIGNED(4)
   };
 } dcd_event_t;
 
-TU_VERIFY_STATIC(sizeof(dcd_event_t) <= 12, "size is not correct");
+// 12 bytes on 32-bit MCUs, larger on 64-bit hosts because of function call pointers
+TU_VERIFY_STATIC(sizeof(dcd_event_t) <= 3*sizeof(void*), "size is not correct");
 
 /*------------------------------------------------------------------*/
 /* Device API
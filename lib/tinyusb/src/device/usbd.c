@@ -141,6 +141,19 @@ static usbd_class_driver_t const usbd_class_drivers[] =
     },
   #endif
 
+  #if CFG_TUD_DFU
+    {
+        .class_code      = TUSB_CLASS_APPLICATION_SPECIFIC,
+        .init            = dfud_init,
+        .open            = dfud_open,
+        .control_request = dfud_control_request,
+        .control_request_complete = dfud_control_request_complete,
+        .xfer_cb         = dfud_xfer_cb,
+        .sof             = NULL,
+        .reset           = dfud_reset
+    },
+  #endif
+
   #if CFG_TUD_CUSTOM_CLASS
     {
         .class_code      = TUSB_CLASS_VENDOR_SPECIFIC,
@@ -0,0 +1,853 @@
+/**************************************************************************/
+/*!
+    @file     dcd_usbip.c
+    @author   hathach
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2018, hathach (tinyusb.org)
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    This file is part of the tinyusb stack.
+*/
+/**************************************************************************/
+
+#include "tusb_option.h"
+
+#if TUSB_OPT_DEVICE_ENABLED && CFG_TUSB_MCU == OPT_MCU_LINUX
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "tusb_hal.h"
+#include "device/dcd.h"
+#include "device/usbd.h"
+#include "device/usbd_pvt.h" // to get descriptors for device list
+
+/* Device controller for Linux: the device is exported over USB/IP on loopback so that
+ * host kernel's vhci-hcd can attach it as a real USB device
+ *
+ *    usbip attach -r 127.0.0.1 -b 1-1
+ *
+ * A background thread plays the role of the USB controller: it receives URBs from the
+ * socket and raises dcd events with the interrupt mutex held, which dcd_int_disable()
+ * takes to keep the stack's critical sections. Protocol is described in the kernel's
+ * Documentation/usb/usbip_protocol.rst, all fields on the wire are big endian.
+ */
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+#ifndef CFG_TUD_USBIP_PORT
+#define CFG_TUD_USBIP_PORT    3240
+#endif
+
+#define USBIP_VERSION         0x0111
+#define USBIP_BUSID           "1-1"
+#define USBIP_BUSNUM          1
+#define USBIP_DEVNUM          1
+#define USBIP_SPEED_FULL      2
+
+#define USBIP_EPIPE           (-32)  // stalled
+#define USBIP_ECONNRESET      (-104) // unlinked
+
+enum
+{
+  OP_REQ_DEVLIST = 0x8005,
+  OP_REP_DEVLIST = 0x0005,
+  OP_REQ_IMPORT  = 0x8003,
+  OP_REP_IMPORT  = 0x0003,
+};
+
+enum
+{
+  USBIP_CMD_SUBMIT = 1,
+  USBIP_CMD_UNLINK = 2,
+  USBIP_RET_SUBMIT = 3,
+  USBIP_RET_UNLINK = 4,
+};
+
+typedef struct ATTR_PACKED
+{
+  uint16_t version;
+  uint16_t code;
+  uint32_t status;
+} usbip_op_header_t;
+
+typedef struct ATTR_PACKED
+{
+  char     path[256];
+  char     busid[32];
+  uint32_t busnum;
+  uint32_t devnum;
+  uint32_t speed;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t  bDeviceClass;
+  uint8_t  bDeviceSubClass;
+  uint8_t  bDeviceProtocol;
+  uint8_t  bConfigurationValue;
+  uint8_t  bNumConfigurations;
+  uint8_t  bNumInterfaces;
+} usbip_device_t;
+
+typedef struct ATTR_PACKED
+{
+  uint8_t bInterfaceClass;
+  uint8_t bInterfaceSubClass;
+  uint8_t bInterfaceProtocol;
+  uint8_t padding;
+} usbip_interface_t;
+
+typedef struct ATTR_PACKED
+{
+  uint32_t command;
+  uint32_t seqnum;
+  uint32_t devid;
+  uint32_t direction;
+  uint32_t ep;
+
+  union
+  {
+    struct ATTR_PACKED
+    {
+      uint32_t transfer_flags;
+      int32_t  transfer_buffer_length;
+      int32_t  start_frame;
+      int32_t  number_of_packets;
+      int32_t  interval;
+      uint8_t  setup[8];
+    } cmd_submit;
+
+    struct ATTR_PACKED
+    {
+      int32_t  status;
+      int32_t  actual_length;
+      int32_t  start_frame;
+      int32_t  number_of_packets;
+      int32_t  error_count;
+      uint8_t  padding[8];
+    } ret_submit;
+
+    struct ATTR_PACKED
+    {
+      uint32_t seqnum;
+      uint8_t  padding[24];
+    } cmd_unlink;
+
+    struct ATTR_PACKED
+    {
+      int32_t  status;
+      uint8_t  padding[24];
+    } ret_unlink;
+  };
+} usbip_header_t;
+
+TU_VERIFY_STATIC(sizeof(usbip_device_t) == 312, "size is not correct");
+TU_VERIFY_STATIC(sizeof(usbip_header_t) == 48 , "size is not correct");
+
+// URB submitted by host, completed with RET_SUBMIT
+typedef struct urb_s
+{
+  struct urb_s* next;
+
+  uint32_t seqnum;
+  uint32_t length;  // transfer buffer length
+  uint32_t actual;  // bytes consumed (OUT) or filled (IN)
+  bool     setup_sent;
+  uint8_t  setup[8];
+  uint8_t  data[];  // OUT data from host, or IN data to host
+} urb_t;
+
+// Transfer descriptor
+typedef struct
+{
+  urb_t*   urb_list;   // URBs waiting for this endpoint, oldest first
+
+  uint8_t* buffer;
+  uint16_t total_len;
+  uint16_t actual_len;
+  uint16_t mps;        // max packet size
+  bool     busy;
+  bool     stalled;
+} xfer_td_t;
+
+static struct
+{
+  // All 16 endpoints including control IN & OUT. Control URBs are queued on OUT.
+  xfer_td_t xfer[16][2];
+
+  int client_fd; // -1 if no host is attached
+
+  pthread_t       thread;
+  pthread_mutex_t int_mutex; // held by controller thread while raising events
+}_dcd = { .client_fd = -1 };
+
+// dcd_int_disable() nesting of the calling thread
+static __thread uint32_t _int_disable_count = 0;
+
+static inline xfer_td_t* get_td(uint8_t epnum, uint8_t dir)
+{
+  return &_dcd.xfer[epnum][dir];
+}
+
+//--------------------------------------------------------------------+
+// Socket helpers
+//--------------------------------------------------------------------+
+static bool sock_recv(int fd, void* buf, size_t len)
+{
+  uint8_t* p = (uint8_t*) buf;
+
+  while ( len )
+  {
+    ssize_t const count = recv(fd, p, len, 0);
+    if ( count <= 0 ) return false;
+
+    p   += count;
+    len -= (size_t) count;
+  }
+
+  return true;
+}
+
+static bool sock_send(int fd, void const* buf, size_t len)
+{
+  uint8_t const* p = (uint8_t const*) buf;
+
+  while ( len )
+  {
+    ssize_t const count = send(fd, p, len, MSG_NOSIGNAL);
+    if ( count <= 0 ) return false;
+
+    p   += count;
+    len -= (size_t) count;
+  }
+
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// URB
+//--------------------------------------------------------------------+
+
+// Complete URB to host and free it. IN data is sent along with the reply.
+static void urb_complete(urb_t* urb, uint8_t dir, int32_t status)
+{
+  if ( _dcd.client_fd >= 0 )
+  {
+    usbip_header_t hdr;
+    tu_memclr(&hdr, sizeof(hdr));
+
+    hdr.command = htonl(USBIP_RET_SUBMIT);
+    hdr.seqnum  = htonl(urb->seqnum);
+    hdr.ret_submit.status        = (int32_t) htonl((uint32_t) status);
+    hdr.ret_submit.actual_length = (int32_t) htonl(urb->actual);
+
+    sock_send(_dcd.client_fd, &hdr, sizeof(hdr));
+    if ( (dir == TUSB_DIR_IN) && urb->actual ) sock_send(_dcd.client_fd, urb->data, urb->actual);
+  }
+
+  free(urb);
+}
+
+static urb_t* urb_pop(xfer_td_t* xfer)
+{
+  urb_t* urb = xfer->urb_list;
+  if ( urb ) xfer->urb_list = urb->next;
+  return urb;
+}
+
+static void urb_append(xfer_td_t* xfer, urb_t* urb)
+{
+  urb_t** p = &xfer->urb_list;
+  while ( *p ) p = &(*p)->next;
+  *p = urb;
+}
+
+// Complete all URBs of an endpoint with status
+static void urb_flush(uint8_t epnum, uint8_t dir, int32_t status)
+{
+  xfer_td_t* xfer = get_td(epnum, dir);
+  urb_t* urb;
+
+  while ( (urb = urb_pop(xfer)) != NULL ) urb_complete(urb, dir, status);
+}
+
+//--------------------------------------------------------------------+
+// Transfer processing, called with int_mutex held
+//--------------------------------------------------------------------+
+
+// Send setup packet of the oldest control URB to the stack
+static void control_setup_next(void)
+{
+  urb_t* urb = get_td(0, TUSB_DIR_OUT)->urb_list;
+
+  if ( urb && !urb->setup_sent )
+  {
+    urb->setup_sent = true;
+    dcd_event_setup_received(0, urb->setup, true);
+  }
+}
+
+// Data or Status stage of control transfer
+static void control_xfer(uint8_t dir, uint8_t* buffer, uint16_t total_bytes)
+{
+  xfer_td_t* ctrl = get_td(0, TUSB_DIR_OUT);
+  urb_t* urb = ctrl->urb_list;
+
+  if ( !urb ) return;
+
+  if ( total_bytes )
+  {
+    // Data stage: host's direction is given by setup packet
+    uint32_t const count = tu_min32(total_bytes, urb->length - urb->actual);
+
+    if ( dir == TUSB_DIR_IN )
+    {
+      memcpy(urb->data + urb->actual, buffer, count);
+    }else
+    {
+      memcpy(buffer, urb->data + urb->actual, count);
+    }
+    urb->actual += count;
+
+    dcd_event_xfer_complete(0, dir ? TUSB_DIR_IN_MASK : 0, count, XFER_RESULT_SUCCESS, true);
+  }
+  else
+  {
+    // Status stage: control transfer is complete
+    dcd_event_xfer_complete(0, dir ? TUSB_DIR_IN_MASK : 0, 0, XFER_RESULT_SUCCESS, true);
+
+    urb_pop(ctrl);
+    urb_complete(urb, (urb->setup[0] & TUSB_DIR_IN_MASK) ? TUSB_DIR_IN : TUSB_DIR_OUT, 0);
+
+    control_setup_next();
+  }
+}
+
+// Move data between queued URBs and the armed transfer of a Bulk/Interrupt endpoint.
+// Packet boundaries are kept: a short packet ends both the transfer and the URB.
+static void edpt_service(uint8_t epnum, uint8_t dir)
+{
+  xfer_td_t* xfer = get_td(epnum, dir);
+
+  while ( xfer->busy && xfer->urb_list )
+  {
+    urb_t* urb = xfer->urb_list;
+
+    uint32_t const count = tu_min32(urb->length - urb->actual, xfer->total_len - xfer->actual_len);
+
+    if ( dir == TUSB_DIR_OUT )
+    {
+      memcpy(xfer->buffer + xfer->actual_len, urb->data + urb->actual, count);
+    }else
+    {
+      memcpy(urb->data + urb->actual, xfer->buffer + xfer->actual_len, count);
+    }
+
+    urb->actual      += count;
+    xfer->actual_len += count;
+
+    bool short_packet;
+    bool urb_done;
+
+    if ( dir == TUSB_DIR_OUT )
+    {
+      // host data is fully consumed, last packet is short unless URB is multiple of packet size
+      urb_done     = (urb->actual == urb->length);
+      short_packet = urb_done && ((urb->length % xfer->mps) || (urb->length == 0));
+    }else
+    {
+      // stack data is fully sent, last packet is short unless transfer is multiple of packet size
+      short_packet = (xfer->actual_len == xfer->total_len) && ((xfer->total_len % xfer->mps) || (xfer->total_len == 0));
+      urb_done     = (urb->actual == urb->length) || short_packet;
+    }
+
+    if ( urb_done )
+    {
+      urb_pop(xfer);
+      urb_complete(urb, dir, 0);
+    }
+
+    if ( short_packet || (xfer->actual_len == xfer->total_len) )
+    {
+      xfer->busy = false;
+      dcd_event_xfer_complete(0, epnum | (dir ? TUSB_DIR_IN_MASK : 0), xfer->actual_len, XFER_RESULT_SUCCESS, true);
+    }
+  }
+}
+
+static void bus_reset(void)
+{
+  for(uint8_t epnum=0; epnum<16; epnum++)
+  {
+    urb_flush(epnum, TUSB_DIR_OUT, USBIP_ECONNRESET);
+    urb_flush(epnum, TUSB_DIR_IN , USBIP_ECONNRESET);
+  }
+
+  tu_varclr(&_dcd.xfer);
+  _dcd.xfer[0][TUSB_DIR_IN].mps  = CFG_TUD_ENDOINT0_SIZE;
+  _dcd.xfer[0][TUSB_DIR_OUT].mps = CFG_TUD_ENDOINT0_SIZE;
+}
+
+//--------------------------------------------------------------------+
+// USB/IP commands
+//--------------------------------------------------------------------+
+static void cmd_submit(usbip_header_t const* hdr, urb_t* urb)
+{
+  uint8_t const epnum = (uint8_t) ntohl(hdr->ep);
+  uint8_t const dir   = ntohl(hdr->direction) ? TUSB_DIR_IN : TUSB_DIR_OUT;
+
+  if ( epnum == 0 )
+  {
+    memcpy(urb->setup, hdr->cmd_submit.setup, 8);
+    urb_append(get_td(0, TUSB_DIR_OUT), urb);
+    control_setup_next();
+  }
+  else if ( epnum < 16 )
+  {
+    xfer_td_t* xfer = get_td(epnum, dir);
+
+    if ( xfer->stalled || !xfer->mps )
+    {
+      urb_complete(urb, dir, USBIP_EPIPE);
+      return;
+    }
+
+    urb_append(xfer, urb);
+    edpt_service(epnum, dir);
+  }
+  else
+  {
+    urb_complete(urb, dir, USBIP_EPIPE);
+  }
+}
+
+static void cmd_unlink(usbip_header_t const* hdr)
+{
+  uint32_t const seqnum = ntohl(hdr->cmd_unlink.seqnum);
+  int32_t status = 0; // URB is already completed
+
+  for(uint8_t i=0; i<32 && !status; i++)
+  {
+    xfer_td_t* xfer = get_td(i/2, i%2);
+
+    for(urb_t** p = &xfer->urb_list; *p; p = &(*p)->next)
+    {
+      // control transfer already seen by the stack runs to completion, its reply is then ignored by host
+      if ( (*p)->seqnum == seqnum && !(*p)->setup_sent )
+      {
+        urb_t* urb = *p;
+        *p = urb->next;
+        free(urb);
+
+        status = USBIP_ECONNRESET;
+        break;
+      }
+    }
+  }
+
+  usbip_header_t reply;
+  tu_memclr(&reply, sizeof(reply));
+
+  reply.command = htonl(USBIP_RET_UNLINK);
+  reply.seqnum  = hdr->seqnum;
+  reply.ret_unlink.status = (int32_t) htonl((uint32_t) status);
+
+  sock_send(_dcd.client_fd, &reply, sizeof(reply));
+}
+
+//--------------------------------------------------------------------+
+// USB/IP operations (before device is attached)
+//--------------------------------------------------------------------+
+
+// Fill device info from descriptors, return number of interfaces
+static uint8_t get_device_info(usbip_device_t* info, usbip_interface_t* itf_arr, uint8_t itf_max)
+{
+  tusb_desc_device_t const*        desc_dev = (tusb_desc_device_t const*) usbd_desc_set->device;
+  tusb_desc_configuration_t const* desc_cfg = (tusb_desc_configuration_t const*) usbd_desc_set->config;
+
+  tu_memclr(info, sizeof(usbip_device_t));
+
+  strcpy(info->path, "/sys/devices/tinyusb/" USBIP_BUSID);
+  strcpy(info->busid, USBIP_BUSID);
+
+  info->busnum              = htonl(USBIP_BUSNUM);
+  info->devnum              = htonl(USBIP_DEVNUM);
+  info->speed               = htonl(USBIP_SPEED_FULL);
+  info->idVendor            = htons(desc_dev->idVendor);
+  info->idProduct           = htons(desc_dev->idProduct);
+  info->bcdDevice           = htons(desc_dev->bcdDevice);
+  info->bDeviceClass        = desc_dev->bDeviceClass;
+  info->bDeviceSubClass     = desc_dev->bDeviceSubClass;
+  info->bDeviceProtocol     = desc_dev->bDeviceProtocol;
+  info->bConfigurationValue = 0;
+  info->bNumConfigurations  = desc_dev->bNumConfigurations;
+  info->bNumInterfaces      = desc_cfg->bNumInterfaces;
+
+  // interface list, alternate settings excluded
+  uint8_t count = 0;
+  uint8_t const* p_desc = (uint8_t const*) desc_cfg;
+  uint8_t const* desc_end = p_desc + desc_cfg->wTotalLength;
+
+  while ( (p_desc < desc_end) && (count < itf_max) )
+  {
+    tusb_desc_interface_t const* desc_itf = (tusb_desc_interface_t const*) p_desc;
+
+    if ( (desc_itf->bDescriptorType == TUSB_DESC_INTERFACE) && (desc_itf->bAlternateSetting == 0) )
+    {
+      itf_arr[count].bInterfaceClass    = desc_itf->bInterfaceClass;
+      itf_arr[count].bInterfaceSubClass = desc_itf->bInterfaceSubClass;
+      itf_arr[count].bInterfaceProtocol = desc_itf->bInterfaceProtocol;
+      itf_arr[count].padding            = 0;
+      count++;
+    }
+
+    p_desc = tu_desc_next(p_desc);
+  }
+
+  return count;
+}
+
+// Handle operation of a new connection, return true if device is imported
+static bool handle_op(int fd)
+{
+  usbip_op_header_t op;
+  TU_VERIFY( sock_recv(fd, &op, sizeof(op)) );
+
+  usbip_device_t    info;
+  usbip_interface_t itf_arr[32];
+  uint8_t const itf_count = get_device_info(&info, itf_arr, 32);
+
+  usbip_op_header_t reply = { .version = htons(USBIP_VERSION), .status = 0 };
+
+  switch ( ntohs(op.code) )
+  {
+    case OP_REQ_DEVLIST:
+    {
+      uint32_t const ndev = htonl(1);
+
+      reply.code = htons(OP_REP_DEVLIST);
+      sock_send(fd, &reply, sizeof(reply));
+      sock_send(fd, &ndev, sizeof(ndev));
+      sock_send(fd, &info, sizeof(info));
+      sock_send(fd, itf_arr, itf_count*sizeof(usbip_interface_t));
+    }
+    return false;
+
+    case OP_REQ_IMPORT:
+    {
+      char busid[32];
+      TU_VERIFY( sock_recv(fd, busid, sizeof(busid)) );
+
+      bool const found = (0 == strncmp(busid, USBIP_BUSID, sizeof(busid)));
+
+      reply.code   = htons(OP_REP_IMPORT);
+      reply.status = htonl(found ? 0 : 1);
+      sock_send(fd, &reply, sizeof(reply));
+
+      if ( found ) sock_send(fd, &info, sizeof(info));
+
+      return found;
+    }
+
+    default: return false;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Controller thread
+//--------------------------------------------------------------------+
+static void* usbip_thread(void* param)
+{
+  (void) param;
+
+  int const listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  TU_ASSERT(listen_fd >= 0, NULL);
+
+  int const on = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  // loopback only, USB/IP has no authentication
+  struct sockaddr_in addr =
+  {
+    .sin_family      = AF_INET,
+    .sin_port        = htons(CFG_TUD_USBIP_PORT),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+  };
+
+  TU_ASSERT(0 == bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)), NULL);
+  TU_ASSERT(0 == listen(listen_fd, 1), NULL);
+
+  while (1)
+  {
+    int const fd = accept(listen_fd, NULL, NULL);
+    if ( fd < 0 ) continue;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if ( !handle_op(fd) )
+    {
+      close(fd);
+      continue;
+    }
+
+    // Attached: vhci-hcd handles port reset and SET_ADDRESS itself
+    pthread_mutex_lock(&_dcd.int_mutex);
+    bus_reset();
+    _dcd.client_fd = fd;
+    dcd_event_bus_signal(0, DCD_EVENT_BUS_RESET, true);
+    pthread_mutex_unlock(&_dcd.int_mutex);
+
+    // Reset recovery time as a real host would, usbd flushes its event queue when handling bus reset
+    usleep(10*1000);
+
+    usbip_header_t hdr;
+    while ( sock_recv(fd, &hdr, sizeof(hdr)) )
+    {
+      if ( ntohl(hdr.command) == USBIP_CMD_SUBMIT )
+      {
+        uint32_t const dir    = ntohl(hdr.direction);
+        uint32_t const length = (uint32_t) ntohl((uint32_t) hdr.cmd_submit.transfer_buffer_length);
+
+        urb_t* urb = (urb_t*) calloc(1, sizeof(urb_t) + length);
+        if ( !urb ) break;
+
+        urb->seqnum = ntohl(hdr.seqnum);
+        urb->length = length;
+
+        // OUT data follows the header, socket is read without holding the mutex
+        if ( !dir && length && !sock_recv(fd, urb->data, length) )
+        {
+          free(urb);
+          break;
+        }
+
+        pthread_mutex_lock(&_dcd.int_mutex);
+        cmd_submit(&hdr, urb);
+        pthread_mutex_unlock(&_dcd.int_mutex);
+      }
+      else if ( ntohl(hdr.command) == USBIP_CMD_UNLINK )
+      {
+        pthread_mutex_lock(&_dcd.int_mutex);
+        cmd_unlink(&hdr);
+        pthread_mutex_unlock(&_dcd.int_mutex);
+      }
+      else
+      {
+        break;
+      }
+    }
+
+    // Detached
+    pthread_mutex_lock(&_dcd.int_mutex);
+    _dcd.client_fd = -1;
+    bus_reset();
+    dcd_event_bus_signal(0, DCD_EVENT_UNPLUGGED, true);
+    pthread_mutex_unlock(&_dcd.int_mutex);
+
+    close(fd);
+  }
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------+
+// Controller API
+//--------------------------------------------------------------------+
+bool dcd_init (uint8_t rhport)
+{
+  (void) rhport;
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&_dcd.int_mutex, &attr);
+
+  bus_reset();
+
+  return 0 == pthread_create(&_dcd.thread, NULL, usbip_thread, NULL);
+}
+
+// Interrupt masking is modeled by int_mutex, nesting is counted per thread
+void dcd_int_enable(uint8_t rhport)
+{
+  (void) rhport;
+
+  if ( _int_disable_count )
+  {
+    _int_disable_count--;
+    pthread_mutex_unlock(&_dcd.int_mutex);
+  }
+}
+
+void dcd_int_disable(uint8_t rhport)
+{
+  (void) rhport;
+
+  pthread_mutex_lock(&_dcd.int_mutex);
+  _int_disable_count++;
+}
+
+void dcd_set_address (uint8_t rhport, uint8_t dev_addr)
+{
+  (void) rhport;
+  (void) dev_addr;
+  // Address is managed by vhci-hcd
+}
+
+void dcd_set_config (uint8_t rhport, uint8_t config_num)
+{
+  (void) rhport;
+  (void) config_num;
+  // Nothing to do
+}
+
+uint32_t dcd_get_frame_number(uint8_t rhport)
+{
+  (void) rhport;
+  return tusb_hal_millis() & 0x7FF; // 1 ms frame, 11-bit counter
+}
+
+//--------------------------------------------------------------------+
+// Endpoint API
+//--------------------------------------------------------------------+
+bool dcd_edpt_open (uint8_t rhport, tusb_desc_endpoint_t const * desc_edpt)
+{
+  (void) rhport;
+
+  uint8_t const epnum = tu_edpt_number(desc_edpt->bEndpointAddress);
+  uint8_t const dir   = tu_edpt_dir(desc_edpt->bEndpointAddress);
+
+  TU_ASSERT(epnum < 16);
+
+  pthread_mutex_lock(&_dcd.int_mutex);
+  _dcd.xfer[epnum][dir].mps     = desc_edpt->wMaxPacketSize.size;
+  _dcd.xfer[epnum][dir].stalled = false;
+  pthread_mutex_unlock(&_dcd.int_mutex);
+
+  return true;
+}
+
+bool dcd_edpt_xfer (uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t total_bytes)
+{
+  (void) rhport;
+
+  uint8_t const epnum = tu_edpt_number(ep_addr);
+  uint8_t const dir   = tu_edpt_dir(ep_addr);
+
+  pthread_mutex_lock(&_dcd.int_mutex);
+
+  if ( epnum == 0 )
+  {
+    control_xfer(dir, buffer, total_bytes);
+  }
+  else
+  {
+    xfer_td_t* xfer = get_td(epnum, dir);
+
+    xfer->buffer     = buffer;
+    xfer->total_len  = total_bytes;
+    xfer->actual_len = 0;
+    xfer->busy       = true;
+
+    edpt_service(epnum, dir);
+  }
+
+  pthread_mutex_unlock(&_dcd.int_mutex);
+
+  return true;
+}
+
+bool dcd_edpt_stalled (uint8_t rhport, uint8_t ep_addr)
+{
+  (void) rhport;
+
+  // control is never got halted
+  if ( ep_addr == 0 ) return false;
+
+  return get_td(tu_edpt_number(ep_addr), tu_edpt_dir(ep_addr))->stalled;
+}
+
+void dcd_edpt_stall (uint8_t rhport, uint8_t ep_addr)
+{
+  (void) rhport;
+
+  uint8_t const epnum = tu_edpt_number(ep_addr);
+  uint8_t const dir   = tu_edpt_dir(ep_addr);
+
+  pthread_mutex_lock(&_dcd.int_mutex);
+
+  if ( epnum == 0 )
+  {
+    // Stall current control transfer only, then continue with next one
+    xfer_td_t* ctrl = get_td(0, TUSB_DIR_OUT);
+
+    if ( ctrl->urb_list && ctrl->urb_list->setup_sent )
+    {
+      urb_complete(urb_pop(ctrl), TUSB_DIR_OUT, USBIP_EPIPE);
+      control_setup_next();
+    }
+  }
+  else
+  {
+    get_td(epnum, dir)->stalled = true;
+    urb_flush(epnum, dir, USBIP_EPIPE);
+  }
+
+  pthread_mutex_unlock(&_dcd.int_mutex);
+}
+
+void dcd_edpt_clear_stall (uint8_t rhport, uint8_t ep_addr)
+{
+  (void) rhport;
+
+  uint8_t const epnum = tu_edpt_number(ep_addr);
+  if ( epnum == 0 ) return;
+
+  pthread_mutex_lock(&_dcd.int_mutex);
+  get_td(epnum, tu_edpt_dir(ep_addr))->stalled = false;
+  pthread_mutex_unlock(&_dcd.int_mutex);
+}
+
+bool dcd_edpt_busy (uint8_t rhport, uint8_t ep_addr)
+{
+  (void) rhport;
+
+  // USBD shouldn't check control endpoint state
+  if ( 0 == tu_edpt_number(ep_addr) ) return false;
+
+  return get_td(tu_edpt_number(ep_addr), tu_edpt_dir(ep_addr))->busy;
+}
+
+#endif
@@ -46,10 +46,10 @@
 #include "nrf_clock.h"
 
 #include "device/dcd.h"
+#include "dcd_nrf5x.h"
 
 // TODO remove later
 #include "device/usbd.h"
-#include "device/usbd_pvt.h" // to use defer function helper
 
 /*------------------------------------------------------------------*/
 /* MACRO TYPEDEF CONSTANT ENUM
@@ -64,6 +64,12 @@ enum
                       USBD_INTENCLR_ENDISOIN_Msk | USBD_INTEN_ENDISOOUT_Msk
 };
 
+// Bit of a pending EasyDMA request, same layout as EPDATASTATUS: IN endpoints 0-7, OUT endpoints 16-23.
+// Control status stage also needs EasyDMA to be free and is queued the same way.
+#define DMA_REQ_EPIN(n)     (n)
+#define DMA_REQ_EP0STATUS   8
+#define DMA_REQ_EPOUT(n)    (16 + (n))
+
 // Transfer descriptor
 typedef struct
 {
@@ -84,44 +90,83 @@ static struct
   // All 8 endpoints including control IN & OUT (offset 1)
   xfer_td_t xfer[8][2];
 
-  // Only one DMA can run at a time
-  volatile bool dma_running;
+  // Only one DMA can run at a time, others wait in dma_pending (bitmask of DMA_REQ_*)
+  volatile bool     dma_running;
+  volatile uint32_t dma_pending;
 }_dcd;
 
+// Kept across bus reset
+static dcd_nrf5x_stats_t _dcd_stats[8][2];
+
 /*------------------------------------------------------------------*/
 /* Control / Bulk / Interrupt (CBI) Transfer
  *------------------------------------------------------------------*/
 
-// helper to start DMA
-static void edpt_dma_start(volatile uint32_t* reg_startep)
+// Start pending DMA requests until one of them occupies EasyDMA.
+// Must be called from ISR or with USBD interrupt disabled.
+static void dma_schedule(void)
 {
-  // Only one dma can be active
-  if ( _dcd.dma_running )
+  while ( !_dcd.dma_running && _dcd.dma_pending )
   {
-    if (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk)
+    // Lowest bit first: IN before OUT, control before others
+    uint8_t const req = (uint8_t) __CLZ(__RBIT(_dcd.dma_pending));
+    _dcd.dma_pending &= ~TU_BIT(req);
+
+    if ( req == DMA_REQ_EP0STATUS )
     {
-      // If called within ISR, use usbd task to defer later
-      usbd_defer_func( (osal_task_func_t) edpt_dma_start, (void*) reg_startep, true );
-      return;
+      // Status stage does not generate END event, EasyDMA is free right after
+      NRF_USBD->TASKS_EP0STATUS = 1;
     }
     else
     {
-      // Otherwise simply block wait
-      while ( _dcd.dma_running )  { }
+      _dcd.dma_running = true;
+
+      if ( req < DMA_REQ_EPOUT(0) )
+      {
+        NRF_USBD->TASKS_STARTEPIN[req] = 1;
+      }else
+      {
+        NRF_USBD->TASKS_STARTEPOUT[req - DMA_REQ_EPOUT(0)] = 1;
+      }
     }
+
+    __ISB(); __DSB();
   }
+}
+
+// Request DMA for an endpoint whose PTR/MAXCNT are already set.
+// If EasyDMA is busy with another endpoint, the request is started from ISR
+// as soon as the running one ends, without going through usbd task.
+static void edpt_dma_start(uint8_t req)
+{
+  bool const in_isr = (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk);
+  bool const int_enabled = !in_isr && (NVIC->ISER[USBD_IRQn >> 5] & TU_BIT(USBD_IRQn & 0x1F));
 
-  _dcd.dma_running = true;
+  if ( int_enabled ) NVIC_DisableIRQ(USBD_IRQn);
 
-  (*reg_startep) = 1;
-  __ISB(); __DSB();
+  _dcd.dma_pending |= TU_BIT(req);
+  dma_schedule();
+
+  if ( int_enabled ) NVIC_EnableIRQ(USBD_IRQn);
 }
 
-// DMA is complete
+// DMA is complete, start next pending one
 static void edpt_dma_end(void)
 {
   TU_ASSERT(_dcd.dma_running, );
   _dcd.dma_running = false;
+
+  dma_schedule();
+}
+
+// Per-endpoint statistics of packets moved by EasyDMA
+static void edpt_dma_stats(uint8_t epnum, uint8_t dir, uint8_t xact_len)
+{
+  dcd_nrf5x_stats_t* stats = &_dcd_stats[epnum][dir];
+
+  stats->xact_count++;
+  stats->byte_count += xact_len;
+  if ( _dcd.dma_running ) stats->dma_wait_count++;
 }
 
 // helper getting td
@@ -161,7 +206,8 @@ static void xact_out_dma(uint8_t epnum)
   NRF_USBD->EPOUT[epnum].PTR    = (uint32_t) xfer->buffer;
   NRF_USBD->EPOUT[epnum].MAXCNT = xact_len;
 
-  edpt_dma_start(&NRF_USBD->TASKS_STARTEPOUT[epnum]);
+  edpt_dma_stats(epnum, TUSB_DIR_OUT, xact_len);
+  edpt_dma_start(DMA_REQ_EPOUT(epnum));
 
   xfer->buffer     += xact_len;
   xfer->actual_len += xact_len;
@@ -183,12 +229,18 @@ static void xact_in_prepare(uint8_t epnum)
 
   xfer->buffer += xact_len;
 
-  edpt_dma_start(&NRF_USBD->TASKS_STARTEPIN[epnum]);
+  edpt_dma_stats(epnum, TUSB_DIR_IN, xact_len);
+  edpt_dma_start(DMA_REQ_EPIN(epnum));
 }
 
 //--------------------------------------------------------------------+
 // Controller API
 //--------------------------------------------------------------------+
+dcd_nrf5x_stats_t const* dcd_nrf5x_stats (uint8_t ep_addr)
+{
+  return &_dcd_stats[tu_edpt_number(ep_addr)][tu_edpt_dir(ep_addr)];
+}
+
 bool dcd_init (uint8_t rhport)
 {
   (void) rhport;
@@ -270,8 +322,7 @@ bool dcd_edpt_xfer (uint8_t rhport, uint8_t ep_addr, uint8_t * buffer, uint16_t
   if ( epnum == 0 && total_bytes == 0 )
   {
     // Status Phase also require Easy DMA has to be free as well !!!!
-    edpt_dma_start(&NRF_USBD->TASKS_EP0STATUS);
-    edpt_dma_end();
+    edpt_dma_start(DMA_REQ_EP0STATUS);
 
     // The nRF doesn't interrupt on status transmit so we queue up a success response.
     dcd_event_xfer_complete(0, ep_addr, 0, XFER_RESULT_SUCCESS, false);
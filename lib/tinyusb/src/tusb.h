@@ -96,6 +96,10 @@
   #if CFG_TUD_CUSTOM_CLASS
     #include "class/custom/custom_device.h"
   #endif
+
+  #if CFG_TUD_DFU
+    #include "class/dfu/dfu_device.h"
+  #endif
 #endif
 
 
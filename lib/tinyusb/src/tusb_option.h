@@ -61,6 +61,8 @@
 
 #define OPT_MCU_SAMD21        200 ///< MicroChip SAMD21
 #define OPT_MCU_SAMD51        201 ///< MicroChip SAMD51
+
+#define OPT_MCU_LINUX         900 ///< Linux host, device is exported over USB/IP
 /** @} */
 
 /** \defgroup group_supported_os Supported RTOS
@@ -194,6 +196,14 @@
     #define CFG_TUD_HID_MOUSE_BOOT 0
   #endif
 
+  #ifndef CFG_TUD_HID_GENERIC
+  #define CFG_TUD_HID_GENERIC         0
+  #endif
+
+  #ifndef CFG_TUD_HID
+  #define CFG_TUD_HID                 ( CFG_TUD_HID_KEYBOARD + CFG_TUD_HID_MOUSE + CFG_TUD_HID_GENERIC )
+  #endif
+
 #endif // TUSB_OPT_DEVICE_ENABLED
 
 //--------------------------------------------------------------------
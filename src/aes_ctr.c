@@ -0,0 +1,347 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "aes_ctr.h"
+
+#ifndef AES_CTR_USE_ECB
+  #if defined(NRF52832_XXAA) || defined(NRF52840_XXAA)
+    #define AES_CTR_USE_ECB   1
+  #else
+    #define AES_CTR_USE_ECB   0
+  #endif
+#endif
+
+#if AES_CTR_USE_ECB
+#include "nrf.h"
+#include "nrf_soc.h"
+#include "boards.h"
+#endif
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+#define KEYSTREAM_LEN       (AES_CTR_KEYSTREAM_BLOCKS*AES_BLOCK_LEN)
+
+// Blocks encrypted per SoftDevice call
+#define ECB_BATCH           8
+
+#define AES_MIN(a, b)       (((a) < (b)) ? (a) : (b))
+
+static struct
+{
+  bool     active;
+  uint8_t  counter[AES_BLOCK_LEN];      // counter block of next keystream block
+  uint32_t rd;                          // read offset in keystream, write offset is rd + avail
+  uint32_t avail;                       // keystream bytes ready
+
+  uint32_t keystream[KEYSTREAM_LEN/4];  // word aligned for XOR
+
+#if AES_CTR_USE_ECB
+  nrf_ecb_hal_data_t ecb;
+#else
+  uint8_t  round_key[11*AES_BLOCK_LEN];
+#endif
+} _ctr;
+
+/*------------------------------------------------------------------*/
+/* Block encryption
+ *------------------------------------------------------------------*/
+static void counter_next(uint8_t counter[AES_BLOCK_LEN])
+{
+  for(int32_t i=AES_BLOCK_LEN-1; i>=0; i--)
+  {
+    if ( ++counter[i] ) break;
+  }
+}
+
+#if AES_CTR_USE_ECB
+
+static void aes_set_key(uint8_t const key[AES_KEY_LEN])
+{
+  memcpy(_ctr.ecb.key, key, AES_KEY_LEN);
+}
+
+// Encrypt count consecutive counter blocks into out, return number of blocks encrypted
+static uint32_t encrypt_blocks(uint8_t* out, uint32_t count)
+{
+  uint32_t done = 0;
+
+  if ( is_ota() )
+  {
+    // ECB peripheral is owned by SoftDevice
+    uint8_t clear[ECB_BATCH][AES_BLOCK_LEN];
+    nrf_ecb_hal_data_block_t blocks[ECB_BATCH];
+
+    while ( count )
+    {
+      uint32_t const n = AES_MIN(count, ECB_BATCH);
+
+      uint8_t counter[AES_BLOCK_LEN];
+      memcpy(counter, _ctr.counter, AES_BLOCK_LEN);
+
+      for(uint32_t i=0; i<n; i++)
+      {
+        memcpy(clear[i], counter, AES_BLOCK_LEN);
+        counter_next(counter);
+
+        blocks[i].p_key        = (soc_ecb_key_t const*) &_ctr.ecb.key;
+        blocks[i].p_cleartext  = (soc_ecb_cleartext_t const*) &clear[i];
+        blocks[i].p_ciphertext = (soc_ecb_ciphertext_t*) (out + i*AES_BLOCK_LEN);
+      }
+
+      // counter only moves on once its blocks are encrypted
+      if ( sd_ecb_blocks_encrypt((uint8_t) n, blocks) != NRF_SUCCESS ) break;
+
+      memcpy(_ctr.counter, counter, AES_BLOCK_LEN);
+
+      out   += n*AES_BLOCK_LEN;
+      count -= n;
+      done  += n;
+    }
+  }
+  else
+  {
+    NRF_ECB->ECBDATAPTR = (uint32_t) &_ctr.ecb;
+
+    while ( count-- )
+    {
+      memcpy(_ctr.ecb.cleartext, _ctr.counter, AES_BLOCK_LEN);
+      counter_next(_ctr.counter);
+
+      // ECB only errors out when pre-empted by CCM or AAR, retry then
+      do
+      {
+        NRF_ECB->EVENTS_ENDECB   = 0;
+        NRF_ECB->EVENTS_ERRORECB = 0;
+        NRF_ECB->TASKS_STARTECB  = 1;
+
+        while ( !NRF_ECB->EVENTS_ENDECB && !NRF_ECB->EVENTS_ERRORECB ) { }
+      } while ( !NRF_ECB->EVENTS_ENDECB );
+
+      memcpy(out, _ctr.ecb.ciphertext, AES_BLOCK_LEN);
+      out += AES_BLOCK_LEN;
+      done++;
+    }
+  }
+
+  return done;
+}
+
+#else
+
+// Software AES-128 encryption (FIPS-197), byte oriented to stay small
+static const uint8_t _sbox[256] =
+{
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static inline uint8_t xtime(uint8_t x)
+{
+  return (uint8_t) ((x << 1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+static void aes_set_key(uint8_t const key[AES_KEY_LEN])
+{
+  uint8_t* rk = _ctr.round_key;
+  uint8_t rcon = 1;
+
+  memcpy(rk, key, AES_KEY_LEN);
+
+  for(uint32_t i=AES_KEY_LEN; i<sizeof(_ctr.round_key); i+=4)
+  {
+    uint8_t t[4] = { rk[i-4], rk[i-3], rk[i-2], rk[i-1] };
+
+    if ( (i % AES_KEY_LEN) == 0 )
+    {
+      // RotWord, SubWord, Rcon
+      uint8_t const t0 = t[0];
+
+      t[0] = _sbox[t[1]] ^ rcon;
+      t[1] = _sbox[t[2]];
+      t[2] = _sbox[t[3]];
+      t[3] = _sbox[t0];
+
+      rcon = xtime(rcon);
+    }
+
+    for(uint32_t j=0; j<4; j++) rk[i+j] = rk[i+j-AES_KEY_LEN] ^ t[j];
+  }
+}
+
+static void aes_encrypt(uint8_t out[AES_BLOCK_LEN], uint8_t const in[AES_BLOCK_LEN])
+{
+  uint8_t const* rk = _ctr.round_key;
+  uint8_t s[AES_BLOCK_LEN];
+  uint8_t t[AES_BLOCK_LEN];
+
+  for(uint32_t i=0; i<AES_BLOCK_LEN; i++) s[i] = in[i] ^ rk[i];
+
+  for(uint32_t round=1; round<=10; round++)
+  {
+    // SubBytes and ShiftRows, state is column major
+    for(uint32_t c=0; c<4; c++)
+    {
+      for(uint32_t r=0; r<4; r++) t[4*c + r] = _sbox[s[4*((c + r) & 3) + r]];
+    }
+
+    // MixColumns, except in last round
+    if ( round < 10 )
+    {
+      for(uint32_t c=0; c<4; c++)
+      {
+        uint8_t const* a = t + 4*c;
+        uint8_t const x = a[0] ^ a[1] ^ a[2] ^ a[3];
+
+        s[4*c + 0] = a[0] ^ x ^ xtime(a[0] ^ a[1]);
+        s[4*c + 1] = a[1] ^ x ^ xtime(a[1] ^ a[2]);
+        s[4*c + 2] = a[2] ^ x ^ xtime(a[2] ^ a[3]);
+        s[4*c + 3] = a[3] ^ x ^ xtime(a[3] ^ a[0]);
+      }
+    }else
+    {
+      memcpy(s, t, AES_BLOCK_LEN);
+    }
+
+    for(uint32_t i=0; i<AES_BLOCK_LEN; i++) s[i] ^= rk[16*round + i];
+  }
+
+  memcpy(out, s, AES_BLOCK_LEN);
+}
+
+static uint32_t encrypt_blocks(uint8_t* out, uint32_t count)
+{
+  for(uint32_t i=0; i<count; i++)
+  {
+    aes_encrypt(out, _ctr.counter);
+    counter_next(_ctr.counter);
+    out += AES_BLOCK_LEN;
+  }
+
+  return count;
+}
+
+#endif
+
+/*------------------------------------------------------------------*/
+/* Internal
+ *------------------------------------------------------------------*/
+// Generate keystream into every free block of the buffer. Keystream is produced in whole blocks
+// and consumed in bytes, so write offset is always block aligned. Return false if block
+// encryption failed, buffer then holds what was generated before.
+static bool keystream_fill(void)
+{
+  uint8_t* keystream = (uint8_t*) _ctr.keystream;
+
+  uint32_t wr     = (_ctr.rd + _ctr.avail) % KEYSTREAM_LEN;
+  uint32_t blocks = (KEYSTREAM_LEN - _ctr.avail) / AES_BLOCK_LEN;
+
+  while ( blocks )
+  {
+    uint32_t const n = AES_MIN(blocks, (KEYSTREAM_LEN - wr) / AES_BLOCK_LEN);
+    uint32_t const done = encrypt_blocks(keystream + wr, n);
+
+    _ctr.avail += done*AES_BLOCK_LEN;
+    blocks     -= done;
+    wr          = (wr + done*AES_BLOCK_LEN) % KEYSTREAM_LEN;
+
+    if ( done < n ) return false;
+  }
+
+  return true;
+}
+
+/*------------------------------------------------------------------*/
+/* API
+ *------------------------------------------------------------------*/
+bool aes_ctr_start(uint8_t const key[AES_KEY_LEN], uint8_t const counter[AES_BLOCK_LEN])
+{
+  memset(&_ctr, 0, sizeof(_ctr));
+
+  aes_set_key(key);
+  memcpy(_ctr.counter, counter, AES_BLOCK_LEN);
+  _ctr.active = true;
+
+  // a partly filled buffer is topped up later
+  return keystream_fill() || _ctr.avail;
+}
+
+bool aes_ctr_crypt(uint8_t* data, uint32_t len)
+{
+  uint8_t const* keystream = (uint8_t const*) _ctr.keystream;
+
+  while ( len )
+  {
+    if ( !_ctr.avail && !keystream_fill() && !_ctr.avail ) return false;
+
+    uint32_t const n = AES_MIN(AES_MIN(len, _ctr.avail), KEYSTREAM_LEN - _ctr.rd);
+    uint8_t const* ks = keystream + _ctr.rd;
+
+    // DFU packets are whole words
+    if ( ((uintptr_t) data | _ctr.rd | n) & 3 )
+    {
+      for(uint32_t i=0; i<n; i++) data[i] ^= ks[i];
+    }else
+    {
+      uint32_t* data32 = (uint32_t*) data;
+      uint32_t const* ks32 = (uint32_t const*) ks;
+
+      for(uint32_t i=0; i<n/4; i++) data32[i] ^= ks32[i];
+    }
+
+    data       += n;
+    len        -= n;
+    _ctr.rd     = (_ctr.rd + n) % KEYSTREAM_LEN;
+    _ctr.avail -= n;
+  }
+
+  return true;
+}
+
+void aes_ctr_task(void)
+{
+  // failure is reported by aes_ctr_crypt() if keystream is still missing then
+  if ( _ctr.active && (KEYSTREAM_LEN - _ctr.avail >= AES_BLOCK_LEN) ) (void) keystream_fill();
+}
+
+void aes_ctr_stop(void)
+{
+  memset(&_ctr, 0, sizeof(_ctr));
+}
@@ -0,0 +1,66 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef AES_CTR_H_
+#define AES_CTR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define AES_BLOCK_LEN             16
+#define AES_KEY_LEN               16
+
+// Keystream generated ahead of data, a few DFU packets worth
+#ifndef AES_CTR_KEYSTREAM_BLOCKS
+#define AES_CTR_KEYSTREAM_BLOCKS  32
+#endif
+
+/* AES-128 CTR (NIST SP 800-38A) over a single stream, counter block is incremented as a 128-bit
+ * big endian integer. Block encryption uses the ECB peripheral on nRF52 (through the SoftDevice
+ * when it is enabled) and a software AES elsewhere, e.g for host test.
+ */
+
+// Start a new stream, keystream is generated right away to fill the buffer.
+// Return false if no keystream could be generated
+bool aes_ctr_start(uint8_t const key[AES_KEY_LEN], uint8_t const counter[AES_BLOCK_LEN]);
+
+// XOR data in place with next len bytes of keystream, generating more if buffer runs dry.
+// Return false if keystream could not be generated, data is then only partly processed
+bool aes_ctr_crypt(uint8_t* data, uint32_t len);
+
+// Top up keystream buffer, called from main loop between packets
+void aes_ctr_task(void);
+
+// Wipe key and keystream
+void aes_ctr_stop(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* AES_CTR_H_ */
@@ -33,6 +33,9 @@
 #define SCHED_MAX_EVENT_DATA_SIZE           sizeof(app_timer_event_t)        /**< Maximum size of scheduler events. */
 #define SCHED_QUEUE_SIZE                    30                               /**< Maximum number of events in the scheduler queue. */
 
+// Longest PWM period used for LEDs is 256 us
+#define PWM_STOP_TIMEOUT_US                 1000
+
 #if defined(LED_NEOPIXEL) || defined(LED_RGB_RED_PIN)
   void neopixel_init(void);
   void neopixel_write(uint8_t *pixels);
@@ -87,17 +90,10 @@ void board_init(void)
 
   // Init app timer (use RTC1)
   app_timer_init();
-
-  // Configure Systick for led blinky
-  NVIC_SetPriority(SysTick_IRQn, 7);
-  SysTick_Config(SystemCoreClock/1000);
 }
 
 void board_teardown(void)
 {
-  // Disable systick, turn off LEDs
-  SysTick->CTRL = 0;
-
   // Disable and reset PWM for LEDs
   led_pwm_teardown();
 
@@ -117,15 +113,6 @@ void board_teardown(void)
   NRF_CLOCK->TASKS_LFCLKSTOP = 1UL;
 }
 
-static uint32_t _systick_count = 0;
-void SysTick_Handler(void)
-{
-  _systick_count++;
-
-  led_tick();
-}
-
-
 uint32_t tusb_hal_millis(void)
 {
   return ( ( ((uint64_t)app_timer_cnt_get())*1000*(APP_TIMER_CONFIG_RTC_FREQUENCY+1)) / APP_TIMER_CLOCK_FREQ );
@@ -133,8 +120,29 @@ uint32_t tusb_hal_millis(void)
 
 void pwm_teardown(NRF_PWM_Type* pwm )
 {
-  pwm->TASKS_SEQSTART[0] = 0;
+  // Stop at the end of current PWM period before disabling. STOPPED is only
+  // generated if a sequence is playing, the wait is bounded by a few periods.
+  if ( pwm->ENABLE )
+  {
+    pwm->EVENTS_STOPPED = 0;
+    pwm->TASKS_STOP     = 1;
+
+    for ( uint32_t i = 0; (i < PWM_STOP_TIMEOUT_US) && !pwm->EVENTS_STOPPED; i++ )
+    {
+      NRFX_DELAY_US(1);
+    }
+  }
+
+  // Drop looping sequence config so that application gets PWM in its reset state
+  pwm->SHORTS            = 0;
+  pwm->LOOP              = 0;
   pwm->ENABLE            = 0;
+  pwm->INTEN             = 0;
+
+  pwm->EVENTS_STOPPED    = 0;
+  pwm->EVENTS_SEQEND[0]  = 0;
+  pwm->EVENTS_SEQEND[1]  = 0;
+  pwm->EVENTS_LOOPSDONE  = 0;
 
   pwm->PSEL.OUT[0] = 0xFFFFFFFF;
   pwm->PSEL.OUT[1] = 0xFFFFFFFF;
@@ -145,87 +153,140 @@ void pwm_teardown(NRF_PWM_Type* pwm )
   pwm->COUNTERTOP  = 0x3FF;
   pwm->PRESCALER   = 0;
   pwm->DECODER     = 0;
-  pwm->LOOP        = 0;
-  pwm->SEQ[0].PTR  = 0;
-  pwm->SEQ[0].CNT  = 0;
+
+  for ( uint8_t i = 0; i < 2; i++ )
+  {
+    pwm->SEQ[i].PTR      = 0;
+    pwm->SEQ[i].CNT      = 0;
+    pwm->SEQ[i].REFRESH  = 0;
+    pwm->SEQ[i].ENDDELAY = 0;
+  }
 }
 
-static uint16_t led_duty_cycles[PWM0_CH_NUM] = { 0 };
+//--------------------------------------------------------------------+
+// LED
+//--------------------------------------------------------------------+
+// The breathing pattern is precomputed once into a PWM sequence which the
+// PWM peripheral plays back in a loop by itself (LOOPSDONE -> SEQSTART0).
+// Changing the blink rate only changes how many PWM periods each step is
+// held (SEQ.REFRESH), no CPU time is spent while the pattern is playing.
+#define LED_PWM_PERIOD_US   256 // 1 MHz PWM clock, COUNTERTOP = 0xff
+#define LED_SEQ_STEPS       64  // steps per breathing cycle
+
+#define LED_PRIMARY_PEAK    0x4f
+#define LED_SECONDARY_PEAK  0x8f
 
 #if LEDS_NUMBER > PWM0_CH_NUM
 #error "Only " PWM0_CH_NUM " concurrent status LEDs are supported."
 #endif
 
+// PWM0 runs the primary LED (channel 0) and the optional RGB LED (channel 1-3)
+static uint16_t led_primary_seq[LED_SEQ_STEPS][PWM0_CH_NUM];
+
+#ifdef LED_SECONDARY_PIN
+// Secondary LED has its own cycle length, it is played by PWM2
+static uint16_t led_secondary_seq[LED_SEQ_STEPS];
+#endif
+
+// Fill a triangle (breathing) envelope into one channel of a sequence
+static void led_seq_fill(uint16_t* seq, uint32_t stride, uint16_t peak)
+{
+  uint32_t const half_cycle = LED_SEQ_STEPS / 2;
+
+  for ( uint32_t i = 0; i < LED_SEQ_STEPS; i++ )
+  {
+    uint32_t cycle = (i > half_cycle) ? (LED_SEQ_STEPS - i) : i;
+    uint16_t duty_cycle = peak * cycle / half_cycle;
+
+    #if LED_STATE_ON == 1
+    duty_cycle = 0xff - duty_cycle;
+    #endif
+
+    seq[i*stride] = duty_cycle;
+  }
+}
+
 void led_pwm_init(uint32_t led_index, uint32_t led_pin)
 {
   NRF_PWM_Type* pwm    = NRF_PWM0;
+  uint32_t channel     = led_index;
+  uint16_t const* seq  = &led_primary_seq[0][0];
+  uint32_t seq_cnt     = NRF_PWM_VALUES_LENGTH(led_primary_seq);
+  uint32_t decoder     = PWM_DECODER_LOAD_Individual;
+
+#ifdef LED_SECONDARY_PIN
+  if ( led_index == LED_SECONDARY )
+  {
+    pwm     = NRF_PWM2;
+    channel = 0;
+    seq     = led_secondary_seq;
+    seq_cnt = NRF_PWM_VALUES_LENGTH(led_secondary_seq);
+    decoder = PWM_DECODER_LOAD_Common;
+
+    led_seq_fill(led_secondary_seq, 1, LED_SECONDARY_PEAK);
+  }
+  else
+#endif
+  if ( led_index == LED_PRIMARY )
+  {
+    led_seq_fill(&led_primary_seq[0][LED_PRIMARY], PWM0_CH_NUM, LED_PRIMARY_PEAK);
+  }
 
   pwm->ENABLE = 0;
 
   nrf_gpio_cfg_output(led_pin);
   nrf_gpio_pin_write(led_pin, 1 - LED_STATE_ON);
 
-  pwm->PSEL.OUT[led_index] = led_pin;
+  pwm->PSEL.OUT[channel] = led_pin;
 
   pwm->MODE            = PWM_MODE_UPDOWN_Up;
   pwm->COUNTERTOP      = 0xff;
   pwm->PRESCALER       = PWM_PRESCALER_PRESCALER_DIV_16;
-  pwm->DECODER         = PWM_DECODER_LOAD_Individual;
-  pwm->LOOP            = 0;
+  pwm->DECODER         = decoder;
 
-  pwm->SEQ[0].PTR      = (uint32_t) (led_duty_cycles);
-  pwm->SEQ[0].CNT      = 4; // default mode is Individual --> count must be 4
-  pwm->SEQ[0].REFRESH  = 0;
-  pwm->SEQ[0].ENDDELAY = 0;
+  // Play SEQ0 then SEQ1 (both are the whole pattern), then restart forever
+  pwm->LOOP            = 1;
+  pwm->SHORTS          = PWM_SHORTS_LOOPSDONE_SEQSTART0_Msk;
+
+  for ( uint8_t i = 0; i < 2; i++ )
+  {
+    pwm->SEQ[i].PTR      = (uint32_t) seq;
+    pwm->SEQ[i].CNT      = seq_cnt;
+    pwm->SEQ[i].REFRESH  = 0;
+    pwm->SEQ[i].ENDDELAY = 0;
+  }
 
   pwm->ENABLE = 1;
 
   pwm->EVENTS_SEQEND[0] = 0;
-//  pwm->TASKS_SEQSTART[0] = 1;
+  pwm->TASKS_SEQSTART[0] = 1;
 }
 
 void led_pwm_teardown(void)
 {
   pwm_teardown(NRF_PWM0);
+#ifdef LED_SECONDARY_PIN
+  pwm_teardown(NRF_PWM2);
+#endif
 }
 
+// Set a constant duty cycle (RGB LED) for every step of the running sequence
 void led_pwm_duty_cycle(uint32_t led_index, uint16_t duty_cycle)
 {
-  led_duty_cycles[led_index] = duty_cycle;
-  nrf_pwm_event_clear(NRF_PWM0, NRF_PWM_EVENT_SEQEND0);
-  nrf_pwm_task_trigger(NRF_PWM0, NRF_PWM_TASK_SEQSTART0);
+  for ( uint32_t i = 0; i < LED_SEQ_STEPS; i++ )
+  {
+    led_primary_seq[i][led_index] = duty_cycle;
+  }
 }
 
-static uint32_t primary_cycle_length;
-#ifdef LED_SECONDARY_PIN
-static uint32_t secondary_cycle_length;
-#endif
-void led_tick() {
-    uint32_t millis = _systick_count;
-
-    uint32_t cycle = millis % primary_cycle_length;
-    uint32_t half_cycle = primary_cycle_length / 2;
-    if (cycle > half_cycle) {
-        cycle = primary_cycle_length - cycle;
-    }
-    uint16_t duty_cycle = 0x4f * cycle / half_cycle;
-    #if LED_STATE_ON == 1
-    duty_cycle = 0xff - duty_cycle;
-    #endif
-    led_pwm_duty_cycle(LED_PRIMARY, duty_cycle);
+// Change the breathing cycle length, takes effect when the current sequence ends
+static void led_pwm_cycle_length(NRF_PWM_Type* pwm, uint32_t ms)
+{
+  uint32_t refresh = (ms * 1000) / (LED_SEQ_STEPS * LED_PWM_PERIOD_US);
+  if ( refresh ) refresh--;
 
-    #ifdef LED_SECONDARY_PIN
-    cycle = millis % secondary_cycle_length;
-    half_cycle = secondary_cycle_length / 2;
-    if (cycle > half_cycle) {
-        cycle = secondary_cycle_length - cycle;
-    }
-    duty_cycle = 0x8f * cycle / half_cycle;
-    #if LED_STATE_ON == 1
-    duty_cycle = 0xff - duty_cycle;
-    #endif
-    led_pwm_duty_cycle(LED_SECONDARY, duty_cycle);
-    #endif
+  pwm->SEQ[0].REFRESH = refresh;
+  pwm->SEQ[1].REFRESH = refresh;
 }
 
 static uint32_t rgb_color;
@@ -237,40 +298,40 @@ void led_state(uint32_t state)
     switch (state) {
         case STATE_USB_MOUNTED:
           new_rgb_color = 0x00ff00;
-          primary_cycle_length = 3000;
+          led_pwm_cycle_length(NRF_PWM0, 3000);
           break;
 
         case STATE_BOOTLOADER_STARTED:
         case STATE_USB_UNMOUNTED:
           new_rgb_color = 0xff0000;
-          primary_cycle_length = 300;
+          led_pwm_cycle_length(NRF_PWM0, 300);
           break;
 
         case STATE_WRITING_STARTED:
           temp_color = 0xff0000;
-          primary_cycle_length = 100;
+          led_pwm_cycle_length(NRF_PWM0, 100);
           break;
 
         case STATE_WRITING_FINISHED:
           // Empty means to unset any temp colors.
-          primary_cycle_length = 3000;
+          led_pwm_cycle_length(NRF_PWM0, 3000);
           break;
 
         case STATE_BLE_CONNECTED:
           new_rgb_color = 0x0000ff;
           #ifdef LED_SECONDARY_PIN
-          secondary_cycle_length = 3000;
+          led_pwm_cycle_length(NRF_PWM2, 3000);
           #else
-          primary_cycle_length = 3000;
+          led_pwm_cycle_length(NRF_PWM0, 3000);
           #endif
           break;
 
         case STATE_BLE_DISCONNECTED:
           new_rgb_color = 0xff00ff;
           #ifdef LED_SECONDARY_PIN
-          secondary_cycle_length = 300;
+          led_pwm_cycle_length(NRF_PWM2, 300);
           #else
-          primary_cycle_length = 300;
+          led_pwm_cycle_length(NRF_PWM0, 300);
           #endif
           break;
 
@@ -307,7 +368,32 @@ void led_state(uint32_t state)
 
 #define BYTE_PER_PIXEL  3
 
-static uint16_t pixels_pattern[NEOPIXELS_NUMBER*BYTE_PER_PIXEL * 8 + 2];
+// The two additional halfwords at the end are needed to reset the sequence
+#define NEOPIXEL_PATTERN_LEN    (NEOPIXELS_NUMBER*BYTE_PER_PIXEL*8 + 2)
+
+// Two transfers (current and queued) at 1.25 us per halfword, with margin
+#define NEOPIXEL_TIMEOUT_US     (NEOPIXEL_PATTERN_LEN*2*2)
+
+// Enough for all status colors used by led_state() plus black
+#define NEOPIXEL_CACHE_SIZE     6
+
+// Patterns are generated once per color and never modified afterwards,
+// EasyDMA can therefore read them while the CPU continues running.
+typedef struct
+{
+  uint32_t rgb;
+  uint16_t pattern[NEOPIXEL_PATTERN_LEN];
+} neopixel_pattern_t;
+
+static neopixel_pattern_t _neopixel_cache[NEOPIXEL_CACHE_SIZE];
+static uint8_t _neopixel_cache_count = 0;
+static uint8_t _neopixel_cache_next  = 0;
+
+// pattern currently sent by DMA and the one to send after it (NULL if none)
+static uint16_t const * volatile _neopixel_playing = NULL;
+static uint16_t const * volatile _neopixel_pending = NULL;
+
+static void neopixel_seqend(void);
 
 // use PWM1 for neopixel
 void neopixel_init(void)
@@ -339,12 +425,14 @@ void neopixel_init(void)
   nrf_pwm_seq_refresh_set(pwm, 0, 0);
   nrf_pwm_seq_end_delay_set(pwm, 0, 0);
 
-  // The Neopixel implementation is a blocking algorithm. DMA
-  // allows for non-blocking operation. To "simulate" a blocking
-  // operation we enable the interruption for the end of sequence
-  // and block the execution thread until the event flag is set by
-  // the peripheral.
-  //    pwm->INTEN |= (PWM_INTEN_SEQEND0_Enabled<<PWM_INTEN_SEQEND0_Pos);
+  // Writes are non-blocking: the end of sequence interrupt marks the
+  // transfer as done and starts the next pattern if one was queued meanwhile.
+  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+  nrf_pwm_int_enable(pwm, NRF_PWM_INT_SEQEND0_MASK);
+
+  NVIC_SetPriority(PWM1_IRQn, 7);
+  NVIC_ClearPendingIRQ(PWM1_IRQn);
+  NVIC_EnableIRQ(PWM1_IRQn);
 
   // PSEL must be configured before enabling PWM
   nrf_pwm_pins_set(pwm, (uint32_t[] ) { LED_NEOPIXEL, 0xFFFFFFFFUL, 0xFFFFFFFFUL, 0xFFFFFFFFUL });
@@ -357,50 +445,139 @@ void neopixel_teardown(void)
 {
   uint8_t rgb[3] = { 0, 0, 0 };
 
-  NRFX_DELAY_US(50);  // wait for previous write is complete
-
   neopixel_write(rgb);
-  NRFX_DELAY_US(50);  // wait for this write
+
+  // End of sequence is polled rather than left to the ISR, which may be masked
+  // at this point. Wait is bounded so that a missed SEQEND cannot hang the boot.
+  NVIC_DisableIRQ(PWM1_IRQn);
+  nrf_pwm_int_disable(NRF_PWM1, NRF_PWM_INT_SEQEND0_MASK);
+
+  for ( uint32_t i = 0; (i < NEOPIXEL_TIMEOUT_US) && (_neopixel_playing || _neopixel_pending); i++ )
+  {
+    neopixel_seqend();
+    NRFX_DELAY_US(1);
+  }
+
+  _neopixel_playing = NULL;
+  _neopixel_pending = NULL;
 
   pwm_teardown(NRF_PWM1);
 }
 
-// write 3 bytes color RGB to built-in neopixel
-void neopixel_write (uint8_t *pixels)
+static void neopixel_start(uint16_t const* pattern)
+{
+  NRF_PWM_Type* pwm = NRF_PWM1;
+
+  _neopixel_playing = pattern;
+
+  nrf_pwm_seq_ptr_set(pwm, 0, pattern);
+  nrf_pwm_seq_cnt_set(pwm, 0, NEOPIXEL_PATTERN_LEN);
+  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+  nrf_pwm_task_trigger(pwm, NRF_PWM_TASK_SEQSTART0);
+}
+
+// Complete the transfer and start the queued one, if any
+static void neopixel_seqend(void)
 {
+  NRF_PWM_Type* pwm = NRF_PWM1;
+
+  if ( nrf_pwm_event_check(pwm, NRF_PWM_EVENT_SEQEND0) )
+  {
+    nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+    _neopixel_playing = NULL;
+
+    uint16_t const* pattern = _neopixel_pending;
+    if ( pattern )
+    {
+      _neopixel_pending = NULL;
+      neopixel_start(pattern);
+    }
+  }
+}
+
+void PWM1_IRQHandler(void)
+{
+  neopixel_seqend();
+}
+
+// Return the (cached) bit pattern for a color, generating it on first use
+static uint16_t const* neopixel_pattern_get(uint8_t const *pixels)
+{
+  uint32_t const rgb = (pixels[2] << 16) | (pixels[1] << 8) | pixels[0];
+
+  for ( uint8_t i = 0; i < _neopixel_cache_count; i++ )
+  {
+    if ( _neopixel_cache[i].rgb == rgb ) return _neopixel_cache[i].pattern;
+  }
+
+  neopixel_pattern_t* entry;
+
+  if ( _neopixel_cache_count < NEOPIXEL_CACHE_SIZE )
+  {
+    entry = &_neopixel_cache[_neopixel_cache_count++];
+  }
+  else
+  {
+    // Evict round robin, but never a pattern that DMA may still read
+    do
+    {
+      entry = &_neopixel_cache[_neopixel_cache_next];
+      _neopixel_cache_next = (_neopixel_cache_next + 1) % NEOPIXEL_CACHE_SIZE;
+    } while ( entry->pattern == _neopixel_playing || entry->pattern == _neopixel_pending );
+  }
+
+  entry->rgb = rgb;
+
   // convert RGB to GRB
   uint8_t grb[BYTE_PER_PIXEL] = {pixels[1], pixels[2], pixels[0]};
+  uint16_t* pattern = entry->pattern;
   uint16_t pos = 0;    // bit position
 
-  // Set all neopixel to same value
-  for (uint16_t n = 0; n < NEOPIXELS_NUMBER; n++ )
+  // First pixel is generated bit by bit, other pixels are the same value
+  for(uint8_t c = 0; c < BYTE_PER_PIXEL; c++)
   {
-    for(uint8_t c = 0; c < BYTE_PER_PIXEL; c++)
-    {
-      uint8_t const pix = grb[c];
+    uint8_t const pix = grb[c];
 
-      for ( uint8_t mask = 0x80; mask > 0; mask >>= 1 )
-      {
-        pixels_pattern[pos] = (pix & mask) ? MAGIC_T1H : MAGIC_T0H;
-        pos++;
-      }
+    for ( uint8_t mask = 0x80; mask > 0; mask >>= 1 )
+    {
+      pattern[pos] = (pix & mask) ? MAGIC_T1H : MAGIC_T0H;
+      pos++;
     }
   }
 
+  for (uint16_t n = 1; n < NEOPIXELS_NUMBER; n++ )
+  {
+    memcpy(pattern + pos, pattern, BYTE_PER_PIXEL*8*2);
+    pos += BYTE_PER_PIXEL*8;
+  }
+
   // Zero padding to indicate the end of sequence
-  pixels_pattern[pos++] = 0 | (0x8000);    // Seq end
-  pixels_pattern[pos++] = 0 | (0x8000);    // Seq end
+  pattern[pos++] = 0 | (0x8000);    // Seq end
+  pattern[pos++] = 0 | (0x8000);    // Seq end
 
-  NRF_PWM_Type* pwm = NRF_PWM1;
+  return pattern;
+}
 
-  nrf_pwm_seq_ptr_set(pwm, 0, pixels_pattern);
-  nrf_pwm_seq_cnt_set(pwm, 0, sizeof(pixels_pattern)/2);
-  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
-  nrf_pwm_task_trigger(pwm, NRF_PWM_TASK_SEQSTART0);
+// write 3 bytes color RGB to built-in neopixel, returns without waiting for the transfer
+void neopixel_write (uint8_t *pixels)
+{
+  // keep PWM1 ISR from completing a transfer while we pick the cache entry
+  // and decide whether to start now or queue the pattern
+  nrf_pwm_int_disable(NRF_PWM1, NRF_PWM_INT_SEQEND0_MASK);
 
-  // blocking wait for sequence complete
-  while( !nrf_pwm_event_check(pwm, NRF_PWM_EVENT_SEQEND0) ) {}
-  nrf_pwm_event_clear(pwm, NRF_PWM_EVENT_SEQEND0);
+  uint16_t const* pattern = neopixel_pattern_get(pixels);
+
+  if ( _neopixel_playing )
+  {
+    // latest color wins, it is sent as soon as the current transfer ends
+    _neopixel_pending = pattern;
+  }
+  else
+  {
+    neopixel_start(pattern);
+  }
+
+  nrf_pwm_int_enable(NRF_PWM1, NRF_PWM_INT_SEQEND0_MASK);
 }
 #endif
 
@@ -86,7 +86,6 @@ void led_pwm_teardown(void);
 void led_pwm_disable(uint32_t led_index);
 void led_pwm_enable(uint32_t led_index);
 void led_state(uint32_t state);
-void led_tick(void);
 
 //--------------------------------------------------------------------+
 // BUTTONS
@@ -100,6 +99,25 @@ void button_init(uint32_t pin);
 bool button_pressed(uint32_t pin);
 
 bool is_ota(void);
+bool is_verify_only(void);
+
+//--------------------------------------------------------------------+
+// BOOT STATISTICS
+//--------------------------------------------------------------------+
+enum {
+  BOOT_PHASE_BOARD_INIT = 0,
+  BOOT_PHASE_BOOTLOADER_INIT,
+  BOOT_PHASE_DFU_INIT,
+  BOOT_PHASE_COUNT
+};
+
+typedef struct {
+  uint32_t reset_reason;                // RESETREAS at startup, accumulated since last cleared by the application
+  uint32_t boot_count;                  // bootloader starts since no init RAM was last lost (power-on or overwritten)
+  uint32_t phase_end_us[BOOT_PHASE_COUNT]; // end of each phase since reset, 0 if not reached
+} boot_stats_t;
+
+boot_stats_t const* boot_stats_get(void);
 
 //--------------------------------------------------------------------+
 // DEBUG
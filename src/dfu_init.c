@@ -61,10 +61,9 @@
  *                     In this template, a simple CRC check is carried out.
  *                     The CRC check can be replaced with other mechanisms, like signing.
  *
- * @note This module does not support security features such as image signing, but the 
- *       implementation allows for such extension.
- *       If the init packet is signed by a trusted source, it must be decrypted before it can be
- *       processed.
+ * @note When built with DFU_PUBLIC_KEY_FILE, only init packets carrying a valid ECDSA P-256
+ *       signature made with the matching private key are accepted. The signed init packet holds
+ *       the SHA-256 of the image, which is checked in stage 2, and is signed for one image type.
  */
 
 #include "dfu_init.h"
@@ -73,6 +72,9 @@
 #include <dfu_types.h>
 #include "nrf_error.h"
 #include "crc16.h"
+#include "sha256.h"
+#include "p256.h"
+#include "aes_ctr.h"
 
 /* ADAFRUIT
  * - All firmware init data must has Device Type ADAFRUIT_DEVICE_TYPE (nrf52832 and nrf52840)
@@ -93,19 +95,52 @@
 
 
 
+/* Extended init packet, same layouts as legacy nrfutil
+ * - CRC16  : crc16 (2)
+ * - Hash   : DFU_INIT_PACKET_USES_HASH (4) | firmware length (4) | SHA-256 of firmware (32)
+ * - Signed : DFU_INIT_PACKET_USES_ECDS (4) | firmware length (4) | SHA-256 of firmware (32) |
+ *            ECDSA P-256 signature (64) of the SHA-256 of the whole init packet before it followed
+ *            by the image type byte of the START packet (DFU_UPDATE_SD/BL/APP), so that an image
+ *            signed as an application cannot be installed as SoftDevice or Bootloader
+ * An encrypted image has DFU_INIT_PACKET_EXT_ENCRYPTED set in the hash or signed packet id, with
+ * the AES-128 CTR initial counter block (16) right after the SHA-256 of the plain text firmware.
+ */
+#define DFU_INIT_PACKET_USES_HASH           1                       //< Extended packet id of an init packet carrying a SHA-256 of the image. */
+#define DFU_INIT_PACKET_USES_ECDS           2                       //< Extended packet id of a signed init packet carrying a SHA-256 of the image. */
+#define DFU_INIT_PACKET_EXT_ENCRYPTED       0x100                   //< Extended packet id flag of an image encrypted with AES-128 CTR. */
+#define DFU_INIT_PACKET_EXT_HASH_LENGTH     (4 + 4 + SHA256_DIGEST_LEN) //< Length of the extended init packet carrying a SHA-256. */
+#define DFU_INIT_PACKET_EXT_ECDS_LENGTH     (DFU_INIT_PACKET_EXT_HASH_LENGTH + P256_SIGNATURE_LEN) //< Length of the extended init packet carrying a signed SHA-256. */
+
 #define DFU_INIT_PACKET_EXT_LENGTH_MIN      2                       //< Minimum length of the extended init packet. The extended init packet may contain a CRC, a HASH, or other data. This value must be changed according to the requirements of the system. The template uses a minimum value of two in order to hold a CRC. */
-#define DFU_INIT_PACKET_EXT_LENGTH_MAX      10                      //< Maximum length of the extended init packet. The extended init packet may contain a CRC, a HASH, or other data. This value must be changed according to the requirements of the system. The template uses a maximum value of 10 in order to hold a CRC and any padded data on transport layer without overflow. */
+#define DFU_INIT_PACKET_EXT_LENGTH_MAX      (DFU_INIT_PACKET_EXT_ECDS_LENGTH + AES_BLOCK_LEN) //< Maximum length of the extended init packet. The extended init packet may contain a CRC, a HASH, or other data. This value must be changed according to the requirements of the system. Sized to hold a signed hash with a counter block, a CRC with padding on transport layer fits as well. */
 
 static uint8_t m_extended_packet[DFU_INIT_PACKET_EXT_LENGTH_MAX];   //< Data array for storage of the extended data received. The extended data follows the normal init data of type \ref dfu_init_packet_t. Extended data can be used for a CRC, hash, signature, or other data. */
 static uint8_t m_extended_packet_length;                            //< Length of the extended data received with init packet. */
 
+static sha256_context_t m_image_sha256;                             //< SHA-256 of the image, updated as data packets are received. */
+static uint8_t          m_image_digest[SHA256_DIGEST_LEN];          //< SHA-256 of the received image, valid once image is post-validated. */
+static uint16_t         m_image_crc;                                //< CRC16 of the image, updated as data packets are received. */
+static uint32_t         m_image_len;                                //< Number of image bytes hashed so far. */
+static bool             m_image_encrypted;                          //< Image data is deciphered as it is received. */
+
+#ifdef DFU_PUBLIC_KEY_FILE
+static uint8_t const    m_public_key[P256_PUBLIC_KEY_LEN] =         //< Public key of the image signer, X | Y big endian. */
+{
+    #include DFU_PUBLIC_KEY_FILE
+};
+#endif
+
+#ifdef DFU_AES_KEY_FILE
+static uint8_t const    m_aes_key[AES_KEY_LEN] =                    //< Key of encrypted images. */
+{
+    #include DFU_AES_KEY_FILE
+};
+#endif
+
 
 uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uint8_t image_type)
 {
     uint32_t i = 0;
-    
-    // In order to support signing or encryption then any init packet decryption function / library
-    // should be called from here or implemented at this location.
 
     // Length check to ensure valid data are parsed.
     if (init_data_len < sizeof(dfu_init_packet_t))
@@ -116,23 +151,78 @@ uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uin
     // Current template uses clear text data so they can be casted for pre-check.
     dfu_init_packet_t * p_init_packet = (dfu_init_packet_t *)p_init_data;
 
-    m_extended_packet_length = ((uint32_t)p_init_data + init_data_len) -
-                               (uint32_t)&p_init_packet->softdevice[p_init_packet->softdevice_len];
-    if (m_extended_packet_length < DFU_INIT_PACKET_EXT_LENGTH_MIN)
+    if (((uint32_t)p_init_data + init_data_len) < 
+        (uint32_t)&p_init_packet->softdevice[p_init_packet->softdevice_len])
     {
         return NRF_ERROR_INVALID_LENGTH;
     }
 
-    if (((uint32_t)p_init_data + init_data_len) < 
-        (uint32_t)&p_init_packet->softdevice[p_init_packet->softdevice_len])
+    uint32_t const ext_length = ((uint32_t)p_init_data + init_data_len) -
+                                (uint32_t)&p_init_packet->softdevice[p_init_packet->softdevice_len];
+    if ((ext_length < DFU_INIT_PACKET_EXT_LENGTH_MIN) || (ext_length > DFU_INIT_PACKET_EXT_LENGTH_MAX))
     {
         return NRF_ERROR_INVALID_LENGTH;
     }
+    m_extended_packet_length = ext_length;
 
     memcpy(m_extended_packet,
            &p_init_packet->softdevice[p_init_packet->softdevice_len],
            m_extended_packet_length);
 
+    uint32_t const ext_id = (ext_length >= DFU_INIT_PACKET_EXT_HASH_LENGTH) ?
+                            uint32_decode(&m_extended_packet[0]) : 0;
+
+    m_image_encrypted = (ext_id & DFU_INIT_PACKET_EXT_ENCRYPTED) != 0;
+    if (m_image_encrypted)
+    {
+#ifdef DFU_AES_KEY_FILE
+        if (ext_length < DFU_INIT_PACKET_EXT_HASH_LENGTH + AES_BLOCK_LEN)
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+#else
+        return NRF_ERROR_NOT_SUPPORTED;
+#endif
+    }
+
+#ifdef DFU_PUBLIC_KEY_FILE
+    // Signature covers the init packet up to itself, including the image hash checked in stage 2,
+    // and the image type.
+    if ((ext_length != DFU_INIT_PACKET_EXT_ECDS_LENGTH + (m_image_encrypted ? AES_BLOCK_LEN : 0)) ||
+        ((ext_id & ~DFU_INIT_PACKET_EXT_ENCRYPTED) != DFU_INIT_PACKET_USES_ECDS))
+    {
+        return NRF_ERROR_FORBIDDEN;
+    }
+
+    uint8_t init_digest[SHA256_DIGEST_LEN];
+
+    // Image hash context is not in use until image data arrives.
+    sha256_init(&m_image_sha256);
+    sha256_update(&m_image_sha256, p_init_data, init_data_len - P256_SIGNATURE_LEN);
+    sha256_update(&m_image_sha256, &image_type, 1);
+    sha256_final(&m_image_sha256, init_digest);
+
+    if (!p256_ecdsa_verify(m_public_key, init_digest,
+                           &m_extended_packet[ext_length - P256_SIGNATURE_LEN]))
+    {
+        return NRF_ERROR_FORBIDDEN;
+    }
+#endif
+
+    // Image data follows this init packet, integrity check runs as it is received.
+    sha256_init(&m_image_sha256);
+    m_image_crc = 0xFFFF;
+    m_image_len = 0;
+
+#ifdef DFU_AES_KEY_FILE
+    // Keystream is generated ahead of data, deciphering then costs a XOR per word.
+    if (m_image_encrypted &&
+        !aes_ctr_start(m_aes_key, &m_extended_packet[DFU_INIT_PACKET_EXT_HASH_LENGTH]))
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+#endif
+
     /** [DFU init application version] */
     // To support application versioning, this check should be updated.
     // This template allows for any application to be installed. However, 
@@ -186,27 +276,73 @@ uint32_t dfu_init_prevalidate(uint8_t * p_init_data, uint32_t init_data_len, uin
 }
 
 
-uint32_t dfu_init_postvalidate(uint8_t * p_image, uint32_t image_len)
+uint32_t dfu_init_image_decrypt(uint8_t * p_data, uint32_t length)
 {
-    uint16_t image_crc;
-    uint16_t received_crc;
-    
-    // In order to support hashing (and signing) then the (decrypted) hash should be fetched and
-    // the corresponding hash should be calculated over the image at this location.
-    // If hashing (or signing) is added to the system then the CRC validation should be removed.
+#ifdef DFU_AES_KEY_FILE
+    if (m_image_encrypted && !aes_ctr_crypt(p_data, length))
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+#else
+    (void)p_data;
+    (void)length;
+#endif
+
+    return NRF_SUCCESS;
+}
 
-    // calculate CRC from active block.
-    image_crc = crc16_compute(p_image, image_len, NULL);
 
-    // Decode the received CRC from extended data.    
-    received_crc = uint16_decode((uint8_t *)&m_extended_packet[0]);
+void dfu_init_image_update(uint8_t const * p_data, uint32_t length)
+{
+    sha256_update(&m_image_sha256, p_data, length);
+    m_image_crc  = crc16_compute(p_data, length, &m_image_crc);
+    m_image_len += length;
+}
+
+
+uint32_t dfu_init_postvalidate(uint8_t * p_image, uint32_t image_len)
+{
+    // Image has been hashed while it was received, p_image is not read again.
+    (void)p_image;
 
-    // Compare the received and calculated CRC.
-    if (image_crc != received_crc)
+    if (m_image_len != image_len)
     {
         return NRF_ERROR_INVALID_DATA;
     }
 
+    sha256_final(&m_image_sha256, m_image_digest);
+
+#ifdef DFU_AES_KEY_FILE
+    aes_ctr_stop();
+#endif
+
+    uint32_t const ext_id = (m_extended_packet_length >= DFU_INIT_PACKET_EXT_HASH_LENGTH) ?
+                            (uint32_decode(&m_extended_packet[0]) & ~DFU_INIT_PACKET_EXT_ENCRYPTED) : 0;
+
+    if ((ext_id == DFU_INIT_PACKET_USES_HASH) || (ext_id == DFU_INIT_PACKET_USES_ECDS))
+    {
+        // Compare firmware length and SHA-256 from extended data.
+        if ((uint32_decode(&m_extended_packet[4]) != image_len) ||
+            (memcmp(&m_extended_packet[8], m_image_digest, SHA256_DIGEST_LEN) != 0))
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+    }
+    else
+    {
+        // Compare the received and calculated CRC.
+        if (m_image_crc != uint16_decode(&m_extended_packet[0]))
+        {
+            return NRF_ERROR_INVALID_DATA;
+        }
+    }
+
     return NRF_SUCCESS;
 }
 
+
+uint8_t const * dfu_init_image_digest(void)
+{
+    return m_image_digest;
+}
+
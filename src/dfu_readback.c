@@ -0,0 +1,328 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "app_util.h"
+#include "crc16.h"
+#include "sha256.h"
+#include "dfu_types.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "flash_nrf5x.h"
+#include "dfu_readback.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+// Flash hashed per dfu_readback_task() call, a few ms at 64 MHz
+#define DIGEST_CHUNK_SIZE     CODE_PAGE_SIZE
+
+#define DIGEST_REGION_COUNT   3
+#define DIGEST_ENTRY_LEN      (4 + SHA256_DIGEST_LEN)
+
+static struct
+{
+  bool     active;
+  uint8_t  op;
+  uint8_t  status;
+  uint32_t addr;
+  uint32_t remaining; // bytes left to read or summarize
+
+  dfu_readback_ready_handler_t ready_handler;
+} _rb;
+
+static struct
+{
+  uint8_t  pending;   // regions not hashed yet
+  uint8_t  current;   // region being hashed, 0 if none
+  uint32_t addr;
+  uint32_t remaining;
+
+  sha256_context_t ctx;
+
+  uint32_t size  [DIGEST_REGION_COUNT];
+  uint8_t  digest[DIGEST_REGION_COUNT][SHA256_DIGEST_LEN];
+} _digest;
+
+/*------------------------------------------------------------------*/
+/* Internal
+ *------------------------------------------------------------------*/
+
+// bootloader settings log spans MBR params and settings pages
+STATIC_ASSERT(BOOTLOADER_SETTINGS_ADDRESS == BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS + CODE_PAGE_SIZE);
+
+// MBR + SoftDevice + application + application data, and bootloader settings log.
+// Bootloader itself is not readable.
+static bool readable_range(uint32_t addr, uint32_t len)
+{
+  if ( (len <= BOOTLOADER_REGION_START) && (addr <= BOOTLOADER_REGION_START - len) ) return true;
+
+  return (addr >= BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS) && (len <= 2*CODE_PAGE_SIZE) &&
+         (addr - BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS <= 2*CODE_PAGE_SIZE - len);
+}
+
+// Content is handed out by READ, application and its data only if DFU_READBACK_APP
+static bool content_readable(uint32_t addr, uint32_t len)
+{
+  if ( !readable_range(addr, len) ) return false;
+
+  if ( DFU_READBACK_APP || (addr >= BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS) ) return true;
+
+  return (len <= DFU_BANK_0_REGION_START) && (addr <= DFU_BANK_0_REGION_START - len);
+}
+
+static uint8_t check_request(uint8_t op, uint32_t addr, uint32_t len)
+{
+  switch (op)
+  {
+    case DFU_READBACK_OP_READ:
+      return content_readable(addr, len) ? DFU_READBACK_STATUS_OK : DFU_READBACK_STATUS_INVALID_RANGE;
+
+    case DFU_READBACK_OP_SUMMARY:
+      if ( (addr % CODE_PAGE_SIZE) || (len % CODE_PAGE_SIZE) ) return DFU_READBACK_STATUS_INVALID_RANGE;
+      return readable_range(addr, len) ? DFU_READBACK_STATUS_OK : DFU_READBACK_STATUS_INVALID_RANGE;
+
+    case DFU_READBACK_OP_DIGEST:
+      // address is the region bitmask
+      return (addr && !(addr & ~DFU_READBACK_REGION_ALL)) ? DFU_READBACK_STATUS_OK : DFU_READBACK_STATUS_INVALID_RANGE;
+
+    default:
+      return DFU_READBACK_STATUS_INVALID_OP;
+  }
+}
+
+static uint8_t region_index(uint8_t region)
+{
+  return (region == DFU_READBACK_REGION_APP) ? 0 : (region == DFU_READBACK_REGION_SOFTDEVICE) ? 1 : 2;
+}
+
+static uint32_t app_size(bootloader_settings_t const* settings)
+{
+  bool const valid = (settings->bank_0 == BANK_VALID_APP) &&
+                     (settings->bank_0_size <= BOOTLOADER_REGION_START - DFU_BANK_0_REGION_START);
+
+  return valid ? settings->bank_0_size : 0;
+}
+
+// Application is what bootloader settings describe, SoftDevice includes the MBR, and bootloader
+// excludes MBR params and settings pages which change without a bootloader update
+static void region_bounds(uint8_t region, uint32_t* start, uint32_t* size)
+{
+  if ( region == DFU_READBACK_REGION_APP )
+  {
+    bootloader_settings_t const * settings;
+    bootloader_util_settings_get(&settings);
+
+    *start = bootloader_app_address();
+    *size  = app_size(settings);
+  }
+  else if ( region == DFU_READBACK_REGION_SOFTDEVICE )
+  {
+    *start = 0;
+    *size  = DFU_BANK_0_REGION_START;
+  }
+  else
+  {
+    *start = BOOTLOADER_REGION_START;
+    *size  = BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS - BOOTLOADER_REGION_START;
+  }
+}
+
+static void digest_start(uint8_t regions)
+{
+  memset(&_digest, 0, sizeof(_digest));
+  _digest.pending = regions;
+
+  // application digest may already be cached in settings
+  if ( regions & DFU_READBACK_REGION_APP )
+  {
+    bootloader_settings_t const * settings;
+    bootloader_util_settings_get(&settings);
+
+    uint32_t const size = app_size(settings);
+
+    if ( size && (settings->app_digest_size == size) )
+    {
+      _digest.size[0] = size;
+      memcpy(_digest.digest[0], settings->app_digest, SHA256_DIGEST_LEN);
+
+      _digest.pending &= ~DFU_READBACK_REGION_APP;
+    }
+  }
+}
+
+/*------------------------------------------------------------------*/
+/* API
+ *------------------------------------------------------------------*/
+void dfu_readback_request(uint8_t const* request, uint16_t len, dfu_readback_ready_handler_t ready_handler)
+{
+  memset(&_rb, 0, sizeof(_rb));
+
+  _rb.active        = true;
+  _rb.ready_handler = ready_handler;
+
+  if ( len < DFU_READBACK_REQUEST_LEN )
+  {
+    _rb.op     = (len > 0) ? request[0] : 0;
+    _rb.status = DFU_READBACK_STATUS_INVALID_OP;
+    return;
+  }
+
+  _rb.op        = request[0];
+  _rb.addr      = uint32_decode(request + 1);
+  _rb.remaining = uint32_decode(request + 5);
+  _rb.status    = check_request(_rb.op, _rb.addr, _rb.remaining);
+
+  // pages still in flash cache (e.g from UF2) must be read back as host will see them
+  if ( _rb.status == DFU_READBACK_STATUS_OK ) flash_nrf5x_flush(true);
+
+  if ( (_rb.op == DFU_READBACK_OP_DIGEST) && (_rb.status == DFU_READBACK_STATUS_OK) )
+  {
+    _rb.remaining = 0;
+    digest_start((uint8_t) _rb.addr);
+  }
+}
+
+uint16_t dfu_readback_next(uint8_t* buf, uint16_t bufsize)
+{
+  // room for at least one page summary
+  if ( !_rb.active || (bufsize < DFU_READBACK_HEADER_LEN + 2) ) return 0;
+
+  // digest is still being computed, transport is called back when done
+  if ( (_rb.op == DFU_READBACK_OP_DIGEST) && (_rb.status == DFU_READBACK_STATUS_OK) && _digest.pending ) return 0;
+
+  buf[0] = _rb.op;
+  buf[1] = _rb.status;
+  (void) uint32_encode(_rb.addr, buf + 2);
+
+  uint8_t* payload = buf + DFU_READBACK_HEADER_LEN;
+  uint16_t const payload_max = bufsize - DFU_READBACK_HEADER_LEN;
+  uint32_t count = 0; // flash bytes covered by this frame
+  uint16_t payload_len = 0;
+
+  if ( _rb.status != DFU_READBACK_STATUS_OK )
+  {
+    // error is reported once
+    _rb.remaining = 0;
+  }
+  else if ( _rb.op == DFU_READBACK_OP_READ )
+  {
+    count = MIN(_rb.remaining, payload_max);
+    memcpy(payload, (void const*) _rb.addr, count);
+
+    payload_len = (uint16_t) count;
+  }
+  else if ( _rb.op == DFU_READBACK_OP_SUMMARY )
+  {
+    uint32_t const num_pages = MIN(_rb.remaining / CODE_PAGE_SIZE, payload_max / 2u);
+
+    for(uint32_t i=0; i<num_pages; i++)
+    {
+      uint16_t const init = 0;
+      uint16_t const crc  = crc16_compute((uint8_t const*) (_rb.addr + i*CODE_PAGE_SIZE), CODE_PAGE_SIZE, &init);
+
+      (void) uint16_encode(crc, payload + 2*i);
+    }
+
+    count       = num_pages * CODE_PAGE_SIZE;
+    payload_len = (uint16_t) (2*num_pages);
+  }
+  else
+  {
+    // DIGEST: all selected regions in one frame
+    for(uint8_t region = DFU_READBACK_REGION_APP; region & DFU_READBACK_REGION_ALL; region <<= 1)
+    {
+      if ( !(_rb.addr & region) ) continue;
+
+      if ( payload_len + DIGEST_ENTRY_LEN > payload_max )
+      {
+        buf[1]      = DFU_READBACK_STATUS_NO_MEM;
+        payload_len = 0;
+        break;
+      }
+
+      uint8_t const idx = region_index(region);
+
+      (void) uint32_encode(_digest.size[idx], payload + payload_len);
+      memcpy(payload + payload_len + 4, _digest.digest[idx], SHA256_DIGEST_LEN);
+
+      payload_len += DIGEST_ENTRY_LEN;
+    }
+  }
+
+  _rb.addr      += count;
+  _rb.remaining -= count;
+
+  // last frame, an empty READ/SUMMARY still gets one (empty) frame
+  if ( _rb.remaining == 0 ) _rb.active = false;
+
+  return DFU_READBACK_HEADER_LEN + payload_len;
+}
+
+void dfu_readback_abort(void)
+{
+  _rb.active = false;
+}
+
+void dfu_readback_task(void)
+{
+  if ( !(_rb.active && (_rb.op == DFU_READBACK_OP_DIGEST) && _digest.pending) ) return;
+
+  if ( !_digest.current )
+  {
+    // lowest pending region first
+    uint32_t start;
+
+    _digest.current = _digest.pending & (uint8_t) (-_digest.pending);
+    region_bounds(_digest.current, &start, &_digest.remaining);
+
+    _digest.addr = start;
+    _digest.size[region_index(_digest.current)] = _digest.remaining;
+
+    sha256_init(&_digest.ctx);
+  }
+
+  uint32_t const count = MIN(_digest.remaining, DIGEST_CHUNK_SIZE);
+
+  sha256_update(&_digest.ctx, (void const*) _digest.addr, count);
+  _digest.addr      += count;
+  _digest.remaining -= count;
+
+  if ( _digest.remaining ) return;
+
+  uint8_t const idx = region_index(_digest.current);
+  sha256_final(&_digest.ctx, _digest.digest[idx]);
+
+  // cache application digest so that next request is answered at once
+  if ( (_digest.current == DFU_READBACK_REGION_APP) && _digest.size[idx] )
+  {
+    bootloader_app_digest_save(_digest.size[idx], _digest.digest[idx]);
+  }
+
+  _digest.pending &= ~_digest.current;
+  _digest.current  = 0;
+
+  if ( !_digest.pending && _rb.ready_handler ) _rb.ready_handler();
+}
@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef DFU_READBACK_H_
+#define DFU_READBACK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Flash readback for production test and fleet audit, shared by serial and BLE DFU transports.
+ *
+ * Request  : op (1) | address (4) | length (4)
+ * Response : op (1) | status (1) | address (4) | payload, all little endian
+ *
+ * A request is answered by a stream of response frames, whose size is chosen by the transport.
+ * - READ    streams the content of [address, address+length)
+ * - SUMMARY returns CRC16-CCITT (zero initial value, same as HF2 CHKSUM_PAGES) of each page
+ *           in [address, address+length), both must be page aligned. Host then READs only
+ *           pages whose CRC differs from its reference image.
+ * - DIGEST  returns size (4) | SHA-256 (32) of each region selected by the bitmask in address field
+ *           (application, SoftDevice with MBR, bootloader, in that order), length is ignored.
+ *           Flash is hashed in chunks by dfu_readback_task() and the whole result is sent in a
+ *           single frame, which the transport must have room for. The application digest is
+ *           cached in bootloader settings, repeated requests are answered at once.
+ * An error is reported by a single frame with non-zero status and no payload.
+ *
+ * Without DFU_READBACK_APP, READ is limited to MBR, SoftDevice and bootloader settings log.
+ */
+
+// Application and its data can be read back by any transport (readback READ, CURRENT.UF2,
+// CURRENT.BIN and APPDATA.BIN, HF2 READ_WORDS, USB DFU upload). Off when encrypted images are
+// accepted, which would otherwise be handed out deciphered. CRCs and digests are still reported.
+#ifndef DFU_READBACK_APP
+  #ifdef DFU_AES_KEY_FILE
+    #define DFU_READBACK_APP  0
+  #else
+    #define DFU_READBACK_APP  1
+  #endif
+#endif
+
+#define DFU_READBACK_REQUEST_LEN    9
+#define DFU_READBACK_HEADER_LEN     6
+
+enum
+{
+  DFU_READBACK_OP_READ    = 0x01,
+  DFU_READBACK_OP_SUMMARY = 0x02,
+  DFU_READBACK_OP_DIGEST  = 0x03,
+};
+
+enum
+{
+  DFU_READBACK_REGION_APP        = 0x01,
+  DFU_READBACK_REGION_SOFTDEVICE = 0x02,
+  DFU_READBACK_REGION_BOOTLOADER = 0x04,
+  DFU_READBACK_REGION_ALL        = 0x07,
+};
+
+enum
+{
+  DFU_READBACK_STATUS_OK            = 0x00,
+  DFU_READBACK_STATUS_INVALID_OP    = 0x01,
+  DFU_READBACK_STATUS_INVALID_RANGE = 0x02,
+  DFU_READBACK_STATUS_NO_MEM        = 0x03, // response does not fit in transport frame
+};
+
+// Invoked from dfu_readback_task() when a deferred response (DIGEST) is ready to be sent
+typedef void (*dfu_readback_ready_handler_t)(void);
+
+// Start a new request, any request in progress is dropped
+void dfu_readback_request(uint8_t const* request, uint16_t len, dfu_readback_ready_handler_t ready_handler);
+
+// Build next response frame into buf (at most bufsize bytes), return its length or 0 when done
+uint16_t dfu_readback_next(uint8_t* buf, uint16_t bufsize);
+
+// Drop request in progress e.g when host is disconnected
+void dfu_readback_abort(void);
+
+// Hash next chunk of a DIGEST request, called from main loop so that transport and WDT are
+// serviced in between
+void dfu_readback_task(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* DFU_READBACK_H_ */
@@ -0,0 +1,426 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "app_util.h"
+#include "crc16.h"
+#include "nrf_nvmc.h"
+#include "nrf_wdt.h"
+#include "dfu_types.h"
+#include "dfu_init.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "dfu_staged.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+// Staged data is read (and deciphered) this much at a time
+#define STAGED_CHUNK_SIZE     256
+
+// Same as init packet buffer of serial and BLE DFU
+#define STAGED_INIT_MAX_LEN   144
+
+STATIC_ASSERT(sizeof(dfu_staged_cmd_t) == 16);
+
+static struct
+{
+  uint32_t addr;      // next staged byte to read
+  uint32_t remaining; // staged bytes not read yet
+  uint16_t count;     // bytes in chunk
+  uint16_t index;     // next byte in chunk
+  bool     failed;    // chunk could not be deciphered, input ends early
+
+  __attribute__((aligned(4))) uint8_t chunk[STAGED_CHUNK_SIZE];
+} _in;
+
+static struct
+{
+  uint32_t start;
+  uint32_t len;       // bytes output so far
+  uint32_t word;      // last bytes output, programmed once the word is complete
+  uint16_t crc;
+} _out;
+
+__attribute__((aligned(4))) static uint8_t _init_packet[STAGED_INIT_MAX_LEN];
+
+/*------------------------------------------------------------------*/
+/* Internal
+ *------------------------------------------------------------------*/
+static void wdt_feed(void)
+{
+  // WDT cannot be disabled once started by application, installation outlasts its timeout
+  if ( nrf_wdt_started() )
+  {
+    for (uint8_t i=0; i<8; i++) nrf_wdt_reload_request_set(i);
+  }
+}
+
+static void in_start(uint32_t addr, uint32_t len)
+{
+  _in.addr      = addr;
+  _in.remaining = len;
+  _in.count     = 0;
+  _in.index     = 0;
+  _in.failed    = false;
+}
+
+static bool in_refill(void)
+{
+  if ( !_in.remaining ) return false;
+
+  _in.count = MIN(_in.remaining, STAGED_CHUNK_SIZE);
+  _in.index = 0;
+
+  memcpy(_in.chunk, (void const*) _in.addr, _in.count);
+
+  if ( NRF_SUCCESS != dfu_init_image_decrypt(_in.chunk, _in.count) )
+  {
+    _in.failed    = true;
+    _in.remaining = 0;
+    return false;
+  }
+
+  _in.addr      += _in.count;
+  _in.remaining -= _in.count;
+
+  return true;
+}
+
+static bool in_getc(uint8_t* b)
+{
+  if ( (_in.index == _in.count) && !in_refill() ) return false;
+
+  *b = _in.chunk[_in.index++];
+  return true;
+}
+
+static void out_start(uint32_t addr)
+{
+  _out.start = addr;
+  _out.len   = 0;
+  _out.word  = 0xFFFFFFFF;
+  _out.crc   = 0xFFFF;
+}
+
+// Integrity check covers what has actually been programmed
+static void out_commit(uint32_t addr, uint32_t len)
+{
+  dfu_init_image_update((uint8_t const*) addr, len);
+  _out.crc = crc16_compute((uint8_t const*) addr, len, &_out.crc);
+}
+
+static bool out_putc(uint8_t b)
+{
+  // must not reach staging region
+  if ( _out.len >= DFU_IMAGE_MAX_SIZE_BANKED ) return false;
+
+  uint32_t const addr  = _out.start + _out.len;
+  uint32_t const shift = 8*(addr % 4);
+
+  if ( (addr % CODE_PAGE_SIZE) == 0 )
+  {
+    nrf_nvmc_page_erase(addr);
+    wdt_feed();
+  }
+
+  _out.word = (_out.word & ~(0xFFu << shift)) | ((uint32_t) b << shift);
+  _out.len++;
+
+  if ( (_out.len % 4) == 0 )
+  {
+    nrf_nvmc_write_word(addr & ~3u, _out.word);
+    _out.word = 0xFFFFFFFF;
+  }
+
+  if ( (_out.len % CODE_PAGE_SIZE) == 0 ) out_commit(addr + 1 - CODE_PAGE_SIZE, CODE_PAGE_SIZE);
+
+  return true;
+}
+
+// Byte output distance bytes ago, from flash unless still waiting for its word to complete
+static uint8_t out_back(uint32_t distance)
+{
+  uint32_t const pos = _out.len - distance;
+
+  if ( pos >= (_out.len & ~3u) ) return (uint8_t) (_out.word >> 8*(pos % 4));
+
+  return *(uint8_t const*) (_out.start + pos);
+}
+
+static void out_finish(void)
+{
+  if ( _out.len % 4 ) nrf_nvmc_write_word((_out.start + _out.len) & ~3u, _out.word);
+
+  uint32_t const partial = _out.len % CODE_PAGE_SIZE;
+  if ( partial ) out_commit(_out.start + _out.len - partial, partial);
+}
+
+#ifndef DFU_DUAL_BANK
+
+static bool staged_copy(void)
+{
+  uint8_t b;
+
+  while ( in_getc(&b) )
+  {
+    if ( !out_putc(b) ) return false;
+  }
+
+  return true;
+}
+
+static bool lz4_length(uint32_t* len)
+{
+  uint8_t b;
+
+  do
+  {
+    if ( !in_getc(&b) ) return false;
+    *len += b;
+  } while ( b == 255 );
+
+  return true;
+}
+
+// LZ4 block: sequences of token | literals | offset | match, the last one has literals only.
+// Matches are read back from bank 0, up to 64 KB behind.
+static bool lz4_decompress(void)
+{
+  uint8_t token;
+
+  while ( in_getc(&token) )
+  {
+    uint32_t len = token >> 4;
+    if ( (len == 15) && !lz4_length(&len) ) return false;
+
+    while ( len-- )
+    {
+      uint8_t b;
+      if ( !in_getc(&b) || !out_putc(b) ) return false;
+    }
+
+    uint8_t offset[2];
+    if ( !in_getc(&offset[0]) ) return true; // last sequence
+    if ( !in_getc(&offset[1]) ) return false;
+
+    uint32_t const distance = uint16_decode(offset);
+    if ( (distance == 0) || (distance > _out.len) ) return false;
+
+    len = token & 0x0F;
+    if ( (len == 15) && !lz4_length(&len) ) return false;
+    len += 4;
+
+    while ( len-- )
+    {
+      if ( !out_putc(out_back(distance)) ) return false;
+    }
+  }
+
+  return true;
+}
+
+static uint32_t staged_install_bank_0(dfu_staged_cmd_t const* cmd, bool resume)
+{
+  // Recorded first, current application is overwritten from now on
+  if ( !resume )
+  {
+    dfu_update_status_t update_status;
+    memset(&update_status, 0, sizeof(update_status));
+
+    update_status.status_code      = DFU_BANK_0_STAGED;
+    update_status.app_size         = cmd->image_size;
+    update_status.app_crc          = cmd->image_crc;
+    update_status.staged_init_size = cmd->init_size;
+    update_status.staged_flags     = cmd->flags;
+
+    bootloader_dfu_update_process(update_status);
+  }
+
+  in_start(DFU_BANK_1_REGION_START, cmd->image_size);
+  out_start(DFU_BANK_0_REGION_START);
+
+  bool const ok = (cmd->flags & DFU_STAGED_FLAG_LZ4) ? lz4_decompress() : staged_copy();
+  out_finish();
+
+  if ( _in.failed ) return NRF_ERROR_INTERNAL;
+
+  return ok ? dfu_init_postvalidate((uint8_t*) _out.start, _out.len) : NRF_ERROR_INVALID_DATA;
+}
+
+#else
+
+// Image runs from the staging region, nothing is written
+static uint32_t staged_install_in_place(uint32_t start, uint32_t size)
+{
+  in_start(start, size);
+  _out.crc = 0xFFFF;
+
+  while ( in_refill() )
+  {
+    // deciphered image would differ from the one stored
+    if ( memcmp(_in.chunk, (void const*) (_in.addr - _in.count), _in.count) ) return NRF_ERROR_NOT_SUPPORTED;
+
+    dfu_init_image_update(_in.chunk, _in.count);
+    _out.crc = crc16_compute(_in.chunk, _in.count, &_out.crc);
+  }
+
+  if ( _in.failed ) return NRF_ERROR_INTERNAL;
+
+  _out.start = start;
+  _out.len   = size;
+
+  uint32_t const err = dfu_init_postvalidate((uint8_t*) start, size);
+  if ( err ) return err;
+
+  // must be linked for this bank, reset handler is within the image
+  uint32_t const reset_handler = ((uint32_t const*) start)[1];
+
+  return (size > 8) && (reset_handler >= start) && (reset_handler < start + size) ? NRF_SUCCESS : NRF_ERROR_INVALID_DATA;
+}
+
+#endif
+
+static uint32_t staged_cmd_get(dfu_staged_cmd_t* cmd)
+{
+  dfu_staged_cmd_t* ram_cmd = (dfu_staged_cmd_t*) DFU_STAGED_CMD_MEM;
+
+  *cmd = *ram_cmd;
+
+  // consumed, a bad image is not tried again at every reset
+  ram_cmd->magic = 0;
+
+  if ( (cmd->magic != DFU_STAGED_CMD_MAGIC) ||
+       (cmd->crc != crc16_compute((uint8_t const*) cmd, offsetof(dfu_staged_cmd_t, crc), NULL)) )
+  {
+    return NRF_ERROR_INVALID_DATA;
+  }
+
+  uint32_t const init_offset = ALIGN_NUM(4, cmd->image_size);
+
+  if ( (cmd->image_size == 0) || (cmd->image_size > DFU_IMAGE_MAX_SIZE_BANKED) ||
+       (cmd->init_size > STAGED_INIT_MAX_LEN) || (init_offset + cmd->init_size > DFU_IMAGE_MAX_SIZE_BANKED) )
+  {
+    return NRF_ERROR_INVALID_LENGTH;
+  }
+
+#ifdef DFU_DUAL_BANK
+  if ( cmd->flags ) return NRF_ERROR_NOT_SUPPORTED;
+#else
+  if ( cmd->flags & ~DFU_STAGED_FLAG_LZ4 ) return NRF_ERROR_NOT_SUPPORTED;
+#endif
+
+  return NRF_SUCCESS;
+}
+
+/*------------------------------------------------------------------*/
+/* API
+ *------------------------------------------------------------------*/
+uint32_t dfu_staged_region_start(void)
+{
+#ifdef DFU_DUAL_BANK
+  return (bootloader_app_address() == DFU_BANK_1_REGION_START) ? DFU_BANK_0_REGION_START : DFU_BANK_1_REGION_START;
+#else
+  return DFU_BANK_1_REGION_START;
+#endif
+}
+
+bool dfu_staged_in_progress(void)
+{
+  bootloader_settings_t const * settings;
+  bootloader_util_settings_get(&settings);
+
+  return settings->bank_0 == BANK_VALID_STAGED;
+}
+
+uint32_t dfu_staged_install(void)
+{
+  bool const resume = dfu_staged_in_progress();
+  dfu_staged_cmd_t cmd;
+  uint32_t err;
+
+  if ( resume )
+  {
+    bootloader_settings_t const * settings;
+    bootloader_util_settings_get(&settings);
+
+    cmd.image_size = settings->bank_0_size;
+    cmd.image_crc  = settings->bank_0_crc;
+    cmd.init_size  = settings->staged_init_size;
+    cmd.flags      = settings->staged_flags;
+    err = NRF_SUCCESS;
+  }
+  else
+  {
+    err = staged_cmd_get(&cmd);
+  }
+
+  uint32_t const start = dfu_staged_region_start();
+
+  // staged data is checked as a whole before anything is written
+  if ( !err && (cmd.image_crc != crc16_compute((uint8_t const*) start, cmd.image_size, NULL)) )
+  {
+    err = NRF_ERROR_INVALID_DATA;
+  }
+
+  if ( !err )
+  {
+    memcpy(_init_packet, (void const*) (start + ALIGN_NUM(4, cmd.image_size)), cmd.init_size);
+    err = dfu_init_prevalidate(_init_packet, cmd.init_size, DFU_UPDATE_APP);
+  }
+
+  if ( !err )
+  {
+#ifdef DFU_DUAL_BANK
+    err = staged_install_in_place(start, cmd.image_size);
+#else
+    err = staged_install_bank_0(&cmd, resume);
+#endif
+  }
+
+  dfu_update_status_t update_status;
+  memset(&update_status, 0, sizeof(update_status));
+
+  if ( !err )
+  {
+    update_status.status_code     = DFU_UPDATE_APP_COMPLETE;
+    update_status.app_crc         = _out.crc;
+    update_status.app_size        = _out.len;
+    update_status.app_image_start = _out.start;
+    update_status.p_app_digest    = dfu_init_image_digest();
+
+    bootloader_dfu_update_process(update_status);
+  }
+  else if ( dfu_staged_in_progress() )
+  {
+    // bank 0 is no longer the previous application, DFU starts for lack of a valid one
+    update_status.status_code = DFU_BANK_0_ERASED;
+
+    bootloader_dfu_update_process(update_status);
+  }
+
+  return err;
+}
@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef DFU_STAGED_H_
+#define DFU_STAGED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* Install of an image the application has staged in flash itself, e.g received over LoRa in the
+ * background, at the next reset and without any transport.
+ *
+ * Application writes the image to the staging region, followed by its init packet (same as for
+ * serial and BLE DFU) at the next word boundary, then the command block below to DFU_STAGED_CMD_MEM
+ * and resets with GPREGRET set to 0x49 (DFU_MAGIC_STAGED_RESET in main.c). The init packet is
+ * checked as for serial and BLE DFU: signature, SHA-256 or CRC of the image, encryption.
+ *
+ * Staging region is the second half of the application area, from DFU_BANK_1_REGION_START
+ * (0x49000 on nRF52832 with S132 6.1.1). The image is copied, or decompressed, to bank 0 which
+ * therefore holds at most as much. Installation is recorded in bootloader settings beforehand and
+ * starts over if interrupted by a reset or power loss.
+ *
+ * With DFU_DUAL_BANK the staging region is the bank the application is not running from, and the
+ * image is stored there as is (neither compressed nor encrypted) and linked for that bank. It is
+ * activated without copy, like an image received over serial or BLE DFU.
+ */
+
+#define DFU_STAGED_CMD_MEM      0x20007F6C  // no init RAM, right below double reset magic
+#define DFU_STAGED_CMD_MAGIC    0x47415453  // "STAG"
+
+enum
+{
+  DFU_STAGED_FLAG_LZ4 = 0x0001, // image is a single LZ4 block (no frame, no size prefix)
+};
+
+typedef struct
+{
+  uint32_t magic;       // DFU_STAGED_CMD_MAGIC
+  uint32_t image_size;  // image as stored in staging region, compressed and/or encrypted
+  uint16_t init_size;   // init packet stored after the image
+  uint16_t flags;       // DFU_STAGED_FLAG_*
+  uint16_t image_crc;   // CRC16-CCITT of the image as stored, checked before bank 0 is touched
+  uint16_t crc;         // CRC16-CCITT of the above fields
+} dfu_staged_cmd_t;
+
+// Start address of the staging region
+uint32_t dfu_staged_region_start(void);
+
+// An installation has been interrupted and must be finished
+bool dfu_staged_in_progress(void);
+
+// Install image described by command block, or finish installation in progress. On error the
+// current application is kept if it has not been overwritten yet, bank 0 is invalid otherwise.
+// SoftDevice must not be enabled.
+uint32_t dfu_staged_install(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* DFU_STAGED_H_ */
@@ -30,38 +30,169 @@
 #define FLASH_PAGE_SIZE           4096
 #define FLASH_CACHE_INVALID_ADDR  0xffffffff
 
-static uint32_t _fl_addr = FLASH_CACHE_INVALID_ADDR;
-static uint8_t _fl_buf[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+// Pages are assembled in RAM from writes which may arrive in any order and size
+// (e.g UF2 blocks written out of order by the host). A page is committed once all
+// of its bytes are written, or when its slot is needed for another page.
 
-void flash_nrf5x_flush (bool need_erase)
+#ifndef FLASH_CACHE_PAGES
+  #ifdef NRF52840_XXAA
+    #define FLASH_CACHE_PAGES     4
+  #else
+    #define FLASH_CACHE_PAGES     1 // nRF52832 is short on RAM
+  #endif
+#endif
+
+// Page completion is tracked per byte rather than with the UF2 writtenMask: writtenMask counts
+// block numbers of the whole file (and does not exist for HF2 and USB DFU writes), while a page
+// is filled by payloads of any size and alignment, some straddling the next page. Committing a
+// page before its last byte arrives would cost another erase and program when that byte does.
+typedef struct
+{
+  uint32_t addr;
+  uint16_t byte_count; // number of bits set in byte_mask
+  bool     need_erase;
+  uint32_t byte_mask[FLASH_PAGE_SIZE / 32]; // bytes written since page was cached
+  uint8_t  buf[FLASH_PAGE_SIZE] __attribute__((aligned(4)));
+} flash_cache_t;
+
+static flash_cache_t _fl_cache[FLASH_CACHE_PAGES] =
+{
+  [0 ... FLASH_CACHE_PAGES-1] = { .addr = FLASH_CACHE_INVALID_ADDR }
+};
+
+// slot to be evicted next when all are in use
+static uint8_t _fl_victim = 0;
+
+static flash_nrf5x_stats_t _fl_stats;
+static flash_nrf5x_commit_cb_t _fl_commit_cb = NULL;
+
+void flash_nrf5x_set_commit_cb (flash_nrf5x_commit_cb_t cb)
+{
+  _fl_commit_cb = cb;
+}
+
+flash_nrf5x_stats_t const* flash_nrf5x_stats (void)
+{
+  return &_fl_stats;
+}
+
+static void cache_commit (flash_cache_t* cache)
 {
-  if ( _fl_addr == FLASH_CACHE_INVALID_ADDR ) return;
+  if ( cache->addr == FLASH_CACHE_INVALID_ADDR ) return;
 
-  if ( memcmp(_fl_buf, (void *) _fl_addr, FLASH_PAGE_SIZE) != 0 )
+  if ( memcmp(cache->buf, (void *) cache->addr, FLASH_PAGE_SIZE) != 0 )
   {
     // - nRF52832 dfu via uart can miss incoming byte when erasing because cpu is blocked for > 2ms.
     // Since dfu_prepare_func_app_erase() already erase the page for us, we can skip it here.
     // - nRF52840 dfu serial/uf2 are USB-based which are DMA and should have no problems.
     //
     // Note: MSC uf2 does not erase page in advance like dfu serial
-    if ( need_erase ) nrf_nvmc_page_erase(_fl_addr);
+    if ( cache->need_erase )
+    {
+      nrf_nvmc_page_erase(cache->addr);
+      _fl_stats.erase_count++;
+    }
 
-    nrf_nvmc_write_words(_fl_addr, (uint32_t *) _fl_buf, FLASH_PAGE_SIZE / 4);
+    nrf_nvmc_write_words(cache->addr, (uint32_t *) cache->buf, FLASH_PAGE_SIZE / 4);
+    _fl_stats.program_count++;
   }
 
-  _fl_addr = FLASH_CACHE_INVALID_ADDR;
+  if ( _fl_commit_cb ) _fl_commit_cb(cache->addr, cache->buf);
+
+  cache->addr = FLASH_CACHE_INVALID_ADDR;
 }
 
-void flash_nrf5x_write (uint32_t dst, void const *src, int len, bool need_erase)
+static flash_cache_t* cache_get (uint32_t page_addr, bool need_erase)
 {
-  uint32_t newAddr = dst & ~(FLASH_PAGE_SIZE - 1);
+  flash_cache_t* free_slot = NULL;
 
-  if ( newAddr != _fl_addr )
+  for(uint8_t i=0; i<FLASH_CACHE_PAGES; i++)
   {
-    flash_nrf5x_flush(need_erase);
-    _fl_addr = newAddr;
-    memcpy(_fl_buf, (void *) newAddr, FLASH_PAGE_SIZE);
+    if ( _fl_cache[i].addr == page_addr ) return &_fl_cache[i];
+    if ( !free_slot && (_fl_cache[i].addr == FLASH_CACHE_INVALID_ADDR) ) free_slot = &_fl_cache[i];
+  }
+
+  // No free slot: commit the oldest page, even if it is not complete
+  if ( !free_slot )
+  {
+    free_slot = &_fl_cache[_fl_victim];
+    _fl_victim = (_fl_victim + 1) % FLASH_CACHE_PAGES;
+
+    cache_commit(free_slot);
   }
-  memcpy(_fl_buf + (dst & (FLASH_PAGE_SIZE - 1)), src, len);
+
+  free_slot->addr       = page_addr;
+  free_slot->byte_count = 0;
+  memset(free_slot->byte_mask, 0, sizeof(free_slot->byte_mask));
+  free_slot->need_erase = need_erase;
+  memcpy(free_slot->buf, (void *) page_addr, FLASH_PAGE_SIZE);
+
+  return free_slot;
 }
 
+void flash_nrf5x_flush (bool need_erase)
+{
+  (void) need_erase; // each page keeps the erase option it was written with
+
+  // lowest address first, so that commit callback still sees a sequential image in order
+  while (1)
+  {
+    flash_cache_t* lowest = NULL;
+
+    for(uint8_t i=0; i<FLASH_CACHE_PAGES; i++)
+    {
+      if ( (_fl_cache[i].addr != FLASH_CACHE_INVALID_ADDR) && (!lowest || (_fl_cache[i].addr < lowest->addr)) )
+      {
+        lowest = &_fl_cache[i];
+      }
+    }
+
+    if ( !lowest ) break;
+
+    cache_commit(lowest);
+  }
+}
+
+// mark bytes [offset, offset+len) as written, 32 at a time
+static void cache_mark (flash_cache_t* cache, uint32_t offset, uint32_t len)
+{
+  uint32_t const end = offset + len;
+
+  while ( offset < end )
+  {
+    uint32_t const bit   = offset % 32;
+    uint32_t const count = (end - offset) < (32 - bit) ? (end - offset) : (32 - bit);
+    uint32_t const mask  = ((count == 32) ? 0xffffffffUL : ((1UL << count) - 1)) << bit;
+
+    uint32_t* word = &cache->byte_mask[offset / 32];
+
+    cache->byte_count += __builtin_popcount(mask & ~(*word));
+    *word |= mask;
+
+    offset += count;
+  }
+}
+
+void flash_nrf5x_write (uint32_t dst, void const *src, int len, bool need_erase)
+{
+  uint8_t const* src8 = (uint8_t const*) src;
+
+  // split writes crossing page boundary
+  while ( len > 0 )
+  {
+    uint32_t const page_addr = dst & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t const offset    = dst & (FLASH_PAGE_SIZE - 1);
+    uint32_t const count     = (uint32_t) len < (FLASH_PAGE_SIZE - offset) ? (uint32_t) len : (FLASH_PAGE_SIZE - offset);
+
+    flash_cache_t* cache = cache_get(page_addr, need_erase);
+
+    memcpy(cache->buf + offset, src8, count);
+    cache_mark(cache, offset, count);
+
+    if ( cache->byte_count == FLASH_PAGE_SIZE ) cache_commit(cache);
+
+    dst  += count;
+    src8 += count;
+    len  -= count;
+  }
+}
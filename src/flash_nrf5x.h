@@ -34,8 +34,20 @@
  extern "C" {
 #endif
 
+typedef struct
+{
+  uint32_t erase_count;
+  uint32_t program_count; // pages programmed
+} flash_nrf5x_stats_t;
+
+// Invoked with the final content of every page committed to flash
+typedef void (*flash_nrf5x_commit_cb_t) (uint32_t addr, uint8_t const *page);
+
 void flash_nrf5x_write (uint32_t dst, void const *src, int len, bool need_erase);
 void flash_nrf5x_flush (bool need_erase);
+void flash_nrf5x_set_commit_cb (flash_nrf5x_commit_cb_t cb);
+
+flash_nrf5x_stats_t const* flash_nrf5x_stats (void);
 
 #ifdef __cplusplus
  }
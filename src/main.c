@@ -61,6 +61,7 @@
 #include "nrf_error.h"
 
 #include "boards.h"
+#include "dfu_staged.h"
 
 #include "pstorage_platform.h"
 #include "nrf_mbr.h"
@@ -95,6 +96,9 @@ void usb_teardown(void);
  * - BOOTLOADER_DFU_OTA_MAGIC used by BLEDfu service : SD is already init
  * - BOOTLOADER_DFU_OTA_FULLRESET_MAGIC entered by soft reset : SD is not init
  * - BOOTLOADER_DFU_SERIAL_MAGIC entered by soft reset : SD is not init
+ * - DFU_MAGIC_VERIFY_ONLY_RESET entered by soft reset : serial DFU that only answers readback
+ *   (e.g image digest) requests, STOP packet or no request within timeout goes back to application
+ * - DFU_MAGIC_STAGED_RESET entered by soft reset : install image staged by application, see dfu_staged.h
  *
  * Note: for DFU_MAGIC_OTA_APPJUM Softdevice must not initialized.
  * since it is already in application. In all other case of OTA SD must be initialized
@@ -103,13 +107,19 @@ void usb_teardown(void);
 #define DFU_MAGIC_OTA_RESET             0xA8
 #define DFU_MAGIC_SERIAL_ONLY_RESET     0x4e
 #define DFU_MAGIC_UF2_RESET             0x57
+#define DFU_MAGIC_VERIFY_ONLY_RESET     0x56
+#define DFU_MAGIC_STAGED_RESET          0x49
 
 #define DFU_DBL_RESET_MAGIC             0x5A1AD5      // SALADS
 #define DFU_DBL_RESET_DELAY             500
 #define DFU_DBL_RESET_MEM               0x20007F7C
 
+#define BOOT_COUNT_MEM                  0x20007FF8    // count and check word, end of no init RAM
+#define BOOT_COUNT_CHECK(_count)        ((_count) ^ 0xB0075EEDUL)
+
 #define BOOTLOADER_VERSION_REGISTER     NRF_TIMER2->CC[0]
 #define DFU_SERIAL_STARTUP_INTERVAL     1000
+#define DFU_VERIFY_ONLY_INTERVAL        10000   // host has to enumerate USB and open the port
 
 // These value must be the same with one in dfu_transport_ble.c
 #define BLEGAP_EVENT_LENGTH             6
@@ -134,12 +144,51 @@ uint32_t* dbl_reset_mem = ((uint32_t*)  DFU_DBL_RESET_MEM );
 // true if ble, false if serial
 bool _ota_dfu = false;
 bool _ota_connected = false;
+static bool _verify_only = false;
 
 bool is_ota(void)
 {
   return _ota_dfu;
 }
 
+bool is_verify_only(void)
+{
+  return _verify_only;
+}
+
+static boot_stats_t _boot_stats;
+
+boot_stats_t const* boot_stats_get(void)
+{
+  return &_boot_stats;
+}
+
+// Boot phases are timed with the DWT cycle counter since RTC1 is not running that early
+static void boot_stats_init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT       = 0;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+  // RESETREAS is left as is for the application
+  _boot_stats.reset_reason = NRF_POWER->RESETREAS;
+
+  // check word tells a count kept from previous start from RAM lost at power-on or
+  // overwritten by the application
+  uint32_t* boot_count = (uint32_t*) BOOT_COUNT_MEM;
+  uint32_t const count = (boot_count[1] == BOOT_COUNT_CHECK(boot_count[0])) ? boot_count[0] + 1 : 1;
+
+  boot_count[0] = count;
+  boot_count[1] = BOOT_COUNT_CHECK(count);
+
+  _boot_stats.boot_count = count;
+}
+
+static void boot_stats_phase_end(uint8_t phase)
+{
+  _boot_stats.phase_end_us[phase] = DWT->CYCCNT / (SystemCoreClock / 1000000);
+}
+
 void softdev_mbr_init(void)
 {
   sd_mbr_command_t com = { .command = SD_MBR_COMMAND_INIT_SD };
@@ -148,21 +197,29 @@ void softdev_mbr_init(void)
 
 int main(void)
 {
+  boot_stats_init();
+
   // SD is already Initialized in case of BOOTLOADER_DFU_OTA_MAGIC
   bool sd_inited = (NRF_POWER->GPREGRET == DFU_MAGIC_OTA_APPJUM);
 
   // Start Bootloader in BLE OTA mode
   _ota_dfu = (NRF_POWER->GPREGRET == DFU_MAGIC_OTA_APPJUM) || (NRF_POWER->GPREGRET == DFU_MAGIC_OTA_RESET);
 
+  // Verify only mode, serial only as well since USB MSC would take UF2 writes
+  _verify_only = (NRF_POWER->GPREGRET == DFU_MAGIC_VERIFY_ONLY_RESET);
+
   // Serial only mode
-  bool serial_only_dfu = (NRF_POWER->GPREGRET == DFU_MAGIC_SERIAL_ONLY_RESET);
+  bool serial_only_dfu = (NRF_POWER->GPREGRET == DFU_MAGIC_SERIAL_ONLY_RESET) || _verify_only;
 
   // start either serial, uf2 or ble
   bool dfu_start = _ota_dfu || serial_only_dfu || (NRF_POWER->GPREGRET == DFU_MAGIC_UF2_RESET) ||
-                    (((*dbl_reset_mem) == DFU_DBL_RESET_MAGIC) && (NRF_POWER->RESETREAS & POWER_RESETREAS_RESETPIN_Msk));
+                    (((*dbl_reset_mem) == DFU_DBL_RESET_MAGIC) && (_boot_stats.reset_reason & POWER_RESETREAS_RESETPIN_Msk));
+
+  // Install image staged by application
+  bool const staged_install = (NRF_POWER->GPREGRET == DFU_MAGIC_STAGED_RESET);
 
   // Clear GPREGRET if it is our values
-  if (dfu_start) NRF_POWER->GPREGRET = 0;
+  if (dfu_start || staged_install) NRF_POWER->GPREGRET = 0;
 
   // Save bootloader version to pre-defined register, retrieved by application
   BOOTLOADER_VERSION_REGISTER = (MK_BOOTLOADER_VERSION);
@@ -171,7 +228,10 @@ int main(void)
   APP_ERROR_CHECK_BOOL(*((uint32_t *)NRF_UICR_BOOT_START_ADDRESS) == BOOTLOADER_REGION_START);
 
   board_init();
+  boot_stats_phase_end(BOOT_PHASE_BOARD_INIT);
+
   bootloader_init();
+  boot_stats_phase_end(BOOT_PHASE_BOOTLOADER_INIT);
 
   led_state(STATE_BOOTLOADER_STARTED);
 
@@ -186,14 +246,29 @@ int main(void)
     led_state(STATE_WRITING_FINISHED);
   }
 
+  // Install image staged by application, one interrupted by a reset or power loss is started over
+  if ( !sd_inited && (staged_install || dfu_staged_in_progress()) )
+  {
+    led_state(STATE_WRITING_STARTED);
+
+    // Application (or DFU if it has been overwritten) is started as usual if image is rejected
+    (void) dfu_staged_install();
+
+    led_state(STATE_WRITING_FINISHED);
+  }
+
+  // Go back to previous application if the one on trial did not confirm itself in time.
+  // SoftDevice is running if jumped from application, next reset will take care of it.
+  if ( !sd_inited ) bootloader_app_trial_check();
+
   /*------------- Determine DFU mode (Serial, OTA, FRESET or normal) -------------*/
   // DFU button pressed
   dfu_start  = dfu_start || button_pressed(BUTTON_DFU);
 
   // DFU + FRESET are pressed --> OTA
-  _ota_dfu = _ota_dfu  || ( button_pressed(BUTTON_DFU) && button_pressed(BUTTON_FRESET) ) ;
+  _ota_dfu = _ota_dfu  || ( !_verify_only && button_pressed(BUTTON_DFU) && button_pressed(BUTTON_FRESET) ) ;
 
-  bool const valid_app = bootloader_app_is_valid(DFU_BANK_0_REGION_START);
+  bool const valid_app = bootloader_app_is_valid(bootloader_app_address());
 
   // App mode: register 1st reset and DFU startup (nrf52832)
   if ( ! (dfu_start || !valid_app) )
@@ -231,8 +306,10 @@ int main(void)
       usb_init(serial_only_dfu);
     }
 
+    boot_stats_phase_end(BOOT_PHASE_DFU_INIT);
+
     // Initiate an update of the firmware.
-    APP_ERROR_CHECK( bootloader_dfu_start(_ota_dfu, 0) );
+    APP_ERROR_CHECK( bootloader_dfu_start(_ota_dfu, _verify_only ? DFU_VERIFY_ONLY_INTERVAL : 0) );
 
     if ( _ota_dfu )
     {
@@ -253,14 +330,15 @@ int main(void)
   board_teardown();
 
   // Jump to application if valid
-  if (bootloader_app_is_valid(DFU_BANK_0_REGION_START) && !bootloader_dfu_sd_in_progress())
+  uint32_t const app_addr = bootloader_app_address();
+
+  if (bootloader_app_is_valid(app_addr) && !bootloader_dfu_sd_in_progress())
   {
     // MBR must be init before start application
     if ( !sd_inited ) softdev_mbr_init();
 
-    // Select a bank region to use as application region.
-    // @note: Only applications running from DFU_BANK_0_REGION_START is supported.
-    bootloader_app_start(DFU_BANK_0_REGION_START);
+    // Application runs from bank 0, or from the bank selected by settings with DFU_DUAL_BANK
+    bootloader_app_start(app_addr);
   }
 
   NVIC_SystemReset();
@@ -281,6 +359,11 @@ void adafruit_factory_reset(void)
   // Only need to erase the 1st page of Application code to make it invalid
   nrf_nvmc_page_erase(DFU_BANK_0_REGION_START);
 
+#ifdef DFU_DUAL_BANK
+  // as well as the one in the other bank, which could be restored otherwise
+  nrf_nvmc_page_erase(DFU_BANK_1_REGION_START);
+#endif
+
   // back to normal
   led_state(STATE_FACTORY_RESET_FINISHED);
 }
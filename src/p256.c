@@ -0,0 +1,542 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "p256.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+// Bits of both scalars consumed per step of u1*G + u2*Q. Each extra bit roughly halves the
+// point additions, but doubles the multiples of G kept in flash (64 bytes each) and of Q
+// built on stack (96 bytes each).
+#ifndef P256_WINDOW_BITS
+#define P256_WINDOW_BITS    4
+#endif
+
+#if (P256_WINDOW_BITS < 1) || (P256_WINDOW_BITS > 4)
+#error P256_WINDOW_BITS must be from 1 to 4
+#endif
+
+#define WINDOW_MASK         ((1u << P256_WINDOW_BITS) - 1)
+#define WINDOW_COUNT        ((256 + P256_WINDOW_BITS - 1) / P256_WINDOW_BITS)
+
+#define LIMB_COUNT          8
+
+// 256-bit integer as little endian 32-bit limbs
+typedef uint32_t p256_int_t[LIMB_COUNT];
+
+typedef struct
+{
+  p256_int_t x, y;
+} affine_point_t;
+
+// X = x*z^2, Y = y*z^3, point at infinity has z = 0
+typedef struct
+{
+  p256_int_t x, y, z;
+} jacobian_point_t;
+
+// Field prime p = 2^256 - 2^224 + 2^192 + 2^96 - 1
+static const p256_int_t _p =
+{
+  0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF
+};
+
+// Curve coefficient b, a is -3
+static const p256_int_t _b =
+{
+  0x27D2604B, 0x3BCE3C3E, 0xCC53B0F6, 0x651D06B0, 0x769886BC, 0xB3EBBD55, 0xAA3A93E7, 0x5AC635D8
+};
+
+// Group order n
+static const p256_int_t _n =
+{
+  0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF
+};
+
+// R^2 mod n with R = 2^256, converts into Montgomery form
+static const p256_int_t _n_rr =
+{
+  0xBE79EEA2, 0x83244C95, 0x49BD6FA6, 0x4699799C, 0x2B6BEC59, 0x2845B239, 0xF3D95620, 0x66E12D94
+};
+
+// -n^-1 mod 2^32
+#define N_INV32             0xEE00BC4Fu
+
+// Precomputed multiples 1G .. (2^P256_WINDOW_BITS - 1)G of the base point
+static const affine_point_t _g_mult[WINDOW_MASK] =
+{
+  { { 0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81, 0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2 },
+    { 0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357, 0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2 } }, // 1G
+#if P256_WINDOW_BITS > 1
+  { { 0x47669978, 0xA60B48FC, 0x77F21B35, 0xC08969E2, 0x04B51AC3, 0x8A523803, 0x8D034F7E, 0x7CF27B18 },
+    { 0x227873D1, 0x9E04B79D, 0x3CE98229, 0xBA7DADE6, 0x9F7430DB, 0x293D9AC6, 0xDB8ED040, 0x07775510 } }, // 2G
+  { { 0xC6E7FD6C, 0xFB41661B, 0xEFADA985, 0xE6C6B721, 0x1D4BF165, 0xC8F7EF95, 0xA6330A44, 0x5ECBE4D1 },
+    { 0xA27D5032, 0x9A79B127, 0x384FB83D, 0xD82AB036, 0x1A64A2EC, 0x374B06CE, 0x4998FF7E, 0x8734640C } }, // 3G
+#endif
+#if P256_WINDOW_BITS > 2
+  { { 0x6B030852, 0x50930244, 0x785596EF, 0x031FE2DB, 0x9EE62BD0, 0xA02DDE65, 0x32D08FBB, 0xE2534A35 },
+    { 0x184ED8C6, 0x5C42C23F, 0xF30EE005, 0x4EFC96C3, 0xDA862D76, 0x19DFEE5F, 0x4C633CC7, 0xE0F1575A } }, // 4G
+  { { 0xC3D033ED, 0x21554A0D, 0x1F5BE524, 0xEF8C82FD, 0x08668FDF, 0xD784C856, 0x515140D2, 0x51590B7A },
+    { 0xFDA16DA4, 0xD1D0BB44, 0xD4D80888, 0x0D012F00, 0xBF8A7926, 0x8AE1BF36, 0x904A727D, 0xE0C17DA8 } }, // 5G
+  { { 0x3C2291A9, 0xC6B0AAE9, 0xEBB215B4, 0x024C740D, 0xB897DDE3, 0x92D3242C, 0x76A4602C, 0xB01A172A },
+    { 0x8FC77FE2, 0xFD7C4853, 0x1C7E16BD, 0x1C00F770, 0xFBA70379, 0x6FEC0E2D, 0x3237DAD5, 0xE85C1074 } }, // 6G
+  { { 0x3187B2A3, 0x30062870, 0xA80FEF5B, 0x7EF9F8B8, 0x7C01FB60, 0x25BB3066, 0xA0BF7B46, 0x8E533B6F },
+    { 0xC1F400B4, 0xC55E1A86, 0xCB041B21, 0x53C73633, 0xA6F59000, 0x6D069F83, 0xE0331836, 0x73EB1DBD } }, // 7G
+#endif
+#if P256_WINDOW_BITS > 3
+  { { 0xDB6FB393, 0xB4DD9DC1, 0x0FCE97DB, 0xC1D23898, 0x3AB54CAD, 0x4042742D, 0xBEE9B053, 0x62D9779D },
+    { 0x0F09957E, 0xDA540A6A, 0xBBE76A78, 0xA2ED51F6, 0x1167CEE0, 0x4FF15D77, 0x91E9D824, 0xAD5ACCBD } }, // 8G
+  { { 0x90949EE0, 0xD79E8A4B, 0x2C6DF8B3, 0x9E0ACB8C, 0x1D71F872, 0x878938D5, 0xFEDF0B71, 0xEA68D7B6 },
+    { 0x4DD048FA, 0xE85A224A, 0xA4DE823F, 0x4D714FEA, 0x4A8EA0C8, 0x87014A96, 0x72C9FCE7, 0x2A2744C9 } }, // 9G
+  { { 0x04C5723F, 0x4C360694, 0x1C48306E, 0x45CA6C47, 0xEA223FB5, 0x591214D1, 0x2A3A993E, 0xCEF66D6B },
+    { 0x44AF0773, 0xCA34BBAA, 0xFE751EEE, 0x590DED29, 0x9D3B4C10, 0x6E123CDD, 0x29AAAE90, 0x878662A2 } }, // 10G
+  { { 0x74BC21D1, 0x433391D3, 0x255048BF, 0x16742ED0, 0xB0C21CDA, 0x0638379D, 0x883B4C59, 0x3ED113B7 },
+    { 0xE82A3740, 0xE2F8EEFC, 0x5E9889DA, 0x090D04DA, 0xA4F4C68A, 0x24C843AF, 0xCCC4C8A2, 0x9099209A } }, // 11G
+  { { 0x8624E3C4, 0xD500C5EE, 0xB2F82C99, 0x79983028, 0x20E5D551, 0x46265373, 0xA817D95E, 0x741DD5BD },
+    { 0xCD4481D3, 0x1995FF22, 0x35BA5CA7, 0x8EEB912C, 0x4887B154, 0x56738355, 0x9C385FDC, 0x0770B46A } }, // 12G
+  { { 0x46072C01, 0x98E15D9D, 0x65EAD58A, 0x792E284B, 0xD85EE2FC, 0x61805DF2, 0xE0AC495A, 0x177C837A },
+    { 0xEFC7BFD8, 0x9C43BBE2, 0xA1FB4DF3, 0x26EE14C3, 0xB40F4E72, 0xA24091AD, 0x4EBEA558, 0x63BB58CD } }, // 13G
+  { { 0x24D2920B, 0x57092773, 0x7A069C5E, 0xF126ACBE, 0x4336DF3C, 0x7A76647F, 0x1C3862B9, 0x54E77A00 },
+    { 0x60D0B375, 0x1BA7C82F, 0x73509008, 0x7171EA77, 0x05A2E7C3, 0x42121F8C, 0x29F43175, 0xF599F1BB } }, // 14G
+  { { 0xE59B9D5F, 0x63668C63, 0xDE3A0EF1, 0xAE03AF92, 0x99888265, 0xADFB3789, 0x971ABAE7, 0xF0454DC6 },
+    { 0x0D034F36, 0x47E59CDE, 0x75B5FA3F, 0x2A3B21CE, 0x1F9643E6, 0x4E6594E5, 0x592E2D1F, 0xB5B93EE3 } }, // 15G
+#endif
+};
+
+/*------------------------------------------------------------------*/
+/* Integer
+ *------------------------------------------------------------------*/
+static void int_load(p256_int_t r, uint8_t const* be)
+{
+  for(uint32_t i=0; i<LIMB_COUNT; i++)
+  {
+    uint8_t const* b = be + 4*(LIMB_COUNT - 1 - i);
+    r[i] = (((uint32_t) b[0]) << 24) | (((uint32_t) b[1]) << 16) | (((uint32_t) b[2]) << 8) | b[3];
+  }
+}
+
+static bool int_is_zero(p256_int_t const a)
+{
+  uint32_t bits = 0;
+  for(uint32_t i=0; i<LIMB_COUNT; i++) bits |= a[i];
+  return bits == 0;
+}
+
+static int int_cmp(p256_int_t const a, p256_int_t const b)
+{
+  for(int32_t i=LIMB_COUNT-1; i>=0; i--)
+  {
+    if ( a[i] != b[i] ) return (a[i] > b[i]) ? 1 : -1;
+  }
+  return 0;
+}
+
+// r = a + b, return carry
+static uint32_t int_add(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  uint64_t carry = 0;
+  for(uint32_t i=0; i<LIMB_COUNT; i++)
+  {
+    carry += (uint64_t) a[i] + b[i];
+    r[i]   = (uint32_t) carry;
+    carry >>= 32;
+  }
+  return (uint32_t) carry;
+}
+
+// r = a - b, return borrow
+static uint32_t int_sub(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  int64_t borrow = 0;
+  for(uint32_t i=0; i<LIMB_COUNT; i++)
+  {
+    borrow += (int64_t) a[i] - b[i];
+    r[i]    = (uint32_t) borrow;
+    borrow >>= 32;
+  }
+  return (uint32_t) (-borrow);
+}
+
+/*------------------------------------------------------------------*/
+/* Field arithmetic mod p, all values fully reduced
+ *------------------------------------------------------------------*/
+static void fe_add(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  if ( int_add(r, a, b) || (int_cmp(r, _p) >= 0) ) int_sub(r, r, _p);
+}
+
+static void fe_sub(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  if ( int_sub(r, a, b) ) int_add(r, r, _p);
+}
+
+// r = a*b mod p, r may alias a or b
+static void fe_mul(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  uint32_t c[2*LIMB_COUNT];
+
+  // operand scanning, inner step is a single UMAAL on Cortex-M4
+  memset(c, 0, sizeof(c));
+  for(uint32_t i=0; i<LIMB_COUNT; i++)
+  {
+    uint32_t carry = 0;
+    for(uint32_t j=0; j<LIMB_COUNT; j++)
+    {
+      uint64_t const t = (uint64_t) a[i]*b[j] + c[i+j] + carry;
+      c[i+j] = (uint32_t) t;
+      carry  = (uint32_t) (t >> 32);
+    }
+    c[i+LIMB_COUNT] = carry;
+  }
+
+  // Fast reduction of FIPS 186-4 D.2.3: limb i of s1 + 2s2 + 2s3 + s4 + s5 - d1 - d2 - d3 - d4
+  int64_t acc;
+
+  acc  = (int64_t) c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14];
+  r[0] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15];
+  r[1] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[2] + c[10] + c[11] - c[13] - c[14] - c[15];
+  r[2] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[3] + 2*(int64_t) c[11] + 2*(int64_t) c[12] + c[13] - c[15] - c[8] - c[9];
+  r[3] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[4] + 2*(int64_t) c[12] + 2*(int64_t) c[13] + c[14] - c[9] - c[10];
+  r[4] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[5] + 2*(int64_t) c[13] + 2*(int64_t) c[14] + c[15] - c[10] - c[11];
+  r[5] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[6] + 3*(int64_t) c[14] + 2*(int64_t) c[15] + c[13] - c[8] - c[9];
+  r[6] = (uint32_t) acc; acc >>= 32;
+
+  acc += (int64_t) c[7] + 3*(int64_t) c[15] + c[8] - c[10] - c[11] - c[12] - c[13];
+  r[7] = (uint32_t) acc; acc >>= 32;
+
+  // fold the few multiples of 2^256 left over
+  int32_t top = (int32_t) acc;
+
+  while ( top > 0 ) top -= (int32_t) int_sub(r, r, _p);
+  while ( top < 0 ) top += (int32_t) int_add(r, r, _p);
+
+  if ( int_cmp(r, _p) >= 0 ) int_sub(r, r, _p);
+}
+
+static void fe_sqr(p256_int_t r, p256_int_t const a)
+{
+  fe_mul(r, a, a);
+}
+
+/*------------------------------------------------------------------*/
+/* Scalar arithmetic mod n, Montgomery multiplication
+ *------------------------------------------------------------------*/
+// r = a*b/R mod n, r may alias a or b
+static void sc_mont_mul(p256_int_t r, p256_int_t const a, p256_int_t const b)
+{
+  uint32_t t[LIMB_COUNT+2];
+  memset(t, 0, sizeof(t));
+
+  for(uint32_t i=0; i<LIMB_COUNT; i++)
+  {
+    uint32_t carry = 0;
+    uint64_t x;
+
+    for(uint32_t j=0; j<LIMB_COUNT; j++)
+    {
+      x     = (uint64_t) a[i]*b[j] + t[j] + carry;
+      t[j]  = (uint32_t) x;
+      carry = (uint32_t) (x >> 32);
+    }
+    x = (uint64_t) t[LIMB_COUNT] + carry;
+    t[LIMB_COUNT]   = (uint32_t) x;
+    t[LIMB_COUNT+1] = (uint32_t) (x >> 32);
+
+    // add m*n so that lowest limb becomes zero, then drop it
+    uint32_t const m = t[0] * N_INV32;
+
+    x     = (uint64_t) m*_n[0] + t[0];
+    carry = (uint32_t) (x >> 32);
+    for(uint32_t j=1; j<LIMB_COUNT; j++)
+    {
+      x      = (uint64_t) m*_n[j] + t[j] + carry;
+      t[j-1] = (uint32_t) x;
+      carry  = (uint32_t) (x >> 32);
+    }
+    x = (uint64_t) t[LIMB_COUNT] + carry;
+    t[LIMB_COUNT-1] = (uint32_t) x;
+    t[LIMB_COUNT]   = t[LIMB_COUNT+1] + (uint32_t) (x >> 32);
+  }
+
+  // t < 2n
+  if ( t[LIMB_COUNT] || (int_cmp(t, _n) >= 0) ) int_sub(t, t, _n);
+  memcpy(r, t, sizeof(p256_int_t));
+}
+
+// r = a^-1 * R mod n (Montgomery form) as a^(n-2), n is prime
+static void sc_inverse(p256_int_t r, p256_int_t const a)
+{
+  p256_int_t am;
+  sc_mont_mul(am, a, _n_rr);
+
+  // top bit of n-2 is set
+  memcpy(r, am, sizeof(p256_int_t));
+
+  for(int32_t bit=254; bit>=0; bit--)
+  {
+    uint32_t const limb = (bit < 32) ? (_n[0] - 2) : _n[bit/32];
+
+    sc_mont_mul(r, r, r);
+    if ( (limb >> (bit % 32)) & 1 ) sc_mont_mul(r, r, am);
+  }
+}
+
+/*------------------------------------------------------------------*/
+/* Point arithmetic
+ *------------------------------------------------------------------*/
+static bool point_is_valid(affine_point_t const* p)
+{
+  p256_int_t lhs, rhs;
+
+  if ( (int_cmp(p->x, _p) >= 0) || (int_cmp(p->y, _p) >= 0) ) return false;
+
+  // y^2 = x^3 - 3x + b
+  fe_sqr(rhs, p->x);
+  fe_mul(rhs, rhs, p->x);
+  fe_sub(rhs, rhs, p->x);
+  fe_sub(rhs, rhs, p->x);
+  fe_sub(rhs, rhs, p->x);
+  fe_add(rhs, rhs, _b);
+
+  fe_sqr(lhs, p->y);
+
+  return int_cmp(lhs, rhs) == 0;
+}
+
+// p = 2p, dbl-2001-b for a = -3: 3M + 5S
+static void point_double(jacobian_point_t* p)
+{
+  p256_int_t delta, gamma, beta, alpha, t;
+
+  fe_sqr(delta, p->z);
+  fe_sqr(gamma, p->y);
+  fe_mul(beta, p->x, gamma);
+
+  // alpha = 3(x - delta)(x + delta)
+  fe_sub(t, p->x, delta);
+  fe_add(alpha, p->x, delta);
+  fe_mul(alpha, alpha, t);
+  fe_add(t, alpha, alpha);
+  fe_add(alpha, alpha, t);
+
+  // z = (y + z)^2 - gamma - delta
+  fe_add(t, p->y, p->z);
+  fe_sqr(t, t);
+  fe_sub(t, t, gamma);
+  fe_sub(p->z, t, delta);
+
+  // x = alpha^2 - 8beta
+  fe_add(beta, beta, beta);
+  fe_add(beta, beta, beta);
+  fe_sqr(t, alpha);
+  fe_sub(t, t, beta);
+  fe_sub(p->x, t, beta);
+
+  // y = alpha(4beta - x) - 8gamma^2
+  fe_sub(t, beta, p->x);
+  fe_mul(t, alpha, t);
+  fe_sqr(gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_sub(p->y, t, gamma);
+}
+
+// p += q, q is affine when qz is NULL (8M + 3S) and Jacobian otherwise (12M + 4S).
+// q must not be the point at infinity.
+static void point_add(jacobian_point_t* p, p256_int_t const qx, p256_int_t const qy, p256_int_t const qz)
+{
+  p256_int_t u1, u2, s1, s2, h, r, t;
+
+  if ( int_is_zero(p->z) )
+  {
+    memcpy(p->x, qx, sizeof(p256_int_t));
+    memcpy(p->y, qy, sizeof(p256_int_t));
+
+    if ( qz )
+    {
+      memcpy(p->z, qz, sizeof(p256_int_t));
+    }else
+    {
+      memset(p->z, 0, sizeof(p256_int_t));
+      p->z[0] = 1;
+    }
+    return;
+  }
+
+  // u2 = qx*pz^2, s2 = qy*pz^3
+  fe_sqr(t, p->z);
+  fe_mul(u2, qx, t);
+  fe_mul(s2, qy, t);
+  fe_mul(s2, s2, p->z);
+
+  // u1 = px*qz^2, s1 = py*qz^3
+  if ( qz )
+  {
+    fe_sqr(t, qz);
+    fe_mul(u1, p->x, t);
+    fe_mul(s1, p->y, t);
+    fe_mul(s1, s1, qz);
+  }else
+  {
+    memcpy(u1, p->x, sizeof(p256_int_t));
+    memcpy(s1, p->y, sizeof(p256_int_t));
+  }
+
+  fe_sub(h, u2, u1);
+  fe_sub(r, s2, s1);
+
+  if ( int_is_zero(h) )
+  {
+    if ( int_is_zero(r) )
+    {
+      point_double(p);
+    }else
+    {
+      // q = -p
+      memset(p->z, 0, sizeof(p256_int_t));
+    }
+    return;
+  }
+
+  // z = pz*qz*h
+  fe_mul(p->z, p->z, h);
+  if ( qz ) fe_mul(p->z, p->z, qz);
+
+  // u1 = v = u1*h^2, h = h^3
+  fe_sqr(t, h);
+  fe_mul(u1, u1, t);
+  fe_mul(h, h, t);
+
+  // x = r^2 - h^3 - 2v
+  fe_sqr(t, r);
+  fe_sub(t, t, h);
+  fe_sub(t, t, u1);
+  fe_sub(p->x, t, u1);
+
+  // y = r(v - x) - s1*h^3
+  fe_sub(t, u1, p->x);
+  fe_mul(t, r, t);
+  fe_mul(s1, s1, h);
+  fe_sub(p->y, t, s1);
+}
+
+static uint32_t scalar_window(p256_int_t const k, uint32_t bit)
+{
+  uint32_t const i = bit / 32;
+  uint64_t w = k[i];
+
+  if ( i < LIMB_COUNT-1 ) w |= ((uint64_t) k[i+1]) << 32;
+
+  return ((uint32_t) (w >> (bit % 32))) & WINDOW_MASK;
+}
+
+/*------------------------------------------------------------------*/
+/* API
+ *------------------------------------------------------------------*/
+bool p256_ecdsa_verify(uint8_t const public_key[P256_PUBLIC_KEY_LEN], uint8_t const digest[32],
+                       uint8_t const signature[P256_SIGNATURE_LEN])
+{
+  p256_int_t r, s, e, w, u1, u2;
+  affine_point_t q;
+
+  int_load(r, signature);
+  int_load(s, signature + 32);
+
+  if ( int_is_zero(r) || int_is_zero(s) || (int_cmp(r, _n) >= 0) || (int_cmp(s, _n) >= 0) ) return false;
+
+  int_load(q.x, public_key);
+  int_load(q.y, public_key + 32);
+
+  if ( !point_is_valid(&q) ) return false;
+
+  // digest is already 256 bits, below 2n
+  int_load(e, digest);
+  if ( int_cmp(e, _n) >= 0 ) int_sub(e, e, _n);
+
+  // u1 = e/s, u2 = r/s: w is in Montgomery form, products come out in normal form
+  sc_inverse(w, s);
+  sc_mont_mul(u1, e, w);
+  sc_mont_mul(u2, r, w);
+
+  // 1Q .. (2^P256_WINDOW_BITS - 1)Q
+  jacobian_point_t q_mult[WINDOW_MASK];
+
+  memset(&q_mult[0], 0, sizeof(jacobian_point_t));
+  point_add(&q_mult[0], q.x, q.y, NULL);
+
+  for(uint32_t i=1; i<WINDOW_MASK; i++)
+  {
+    q_mult[i] = q_mult[i-1];
+    point_add(&q_mult[i], q.x, q.y, NULL);
+  }
+
+  // u1*G + u2*Q, doublings are shared by both scalars (Straus)
+  jacobian_point_t sum;
+  memset(&sum, 0, sizeof(sum));
+
+  for(int32_t bit = (WINDOW_COUNT-1)*P256_WINDOW_BITS; bit >= 0; bit -= P256_WINDOW_BITS)
+  {
+    if ( !int_is_zero(sum.z) )
+    {
+      for(uint32_t i=0; i<P256_WINDOW_BITS; i++) point_double(&sum);
+    }
+
+    uint32_t const g = scalar_window(u1, bit);
+    if ( g ) point_add(&sum, _g_mult[g-1].x, _g_mult[g-1].y, NULL);
+
+    uint32_t const k = scalar_window(u2, bit);
+    if ( k ) point_add(&sum, q_mult[k-1].x, q_mult[k-1].y, q_mult[k-1].z);
+  }
+
+  if ( int_is_zero(sum.z) ) return false;
+
+  // Affine x = X/Z^2 reduced mod n must be r. Since x < p < 2n, either x = r or x = r + n,
+  // check X = r*Z^2 instead of inverting Z.
+  p256_int_t zz, t;
+
+  fe_sqr(zz, sum.z);
+  fe_mul(t, r, zz);
+  if ( int_cmp(t, sum.x) == 0 ) return true;
+
+  if ( int_add(t, r, _n) || (int_cmp(t, _p) >= 0) ) return false;
+
+  fe_mul(t, t, zz);
+  return int_cmp(t, sum.x) == 0;
+}
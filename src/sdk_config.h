@@ -64,7 +64,7 @@
 // <e> HCI_MEM_POOL_ENABLED - hci_mem_pool - memory pool implementation used by HCI
 //==========================================================
 #define HCI_MEM_POOL_ENABLED               1
-#define HCI_TX_BUF_SIZE                    600 // not used
+#define HCI_TX_BUF_SIZE                    600 // readback frames
 #define HCI_RX_BUF_SIZE                    600
 #define HCI_RX_BUF_QUEUE_SIZE              8   // must be power of 2
 
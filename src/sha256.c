@@ -0,0 +1,179 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+static const uint32_t _k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+// rotations fold into the barrel shifter operand of EOR on Cortex-M4
+#define CH(x, y, z)   ((((y) ^ (z)) & (x)) ^ (z))
+#define MAJ(x, y, z)  (((x) & (y)) | (((x) | (y)) & (z)))
+#define EP0(x)        (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define EP1(x)        (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SIG0(x)       (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SIG1(x)       (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+// One round with the working variables renamed instead of shifted, so that
+// eight rounds in a row need no register moves at all
+#define ROUND(a, b, c, d, e, f, g, h, i) \
+  do { \
+    uint32_t const t1 = (h) + EP1(e) + CH(e, f, g) + _k[i] + w[i]; \
+    (d) += t1; \
+    (h)  = t1 + EP0(a) + MAJ(a, b, c); \
+  } while(0)
+
+/*------------------------------------------------------------------*/
+/* Internal
+ *------------------------------------------------------------------*/
+static inline uint32_t load_be32(uint8_t const* p)
+{
+  uint32_t w;
+  memcpy(&w, p, 4); // single (unaligned) LDR on Cortex-M4
+  return __builtin_bswap32(w);
+}
+
+static inline void store_be32(uint32_t w, uint8_t* p)
+{
+  w = __builtin_bswap32(w);
+  memcpy(p, &w, 4);
+}
+
+static void transform(uint32_t state[8], uint8_t const* data)
+{
+  uint32_t w[64];
+
+  for(uint32_t i=0; i<16; i++) w[i] = load_be32(data + 4*i);
+  for(uint32_t i=16; i<64; i++) w[i] = SIG1(w[i-2]) + w[i-7] + SIG0(w[i-15]) + w[i-16];
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+  // unrolled by 8 only: full unroll is ~4x the code for little gain, bootloader space is tight
+  for(uint32_t i=0; i<64; i+=8)
+  {
+    ROUND(a, b, c, d, e, f, g, h, i  );
+    ROUND(h, a, b, c, d, e, f, g, i+1);
+    ROUND(g, h, a, b, c, d, e, f, i+2);
+    ROUND(f, g, h, a, b, c, d, e, i+3);
+    ROUND(e, f, g, h, a, b, c, d, i+4);
+    ROUND(d, e, f, g, h, a, b, c, i+5);
+    ROUND(c, d, e, f, g, h, a, b, i+6);
+    ROUND(b, c, d, e, f, g, h, a, i+7);
+  }
+
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/*------------------------------------------------------------------*/
+/* API
+ *------------------------------------------------------------------*/
+void sha256_init(sha256_context_t* ctx)
+{
+  static const uint32_t iv[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memcpy(ctx->state, iv, sizeof(iv));
+  ctx->total_len = 0;
+  ctx->block_len = 0;
+}
+
+void sha256_update(sha256_context_t* ctx, void const* data, uint32_t len)
+{
+  uint8_t const* p = (uint8_t const*) data;
+
+  ctx->total_len += len;
+
+  // complete pending partial block first
+  if ( ctx->block_len )
+  {
+    uint32_t const n = (len < SHA256_BLOCK_LEN - ctx->block_len) ? len : (SHA256_BLOCK_LEN - ctx->block_len);
+
+    memcpy(ctx->block + ctx->block_len, p, n);
+    ctx->block_len += n;
+    p   += n;
+    len -= n;
+
+    if ( ctx->block_len < SHA256_BLOCK_LEN ) return;
+
+    transform(ctx->state, ctx->block);
+    ctx->block_len = 0;
+  }
+
+  // full blocks are hashed in place e.g straight from flash
+  while ( len >= SHA256_BLOCK_LEN )
+  {
+    transform(ctx->state, p);
+    p   += SHA256_BLOCK_LEN;
+    len -= SHA256_BLOCK_LEN;
+  }
+
+  memcpy(ctx->block, p, len);
+  ctx->block_len = len;
+}
+
+void sha256_final(sha256_context_t* ctx, uint8_t digest[SHA256_DIGEST_LEN])
+{
+  uint32_t n = ctx->block_len;
+
+  ctx->block[n++] = 0x80;
+
+  // no room for the 64-bit length: pad out this block and use another one
+  if ( n > SHA256_BLOCK_LEN - 8 )
+  {
+    memset(ctx->block + n, 0, SHA256_BLOCK_LEN - n);
+    transform(ctx->state, ctx->block);
+    n = 0;
+  }
+
+  memset(ctx->block + n, 0, SHA256_BLOCK_LEN - 8 - n);
+
+  // message length in bits, upper word only holds the 3 bits shifted out of total_len
+  store_be32(ctx->total_len >> 29, ctx->block + SHA256_BLOCK_LEN - 8);
+  store_be32(ctx->total_len << 3 , ctx->block + SHA256_BLOCK_LEN - 4);
+  transform(ctx->state, ctx->block);
+
+  for(uint32_t i=0; i<8; i++) store_be32(ctx->state[i], digest + 4*i);
+
+  memset(ctx, 0, sizeof(sha256_context_t));
+}
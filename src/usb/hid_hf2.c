@@ -0,0 +1,410 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+#include "uf2/uf2.h"
+
+#if CFG_TUD_HID_GENERIC
+
+#include "crc16.h"
+#include "flash_nrf5x.h"
+#include "sha256.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "dfu_readback.h"
+
+/* HF2 (HID Flashing Format) on the generic HID interface, see https://github.com/Microsoft/uf2/blob/master/hf2.md
+ * A command is split into 64-byte reports, reassembled here, executed and answered the same way.
+ * Pages are written with the same flash writer as UF2 and USB DFU, CHKSUM_PAGES lets host
+ * skip pages that already hold the right content.
+ */
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+
+// First byte of each report is packet type | payload length
+#define HF2_REPORT_SIZE         CFG_TUD_HID_BUFSIZE
+#define HF2_PAYLOAD_SIZE        (HF2_REPORT_SIZE - 1)
+
+#define HF2_FLAG_CMDPKT_BODY    0x00
+#define HF2_FLAG_CMDPKT_LAST    0x40
+#define HF2_FLAG_MASK           0xC0
+#define HF2_SIZE_MASK           0x3F
+
+// Largest command is WRITE_FLASH_PAGE: header + address + one flash page
+#define HF2_BUFSIZE             (8 + 4 + FLASH_PAGE_SIZE)
+
+#define HF2_MODE_BOOTLOADER     0x01
+
+enum
+{
+  HF2_CMD_BININFO               = 0x0001,
+  HF2_CMD_INFO                  = 0x0002,
+  HF2_CMD_RESET_INTO_APP        = 0x0003,
+  HF2_CMD_RESET_INTO_BOOTLOADER = 0x0004,
+  HF2_CMD_START_FLASH           = 0x0005,
+  HF2_CMD_WRITE_FLASH_PAGE      = 0x0006,
+  HF2_CMD_CHKSUM_PAGES          = 0x0007,
+  HF2_CMD_READ_WORDS            = 0x0008,
+};
+
+enum
+{
+  HF2_STATUS_OK          = 0x00,
+  HF2_STATUS_INVALID_CMD = 0x01,
+  HF2_STATUS_EXEC_ERR    = 0x02,
+};
+
+typedef struct ATTR_PACKED
+{
+  uint32_t cmd;
+  uint16_t tag;
+  uint8_t  reserved0;
+  uint8_t  reserved1;
+} hf2_command_t;
+
+typedef struct ATTR_PACKED
+{
+  uint16_t tag;
+  uint8_t  status;
+  uint8_t  status_info;
+} hf2_response_t;
+
+typedef struct ATTR_PACKED
+{
+  uint32_t mode;
+  uint32_t flash_page_size;
+  uint32_t flash_num_pages;
+  uint32_t max_message_size;
+  uint32_t family_id;
+} hf2_bininfo_t;
+
+TU_VERIFY_STATIC(HF2_PAYLOAD_SIZE <= HF2_SIZE_MASK, "payload length must fit in report header");
+
+// Command and its response share the buffer, host waits for response before sending next command
+static union
+{
+  uint32_t       buf32[HF2_BUFSIZE/4];
+  uint8_t        buf[HF2_BUFSIZE];
+  hf2_command_t  cmd;
+  hf2_response_t resp;
+} _hf2;
+
+static uint16_t _rx_count = 0; // command bytes received so far
+static uint16_t _tx_count = 0; // response length
+static uint16_t _tx_sent  = 0; // response bytes queued to host
+
+static uint32_t _hf2_end_addr = 0;       // end of written image, 0 if nothing is written
+static bool     _reset_pending = false;  // reset into application once response is sent
+
+uint16_t write_state_crc(uint32_t size);
+bool write_state_digest(uint32_t size, uint8_t digest[SHA256_DIGEST_LEN]);
+void write_state_crc_start(void);
+
+//--------------------------------------------------------------------+
+// HF2
+//--------------------------------------------------------------------+
+
+// Queue next report of the response
+static void send_next_report(void)
+{
+  if ( _tx_sent >= _tx_count ) return;
+
+  uint16_t const remain = _tx_count - _tx_sent;
+  uint8_t  const size   = (uint8_t) tu_min16(remain, HF2_PAYLOAD_SIZE);
+
+  // reports are fixed size, pad the last one
+  uint8_t report[HF2_REPORT_SIZE] = { 0 };
+  report[0] = (size == remain ? HF2_FLAG_CMDPKT_LAST : HF2_FLAG_CMDPKT_BODY) | size;
+  memcpy(report+1, _hf2.buf + _tx_sent, size);
+
+  if ( tud_hid_generic_report(0, report, sizeof(report)) ) _tx_sent += size;
+}
+
+static void send_response(uint16_t tag, uint8_t status, uint16_t data_len)
+{
+  _hf2.resp.tag         = tag;
+  _hf2.resp.status      = status;
+  _hf2.resp.status_info = 0;
+
+  _tx_count = sizeof(hf2_response_t) + data_len;
+  _tx_sent  = 0;
+
+  send_next_report();
+}
+
+// Check [addr, addr+len) is within flash that host is allowed to read
+static bool readable_range(uint32_t addr, uint32_t len)
+{
+  return (len <= USER_FLASH_END) && (addr <= USER_FLASH_END - len);
+}
+
+// READ_WORDS content, application and its data only if DFU_READBACK_APP
+static bool content_readable(uint32_t addr, uint32_t len)
+{
+  uint32_t const end = DFU_READBACK_APP ? USER_FLASH_END : USER_FLASH_START;
+  return (len <= end) && (addr <= end - len);
+}
+
+// Save settings of the written image (if any) then let bootloader reset into application
+static void reset_into_app(void)
+{
+  dfu_update_status_t update_status;
+  memset(&update_status, 0, sizeof(dfu_update_status_t ));
+
+  if ( !_hf2_end_addr )
+  {
+    update_status.status_code = DFU_RESET;
+    bootloader_dfu_update_process(update_status);
+    return;
+  }
+
+  flash_nrf5x_flush(true);
+  led_state(STATE_WRITING_FINISHED);
+
+  // Pages skipped by host (via CHKSUM_PAGES) could be at the end of image, keep size of
+  // current application if it is larger. CRC is computed on what is actually in flash.
+  uint32_t app_size = _hf2_end_addr - USER_FLASH_START;
+
+  bootloader_settings_t const * boot_setting;
+  bootloader_util_settings_get(&boot_setting);
+
+  // only if it is the application being replaced, not one running from bank 1
+  if ( (boot_setting->bank_0 == BANK_VALID_APP) && (bootloader_app_address() == USER_FLASH_START) &&
+       (boot_setting->bank_0_size <= USER_FLASH_WRITE_END - USER_FLASH_START) )
+  {
+    app_size = tu_max32(app_size, boot_setting->bank_0_size);
+  }
+
+  uint8_t app_digest[SHA256_DIGEST_LEN];
+
+  update_status.status_code  = DFU_UPDATE_APP_COMPLETE;
+  update_status.app_size     = app_size;
+  update_status.app_crc      = write_state_crc(app_size);
+  update_status.p_app_digest = write_state_digest(app_size, app_digest) ? app_digest : NULL;
+
+  bootloader_dfu_update_process(update_status);
+}
+
+// Execute a complete command in _hf2.buf
+static void process_command(uint16_t len)
+{
+  if ( len < sizeof(hf2_command_t) ) return;
+
+  uint32_t const cmd_id   = _hf2.cmd.cmd;
+  uint16_t const tag      = _hf2.cmd.tag;
+  uint16_t const data_len = len - sizeof(hf2_command_t);
+
+  // command arguments are 32-bit words following the header
+  uint32_t const arg0 = _hf2.buf32[2];
+  uint32_t const arg1 = _hf2.buf32[3];
+
+  // response data follows response header
+  uint8_t* resp_data = _hf2.buf + sizeof(hf2_response_t);
+  uint16_t const resp_max = sizeof(_hf2.buf) - sizeof(hf2_response_t);
+
+  switch ( cmd_id )
+  {
+    case HF2_CMD_BININFO:
+    {
+      hf2_bininfo_t const bininfo =
+      {
+        .mode             = HF2_MODE_BOOTLOADER,
+        .flash_page_size  = FLASH_PAGE_SIZE,
+        .flash_num_pages  = USER_FLASH_END / FLASH_PAGE_SIZE,
+        .max_message_size = HF2_BUFSIZE,
+        .family_id        = UF2_FAMILY_ID
+      };
+
+      memcpy(resp_data, &bininfo, sizeof(bininfo));
+      send_response(tag, HF2_STATUS_OK, sizeof(bininfo));
+    }
+    break;
+
+    case HF2_CMD_INFO:
+    {
+      extern const char infoUf2File[];
+
+      uint16_t const count = (uint16_t) tu_min32(strlen(infoUf2File), resp_max);
+      memcpy(resp_data, infoUf2File, count);
+      send_response(tag, HF2_STATUS_OK, count);
+    }
+    break;
+
+    case HF2_CMD_RESET_INTO_APP:
+      // reset once response reaches host
+      _reset_pending = true;
+      send_response(tag, HF2_STATUS_OK, 0);
+    break;
+
+    // already in bootloader, nothing to prepare for flashing
+    case HF2_CMD_RESET_INTO_BOOTLOADER:
+    case HF2_CMD_START_FLASH:
+      send_response(tag, HF2_STATUS_OK, 0);
+    break;
+
+    case HF2_CMD_WRITE_FLASH_PAGE:
+    {
+      uint32_t const addr  = arg0;
+      uint32_t const count = (data_len > 4) ? (data_len - 4u) : 0;
+
+      if ( !USB_RAW_WRITE || (count == 0) || (addr < USER_FLASH_START) || (addr > USER_FLASH_WRITE_END - count) )
+      {
+        send_response(tag, HF2_STATUS_EXEC_ERR, 0);
+        break;
+      }
+
+      if ( !_hf2_end_addr )
+      {
+        write_state_crc_start();
+        led_state(STATE_WRITING_STARTED);
+      }
+
+      // page is copied to flash cache, unchanged pages are not erased/programmed
+      flash_nrf5x_write(addr, _hf2.buf + sizeof(hf2_command_t) + 4, count, true);
+
+      _hf2_end_addr = tu_max32(_hf2_end_addr, addr + count);
+
+      send_response(tag, HF2_STATUS_OK, 0);
+    }
+    break;
+
+    case HF2_CMD_CHKSUM_PAGES:
+    {
+      uint32_t const addr      = arg0;
+      uint32_t const num_pages = arg1;
+
+      if ( (data_len < 8) || (num_pages > resp_max/2) || !readable_range(addr, num_pages*FLASH_PAGE_SIZE) )
+      {
+        send_response(tag, HF2_STATUS_EXEC_ERR, 0);
+        break;
+      }
+
+      // pages still in flash cache must be checksummed as host will see them
+      flash_nrf5x_flush(true);
+
+      // CRC16-CCITT with zero initial value (XMODEM) as specified by HF2
+      for(uint32_t i=0; i<num_pages; i++)
+      {
+        uint16_t const init = 0;
+        uint16_t const crc  = crc16_compute((uint8_t const*) (addr + i*FLASH_PAGE_SIZE), FLASH_PAGE_SIZE, &init);
+
+        resp_data[2*i]   = tu_u16_low(crc);
+        resp_data[2*i+1] = tu_u16_high(crc);
+      }
+
+      send_response(tag, HF2_STATUS_OK, (uint16_t) (2*num_pages));
+    }
+    break;
+
+    case HF2_CMD_READ_WORDS:
+    {
+      uint32_t const addr      = arg0;
+      uint32_t const num_words = arg1;
+
+      if ( (data_len < 8) || (num_words > resp_max/4) || !content_readable(addr, 4*num_words) )
+      {
+        send_response(tag, HF2_STATUS_EXEC_ERR, 0);
+        break;
+      }
+
+      flash_nrf5x_flush(true);
+
+      memcpy(resp_data, (void const*) addr, 4*num_words);
+      send_response(tag, HF2_STATUS_OK, (uint16_t) (4*num_words));
+    }
+    break;
+
+    default:
+      send_response(tag, HF2_STATUS_INVALID_CMD, 0);
+    break;
+  }
+}
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+
+void tud_hid_generic_out_cb(uint8_t const* report, uint16_t len)
+{
+  if ( len == 0 ) return;
+
+  uint8_t const type = report[0] & HF2_FLAG_MASK;
+  uint8_t const size = report[0] & HF2_SIZE_MASK;
+
+  // serial packets are not supported, malformed or oversize command is dropped
+  if ( (type != HF2_FLAG_CMDPKT_BODY && type != HF2_FLAG_CMDPKT_LAST) ||
+       (size > len - 1) || (_rx_count + size > sizeof(_hf2.buf)) )
+  {
+    _rx_count = 0;
+    return;
+  }
+
+  memcpy(_hf2.buf + _rx_count, report+1, size);
+  _rx_count += size;
+
+  if ( type == HF2_FLAG_CMDPKT_LAST )
+  {
+    uint16_t const count = _rx_count;
+    _rx_count = 0;
+
+    process_command(count);
+  }
+}
+
+void tud_hid_generic_report_complete_cb(void)
+{
+  if ( _tx_sent < _tx_count )
+  {
+    send_next_report();
+  }
+  else if ( _reset_pending )
+  {
+    _reset_pending = false;
+    reset_into_app();
+  }
+}
+
+// HF2 only uses interrupt endpoints, control GET_REPORT is stalled
+uint16_t tud_hid_generic_get_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
+{
+  (void) report_id;
+  (void) report_type;
+  (void) buffer;
+  (void) reqlen;
+
+  return 0;
+}
+
+void tud_hid_generic_set_report_cb(uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
+{
+  (void) report_id;
+  (void) report_type;
+  (void) buffer;
+  (void) bufsize;
+}
+
+#endif
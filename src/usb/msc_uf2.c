@@ -27,19 +27,109 @@
 
 #if CFG_TUD_MSC
 
+#include "sha256.h"
 #include "bootloader.h"
 
 /*------------------------------------------------------------------*/
 /* MACRO TYPEDEF CONSTANT ENUM
  *------------------------------------------------------------------*/
 
+// Number of sectors received by WRITE10 that can wait for msc_uf2_task() to
+// write them, default to two transfers worth.
+#ifndef CFG_UF2_WRITE_QUEUE
+#define CFG_UF2_WRITE_QUEUE   (2*CFG_TUD_MSC_BUFSIZE/512)
+#endif
+
+typedef struct
+{
+  uint32_t lba;
+  uint8_t  data[512] __attribute__((aligned(4)));
+} uf2_sector_t;
+
 /*------------------------------------------------------------------*/
 /* UF2
  *------------------------------------------------------------------*/
 static WriteState _wr_state = { 0 };
 
+// UF2 sectors are queued by WRITE10 callback and written from the main loop, so that
+// the stack can receive next transfer while flash is erased/programmed.
+static uf2_sector_t _wr_queue[CFG_UF2_WRITE_QUEUE];
+static uint8_t _wr_head  = 0; // oldest queued sector
+static uint8_t _wr_count = 0;
+
+// WRITE10 completed, check if file is complete once queue is drained
+static bool _wr_complete = false;
+
 void read_block(uint32_t block_no, uint8_t *data);
+int read_block_segments(uint32_t block_no, tud_msc_segment_t segs[], uint8_t max_segs, bool first_block);
 int write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state);
+bool write_state_verify(WriteState const *state);
+uint16_t write_state_crc(uint32_t size);
+bool write_state_digest(uint32_t size, uint8_t digest[SHA256_DIGEST_LEN]);
+
+// Write oldest queued sector to flash
+static void write_queue_pop(void)
+{
+  uf2_sector_t* sector = &_wr_queue[_wr_head];
+
+  write_block(sector->lba, sector->data, false, &_wr_state);
+
+  _wr_head = (_wr_head + 1) % CFG_UF2_WRITE_QUEUE;
+  _wr_count--;
+}
+
+// uf2 file writing is complete --> complete DFU process
+static void write_complete(void)
+{
+  if ( !(_wr_state.numBlocks && (_wr_state.numWritten >= _wr_state.numBlocks)) ) return;
+
+  // every block was refused (e.g CURRENT.UF2 of an application running from bank 1),
+  // flash is untouched and current application stays as it is
+  if ( !_wr_state.endAddr )
+  {
+    memset(&_wr_state, 0, sizeof(_wr_state));
+    led_state(STATE_USB_MOUNTED);
+    return;
+  }
+
+  dfu_update_status_t update_status;
+  memset(&update_status, 0, sizeof(dfu_update_status_t ));
+
+  // image does not match its checksum: invalidate app and stay in bootloader for another try
+  if ( !write_state_verify(&_wr_state) )
+  {
+    memset(&_wr_state, 0, sizeof(_wr_state));
+    led_state(STATE_USB_MOUNTED);
+
+    update_status.status_code = DFU_BANK_0_ERASED;
+    bootloader_dfu_update_process(update_status);
+    return;
+  }
+
+  led_state(STATE_WRITING_FINISHED);
+
+  uint8_t app_digest[SHA256_DIGEST_LEN];
+
+  update_status.status_code  = DFU_UPDATE_APP_COMPLETE;
+  update_status.app_size     = _wr_state.endAddr ? (_wr_state.endAddr - USER_FLASH_START) : 0;
+  update_status.app_crc      = write_state_crc(update_status.app_size);
+  update_status.p_app_digest = write_state_digest(update_status.app_size, app_digest) ? app_digest : NULL;
+
+  bootloader_dfu_update_process(update_status);
+}
+
+// Called from main loop after tud_task()
+void msc_uf2_task(void)
+{
+  // one sector at a time so that tud_task() still runs between page commits
+  if ( _wr_count ) write_queue_pop();
+
+  if ( _wr_complete && !_wr_count )
+  {
+    _wr_complete = false;
+    write_complete();
+  }
+}
 
 //--------------------------------------------------------------------+
 // tinyusb callbacks
@@ -103,7 +193,6 @@ int32_t tud_msc_scsi_cb (uint8_t lun, uint8_t const scsi_cmd[16], void* buffer,
 int32_t tud_msc_read10_cb (uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize)
 {
   (void) lun;
-  memset(buffer, 0, bufsize);
 
   // since we return block size each, offset should always be zero
   TU_ASSERT(offset == 0, -1);
@@ -122,43 +211,73 @@ int32_t tud_msc_read10_cb (uint8_t lun, uint32_t lba, uint32_t offset, void* buf
   return count;
 }
 
+// Callback invoked when received READ10 command, takes precedence over tud_msc_read10_cb().
+// Describe disk's data as segments (up to bufsize) which are assembled by the stack.
+int32_t tud_msc_read10_segments_cb (uint8_t lun, uint32_t lba, uint32_t offset,
+                                    tud_msc_segment_t segments[], uint8_t max_segments, uint32_t bufsize)
+{
+  (void) lun;
+
+  // since we return block size each, offset should always be zero
+  TU_ASSERT(offset == 0, -1);
+
+  uint32_t count = 0;
+  int32_t  nseg  = 0;
+
+  while ( count < bufsize )
+  {
+    int n = read_block_segments(lba, segments + nseg, max_segments - nseg, count == 0);
+
+    // out of segments or scratch buffer, stack will transfer this much and call us again
+    if ( n == 0 ) break;
+
+    lba++;
+    nseg  += n;
+    count += 512;
+  }
+
+  return nseg;
+}
+
 // Callback invoked when received WRITE10 command.
 // Process data in buffer to disk's storage and return number of written bytes
 int32_t tud_msc_write10_cb (uint8_t lun, uint32_t lba, uint32_t offset, uint8_t* buffer, uint32_t bufsize)
 {
   (void) lun;
 
+  // since we accept block size each, offset should always be zero
+  TU_ASSERT(offset == 0, -1);
+
   uint32_t count = 0;
-  int wr_ret;
 
-  while ( (count < bufsize) && ((wr_ret = write_block(lba, buffer, false, &_wr_state)) > 0) )
+  while ( count < bufsize )
   {
+    // Consider non-uf2 block write as successful, no need to queue it
+    if ( is_uf2_block(buffer) )
+    {
+      // Queue is full: write oldest sector now. Returning 0 (busy) does not work here since
+      // tud_task() would keep invoking us without letting msc_uf2_task() drain the queue.
+      if ( _wr_count == CFG_UF2_WRITE_QUEUE ) write_queue_pop();
+
+      uf2_sector_t* sector = &_wr_queue[(_wr_head + _wr_count) % CFG_UF2_WRITE_QUEUE];
+      sector->lba = lba;
+      memcpy(sector->data, buffer, 512);
+      _wr_count++;
+    }
+
     lba++;
     buffer += 512;
     count  += 512;
   }
 
-  // Consider non-uf2 block write as successful
-  return  (wr_ret < 0) ? bufsize : count;
+  return count;
 }
 
 // Callback invoked when WRITE10 command is completed (status received and accepted by host).
 void tud_msc_write10_complete_cb(uint8_t lun)
 {
-  // uf2 file writing is complete --> complete DFU process
-  if ( _wr_state.numBlocks && (_wr_state.numWritten >= _wr_state.numBlocks) )
-  {
-    led_state(STATE_WRITING_FINISHED);
-
-    dfu_update_status_t update_status;
-
-    memset(&update_status, 0, sizeof(dfu_update_status_t ));
-    update_status.status_code = DFU_UPDATE_APP_COMPLETE;
-    update_status.app_crc     = 0; // skip CRC checking with uf2 upgrade
-    update_status.app_size    = _wr_state.numBlocks*256;
-
-    bootloader_dfu_update_process(update_status);
-  }
+  (void) lun;
+  _wr_complete = true;
 }
 
 void tud_msc_capacity_cb(uint8_t lun, uint32_t* block_count, uint16_t* block_size)
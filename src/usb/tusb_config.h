@@ -32,7 +32,11 @@
 //--------------------------------------------------------------------+
 // COMMON CONFIGURATION
 //--------------------------------------------------------------------+
+// host builds select OPT_MCU_LINUX (USB/IP)
+#ifndef CFG_TUSB_MCU
 #define CFG_TUSB_MCU                OPT_MCU_NRF5X
+#endif
+
 #define CFG_TUSB_RHPORT0_MODE       OPT_MODE_DEVICE
 
 #ifndef CFG_TUSB_DEBUG
@@ -60,8 +64,9 @@
 #define CFG_TUD_MSC                 1
 #define CFG_TUD_HID_KEYBOARD        0
 #define CFG_TUD_HID_MOUSE           0
-#define CFG_TUD_HID_GENERIC         0 // not supported yet
-#define CFG_TUD_CUSTOM_CLASS        0
+#define CFG_TUD_HID_GENERIC         1 // HF2 flashing
+#define CFG_TUD_CUSTOM_CLASS        1 // vendor bulk DFU
+#define CFG_TUD_DFU                 1
 
 
 /*------------------------------------------------------------------*/
@@ -85,6 +90,19 @@
 // Buffer size for each read/write transfer, the more the better
 #define CFG_TUD_MSC_BUFSIZE         (4*1024)
 
+// Segments for scatter READ10, a UF2 block of CURRENT.UF2 takes 3 segments
+#define CFG_TUD_MSC_READ_SEGMENTS   (3*CFG_TUD_MSC_BUFSIZE/512)
+
+// Vendor bulk DFU: each OUT transfer holds a 4-byte header and up to a flash page of data
+#define CFG_TUD_CUSTOM_BUFSIZE      (4*1024 + CFG_TUD_CUSTOM_EPSIZE)
+#define CFG_TUD_CUSTOM_EPSIZE       64
+
+// USB DFU 1.1: one download block per flash page
+#define CFG_TUD_DFU_TRANSFER_SIZE   4096
+
+// HID generic report size, HF2 uses 64-byte reports
+#define CFG_TUD_HID_BUFSIZE         64
+
 // Vendor name included in Inquiry response, max 8 bytes
 #define CFG_TUD_MSC_VENDOR          "Adafruit"
 
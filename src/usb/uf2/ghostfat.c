@@ -1,14 +1,20 @@
 #include "compile_date.h"
 
 #include "uf2.h"
+#include "md5.h"
+#include "sha256.h"
 #include "flash_nrf5x.h"
 #include <string.h>
+#include <stdio.h>
 
 #include "boards.h"
 #include "tusb.h"
+#include "portable/nordic/nrf5x/dcd_nrf5x.h"
 
 #include "bootloader_settings.h"
 #include "bootloader.h"
+#include "crc16.h"
+#include "dfu_readback.h"
 
 typedef struct {
     uint8_t JumpInstruction[3];
@@ -52,11 +58,30 @@ STATIC_ASSERT(sizeof(DirEntry) == 32);
 
 struct TextFile {
   char const name[11];
-  char const *content;
+  char const *content; // static text, NULL for files generated from flash
+  uint32_t size;       // 0 if sized at runtime from the current application
+  uint32_t flashAddr;  // raw flash content, 0 for the UF2 image, FLASH_ADDR_APP for the application
+  int (*render)(char *buf, int bufsize); // text generated on each read, padded to size
 };
 
+// Location of a file on the volume, computed once by layout_init()
+typedef struct {
+  uint32_t size;
+  uint16_t startCluster;
+  uint16_t lastCluster;
+} FileLayout;
+
 #define NUM_FAT_BLOCKS UF2_NUM_BLOCKS
 
+// Current application, which runs from bank 1 after some updates with dual banks
+#define FLASH_ADDR_APP 1
+
+#ifdef DFU_DUAL_BANK
+#define CURRENT_FLASH_MAX  DFU_IMAGE_MAX_SIZE_BANKED
+#else
+#define CURRENT_FLASH_MAX  FLASH_SIZE
+#endif
+
 #define STR0(x) #x
 #define STR(x) STR0(x)
 
@@ -76,12 +101,26 @@ const char indexFile[] = //
     "</body>"
     "</html>\n";
 
-// WARNING -- code presumes only one NULL .content for .UF2 file
-//            and requires it be the last element of the array
+#define APPDATA_ADDR_START (BOOTLOADER_REGION_START - DFU_APP_DATA_RESERVED)
+
+static int render_info(char *buf, int bufsize);
+static int render_stats(char *buf, int bufsize);
+
 static struct TextFile const info[] = {
-    {.name = "INFO_UF2TXT", .content = infoUf2File},
-    {.name = "INDEX   HTM", .content = indexFile},
+    {.name = "INFO_UF2TXT", .render = render_info, .size = 512},
+    {.name = "STATS   TXT", .render = render_stats, .size = 512},
+    {.name = "INDEX   HTM", .content = indexFile  , .size = sizeof(indexFile) - 1},
+#if DFU_READBACK_APP
     {.name = "CURRENT UF2"},
+    {.name = "CURRENT BIN", .flashAddr = FLASH_ADDR_APP},
+#endif
+#if DFU_READBACK_APP && UF2_EXPORT_APPDATA && DFU_APP_DATA_RESERVED
+    {.name = "APPDATA BIN", .flashAddr = APPDATA_ADDR_START, .size = DFU_APP_DATA_RESERVED},
+#endif
+#if UF2_EXPORT_SETTINGS
+    // settings log: MBR params page followed by settings page
+    {.name = "SETTINGSBIN", .flashAddr = BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS, .size = 2*CODE_PAGE_SIZE},
+#endif
 };
 
 // WARNING -- code presumes each non-UF2 file content fits in single sector
@@ -95,9 +134,6 @@ STATIC_ASSERT(ARRAY_SIZE(indexFile) < 512);
 
 
 #define UF2_SIZE           (current_flash_size() * 2)
-#define UF2_SECTORS        (UF2_SIZE / 512)
-#define UF2_FIRST_SECTOR   (NUM_FILES + 1) // WARNING -- code presumes each non-UF2 file content fits in single sector
-#define UF2_LAST_SECTOR    (UF2_FIRST_SECTOR + UF2_SECTORS - 1)
 
 #define RESERVED_SECTORS   1
 #define ROOT_DIR_SECTORS   4
@@ -109,10 +145,10 @@ STATIC_ASSERT(ARRAY_SIZE(indexFile) < 512);
 #define START_CLUSTERS     (START_ROOTDIR + ROOT_DIR_SECTORS)
 
 // all directory entries must fit in a single sector
-// because otherwise current code overflows buffer
+// because only the first root directory sector is cached
 #define DIRENTRIES_PER_SECTOR (512/sizeof(DirEntry))
 
-STATIC_ASSERT(NUM_DIRENTRIES < DIRENTRIES_PER_SECTOR * ROOT_DIR_SECTORS);
+STATIC_ASSERT(NUM_DIRENTRIES <= DIRENTRIES_PER_SECTOR);
 
 
 static FAT_BootBlock const BootBlock = {
@@ -138,17 +174,19 @@ static FAT_BootBlock const BootBlock = {
 #define NRF_LOG_DEBUG(...)
 #define NRF_LOG_WARNING(...)
 
+// current application size, computed once per layout
+static uint32_t _flash_sz = 0;
+
 // get current.uf2 flash size in bytes, round up to 256 bytes
 static uint32_t current_flash_size(void)
 {
-  static uint32_t flash_sz = 0;
-  uint32_t result = flash_sz; // presumes atomic 32-bit read/write and static result
+  uint32_t result = _flash_sz; // presumes atomic 32-bit read/write and static result
 
   // only need to compute once
   if ( result == 0 )
   {
     // return 1 block of 256 bytes
-    if ( !bootloader_app_is_valid(DFU_BANK_0_REGION_START) )
+    if ( !bootloader_app_is_valid(bootloader_app_address()) )
     {
       result = 256;
     }else
@@ -167,15 +205,15 @@ static uint32_t current_flash_size(void)
 
       // if bank0 size is not valid, happens when flashed with jlink
       // use maximum application size
-      if ( (result == 0) || (result == 0xFFFFFFFFUL) )
+      if ( (result == 0) || (result > CURRENT_FLASH_MAX) )
       {
-        result = FLASH_SIZE;
+        result = CURRENT_FLASH_MAX;
       }
     }
-    flash_sz = result; // presumes atomic 32-bit read/write and static result
+    _flash_sz = result; // presumes atomic 32-bit read/write and static result
   }
 
-  return flash_sz;
+  return _flash_sz;
 }
 
 void padded_memcpy (char *dst, char const *src, int len)
@@ -190,95 +228,325 @@ void padded_memcpy (char *dst, char const *src, int len)
 }
 
 
+/*------------------------------------------------------------------*/
+/* Volume layout
+ *------------------------------------------------------------------*/
+static FileLayout _file_layout[NUM_FILES];
+
+// Root directory content never changes while mounted, build it only once
+static uint8_t _dir_sector[512] __attribute__((aligned(4)));
+static bool _layout_inited = false;
+
+static void layout_init(void)
+{
+  // Files are placed back to back starting at cluster 2
+  uint32_t cluster = 2;
+
+  for (uint32_t i = 0; i < NUM_FILES; i++) {
+    FileLayout *fl = &_file_layout[i];
+
+    if (info[i].content || info[i].render || info[i].size) {
+      fl->size = info[i].size;
+    } else {
+      // CURRENT.UF2 wraps every 256 bytes of flash in a 512-byte block
+      fl->size = info[i].flashAddr ? current_flash_size() : UF2_SIZE;
+    }
+
+    uint32_t sectors = (fl->size + 511) / 512;
+    if (sectors == 0) sectors = 1;
+
+    fl->startCluster = cluster;
+    fl->lastCluster  = cluster + sectors - 1;
+    cluster += sectors;
+  }
+
+  memset(_dir_sector, 0, sizeof(_dir_sector));
+  DirEntry *d = (void *) _dir_sector;
+
+  // volume label is first directory entry
+  padded_memcpy(d->name, (char const *) BootBlock.VolumeLabel, 11);
+  d->attrs = 0x28;
+  d++;
+
+  for (uint32_t i = 0; i < NUM_FILES; i++, d++) {
+    uint16_t startCluster = _file_layout[i].startCluster;
+
+    padded_memcpy(d->name, info[i].name, 11);
+    d->createTimeFine   = __SECONDS_INT__ % 2 * 100;
+    d->createTime       = __DOSTIME__;
+    d->createDate       = __DOSDATE__;
+    d->lastAccessDate   = __DOSDATE__;
+    d->highStartCluster = 0; // only used by FAT32
+    // DIR_WrtTime and DIR_WrtDate must be supported
+    d->updateTime       = __DOSTIME__;
+    d->updateDate       = __DOSDATE__;
+    d->startCluster     = startCluster;
+    d->size             = _file_layout[i].size;
+  }
+
+  _layout_inited = true;
+}
+
+/** Application has been erased or replaced, CURRENT.UF2 and CURRENT.BIN are sized again on next read */
+void ghostfat_layout_reset(void) {
+  _layout_inited = false;
+  _flash_sz = 0;
+}
+
+// Generate one FAT sector: each file is a single contiguous cluster chain,
+// so only the part of each chain falling into this sector is filled in.
+static void fat_sector(uint32_t sectionIdx, uint16_t *fat)
+{
+  uint32_t const first = sectionIdx * 256;
+  uint32_t const last  = first + 255;
+
+  if (sectionIdx == 0) {
+    fat[0] = 0xfff8; // first FAT entry must match BPB MediaDescriptor
+    fat[1] = 0xffff;
+  }
+
+  for (uint32_t i = 0; i < NUM_FILES; i++) {
+    FileLayout const *fl = &_file_layout[i];
+
+    uint32_t lo = (fl->startCluster > first) ? fl->startCluster : first;
+    uint32_t hi = (fl->lastCluster  < last ) ? fl->lastCluster  : last;
+    if (lo > hi) continue;
+
+    for (uint32_t v = lo; v < hi; v++) fat[v - first] = v + 1;
+    fat[hi - first] = (hi == fl->lastCluster) ? 0xffff : hi + 1;
+  }
+}
+
+/*------------------------------------------------------------------*/
+/* Telemetry
+ *------------------------------------------------------------------*/
+
+// UF2 transfer of this session
+static struct {
+    uint32_t bytes;    // payload bytes written to flash
+    uint32_t start_ms; // first block received
+    uint32_t last_ms;  // latest block received
+} _dfu_stats;
+
+static char const *reset_reason_str(uint32_t reason) {
+    if (reason & POWER_RESETREAS_RESETPIN_Msk) return "pin";
+    if (reason & POWER_RESETREAS_DOG_Msk) return "watchdog";
+    if (reason & POWER_RESETREAS_SREQ_Msk) return "soft";
+    if (reason & POWER_RESETREAS_LOCKUP_Msk) return "lockup";
+    if (reason & POWER_RESETREAS_OFF_Msk) return "wakeup";
+#ifdef POWER_RESETREAS_VBUS_Msk
+    if (reason & POWER_RESETREAS_VBUS_Msk) return "vbus";
+#endif
+    if (reason) return "other";
+    return "power-on";
+}
+
+static int render_info(char *buf, int bufsize) {
+    bootloader_settings_t const *settings;
+    bootloader_util_settings_get(&settings);
+
+    int len = snprintf(buf, bufsize, "%s", infoUf2File);
+
+    // text is already cut at bufsize, nothing more fits
+    if (len < 0 || len >= bufsize) return len;
+
+    // bootloader_app_is_valid() compares the recorded CRC with flash, unless none is recorded
+    if (!bootloader_app_is_valid(bootloader_app_address())) {
+        len += snprintf(buf + len, bufsize - len, "App: none\r\n");
+    } else if (settings->bank_0_crc) {
+        len += snprintf(buf + len, bufsize - len, "App: valid, CRC %04X matches flash\r\n", settings->bank_0_crc);
+    } else {
+        len += snprintf(buf + len, bufsize - len, "App: valid, CRC not checked\r\n");
+    }
+
+    return len;
+}
+
+static int render_stats(char *buf, int bufsize) {
+    boot_stats_t const *boot = boot_stats_get();
+    flash_nrf5x_stats_t const *flash = flash_nrf5x_stats();
+    uint32_t const *phase = boot->phase_end_us;
+
+    uint32_t dfu_ms = _dfu_stats.last_ms - _dfu_stats.start_ms;
+    uint32_t dfu_bps = dfu_ms ? (uint32_t) (((uint64_t) _dfu_stats.bytes * 1000) / dfu_ms) : 0;
+
+    // EasyDMA packets of all endpoints, and how many had to wait for another endpoint
+    uint32_t dma_xact = 0, dma_wait = 0;
+    for (uint8_t ep = 0; ep < 8; ep++) {
+        for (uint8_t dir = 0; dir < 2; dir++) {
+            dcd_nrf5x_stats_t const *usb = dcd_nrf5x_stats(dir ? (ep | 0x80) : ep);
+            dma_xact += usb->xact_count;
+            dma_wait += usb->dma_wait_count;
+        }
+    }
+
+    return snprintf(buf, bufsize,
+        "Reset-Reason: %s (0x%08lX)\r\n"
+        "Boot-Count: %u\r\n"
+        "Board-Init-us: %lu\r\n"
+        "Bootloader-Init-us: %lu\r\n"
+        "DFU-Init-us: %lu\r\n"
+        "Uptime-ms: %lu\r\n"
+        "DFU-Bytes: %lu\r\n"
+        "DFU-Duration-ms: %lu\r\n"
+        "DFU-Throughput-Bps: %lu\r\n"
+        "Flash-Erases: %lu\r\n"
+        "Flash-Programs: %lu\r\n"
+        "USB-DMA-Packets: %lu\r\n"
+        "USB-DMA-Waits: %lu\r\n",
+        reset_reason_str(boot->reset_reason), boot->reset_reason,
+        boot->boot_count,
+        phase[BOOT_PHASE_BOARD_INIT],
+        phase[BOOT_PHASE_BOOTLOADER_INIT] - phase[BOOT_PHASE_BOARD_INIT],
+        phase[BOOT_PHASE_DFU_INIT] - phase[BOOT_PHASE_BOOTLOADER_INIT],
+        tusb_hal_millis(),
+        _dfu_stats.bytes, dfu_ms, dfu_bps,
+        flash->erase_count, flash->program_count,
+        dma_xact, dma_wait);
+}
+
 /*------------------------------------------------------------------*/
 /* Read
  *------------------------------------------------------------------*/
-void read_block(uint32_t block_no, uint8_t *data) {
-    memset(data, 0, 512);
-    uint32_t sectionIdx = block_no;
+
+// Sectors are described as segments (templates, pointers into flash) and
+// assembled by the MSC driver straight into its transfer buffer.
+#define UF2_PAYLOAD_SIZE  256
+#define UF2_HEADER_SLOTS  (CFG_TUD_MSC_BUFSIZE / 512)
+
+// 32 byte header, the only part of a UF2 block that varies
+typedef struct {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t flags;
+    uint32_t targetAddr;
+    uint32_t payloadSize;
+    uint32_t blockNo;
+    uint32_t numBlocks;
+    uint32_t familyID;
+} UF2_Header;
+
+// Padding after the payload, ending with the closing magic
+typedef struct {
+    uint8_t padding[sizeof(UF2_Block) - sizeof(UF2_Header) - UF2_PAYLOAD_SIZE - 4];
+    uint32_t magicEnd;
+} UF2_Tail;
+
+STATIC_ASSERT(sizeof(UF2_Header) == offsetof(UF2_Block, data));
+STATIC_ASSERT(sizeof(UF2_Header) + UF2_PAYLOAD_SIZE + sizeof(UF2_Tail) == 512);
+
+static UF2_Tail const _uf2_tail = { .magicEnd = UF2_MAGIC_END };
+static uint8_t const _boot_signature[2] = { 0x55, 0xaa };
+
+// One header per block of a transfer, headers are only the varying part of a UF2 block
+static UF2_Header _uf2_header[UF2_HEADER_SLOTS];
+
+// Generated FAT or text sector, shared by all blocks of a transfer
+static uint32_t _sector_scratch[128];
+
+#define SEGMENT(_buf, _len)  do { segs[n].buffer = (_buf); segs[n].len = (_len); n++; } while(0)
+
+/** Describe a sector as list of segments
+ *
+ * @param first_block true if this is the first block of the transfer, FAT and text
+ *        sectors are generated into a single scratch buffer and can only come first
+ * @return number of segments, 0 if they do not fit into max_segs or the scratch
+ *         buffer is in use, caller must then transfer what it has and retry
+ */
+int read_block_segments(uint32_t block_no, tud_msc_segment_t segs[], uint8_t max_segs, bool first_block) {
+    int n = 0;
+
+    if (!_layout_inited) layout_init();
+
+    // a sector never takes more than 3 segments
+    if (max_segs < 3) return 0;
 
     if (block_no == 0) { // Requested boot block
-        memcpy(data, &BootBlock, sizeof(BootBlock));
-        data[510] = 0x55;
-        data[511] = 0xaa;
-        // logval("data[0]", data[0]);
+        SEGMENT(&BootBlock, sizeof(BootBlock));
+        SEGMENT(NULL, 510 - sizeof(BootBlock));
+        SEGMENT(_boot_signature, 2);
     } else if (block_no < START_ROOTDIR) {  // Requested FAT table sector
-        sectionIdx -= START_FAT0;
-        // logval("sidx", sectionIdx);
+        uint32_t sectionIdx = block_no - START_FAT0;
         if (sectionIdx >= SECTORS_PER_FAT)
             sectionIdx -= SECTORS_PER_FAT; // second FAT is same as the first...
-        if (sectionIdx == 0) {
-            data[0] = 0xf8; // first FAT entry must match BPB MediaDescriptor
-            // WARNING -- code presumes only one NULL .content for .UF2 file
-            //            and all non-NULL .content fit in one sector
-            //            and requires it be the last element of the array
-            for (int i = 1; i < NUM_FILES * 2 + 4; ++i) {
-                data[i] = 0xff;
-            }
-        }
-        for (int i = 0; i < 256; ++i) { // Generate the FAT chain for the firmware "file"
-            uint32_t v = sectionIdx * 256 + i;
-            if (UF2_FIRST_SECTOR <= v && v <= UF2_LAST_SECTOR)
-                ((uint16_t *)(void *)data)[i] = v == UF2_LAST_SECTOR ? 0xffff : v + 1;
-        }
-    } else if (block_no < START_CLUSTERS) { // Requested root directory sector
 
-        sectionIdx -= START_ROOTDIR;
-
-        DirEntry *d = (void *)data;
-        int remainingEntries = DIRENTRIES_PER_SECTOR;
-        if (sectionIdx == 0) { // volume label first
-            // volume label is first directory entry
-            padded_memcpy(d->name, (char const *) BootBlock.VolumeLabel, 11);
-            d->attrs = 0x28;
-            d++;
-            remainingEntries--;
-        }
-
-        for (int i = DIRENTRIES_PER_SECTOR * sectionIdx;
-             remainingEntries > 0 && i < NUM_FILES;
-             i++, d++) {
-
-            // WARNING -- code presumes all but last file take exactly one sector
-            uint16_t startCluster = i + 2;
-
-            struct TextFile const * inf = &info[i];
-            padded_memcpy(d->name, inf->name, 11);
-            d->createTimeFine   = __SECONDS_INT__ % 2 * 100;
-            d->createTime       = __DOSTIME__;
-            d->createDate       = __DOSDATE__;
-            d->lastAccessDate   = __DOSDATE__;
-            d->highStartCluster = startCluster >> 8;
-            // DIR_WrtTime and DIR_WrtDate must be supported
-            d->updateTime       = __DOSTIME__;
-            d->updateDate       = __DOSDATE__;
-            d->startCluster     = startCluster & 0xFF;
-            // WARNING -- code presumes only one NULL .content for .UF2 file
-            //            and requires it be the last element of the array
-            d->size = inf->content ? strlen(inf->content) : UF2_SIZE;
-        }
+        if (!first_block) return 0;
 
+        memset(_sector_scratch, 0, sizeof(_sector_scratch));
+        fat_sector(sectionIdx, (uint16_t *) _sector_scratch);
+        SEGMENT(_sector_scratch, 512);
+    } else if (block_no < START_CLUSTERS) { // Requested root directory sector
+        SEGMENT((block_no == START_ROOTDIR) ? _dir_sector : NULL, 512);
     } else {
-        sectionIdx -= START_CLUSTERS;
-        if (sectionIdx < NUM_FILES - 1) {
-            memcpy(data, info[sectionIdx].content, strlen(info[sectionIdx].content));
-        } else { // generate the UF2 file data on-the-fly
-            sectionIdx -= NUM_FILES - 1;
-            uint32_t addr = USER_FLASH_START + sectionIdx * 256;
-            if (addr < USER_FLASH_START+FLASH_SIZE) {
-                UF2_Block *bl = (void *)data;
+        uint32_t cluster = block_no - START_CLUSTERS + 2;
+
+        for (uint32_t i = 0; i < NUM_FILES; i++) {
+            FileLayout const *fl = &_file_layout[i];
+            if (cluster < fl->startCluster || cluster > fl->lastCluster) continue;
+
+            uint32_t sectionIdx = cluster - fl->startCluster;
+
+            if (info[i].render) {
+                if (!first_block) return 0;
+
+                // WARNING -- code presumes rendered files fit in single sector
+                char *text = (char *) _sector_scratch;
+                int len = info[i].render(text, info[i].size);
+                if (len < 0) len = 0;
+                if (len > (int) info[i].size) len = info[i].size;
+                memset(text + len, ' ', info[i].size - len);
+
+                SEGMENT(text, info[i].size);
+                if (info[i].size < 512) SEGMENT(NULL, 512 - info[i].size);
+            } else if (info[i].content) {
+                // WARNING -- code presumes each non-UF2 file content fits in single sector
+                SEGMENT(info[i].content, info[i].size);
+                SEGMENT(NULL, 512 - info[i].size);
+            } else if (info[i].flashAddr) { // raw flash, served directly
+                uint32_t base = (info[i].flashAddr == FLASH_ADDR_APP) ? bootloader_app_address() : info[i].flashAddr;
+                uint32_t offset = sectionIdx * 512;
+                uint32_t len = fl->size - offset;
+                if (len > 512) len = 512;
+
+                SEGMENT((void const *) (base + offset), len);
+                if (len < 512) SEGMENT(NULL, 512 - len);
+            } else { // generate the UF2 file data on-the-fly
+                uint32_t addr = bootloader_app_address() + sectionIdx * UF2_PAYLOAD_SIZE;
+
+                UF2_Header *bl = &_uf2_header[block_no % UF2_HEADER_SLOTS];
                 bl->magicStart0 = UF2_MAGIC_START0;
                 bl->magicStart1 = UF2_MAGIC_START1;
-                bl->magicEnd = UF2_MAGIC_END;
-                bl->blockNo = sectionIdx;
-                bl->numBlocks = current_flash_size() / 256;
-                bl->targetAddr = addr;
-                bl->payloadSize = 256;
                 bl->flags = UF2_FLAG_FAMILYID;
+                bl->targetAddr = addr;
+                bl->payloadSize = UF2_PAYLOAD_SIZE;
+                bl->blockNo = sectionIdx;
+                bl->numBlocks = current_flash_size() / UF2_PAYLOAD_SIZE;
                 bl->familyID = UF2_FAMILY_ID;
-                memcpy(bl->data, (void *)addr, bl->payloadSize);
+
+                SEGMENT(bl, sizeof(UF2_Header));
+                SEGMENT((void const *) addr, UF2_PAYLOAD_SIZE);
+                SEGMENT(&_uf2_tail, sizeof(_uf2_tail));
             }
+            break;
         }
+
+        // free cluster
+        if (n == 0) SEGMENT(NULL, 512);
+    }
+
+    return n;
+}
+
+void read_block(uint32_t block_no, uint8_t *data) {
+    tud_msc_segment_t segs[3];
+    int count = read_block_segments(block_no, segs, ARRAY_SIZE(segs), true);
+
+    for (int i = 0; i < count; i++) {
+        if (segs[i].buffer)
+            memcpy(data, segs[i].buffer, segs[i].len);
+        else
+            memset(data, 0, segs[i].len);
+        data += segs[i].len;
     }
 }
 
@@ -286,10 +554,157 @@ void read_block(uint32_t block_no, uint8_t *data) {
 /* Write UF2
  *------------------------------------------------------------------*/
 
+// The image CRC is combined from per-page CRCs taken as each page is committed
+// to flash, so pages may be flashed in any order without reading the image back.
+#define IMAGE_PAGES (FLASH_SIZE / FLASH_PAGE_SIZE)
+
+static uint16_t _page_crc[IMAGE_PAGES]; // CRC16 of page content with zero initial value
+static uint8_t _page_crc_valid[(IMAGE_PAGES + 7) / 8];
+
+// SHA-256 of the image is streamed from pages committed in address order from USER_FLASH_START,
+// as UF2 files are usually written. The last committed page is hashed only once the next one
+// comes (or when the image size is known), any other order ends the stream.
+static sha256_context_t _image_sha256;
+static uint32_t _image_sha256_len;  // bytes of image hashed
+static uint32_t _image_sha256_next; // address of next page to be committed in order
+static bool _image_sha256_valid;
+
+static void page_committed(uint32_t addr, uint8_t const *page) {
+    if (addr < USER_FLASH_START || addr >= USER_FLASH_END) return;
+
+    uint32_t const idx = (addr - USER_FLASH_START) / FLASH_PAGE_SIZE;
+    uint16_t const zero = 0;
+
+    _page_crc[idx] = crc16_compute(page, FLASH_PAGE_SIZE, &zero);
+    _page_crc_valid[idx / 8] |= 1 << (idx % 8);
+
+    if (_image_sha256_valid && (addr == _image_sha256_next)) {
+        // previous page is final now
+        if (addr > USER_FLASH_START) {
+            sha256_update(&_image_sha256, (void const *) (addr - FLASH_PAGE_SIZE), FLASH_PAGE_SIZE);
+            _image_sha256_len += FLASH_PAGE_SIZE;
+        }
+        _image_sha256_next += FLASH_PAGE_SIZE;
+    } else {
+        _image_sha256_valid = false;
+    }
+}
+
+// a * b modulo the CRC16-CCITT polynomial
+static uint16_t crc16_mulmod(uint16_t a, uint16_t b) {
+    uint16_t r = 0;
+    for (int i = 15; i >= 0; i--) {
+        r = (r << 1) ^ ((r & 0x8000) ? 0x1021 : 0);
+        if (b & (1u << i)) r ^= a;
+    }
+    return r;
+}
+
+// x^(8*len) modulo the polynomial, i.e the effect of len bytes on a CRC
+static uint16_t crc16_xpow(uint32_t len) {
+    uint16_t base = 0x0100; // x^8
+    uint16_t result = 1;
+    while (len) {
+        if (len & 1) result = crc16_mulmod(result, base);
+        base = crc16_mulmod(base, base);
+        len >>= 1;
+    }
+    return result;
+}
+
+/** CRC16 of the first size bytes of the application, same as bootloader_app_is_valid() computes
+ *
+ * Pages committed during this transfer use their recorded CRC, others (unchanged
+ * pages, partial last page) are read from flash.
+ */
+uint16_t write_state_crc(uint32_t size) {
+    uint16_t const xpage = crc16_xpow(FLASH_PAGE_SIZE);
+    uint16_t crc = 0xFFFF;
+
+    for (uint32_t offset = 0; offset < size; offset += FLASH_PAGE_SIZE) {
+        uint32_t const idx = offset / FLASH_PAGE_SIZE;
+        uint32_t const len = (size - offset < FLASH_PAGE_SIZE) ? (size - offset) : FLASH_PAGE_SIZE;
+
+        if ((len == FLASH_PAGE_SIZE) && (_page_crc_valid[idx / 8] & (1 << (idx % 8)))) {
+            // crc(A || B) = crc(A) * x^(8*len(B)) + crc_0(B)
+            crc = crc16_mulmod(crc, xpage) ^ _page_crc[idx];
+        } else {
+            crc = crc16_compute((uint8_t const *) (USER_FLASH_START + offset), len, &crc);
+        }
+    }
+
+    return crc;
+}
+
+/** SHA-256 of the first size bytes of the application, streamed while pages were committed
+ *
+ * @return false if pages were not committed in order or do not cover size
+ */
+bool write_state_digest(uint32_t size, uint8_t digest[SHA256_DIGEST_LEN]) {
+    if (!_image_sha256_valid || size < _image_sha256_len ||
+        size > _image_sha256_next - USER_FLASH_START) {
+        return false;
+    }
+
+    // remaining part of the last committed page
+    sha256_update(&_image_sha256, (void const *) (USER_FLASH_START + _image_sha256_len),
+                  size - _image_sha256_len);
+    sha256_final(&_image_sha256, digest);
+
+    _image_sha256_valid = false;
+    return true;
+}
+
+/** Record CRC and SHA-256 of pages committed from now on, used by write_state_crc() and write_state_digest() */
+void write_state_crc_start(void) {
+    // CRCs recorded by a previous transfer may no longer match flash
+    memset(_page_crc_valid, 0, sizeof(_page_crc_valid));
+
+    sha256_init(&_image_sha256);
+    _image_sha256_len = 0;
+    _image_sha256_next = USER_FLASH_START;
+    _image_sha256_valid = true;
+
+    flash_nrf5x_set_commit_cb(page_committed);
+}
+
+static UF2_Checksum const *block_checksum(UF2_Block const *bl) {
+    return (UF2_Checksum const *) (bl->data + sizeof(bl->data) - sizeof(UF2_Checksum));
+}
+
+// [addr, addr + size) lies within [start, end), in a form that cannot wrap around
+static bool range_within(uint32_t addr, uint32_t size, uint32_t start, uint32_t end) {
+    return (size <= end - start) && (addr - start <= end - start - size);
+}
+
+// Check if flash range already holds the content described by checksum
+static bool checksum_match(UF2_Checksum const *cs) {
+    if (!range_within(cs->targetAddr, cs->size, USER_FLASH_START, USER_FLASH_END)) {
+        return false;
+    }
+
+    md5_context_t ctx;
+    uint8_t digest[16];
+
+    md5_init(&ctx);
+    md5_update(&ctx, (void const *) cs->targetAddr, cs->size);
+    md5_final(&ctx, digest);
+
+    return memcmp(digest, cs->md5, sizeof(digest)) == 0;
+}
+
+/** Verify flashed image against the whole-image checksum carried by the UF2 file
+ *
+ * @return true if the file has no image checksum or flash matches it
+ */
+bool write_state_verify(WriteState const *state) {
+    return !state->hasImageChecksum || checksum_match(&state->imageChecksum);
+}
+
 /** Write an block
  *
  * @return number of bytes processed, only 3 following values
- *  -1 : if not an uf2 block
+ *  -1 : if not an uf2 block, or unsigned images are refused (USB_RAW_WRITE)
  * 512 : write is successful
  *   0 : is busy with flashing, tinyusb stack will call write_block again with the same parameters later on
  */
@@ -302,13 +717,26 @@ int write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state)
         return -1;
     }
 
+#if !USB_RAW_WRITE
+    // unsigned image, refused as a whole
+    return -1;
+#endif
+
     // only accept block with same family id
     if ( UF2_FAMILY_ID && !((bl->flags & UF2_FLAG_FAMILYID) && (bl->familyID == UF2_FAMILY_ID)) ) {
       return -1;
     }
 
-    if ((bl->flags & UF2_FLAG_NOFLASH) || bl->payloadSize > 256 || (bl->targetAddr & 0xff) ||
-        bl->targetAddr < USER_FLASH_START || bl->targetAddr + bl->payloadSize > USER_FLASH_END) {
+    // payload can be up to 476 bytes at any alignment, flash writer handles page crossing
+    // unless the end of data[] is taken by a checksum
+    uint32_t maxPayload = sizeof(bl->data);
+    if (bl->flags & UF2_FLAG_MD5) maxPayload -= sizeof(UF2_Checksum);
+
+    // completion is tracked per block number in writtenMask, a file with more blocks than it
+    // can hold (full size image in small payloads) is refused as a whole rather than never
+    // completing half written
+    if ((bl->flags & UF2_FLAG_NOFLASH) || bl->payloadSize > maxPayload || bl->numBlocks >= MAX_BLOCKS ||
+        !range_within(bl->targetAddr, bl->payloadSize, USER_FLASH_START, USER_FLASH_WRITE_END)) {
 #if USE_DBG_MSC
         if (!quiet)
             logval("invalid target addr", bl->targetAddr);
@@ -316,17 +744,42 @@ int write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state)
         NRF_LOG_WARNING("Skip block at %x", bl->targetAddr);
         // this happens when we're trying to re-flash CURRENT.UF2 file previously
         // copied from a device; we still want to count these blocks to reset properly
+
+        // comment block with checksum describes the whole image
+        if (state && (bl->flags & UF2_FLAG_NOFLASH) && (bl->flags & UF2_FLAG_MD5)) {
+            memcpy(&state->imageChecksum, block_checksum(bl), sizeof(UF2_Checksum));
+            state->hasImageChecksum = true;
+        }
+    } else if ((bl->flags & UF2_FLAG_MD5) && checksum_match(block_checksum(bl))) {
+        // flash already has this range, nothing to write
+        NRF_LOG_DEBUG("Same block at %x", bl->targetAddr);
+
+        if (state) {
+            state->numSkipped++;
+            if (bl->targetAddr + bl->payloadSize > state->endAddr) {
+                state->endAddr = bl->targetAddr + bl->payloadSize;
+            }
+        }
     } else {
         // logval("write block at", bl->targetAddr);
         NRF_LOG_DEBUG("Write block at %x", bl->targetAddr);
 
-        static bool first_write = true;
-        if ( first_write ) {
-          first_write = false;
+        // state is cleared when a transfer is given up, recording starts again with the next one
+        if (state && !state->started) {
+          state->started = true;
           led_state(STATE_WRITING_STARTED);
+          write_state_crc_start();
         }
 
         flash_nrf5x_write(bl->targetAddr, bl->data, bl->payloadSize, true);
+
+        _dfu_stats.last_ms = tusb_hal_millis();
+        if (!_dfu_stats.bytes) _dfu_stats.start_ms = _dfu_stats.last_ms;
+        _dfu_stats.bytes += bl->payloadSize;
+
+        if (state && (bl->targetAddr + bl->payloadSize > state->endAddr)) {
+            state->endAddr = bl->targetAddr + bl->payloadSize;
+        }
     }
 
     if (state && bl->numBlocks) {
@@ -0,0 +1,141 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "md5.h"
+
+//--------------------------------------------------------------------+
+// MACRO TYPEDEF CONSTANT ENUM DECLARATION
+//--------------------------------------------------------------------+
+
+// per-round shift amounts
+static uint8_t const _shift[64] =
+{
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// floor(abs(sin(i+1)) * 2^32)
+static uint32_t const _k[64] =
+{
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+//--------------------------------------------------------------------+
+// IMPLEMENTATION
+//--------------------------------------------------------------------+
+static void md5_transform(uint32_t state[4], uint8_t const block[64])
+{
+  uint32_t m[16];
+  for(uint8_t i=0; i<16; i++)
+  {
+    m[i] = block[i*4] | (block[i*4+1] << 8) | (block[i*4+2] << 16) | ((uint32_t) block[i*4+3] << 24);
+  }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+  for(uint8_t i=0; i<64; i++)
+  {
+    uint32_t f;
+    uint8_t  g;
+
+    switch (i / 16)
+    {
+      case 0 : f = (b & c) | (~b & d); g = i;              break;
+      case 1 : f = (d & b) | (~d & c); g = (5*i + 1) % 16; break;
+      case 2 : f = b ^ c ^ d;          g = (3*i + 5) % 16; break;
+      default: f = c ^ (b | ~d);       g = (7*i) % 16;     break;
+    }
+
+    f += a + _k[i] + m[g];
+    a  = d;
+    d  = c;
+    c  = b;
+    b += (f << _shift[i]) | (f >> (32 - _shift[i]));
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void md5_init(md5_context_t* ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->count    = 0;
+}
+
+void md5_update(md5_context_t* ctx, void const* data, uint32_t len)
+{
+  uint8_t const* p = (uint8_t const*) data;
+  uint32_t used = ctx->count % 64;
+
+  ctx->count += len;
+
+  while ( len )
+  {
+    uint32_t n = 64 - used;
+    if ( n > len ) n = len;
+
+    memcpy(ctx->buf + used, p, n);
+    used += n;
+    p    += n;
+    len  -= n;
+
+    if ( used == 64 )
+    {
+      md5_transform(ctx->state, ctx->buf);
+      used = 0;
+    }
+  }
+}
+
+void md5_final(md5_context_t* ctx, uint8_t digest[16])
+{
+  uint64_t const bits = ((uint64_t) ctx->count) * 8;
+  uint8_t  const pad  = 0x80;
+  uint8_t  const zero = 0;
+
+  md5_update(ctx, &pad, 1);
+  while ( ctx->count % 64 != 56 ) md5_update(ctx, &zero, 1);
+
+  uint8_t len_le[8];
+  for(uint8_t i=0; i<8; i++) len_le[i] = (uint8_t) (bits >> (8*i));
+  md5_update(ctx, len_le, 8);
+
+  for(uint8_t i=0; i<16; i++) digest[i] = (uint8_t) (ctx->state[i/4] >> (8*(i%4)));
+}
@@ -52,11 +52,24 @@ extern bool sdRunning;
 // If set, the block is "comment" and should not be flashed to the device
 #define UF2_FLAG_NOFLASH 0x00000001
 #define UF2_FLAG_FAMILYID 0x00002000
+// If set, the last 24 bytes of data[] hold a UF2_Checksum of a flash range
+#define UF2_FLAG_MD5 0x00004000
 
 #define MAX_BLOCKS (FLASH_SIZE / 256 + 100)
+typedef struct {
+    uint32_t targetAddr;
+    uint32_t size;
+    uint8_t md5[16];
+} UF2_Checksum;
+
 typedef struct {
     uint32_t numBlocks;
     uint32_t numWritten;
+    uint32_t endAddr; // end of the highest written payload, image size is endAddr - USER_FLASH_START
+    uint32_t numSkipped; // blocks whose checksum already matched flash
+    bool started; // first block written, CRC and SHA-256 of committed pages are recorded from then
+    bool hasImageChecksum;
+    UF2_Checksum imageChecksum; // from a NOFLASH block, verified before marking the app valid
     uint8_t writtenMask[MAX_BLOCKS / 8 + 1];
 } WriteState;
 
@@ -12,6 +12,31 @@
 #define USER_FLASH_START   0x26000
 #define USER_FLASH_END     0xAD000 // Fat Fs start here
 
+// USB writes always go to bank 0. With dual banks they must stay out of bank 1, which holds
+// either the running application or the previous one kept for rollback
+#ifdef DFU_DUAL_BANK
+#define USER_FLASH_WRITE_END  DFU_BANK_1_REGION_START
+#else
+#define USER_FLASH_WRITE_END  USER_FLASH_END
+#endif
+
+// Images written over USB (UF2, HF2, USB DFU) have no init packet and so no signature, they are
+// refused when only signed images are accepted
+#ifdef DFU_PUBLIC_KEY_FILE
+#define USB_RAW_WRITE      0
+#else
+#define USB_RAW_WRITE      1
+#endif
+
 #define FLASH_PAGE_SIZE    4096
 
+// Export application data and bootloader settings as raw files on the drive
+#ifndef UF2_EXPORT_APPDATA
+#define UF2_EXPORT_APPDATA  1
+#endif
+
+#ifndef UF2_EXPORT_SETTINGS
+#define UF2_EXPORT_SETTINGS 1
+#endif
+
 #define UF2_FAMILY_ID      0xADA52840
@@ -40,10 +40,6 @@
 // MACRO TYPEDEF CONSTANT ENUM DECLARATION
 //--------------------------------------------------------------------+
 
-// from usb_desc.c for dynamic descriptor
-extern tusb_desc_device_t usb_desc_dev;
-extern usb_desc_cfg_t     usb_desc_cfg;
-
 // Serial string using unique Device ID
 extern uint16_t           usb_desc_str_serial[1+16];
 
@@ -94,15 +90,8 @@ void usb_init(bool cdc_only)
     tusb_hal_nrf_power_event(NRFX_POWER_USB_EVT_READY);
   }
 
-  if ( cdc_only )
-  {
-    // Change PID to CDC only
-    usb_desc_dev.idProduct = USB_DESC_CDC_ONLY_PID;
-
-    // Remove MSC interface = reduce total interface + adjust config desc length
-    usb_desc_cfg.config.bNumInterfaces--;
-    usb_desc_cfg.config.wTotalLength -= sizeof(usb_desc_cfg.msc);
-  }
+  // Only CDC, e.g verify only mode must not offer any interface that writes flash
+  if ( cdc_only ) usb_desc_cdc_only();
 
   // Create Serial string descriptor
   char tmp_serial[17];
@@ -29,6 +29,9 @@
 enum {
     ITF_NUM_CDC = 0  ,
     ITF_NUM_CDC_DATA ,
+    ITF_NUM_VENDOR   ,
+    ITF_NUM_DFU      ,
+    ITF_NUM_HID      ,
     ITF_NUM_MSC      ,
     ITF_NUM_TOTAL
 };
@@ -39,7 +42,10 @@ enum {
     ITF_STR_PRODUCT      ,
     ITF_STR_SERIAL       ,
     ITF_STR_CDC          ,
-    ITF_STR_MSC
+    ITF_STR_MSC          ,
+    ITF_STR_VENDOR       ,
+    ITF_STR_DFU          ,
+    ITF_STR_HID
 };
 
 /*------------- Endpoint Numbering & Size -------------*/
@@ -53,6 +59,16 @@ enum {
 #define EP_CDC_OUT         _EP_OUT( ITF_NUM_CDC+2 )
 #define EP_CDC_IN          _EP_IN ( ITF_NUM_CDC+2 )
 
+// Vendor Bulk DFU
+#define EP_VENDOR_OUT      _EP_OUT( ITF_NUM_VENDOR+1 )
+#define EP_VENDOR_IN       _EP_IN ( ITF_NUM_VENDOR+1 )
+
+// HID HF2
+#define EP_HID_OUT         _EP_OUT( ITF_NUM_HID+1 )
+#define EP_HID_IN          _EP_IN ( ITF_NUM_HID+1 )
+
+#define EP_HID_SIZE        CFG_TUD_HID_BUFSIZE
+
 // Mass Storage
 #define EP_MSC_OUT         _EP_OUT( ITF_NUM_MSC+1 )
 #define EP_MSC_IN          _EP_IN ( ITF_NUM_MSC+1 )
@@ -82,6 +98,15 @@ enum {
                                                                                                                     \
     /* 5: MSC Interface */                                                                                          \
     TUD_DESC_STRCONV('B','l','u','e','f','r','u','i','t',' ','U','F','2'),                                          \
+                                                                                                                    \
+    /* 6: Vendor Interface */                                                                                       \
+    TUD_DESC_STRCONV('B','l','u','e','f','r','u','i','t',' ','D','F','U'),                                          \
+                                                                                                                    \
+    /* 7: DFU Interface */                                                                                          \
+    TUD_DESC_STRCONV('B','l','u','e','f','r','u','i','t',' ','A','p','p','l','i','c','a','t','i','o','n'),          \
+                                                                                                                    \
+    /* 8: HID Interface */                                                                                          \
+    TUD_DESC_STRCONV('B','l','u','e','f','r','u','i','t',' ','H','F','2'),                                          \
 }
 #endif
 
@@ -91,6 +116,30 @@ uint16_t usb_desc_str_serial[1+16] = { TUD_DESC_STR_HEADER(16) };
 // array of pointer to string descriptors
 uint16_t const * const string_desc_arr [] = USB_STRING_DESCRIPTORS;
 
+//--------------------------------------------------------------------+
+// HID Report Descriptor
+//--------------------------------------------------------------------+
+
+// HF2: vendor usage page 0xFF97 with 64-byte input and output reports
+uint8_t const desc_hid_hf2_report[] =
+{
+    HID_USAGE_PAGE_N ( 0xFF97, 2                   ),
+    HID_USAGE        ( 0x01                        ),
+    HID_COLLECTION   ( HID_COLLECTION_APPLICATION  ),
+      HID_LOGICAL_MIN  ( 0x00                      ),
+      HID_LOGICAL_MAX_N( 0xFF, 2                   ),
+      HID_REPORT_SIZE  ( 8                         ),
+
+      HID_REPORT_COUNT ( EP_HID_SIZE               ),
+      HID_USAGE        ( 0x01                      ),
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),
+
+      HID_REPORT_COUNT ( EP_HID_SIZE               ),
+      HID_USAGE        ( 0x01                      ),
+      HID_OUTPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),
+    HID_COLLECTION_END
+};
+
 //--------------------------------------------------------------------+
 // Device Descriptor
 //--------------------------------------------------------------------+
@@ -247,6 +296,123 @@ usb_desc_cfg_t usb_desc_cfg =
       },
     },
 
+    //------------- Vendor Bulk DFU -------------//
+    .vendor =
+    {
+      .itf =
+      {
+          .bLength            = sizeof(tusb_desc_interface_t),
+          .bDescriptorType    = TUSB_DESC_INTERFACE,
+          .bInterfaceNumber   = ITF_NUM_VENDOR,
+          .bAlternateSetting  = 0x00,
+          .bNumEndpoints      = 2,
+          .bInterfaceClass    = TUSB_CLASS_VENDOR_SPECIFIC,
+          .bInterfaceSubClass = 0x00,
+          .bInterfaceProtocol = 0x00,
+          .iInterface         = ITF_STR_VENDOR
+      },
+
+      .ep_out =
+      {
+          .bLength          = sizeof(tusb_desc_endpoint_t),
+          .bDescriptorType  = TUSB_DESC_ENDPOINT,
+          .bEndpointAddress = EP_VENDOR_OUT,
+          .bmAttributes     = { .xfer = TUSB_XFER_BULK },
+          .wMaxPacketSize   = { .size = CFG_TUD_CUSTOM_EPSIZE },
+          .bInterval        = 0
+      },
+
+      .ep_in =
+      {
+          .bLength          = sizeof(tusb_desc_endpoint_t),
+          .bDescriptorType  = TUSB_DESC_ENDPOINT,
+          .bEndpointAddress = EP_VENDOR_IN,
+          .bmAttributes     = { .xfer = TUSB_XFER_BULK },
+          .wMaxPacketSize   = { .size = CFG_TUD_CUSTOM_EPSIZE },
+          .bInterval        = 0
+      }
+    },
+
+    //------------- USB DFU 1.1 -------------//
+    .dfu =
+    {
+      .itf =
+      {
+          .bLength            = sizeof(tusb_desc_interface_t),
+          .bDescriptorType    = TUSB_DESC_INTERFACE,
+          .bInterfaceNumber   = ITF_NUM_DFU,
+          .bAlternateSetting  = 0x00,
+          .bNumEndpoints      = 0,
+          .bInterfaceClass    = TUSB_CLASS_APPLICATION_SPECIFIC,
+          .bInterfaceSubClass = DFU_SUBCLASS,
+          .bInterfaceProtocol = DFU_PROTOCOL_DFU_MODE,
+          .iInterface         = ITF_STR_DFU
+      },
+
+      .func =
+      {
+          .bLength            = sizeof(dfu_desc_func_t),
+          .bDescriptorType    = DFU_DESC_FUNCTIONAL,
+          .bmAttributes       = {
+              .can_download           = 1,
+              .can_upload             = 1,
+              .manifestation_tolerant = 0, // reset to application after download
+              .will_detach            = 0
+          },
+          .wDetachTimeOut     = 1000,
+          .wTransferSize      = CFG_TUD_DFU_TRANSFER_SIZE,
+          .bcdDFUVersion      = 0x0110
+      }
+    },
+
+    //------------- HID HF2 -------------//
+    .hid =
+    {
+      .itf =
+      {
+          .bLength            = sizeof(tusb_desc_interface_t),
+          .bDescriptorType    = TUSB_DESC_INTERFACE,
+          .bInterfaceNumber   = ITF_NUM_HID,
+          .bAlternateSetting  = 0x00,
+          .bNumEndpoints      = 2,
+          .bInterfaceClass    = TUSB_CLASS_HID,
+          .bInterfaceSubClass = HID_SUBCLASS_NONE,
+          .bInterfaceProtocol = HID_PROTOCOL_NONE,
+          .iInterface         = ITF_STR_HID
+      },
+
+      .hid_desc =
+      {
+          .bLength            = sizeof(tusb_hid_descriptor_hid_t),
+          .bDescriptorType    = HID_DESC_TYPE_HID,
+          .bcdHID             = 0x0111,
+          .bCountryCode       = HID_Local_NotSupported,
+          .bNumDescriptors    = 1,
+          .bReportType        = HID_DESC_TYPE_REPORT,
+          .wReportLength      = sizeof(desc_hid_hf2_report)
+      },
+
+      .ep_out =
+      {
+          .bLength          = sizeof(tusb_desc_endpoint_t),
+          .bDescriptorType  = TUSB_DESC_ENDPOINT,
+          .bEndpointAddress = EP_HID_OUT,
+          .bmAttributes     = { .xfer = TUSB_XFER_INTERRUPT },
+          .wMaxPacketSize   = { .size = EP_HID_SIZE },
+          .bInterval        = 1
+      },
+
+      .ep_in =
+      {
+          .bLength          = sizeof(tusb_desc_endpoint_t),
+          .bDescriptorType  = TUSB_DESC_ENDPOINT,
+          .bEndpointAddress = EP_HID_IN,
+          .bmAttributes     = { .xfer = TUSB_XFER_INTERRUPT },
+          .wMaxPacketSize   = { .size = EP_HID_SIZE },
+          .bInterval        = 1
+      }
+    },
+
     //------------- Mass Storage-------------//
     .msc =
     {
@@ -285,6 +451,14 @@ usb_desc_cfg_t usb_desc_cfg =
     }
 };
 
+void usb_desc_cdc_only(void)
+{
+  usb_desc_dev.idProduct = USB_DESC_CDC_ONLY_PID;
+
+  // stack only opens interfaces within wTotalLength
+  usb_desc_cfg.config.bNumInterfaces = ITF_NUM_CDC_DATA + 1;
+  usb_desc_cfg.config.wTotalLength   = sizeof(usb_desc_cfg.config) + sizeof(usb_desc_cfg.cdc);
+}
 
 // tud_desc_set is required by tinyusb stack
 // since CFG_TUD_DESC_AUTO is enabled, we only need to set string_arr 
@@ -297,7 +471,7 @@ tud_desc_set_t tud_desc_set =
 
     .hid_report =
     {
-        .generic       = NULL,
+        .generic       = desc_hid_hf2_report,
         .boot_keyboard = NULL,
         .boot_mouse    = NULL
     }
@@ -50,7 +50,7 @@ typedef struct ATTR_PACKED
 {
   tusb_desc_configuration_t           config;
 
-  //------------- CDC -------------//
+  //------------- CDC (must be first, the only one kept in CDC only mode) -------------//
   struct ATTR_PACKED
   {
     tusb_desc_interface_assoc_t       iad;
@@ -69,6 +69,30 @@ typedef struct ATTR_PACKED
     tusb_desc_endpoint_t              ep_in;
   }cdc;
 
+  //------------- Vendor Bulk DFU -------------//
+  struct ATTR_PACKED
+  {
+    tusb_desc_interface_t             itf;
+    tusb_desc_endpoint_t              ep_out;
+    tusb_desc_endpoint_t              ep_in;
+  } vendor;
+
+  //------------- USB DFU 1.1 -------------//
+  struct ATTR_PACKED
+  {
+    tusb_desc_interface_t             itf;
+    dfu_desc_func_t                   func;
+  } dfu;
+
+  //------------- HID HF2 -------------//
+  struct ATTR_PACKED
+  {
+    tusb_desc_interface_t             itf;
+    tusb_hid_descriptor_hid_t         hid_desc;
+    tusb_desc_endpoint_t              ep_out;
+    tusb_desc_endpoint_t              ep_in;
+  } hid;
+
   //------------- Mass Storage -------------//
   struct ATTR_PACKED
   {
@@ -78,6 +102,10 @@ typedef struct ATTR_PACKED
   } msc;
 } usb_desc_cfg_t;
 
+// Switch descriptors to CDC only mode before tusb_init(): CDC only PID, and the configuration
+// ends after CDC so that no other interface (vendor DFU, USB DFU, HF2, MSC) is enumerated
+void usb_desc_cdc_only(void);
+
 
 #ifdef __cplusplus
  }
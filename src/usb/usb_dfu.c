@@ -0,0 +1,151 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+#include "uf2/uf2.h"
+
+#if CFG_TUD_DFU
+
+#include "flash_nrf5x.h"
+#include "sha256.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "dfu_readback.h"
+
+/* USB DFU 1.1 interface: host tools (e.g dfu-util) download a raw application binary
+ * in CFG_TUD_DFU_TRANSFER_SIZE blocks, block N is written at USER_FLASH_START + N*size.
+ * Blocks go through the same flash writer and the image is validated the same way as
+ * a UF2 file copied to the MSC drive.
+ */
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+
+// Worst case NVMC timing: page erase 85 ms, word write 41 us
+#define FLASH_ERASE_PAGE_MS   85
+#define FLASH_WRITE_PAGE_MS   (((FLASH_PAGE_SIZE/4)*41 + 999) / 1000)
+
+TU_VERIFY_STATIC(CFG_TUD_DFU_TRANSFER_SIZE == FLASH_PAGE_SIZE, "each block must map to one flash page");
+
+static uint32_t _dfu_end_addr = 0; // end of downloaded image
+
+uint16_t write_state_crc(uint32_t size);
+bool write_state_digest(uint32_t size, uint8_t digest[SHA256_DIGEST_LEN]);
+void write_state_crc_start(void);
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+
+// Time for host to wait before polling status, estimated from what flash writer will do
+uint32_t tud_dfu_poll_timeout_cb(uint8_t state, uint16_t block_num, uint8_t const* data, uint16_t length)
+{
+  // flush last page, then save bootloader settings
+  if ( state == DFU_MANIFEST ) return 2*(FLASH_ERASE_PAGE_MS + FLASH_WRITE_PAGE_MS);
+
+  uint32_t const addr = USER_FLASH_START + block_num*CFG_TUD_DFU_TRANSFER_SIZE;
+  if ( addr + length > USER_FLASH_WRITE_END ) return 0;
+
+  // unchanged page is not written
+  if ( memcmp((void const*) addr, data, length) == 0 ) return 0;
+
+  return FLASH_ERASE_PAGE_MS + FLASH_WRITE_PAGE_MS;
+}
+
+bool tud_dfu_download_cb(uint16_t block_num, uint8_t const* data, uint16_t length)
+{
+  uint32_t const addr = USER_FLASH_START + block_num*CFG_TUD_DFU_TRANSFER_SIZE;
+
+  TU_VERIFY( USB_RAW_WRITE && (addr + length <= USER_FLASH_WRITE_END) );
+
+  if ( block_num == 0 )
+  {
+    _dfu_end_addr = 0;
+    write_state_crc_start();
+    led_state(STATE_WRITING_STARTED);
+  }
+
+  flash_nrf5x_write(addr, data, length, true);
+
+  if ( addr + length > _dfu_end_addr ) _dfu_end_addr = addr + length;
+
+  return true;
+}
+
+bool tud_dfu_manifest_cb(void)
+{
+  TU_VERIFY( _dfu_end_addr );
+
+  flash_nrf5x_flush(true);
+
+  led_state(STATE_WRITING_FINISHED);
+
+  dfu_update_status_t update_status;
+  memset(&update_status, 0, sizeof(dfu_update_status_t ));
+
+  uint8_t app_digest[SHA256_DIGEST_LEN];
+
+  update_status.status_code  = DFU_UPDATE_APP_COMPLETE;
+  update_status.app_size     = _dfu_end_addr - USER_FLASH_START;
+  update_status.app_crc      = write_state_crc(update_status.app_size);
+  update_status.p_app_digest = write_state_digest(update_status.app_size, app_digest) ? app_digest : NULL;
+
+  bootloader_dfu_update_process(update_status);
+
+  return true;
+}
+
+// Upload current application, from the bank it runs from
+uint16_t tud_dfu_upload_cb(uint16_t block_num, uint8_t* data, uint16_t length)
+{
+  uint32_t const app_addr = bootloader_app_address();
+
+  if ( !DFU_READBACK_APP || !bootloader_app_is_valid(app_addr) ) return 0;
+
+  bootloader_settings_t const * boot_setting;
+  bootloader_util_settings_get(&boot_setting);
+
+  uint32_t app_size = boot_setting->bank_0_size;
+
+#ifdef DFU_DUAL_BANK
+  uint32_t const app_max = DFU_IMAGE_MAX_SIZE_BANKED;
+#else
+  uint32_t const app_max = FLASH_SIZE;
+#endif
+
+  // size is unknown if flashed with jlink, upload whole application region
+  if ( (app_size == 0) || (app_size > app_max) ) app_size = app_max;
+
+  uint32_t const offset = block_num*CFG_TUD_DFU_TRANSFER_SIZE;
+  if ( offset >= app_size ) return 0;
+
+  uint16_t const count = (uint16_t) tu_min32(length, app_size - offset);
+  memcpy(data, (void const*) (app_addr + offset), count);
+
+  return count;
+}
+
+#endif
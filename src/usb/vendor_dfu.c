@@ -0,0 +1,190 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "tusb.h"
+
+#if CFG_TUD_CUSTOM_CLASS
+
+#include "dfu.h"
+#include "dfu_types.h"
+#include "nrf_error.h"
+#include "boards.h"
+
+/* DFU over a vendor bulk endpoint pair, a faster alternative to serial DFU over CDC.
+ * USB bulk transfers are already reliable and packetized, so there is no SLIP/HCI
+ * framing: each OUT transfer (ended by a short or zero length packet) is one DFU packet
+ * made of a header followed by word-sized payload, same payload as serial transport.
+ * Every packet is answered on IN endpoint with a response carrying the nrf error code.
+ * A host keeps at most two packets unanswered: one being handled, one received into the
+ * other OUT buffer.
+ */
+
+/*------------------------------------------------------------------*/
+/* MACRO TYPEDEF CONSTANT ENUM
+ *------------------------------------------------------------------*/
+typedef struct ATTR_PACKED
+{
+  uint8_t  packet_type; // INIT_PACKET, START_PACKET, DATA_PACKET, STOP_DATA_PACKET
+  uint8_t  seq;         // echoed back in response
+  uint16_t reserved;
+} vendor_dfu_header_t;
+
+typedef struct ATTR_PACKED
+{
+  uint8_t  packet_type;
+  uint8_t  seq;
+  uint16_t reserved;
+  uint32_t result;      // NRF_SUCCESS or error code
+} vendor_dfu_response_t;
+
+TU_VERIFY_STATIC(sizeof(vendor_dfu_header_t) == 4, "payload must stay word aligned");
+
+// Responses waiting for IN endpoint, more than a host may leave unanswered
+#define RESP_QUEUE_SIZE   4
+
+/*------------------------------------------------------------------*/
+/* VARIABLE DECLARATION
+ *------------------------------------------------------------------*/
+static vendor_dfu_response_t _resp_queue[RESP_QUEUE_SIZE];
+static uint8_t _resp_head;
+static uint8_t _resp_count;
+
+// Image is activated once the response to STOP is sent, USB is torn down when settings are saved
+static bool _activate_pending;
+
+/*------------------------------------------------------------------*/
+/* Responses
+ *------------------------------------------------------------------*/
+
+// Send oldest queued response, it is written again from tx complete if IN endpoint is busy
+static void send_next_response(void)
+{
+  if ( !_resp_count ) return;
+
+  if ( tud_custom_write(&_resp_queue[_resp_head], sizeof(vendor_dfu_response_t)) )
+  {
+    _resp_head = (_resp_head + 1) % RESP_QUEUE_SIZE;
+    _resp_count--;
+  }
+}
+
+static void send_response(vendor_dfu_response_t const* resp)
+{
+  // host reading no response at all only loses the newest ones
+  if ( _resp_count < RESP_QUEUE_SIZE )
+  {
+    _resp_queue[(_resp_head + _resp_count) % RESP_QUEUE_SIZE] = *resp;
+    _resp_count++;
+  }
+
+  send_next_response();
+}
+
+/*------------------------------------------------------------------*/
+/* tinyusb callbacks
+ *------------------------------------------------------------------*/
+void tud_custom_rx_cb(uint8_t const* buffer, uint32_t bufsize)
+{
+  vendor_dfu_header_t const* hdr = (vendor_dfu_header_t const*) buffer;
+
+  vendor_dfu_response_t resp =
+  {
+    .packet_type = hdr->packet_type,
+    .seq         = hdr->seq,
+    .result      = NRF_SUCCESS
+  };
+
+  if ( (bufsize < sizeof(vendor_dfu_header_t)) || (bufsize % 4) )
+  {
+    resp.result = NRF_ERROR_INVALID_LENGTH;
+    send_response(&resp);
+    return;
+  }
+
+  // Adafruit modification for startup dfu
+  extern bool dfu_startup_packet_received;
+  dfu_startup_packet_received = true;
+
+  // payload is passed in place, transfer buffer is word aligned
+  dfu_update_packet_t packet = { .packet_type = hdr->packet_type };
+  packet.params.data_packet.p_data_packet = (uint32_t*) (buffer + sizeof(vendor_dfu_header_t));
+  packet.params.data_packet.packet_length = (bufsize - sizeof(vendor_dfu_header_t)) / sizeof(uint32_t);
+
+  switch ( hdr->packet_type )
+  {
+    case START_PACKET:
+      if ( packet.params.data_packet.packet_length * sizeof(uint32_t) < sizeof(dfu_start_packet_t) )
+      {
+        resp.result = NRF_ERROR_INVALID_LENGTH;
+        break;
+      }
+
+      packet.params.start_packet = (dfu_start_packet_t*) packet.params.data_packet.p_data_packet;
+      resp.result = dfu_start_pkt_handle(&packet);
+    break;
+
+    case INIT_PACKET:
+      resp.result = dfu_init_pkt_handle(&packet);
+      if ( resp.result == NRF_SUCCESS ) resp.result = dfu_init_pkt_complete();
+
+      if ( resp.result == NRF_SUCCESS ) led_state(STATE_WRITING_STARTED);
+    break;
+
+    case DATA_PACKET:
+      resp.result = dfu_data_pkt_handle(&packet);
+
+      // more data is expected, not an error
+      if ( resp.result == NRF_ERROR_INVALID_LENGTH ) resp.result = NRF_SUCCESS;
+    break;
+
+    case STOP_DATA_PACKET:
+      resp.result = dfu_image_validate();
+      _activate_pending = (resp.result == NRF_SUCCESS);
+    break;
+
+    default:
+      resp.result = NRF_ERROR_NOT_SUPPORTED;
+    break;
+  }
+
+  send_response(&resp);
+}
+
+void tud_custom_tx_complete_cb(void)
+{
+  if ( _resp_count )
+  {
+    send_next_response();
+  }
+  else if ( _activate_pending )
+  {
+    _activate_pending = false;
+
+    (void) dfu_image_activate();
+    led_state(STATE_WRITING_FINISHED);
+  }
+}
+
+#endif
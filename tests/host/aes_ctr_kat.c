@@ -0,0 +1,167 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// Software AES-128 CTR (aes_ctr.c without the ECB peripheral) against FIPS-197 and SP 800-38A
+// known answers, fed in any split and alignment. Keystream of a long stream topped up between
+// pieces and across the end of the buffer and of the 128-bit counter must match blocks
+// encrypted from their own counter.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "aes_ctr.h"
+
+typedef struct
+{
+  char const* key;
+  char const* counter;
+  char const* plain;
+  char const* cipher;
+} vector_t;
+
+static vector_t const _vectors[] =
+{
+  // FIPS-197 appendix B and C.1: single block, keystream of the plaintext as counter
+  { "2b7e151628aed2a6abf7158809cf4f3c", "3243f6a8885a308d313198a2e0370734",
+    "00000000000000000000000000000000", "3925841d02dc09fbdc118597196a0b32" },
+  { "000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff",
+    "00000000000000000000000000000000", "69c4e0d86a7b0430d8cdb78070b4c55a" },
+
+  // SP 800-38A F.5.1 CTR-AES128.Encrypt, counter carries from byte 15 into byte 14
+  { "2b7e151628aed2a6abf7158809cf4f3c", "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff",
+    "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51"
+    "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710",
+    "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff"
+    "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee" },
+};
+
+#define STREAM_BLOCKS   (3*AES_CTR_KEYSTREAM_BLOCKS + 5)
+
+static uint8_t _buf[STREAM_BLOCKS*AES_BLOCK_LEN + 4];
+
+static uint32_t from_hex(char const* hex, uint8_t* out)
+{
+  uint32_t const len = strlen(hex) / 2;
+  for(uint32_t i = 0; i < len; i++) sscanf(hex + 2*i, "%2hhx", &out[i]);
+  return len;
+}
+
+// crypt vector in pieces of chunk bytes, from a buffer offset by align bytes
+static void check_vector(vector_t const* v, uint32_t chunk, uint32_t align)
+{
+  uint8_t key[AES_KEY_LEN], counter[AES_BLOCK_LEN], cipher[64];
+  uint8_t* data = _buf + align;
+
+  HOST_CHECK( from_hex(v->key, key) == AES_KEY_LEN );
+  HOST_CHECK( from_hex(v->counter, counter) == AES_BLOCK_LEN );
+  uint32_t const len = from_hex(v->plain, data);
+  HOST_CHECK( from_hex(v->cipher, cipher) == len );
+
+  // encrypt, then decrypt back
+  for(int pass = 0; pass < 2; pass++)
+  {
+    HOST_CHECK( aes_ctr_start(key, counter) );
+    for(uint32_t offset = 0; offset < len; offset += chunk)
+    {
+      HOST_CHECK( aes_ctr_crypt(data + offset, (len - offset) < chunk ? (len - offset) : chunk) );
+    }
+    aes_ctr_stop();
+
+    if ( pass == 0 ) HOST_CHECK( memcmp(data, cipher, len) == 0 );
+  }
+
+  uint8_t plain[64];
+  from_hex(v->plain, plain);
+  HOST_CHECK( memcmp(data, plain, len) == 0 );
+}
+
+// Keystream block of a counter, encrypted on its own
+static void keystream_block(uint8_t const key[AES_KEY_LEN], uint8_t const counter[AES_BLOCK_LEN], uint8_t* out)
+{
+  memset(out, 0, AES_BLOCK_LEN);
+  HOST_CHECK( aes_ctr_start(key, counter) );
+  HOST_CHECK( aes_ctr_crypt(out, AES_BLOCK_LEN) );
+  aes_ctr_stop();
+}
+
+// Stream longer than the keystream buffer, starting a few blocks before the counter wraps
+static void check_stream(uint32_t chunk, bool task)
+{
+  uint8_t key[AES_KEY_LEN];
+  uint8_t counter[AES_BLOCK_LEN];
+
+  for(uint32_t i = 0; i < AES_KEY_LEN; i++) key[i] = (uint8_t) (i*29 + chunk);
+  memset(counter, 0xFF, AES_BLOCK_LEN);
+  counter[AES_BLOCK_LEN-1] = 0xFD;
+
+  uint32_t const len = sizeof(_buf) - 4;
+  memset(_buf, 0, sizeof(_buf));
+
+  HOST_CHECK( aes_ctr_start(key, counter) );
+  for(uint32_t offset = 0; offset < len; offset += chunk)
+  {
+    HOST_CHECK( aes_ctr_crypt(_buf + offset, (len - offset) < chunk ? (len - offset) : chunk) );
+    if ( task ) aes_ctr_task();
+  }
+  aes_ctr_stop();
+
+  for(uint32_t i = 0; i < STREAM_BLOCKS; i++)
+  {
+    uint8_t expected[AES_BLOCK_LEN];
+    keystream_block(key, counter, expected);
+    HOST_CHECK( memcmp(_buf + i*AES_BLOCK_LEN, expected, AES_BLOCK_LEN) == 0 );
+
+    // 128-bit big endian increment
+    for(int32_t b = AES_BLOCK_LEN-1; b >= 0 && !++counter[b]; b--) { }
+  }
+
+  // all ones wrapped to zero
+  HOST_CHECK( counter[0] == 0 && counter[AES_BLOCK_LEN-1] == (uint8_t) (STREAM_BLOCKS - 3) );
+}
+
+int main(void)
+{
+  uint32_t const chunks[] = { 1, 3, 4, 15, 16, 17, 64 };
+
+  for(uint32_t i = 0; i < sizeof(_vectors)/sizeof(_vectors[0]); i++)
+  {
+    for(uint32_t c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++)
+    {
+      for(uint32_t align = 0; align < 4; align++) check_vector(&_vectors[i], chunks[c], align);
+    }
+  }
+
+  uint32_t const stream_chunks[] = { 1, 7, 16, 20, 512, AES_CTR_KEYSTREAM_BLOCKS*AES_BLOCK_LEN + 4, sizeof(_buf) };
+
+  for(uint32_t c = 0; c < sizeof(stream_chunks)/sizeof(stream_chunks[0]); c++)
+  {
+    check_stream(stream_chunks[c], false);
+    check_stream(stream_chunks[c], true);
+  }
+
+  printf("aes128 ctr: FIPS-197 and SP 800-38A vectors ok, streams of %u blocks match\n", STREAM_BLOCKS);
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+// Signed init packets of the dfu_init_signed image, for application and sd_bl image types.
+// Unsigned part made with:
+//   img = bytes((i*13) & 0xff for i in range(10000))
+//   pkt = struct.pack('<HHIHH', 0x0052, 52840, 0xFFFFFFFF, 1, 0xFFFE)
+//   pkt += struct.pack('<II', 2, len(img)) + hashlib.sha256(img).digest()
+// then signed with: tools/sign_init_packet.py p256_test_key.pem <image type> init.bin signed.bin
+
+static uint8_t const _init_app[] = {
+  0x52, 0x00, 0x68, 0xce, 0xff, 0xff, 0xff, 0xff, 0x01, 0x00, 0xfe, 0xff,
+  0x02, 0x00, 0x00, 0x00, 0x10, 0x27, 0x00, 0x00, 0x53, 0x52, 0x03, 0x67,
+  0x13, 0x51, 0xe5, 0x53, 0x19, 0x9e, 0xc5, 0xbe, 0xab, 0x26, 0x99, 0xd7,
+  0x14, 0xc9, 0x40, 0xea, 0x88, 0x01, 0x6b, 0xe3, 0xe4, 0x5e, 0x24, 0xfd,
+  0x36, 0x7f, 0x51, 0x01, 0x7c, 0x1d, 0x49, 0xfd, 0xe3, 0x58, 0x6a, 0x2a,
+  0x3a, 0x7f, 0x75, 0x0a, 0x28, 0x70, 0x77, 0x24, 0x59, 0x79, 0xed, 0x47,
+  0x24, 0xc3, 0x39, 0x30, 0xd7, 0xeb, 0xd7, 0x4d, 0x1e, 0xc1, 0x17, 0x98,
+  0xee, 0x6f, 0x37, 0xaa, 0x77, 0x32, 0xb9, 0x65, 0xa8, 0xa8, 0x44, 0x9b,
+  0x67, 0x2f, 0x86, 0x90, 0x54, 0xf8, 0x0a, 0x27, 0x07, 0xee, 0xe2, 0x98,
+  0x71, 0x72, 0xfb, 0x4e, 0xb1, 0x9e, 0x1e, 0xc6
+};
+
+static uint8_t const _init_sd_bl[] = {
+  0x52, 0x00, 0x68, 0xce, 0xff, 0xff, 0xff, 0xff, 0x01, 0x00, 0xfe, 0xff,
+  0x02, 0x00, 0x00, 0x00, 0x10, 0x27, 0x00, 0x00, 0x53, 0x52, 0x03, 0x67,
+  0x13, 0x51, 0xe5, 0x53, 0x19, 0x9e, 0xc5, 0xbe, 0xab, 0x26, 0x99, 0xd7,
+  0x14, 0xc9, 0x40, 0xea, 0x88, 0x01, 0x6b, 0xe3, 0xe4, 0x5e, 0x24, 0xfd,
+  0x36, 0x7f, 0x51, 0x01, 0x20, 0x2f, 0xcd, 0x09, 0x1e, 0xaa, 0x0a, 0x4b,
+  0x59, 0x55, 0xe1, 0x6f, 0x7a, 0x88, 0xa1, 0x50, 0x9c, 0x94, 0xd4, 0xaa,
+  0x9c, 0x78, 0xcf, 0x80, 0xb8, 0x17, 0x41, 0x8a, 0xb3, 0x95, 0x4f, 0xa2,
+  0x8f, 0x7f, 0xed, 0xeb, 0x36, 0xb5, 0x32, 0x3c, 0x9d, 0xbe, 0x35, 0xec,
+  0x22, 0x22, 0xee, 0xf7, 0x9d, 0xb9, 0xcc, 0x77, 0x72, 0x88, 0x51, 0x96,
+  0x4c, 0x3a, 0x60, 0xbc, 0xf2, 0x51, 0x5d, 0x71
+};
@@ -0,0 +1,106 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// dfu_init built with a public key: signed init packets are accepted for the image type they were
+// signed for only, tampered or unsigned packets are refused, and the image must match its hash.
+
+#include <string.h>
+
+#include "flash_sim.h"
+
+#include "nrf_error.h"
+#include "dfu_types.h"
+#include "dfu_init.h"
+
+#include "dfu_init_packets.h"
+
+#define IMAGE_SIZE    10000
+
+static uint8_t _image[IMAGE_SIZE];
+
+// dfu_init takes addresses as 32-bit, init packet is placed in simulated flash
+static uint8_t* const _init = (uint8_t*) FLASH_SIM_START;
+
+static uint32_t run(uint8_t const* packet, uint32_t len, uint8_t image_type, bool tamper_image)
+{
+  memcpy(_init, packet, len);
+
+  uint32_t err = dfu_init_prevalidate(_init, len, image_type);
+  if ( err ) return err;
+
+  if ( tamper_image ) _image[100] ^= 1;
+
+  // as received in data packets
+  for(uint32_t offset = 0; offset < IMAGE_SIZE; offset += 20)
+  {
+    dfu_init_image_update(_image + offset, (IMAGE_SIZE - offset) < 20 ? (IMAGE_SIZE - offset) : 20);
+  }
+
+  err = dfu_init_postvalidate(_image, IMAGE_SIZE);
+
+  if ( tamper_image ) _image[100] ^= 1;
+
+  return err;
+}
+
+int main(void)
+{
+  flash_sim_init();
+
+  for(uint32_t i = 0; i < IMAGE_SIZE; i++) _image[i] = (uint8_t) (i*13);
+
+  uint8_t const sd_bl = DFU_UPDATE_SD | DFU_UPDATE_BL;
+  uint8_t packet[sizeof(_init_app)];
+
+  HOST_CHECK( run(_init_app, sizeof(_init_app), DFU_UPDATE_APP, false) == NRF_SUCCESS );
+  HOST_CHECK( run(_init_sd_bl, sizeof(_init_sd_bl), sd_bl, false) == NRF_SUCCESS );
+
+  // signed for another image type
+  HOST_CHECK( run(_init_app, sizeof(_init_app), sd_bl, false) == NRF_ERROR_FORBIDDEN );
+  HOST_CHECK( run(_init_app, sizeof(_init_app), DFU_UPDATE_BL, false) == NRF_ERROR_FORBIDDEN );
+  HOST_CHECK( run(_init_sd_bl, sizeof(_init_sd_bl), DFU_UPDATE_APP, false) == NRF_ERROR_FORBIDDEN );
+
+  // tampered signature, header, image hash
+  uint32_t const tamper[] = { sizeof(packet) - 1, 4, 30 };
+  for(uint32_t i = 0; i < sizeof(tamper)/sizeof(tamper[0]); i++)
+  {
+    memcpy(packet, _init_app, sizeof(packet));
+    packet[tamper[i]] ^= 1;
+    HOST_CHECK( run(packet, sizeof(packet), DFU_UPDATE_APP, false) == NRF_ERROR_FORBIDDEN );
+  }
+
+  // same hash packet without signature, or as extended id 1
+  HOST_CHECK( run(_init_app, sizeof(_init_app) - 64, DFU_UPDATE_APP, false) == NRF_ERROR_FORBIDDEN );
+
+  memcpy(packet, _init_app, sizeof(packet));
+  packet[12] = 1;
+  HOST_CHECK( run(packet, sizeof(packet), DFU_UPDATE_APP, false) == NRF_ERROR_FORBIDDEN );
+
+  // image not matching signed hash
+  HOST_CHECK( run(_init_app, sizeof(_init_app), DFU_UPDATE_APP, true) == NRF_ERROR_INVALID_DATA );
+
+  printf("dfu_init: signed packets accepted for their image type only, tampered ones refused\n");
+
+  return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// tusb_fifo against a plain model queue under random operations of every kind (single and bulk
+// read/write, peek, linear read/write, clear) for depths of 1 to 64 items of 1 to 8 bytes, in
+// both normal and overwritable mode, then directed checks of wrapped copies and linear spans, and
+// the time per item of bulk and single item copies.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "common/tusb_common.h"
+#include "common/tusb_fifo.h"
+
+#define MAX_DEPTH       64
+#define MAX_ITEM_SIZE   8
+#define RANDOM_OPS      400000
+
+#define BENCH_DEPTH     1024
+#define BENCH_ITEMS     (2*1024*1024)
+
+// Model: items in order, oldest first
+static struct
+{
+  uint8_t  items[MAX_DEPTH][MAX_ITEM_SIZE];
+  uint16_t count;
+  uint16_t depth;
+  uint16_t item_size;
+  bool     overwritable;
+} _model;
+
+static uint32_t _rand_state = 1;
+
+static uint32_t host_rand(void)
+{
+  _rand_state = _rand_state * 1103515245 + 12345;
+  return _rand_state >> 8;
+}
+
+static void model_push(uint8_t const* item)
+{
+  if ( _model.count == _model.depth )
+  {
+    // oldest item is overwritten
+    memmove(_model.items[0], _model.items[1], (_model.depth - 1) * MAX_ITEM_SIZE);
+    _model.count--;
+  }
+
+  memcpy(_model.items[_model.count++], item, _model.item_size);
+}
+
+static void model_pop(uint8_t* item)
+{
+  memcpy(item, _model.items[0], _model.item_size);
+  memmove(_model.items[0], _model.items[1], (_model.depth - 1) * MAX_ITEM_SIZE);
+  _model.count--;
+}
+
+static void fill_random(uint8_t* buf, uint32_t len)
+{
+  for(uint32_t i = 0; i < len; i++) buf[i] = (uint8_t) host_rand();
+}
+
+// fifo holds exactly the model items
+static void check_same(tu_fifo_t* f)
+{
+  uint8_t item[MAX_ITEM_SIZE];
+
+  HOST_CHECK( tu_fifo_count(f) == _model.count );
+  HOST_CHECK( tu_fifo_remaining(f) == _model.depth - _model.count );
+  HOST_CHECK( tu_fifo_empty(f) == (_model.count == 0) );
+  HOST_CHECK( tu_fifo_full(f) == (_model.count == _model.depth) );
+
+  for(uint16_t i = 0; i < _model.count; i++)
+  {
+    HOST_CHECK( tu_fifo_peek_at(f, i, item) );
+    HOST_CHECK( memcmp(item, _model.items[i], _model.item_size) == 0 );
+  }
+
+  HOST_CHECK( !tu_fifo_peek_at(f, _model.count, item) );
+}
+
+static void random_config(tu_fifo_t* f, uint8_t* buf)
+{
+  _model.depth        = 1 + host_rand() % MAX_DEPTH;
+  _model.item_size    = 1 + host_rand() % MAX_ITEM_SIZE;
+  _model.overwritable = host_rand() & 1;
+  _model.count        = 0;
+
+  tu_fifo_config(f, buf, _model.depth, _model.item_size, _model.overwritable);
+}
+
+static void random_op(tu_fifo_t* f)
+{
+  static uint8_t data[2*MAX_DEPTH*MAX_ITEM_SIZE + MAX_ITEM_SIZE];
+  static uint8_t out [2*MAX_DEPTH*MAX_ITEM_SIZE + MAX_ITEM_SIZE];
+
+  uint16_t const isz = _model.item_size;
+
+  // counts go past depth to hit clamping and overwriting
+  uint16_t const n = host_rand() % (2*_model.depth + 2);
+
+  switch ( host_rand() % 8 )
+  {
+    case 0: // write one
+    {
+      fill_random(data, isz);
+      bool const accepted = _model.overwritable || (_model.count < _model.depth);
+
+      HOST_CHECK( tu_fifo_write(f, data) == accepted );
+      if ( accepted ) model_push(data);
+    }
+    break;
+
+    case 1: // write n
+    {
+      fill_random(data, n*isz);
+
+      uint16_t const expected = _model.overwritable ? n : tu_min16(n, _model.depth - _model.count);
+      HOST_CHECK( tu_fifo_write_n(f, data, n) == expected );
+
+      // model overwrites its oldest items the same way
+      for(uint16_t i = 0; i < expected; i++) model_push(data + i*isz);
+    }
+    break;
+
+    case 2: // read one
+    {
+      bool const available = (_model.count > 0);
+
+      HOST_CHECK( tu_fifo_read(f, out) == available );
+      if ( available )
+      {
+        uint8_t item[MAX_ITEM_SIZE];
+        model_pop(item);
+        HOST_CHECK( memcmp(out, item, isz) == 0 );
+      }
+    }
+    break;
+
+    case 3: // read n
+    {
+      uint16_t const expected = tu_min16(n, _model.count);
+
+      memset(out, 0xA5, sizeof(out));
+      HOST_CHECK( tu_fifo_read_n(f, out, n) == expected );
+
+      for(uint16_t i = 0; i < expected; i++)
+      {
+        uint8_t item[MAX_ITEM_SIZE];
+        model_pop(item);
+        HOST_CHECK( memcmp(out + i*isz, item, isz) == 0 );
+      }
+
+      // nothing written past what was read
+      HOST_CHECK( out[expected*isz] == 0xA5 );
+    }
+    break;
+
+    case 4: // linear read, consume part of it
+    {
+      void const* p;
+      uint16_t const span = tu_fifo_get_linear_read(f, &p);
+
+      HOST_CHECK( span <= _model.count );
+      HOST_CHECK( (span > 0) == (_model.count > 0) );
+      HOST_CHECK( (uint8_t const*) p >= f->buffer && (uint8_t const*) p + span*isz <= f->buffer + _model.depth*isz );
+
+      uint16_t const used = span ? (host_rand() % (span + 1)) : 0;
+
+      for(uint16_t i = 0; i < used; i++)
+      {
+        uint8_t item[MAX_ITEM_SIZE];
+        model_pop(item);
+        HOST_CHECK( memcmp((uint8_t const*) p + i*isz, item, isz) == 0 );
+      }
+
+      tu_fifo_advance_read(f, used);
+    }
+    break;
+
+    case 5: // linear write, fill part of it
+    {
+      void* p;
+      uint16_t const span = tu_fifo_get_linear_write(f, &p);
+
+      HOST_CHECK( span <= _model.depth - _model.count );
+      HOST_CHECK( (span > 0) == (_model.count < _model.depth) );
+      HOST_CHECK( (uint8_t*) p >= f->buffer && (uint8_t*) p + span*isz <= f->buffer + _model.depth*isz );
+
+      uint16_t const used = span ? (host_rand() % (span + 1)) : 0;
+
+      fill_random(p, used*isz);
+      for(uint16_t i = 0; i < used; i++) model_push((uint8_t*) p + i*isz);
+
+      tu_fifo_advance_write(f, used);
+    }
+    break;
+
+    case 6: // advancing past the content is clamped
+      tu_fifo_advance_read(f, _model.count + 1 + host_rand() % 4);
+      _model.count = 0;
+    break;
+
+    default:
+      if ( (host_rand() % 16) == 0 )
+      {
+        tu_fifo_clear(f);
+        _model.count = 0;
+      }
+    break;
+  }
+
+  check_same(f);
+}
+
+// Directed: bulk copies split at the end of the buffer, both ways, items of several bytes
+static void check_wrap(void)
+{
+  uint8_t buf[8*3];
+  uint8_t data[16*3], out[8*3];
+  tu_fifo_t f;
+
+  for(uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t) (i + 1);
+
+  tu_fifo_config(&f, buf, 8, 3, false);
+
+  // move indices to 6 so that 5 items wrap as 2 + 3
+  HOST_CHECK( tu_fifo_write_n(&f, data, 6) == 6 );
+  HOST_CHECK( tu_fifo_read_n(&f, out, 6) == 6 );
+  HOST_CHECK( memcmp(out, data, 6*3) == 0 );
+
+  HOST_CHECK( tu_fifo_write_n(&f, data, 5) == 5 );
+  HOST_CHECK( f.wr_idx == 3 );
+  HOST_CHECK( memcmp(buf + 6*3, data, 2*3) == 0 );
+  HOST_CHECK( memcmp(buf, data + 2*3, 3*3) == 0 );
+
+  memset(out, 0, sizeof(out));
+  HOST_CHECK( tu_fifo_read_n(&f, out, 8) == 5 );
+  HOST_CHECK( memcmp(out, data, 5*3) == 0 );
+  HOST_CHECK( f.rd_idx == 3 && tu_fifo_empty(&f) );
+
+  // non overwritable: full fifo takes nothing more
+  HOST_CHECK( tu_fifo_write_n(&f, data, 8) == 8 );
+  HOST_CHECK( tu_fifo_write_n(&f, data, 1) == 0 );
+  HOST_CHECK( !tu_fifo_write(&f, data) );
+
+  // overwritable: more than depth at once keeps the last 8 items, in order
+  tu_fifo_config(&f, buf, 8, 3, true);
+  HOST_CHECK( tu_fifo_write_n(&f, data, 3) == 3 );
+  HOST_CHECK( tu_fifo_write_n(&f, data + 3, 7) == 7 ); // 2 oldest overwritten
+  HOST_CHECK( tu_fifo_full(&f) );
+  HOST_CHECK( tu_fifo_read_n(&f, out, 8) == 8 );
+  HOST_CHECK( memcmp(out, data + 2*3, 3) == 0 );
+
+  uint8_t many[20*3];
+  for(uint32_t i = 0; i < sizeof(many); i++) many[i] = (uint8_t) (0x80 + i);
+
+  HOST_CHECK( tu_fifo_write_n(&f, many, 20) == 20 );
+  HOST_CHECK( tu_fifo_count(&f) == 8 );
+  HOST_CHECK( tu_fifo_read_n(&f, out, 8) == 8 );
+  HOST_CHECK( memcmp(out, many + 12*3, 8*3) == 0 );
+}
+
+// Directed: linear spans stop at the end of the buffer, the rest follows from the start
+static void check_linear(void)
+{
+  uint8_t buf[16];
+  uint8_t data[16] = { 0 };
+  tu_fifo_t f;
+
+  tu_fifo_config(&f, buf, 16, 1, false);
+  tu_fifo_write_n(&f, data, 12);
+  tu_fifo_read_n(&f, data, 10);
+
+  // 2 items at 10..11, free space is 12..15 then 0..9
+  void* w;
+  HOST_CHECK( tu_fifo_get_linear_write(&f, &w) == 4 && w == buf + 12 );
+  tu_fifo_advance_write(&f, 4);
+  HOST_CHECK( tu_fifo_get_linear_write(&f, &w) == 10 && w == buf );
+
+  void const* r;
+  HOST_CHECK( tu_fifo_get_linear_read(&f, &r) == 6 && r == buf + 10 );
+  tu_fifo_advance_read(&f, 6);
+  HOST_CHECK( tu_fifo_get_linear_read(&f, &r) == 0 && tu_fifo_empty(&f) );
+}
+
+// Time per item of write then read of count items, in bulk or one item at a time
+static double bench(uint16_t item_size, uint16_t count, bool bulk)
+{
+  static uint8_t buf[BENCH_DEPTH*64];
+  static uint8_t data[BENCH_DEPTH*64];
+  tu_fifo_t f;
+
+  // odd start so that copies wrap around now and then
+  tu_fifo_config(&f, buf, BENCH_DEPTH, item_size, false);
+  tu_fifo_write_n(&f, data, 3);
+  tu_fifo_read_n(&f, data, 3);
+
+  uint32_t const rounds = BENCH_ITEMS / count;
+  uint64_t const t0 = host_time_ns();
+
+  for(uint32_t r = 0; r < rounds; r++)
+  {
+    if ( bulk )
+    {
+      tu_fifo_write_n(&f, data, count);
+      tu_fifo_read_n(&f, data, count);
+    }
+    else
+    {
+      for(uint16_t i = 0; i < count; i++) tu_fifo_write(&f, data + i*item_size);
+      for(uint16_t i = 0; i < count; i++) tu_fifo_read(&f, data + i*item_size);
+    }
+  }
+
+  HOST_CHECK( tu_fifo_empty(&f) );
+
+  return (double) (host_time_ns() - t0) / ((double) rounds * count);
+}
+
+int main(void)
+{
+  static uint8_t buf[MAX_DEPTH*MAX_ITEM_SIZE];
+  tu_fifo_t f;
+
+  random_config(&f, buf);
+
+  for(uint32_t i = 0; i < RANDOM_OPS; i++)
+  {
+    if ( (host_rand() % 500) == 0 ) random_config(&f, buf);
+    random_op(&f);
+  }
+  printf("tusb_fifo: %u random operations match the model\n", RANDOM_OPS);
+
+  check_wrap();
+  check_linear();
+  printf("  wrapped copies, overwriting and linear spans ok\n");
+
+  printf("  %-10s %6s %12s %12s\n", "item size", "count", "bulk ns", "single ns");
+
+  uint16_t const sizes[]  = { 1, 4, 64 };
+  uint16_t const counts[] = { 16, 128, 512 };
+
+  for(uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+  {
+    for(uint32_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++)
+    {
+      printf("  %-10u %6u %12.2f %12.2f\n", sizes[s], counts[c],
+             bench(sizes[s], counts[c], true), bench(sizes[s], counts[c], false));
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Erase/program counts of flash_nrf5x page cache for a 256 KB image written in the orders
+// hosts are seen to use, and checks that every page ends up in flash exactly as written.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "flash_nrf5x.h"
+
+#define IMAGE_ADDR      0x26000UL
+#define IMAGE_SIZE      (256*1024UL)
+#define IMAGE_PAGES     (IMAGE_SIZE / FLASH_SIM_PAGE_SIZE)
+
+#define MAX_CHUNKS      IMAGE_SIZE // 1 byte payloads
+
+typedef enum
+{
+  ORDER_SEQUENTIAL,
+  ORDER_REVERSE,
+  ORDER_SHUFFLE_16K, // shuffled within 16 KB windows, e.g OS writeback of a large copy
+  ORDER_RANDOM,
+} order_t;
+
+static char const* const _order_name[] = { "sequential", "reverse", "shuffled in 16 KB", "fully random" };
+
+static uint8_t  _image[IMAGE_SIZE];
+static uint32_t _chunks[MAX_CHUNKS];
+static uint32_t _rand_state;
+
+// pages seen by commit callback
+static uint32_t _commit_count;
+
+static uint32_t host_rand(void)
+{
+  _rand_state = _rand_state * 1103515245 + 12345;
+  return _rand_state >> 8;
+}
+
+static void shuffle(uint32_t* array, uint32_t count)
+{
+  for(uint32_t i = count - 1; i > 0; i--)
+  {
+    uint32_t const j = host_rand() % (i + 1);
+    uint32_t const t = array[i];
+
+    array[i] = array[j];
+    array[j] = t;
+  }
+}
+
+static void commit_cb(uint32_t addr, uint8_t const* page)
+{
+  (void) addr;
+  (void) page;
+  _commit_count++;
+}
+
+typedef struct
+{
+  uint32_t erase;
+  uint32_t program;
+  uint32_t program_before_flush;
+} result_t;
+
+// Write the image in chunks of payload bytes in the given order
+static result_t run(order_t order, uint32_t payload, uint32_t seed)
+{
+  uint32_t const count = (IMAGE_SIZE + payload - 1) / payload;
+  uint32_t const window = (16*1024) / payload;
+
+  HOST_CHECK(count <= MAX_CHUNKS);
+
+  _rand_state = seed;
+  for(uint32_t i = 0; i < IMAGE_SIZE; i++) _image[i] = (uint8_t) host_rand();
+
+  for(uint32_t i = 0; i < count; i++) _chunks[i] = (order == ORDER_REVERSE) ? (count - 1 - i) : i;
+
+  if ( order == ORDER_SHUFFLE_16K )
+  {
+    for(uint32_t i = 0; i < count; i += window) shuffle(_chunks + i, (count - i) < window ? (count - i) : window);
+  }
+  else if ( order == ORDER_RANDOM )
+  {
+    shuffle(_chunks, count);
+  }
+
+  flash_sim_erase_all();
+  _commit_count = 0;
+
+  flash_nrf5x_stats_t const before = *flash_nrf5x_stats();
+
+  for(uint32_t i = 0; i < count; i++)
+  {
+    uint32_t const offset = _chunks[i] * payload;
+    uint32_t const len    = (IMAGE_SIZE - offset) < payload ? (IMAGE_SIZE - offset) : payload;
+
+    flash_nrf5x_write(IMAGE_ADDR + offset, _image + offset, (int) len, true);
+  }
+
+  result_t result;
+  result.program_before_flush = flash_nrf5x_stats()->program_count - before.program_count;
+
+  flash_nrf5x_flush(true);
+
+  result.erase   = flash_nrf5x_stats()->erase_count   - before.erase_count;
+  result.program = flash_nrf5x_stats()->program_count - before.program_count;
+
+  HOST_CHECK( memcmp((void*) IMAGE_ADDR, _image, IMAGE_SIZE) == 0 );
+  HOST_CHECK( result.erase == flash_sim_stats.erase_count );
+  HOST_CHECK( _commit_count >= IMAGE_PAGES );
+
+  return result;
+}
+
+int main(void)
+{
+  flash_sim_init();
+  flash_nrf5x_set_commit_cb(commit_cb);
+
+  printf("flash_nrf5x page cache, %u slot(s), %lu KB image\n", FLASH_CACHE_PAGES, IMAGE_SIZE / 1024);
+  printf("  %-18s %8s %6s %8s\n", "order", "payload", "erase", "program");
+
+  uint32_t const payloads[] = { 256, 476 };
+
+  for(uint32_t p = 0; p < sizeof(payloads)/sizeof(payloads[0]); p++)
+  {
+    for(order_t order = ORDER_SEQUENTIAL; order <= ORDER_RANDOM; order++)
+    {
+      result_t const r = run(order, payloads[p], 1);
+      printf("  %-18s %8u %6u %8u\n", _order_name[order], payloads[p], r.erase, r.program);
+
+      // pages are complete as soon as their last chunk arrives. In reverse, a chunk crossing a
+      // page boundary writes the lower page first, which takes a second slot
+      if ( (order == ORDER_SEQUENTIAL) ||
+           (order == ORDER_REVERSE && (FLASH_CACHE_PAGES > 1 || (FLASH_SIM_PAGE_SIZE % payloads[p]) == 0)) )
+      {
+        HOST_CHECK( r.erase == IMAGE_PAGES && r.program == IMAGE_PAGES );
+      }
+
+      // 16 KB windows of 256 byte payloads are page aligned and fit in 4 slots
+      if ( order == ORDER_SHUFFLE_16K && payloads[p] == 256 && FLASH_CACHE_PAGES >= 4 )
+      {
+        HOST_CHECK( r.erase == IMAGE_PAGES );
+      }
+    }
+  }
+
+  // Payloads that are not a multiple of 4 still complete pages, which are committed before flush
+  uint32_t const odd_payloads[] = { 1, 7, 13, 255, 473 };
+
+  for(uint32_t p = 0; p < sizeof(odd_payloads)/sizeof(odd_payloads[0]); p++)
+  {
+    result_t const r = run(ORDER_SEQUENTIAL, odd_payloads[p], 2);
+
+    HOST_CHECK( r.erase == IMAGE_PAGES && r.program == IMAGE_PAGES );
+    HOST_CHECK( r.program_before_flush == IMAGE_PAGES );
+  }
+  printf("  odd payload sizes: pages committed once each, as soon as complete\n");
+
+  return 0;
+}
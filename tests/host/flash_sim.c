@@ -0,0 +1,158 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "flash_sim.h"
+
+flash_sim_stats_t flash_sim_stats;
+
+static uint32_t _power_left;
+static jmp_buf* _power_reset;
+
+// Power is lost before an erase or word write once the count is used up
+static void power_take(void)
+{
+  if ( _power_reset == NULL ) return;
+
+  if ( _power_left == 0 )
+  {
+    jmp_buf* reset = _power_reset;
+    _power_reset = NULL;
+    longjmp(*reset, 1);
+  }
+
+  _power_left--;
+}
+
+void flash_sim_init(void)
+{
+  void* p = mmap((void*) FLASH_SIM_START, FLASH_SIM_END - FLASH_SIM_START, PROT_READ | PROT_WRITE,
+                 MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if ( p != (void*) FLASH_SIM_START )
+  {
+    fprintf(stderr, "cannot map simulated flash at 0x%lx\n", FLASH_SIM_START);
+    exit(1);
+  }
+
+  flash_sim_erase_all();
+}
+
+void flash_sim_init_file(char const* path)
+{
+  uint32_t const size = FLASH_SIM_END - FLASH_SIM_START;
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  struct stat st;
+
+  if ( fd < 0 || fstat(fd, &st) < 0 )
+  {
+    perror(path);
+    exit(1);
+  }
+
+  // new file starts erased, an existing one keeps its content from previous runs
+  bool const is_new = (st.st_size == 0);
+
+  if ( ftruncate(fd, size) < 0 )
+  {
+    perror(path);
+    exit(1);
+  }
+
+  void* p = mmap((void*) FLASH_SIM_START, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0);
+  close(fd);
+
+  if ( p != (void*) FLASH_SIM_START )
+  {
+    fprintf(stderr, "cannot map %s as simulated flash at 0x%lx\n", path, FLASH_SIM_START);
+    exit(1);
+  }
+
+  if ( is_new ) flash_sim_erase_all();
+  memset(&flash_sim_stats, 0, sizeof(flash_sim_stats));
+}
+
+void flash_sim_sync(void)
+{
+  msync((void*) FLASH_SIM_START, FLASH_SIM_END - FLASH_SIM_START, MS_SYNC);
+}
+
+void flash_sim_erase_all(void)
+{
+  memset((void*) FLASH_SIM_START, 0xFF, FLASH_SIM_END - FLASH_SIM_START);
+  memset(&flash_sim_stats, 0, sizeof(flash_sim_stats));
+}
+
+void flash_sim_power_cut(uint32_t count, jmp_buf* reset)
+{
+  _power_left  = count;
+  _power_reset = reset;
+}
+
+uint64_t host_time_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+//--------------------------------------------------------------------+
+// NVMC
+//--------------------------------------------------------------------+
+void nrf_nvmc_page_erase(uint32_t address)
+{
+  HOST_CHECK( (address % FLASH_SIM_PAGE_SIZE) == 0 );
+  HOST_CHECK( (address >= FLASH_SIM_START) && (address < FLASH_SIM_END) );
+
+  power_take();
+
+  memset((void*) (uintptr_t) address, 0xFF, FLASH_SIM_PAGE_SIZE);
+  flash_sim_stats.erase_count++;
+}
+
+void nrf_nvmc_write_word(uint32_t address, uint32_t value)
+{
+  HOST_CHECK( (address % 4) == 0 );
+  HOST_CHECK( (address >= FLASH_SIM_START) && (address < FLASH_SIM_END) );
+
+  power_take();
+
+  *((uint32_t*) (uintptr_t) address) &= value;
+  flash_sim_stats.word_count++;
+}
+
+void nrf_nvmc_write_words(uint32_t address, const uint32_t * src, uint32_t num_words)
+{
+  for(uint32_t i = 0; i < num_words; i++)
+  {
+    nrf_nvmc_write_word(address + 4*i, src[i]);
+  }
+}
@@ -0,0 +1,74 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FLASH_SIM_H_
+#define FLASH_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+// Simulated nRF52840 flash, mapped at its real addresses so that bootloader sources read it
+// through plain pointers. It starts above the default vm.mmap_min_addr (64 KB), MBR and
+// SoftDevice are left out. Erased state is 0xFF and writes only clear bits, like NOR flash.
+#define FLASH_SIM_START       0x10000UL
+#define FLASH_SIM_END         0x100000UL
+#define FLASH_SIM_PAGE_SIZE   4096
+
+typedef struct
+{
+  uint32_t erase_count;
+  uint32_t word_count; // words programmed
+} flash_sim_stats_t;
+
+extern flash_sim_stats_t flash_sim_stats;
+
+// Map flash region, all erased
+void flash_sim_init(void);
+
+// Map flash region onto a file of FLASH_SIM_END - FLASH_SIM_START bytes, offset 0 is
+// FLASH_SIM_START. A new file is erased, an existing one keeps its content
+void flash_sim_init_file(char const* path);
+
+// Write flash content back to the file of flash_sim_init_file()
+void flash_sim_sync(void);
+
+// Erase flash region, statistics are cleared
+void flash_sim_erase_all(void);
+
+// Lose power after count more erases or word writes: the next one is not done, the code
+// writing flash stops there and longjmp()s to reset instead. NULL keeps power on
+void flash_sim_power_cut(uint32_t count, jmp_buf* reset);
+
+// Monotonic time in nanoseconds, for benchmarks
+uint64_t host_time_ns(void);
+
+#define HOST_CHECK(cond) \
+  do { \
+    if ( !(cond) ) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); exit(1); } \
+  } while (0)
+
+#endif /* FLASH_SIM_H_ */
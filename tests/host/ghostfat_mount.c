@@ -0,0 +1,278 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Time taken by the virtual UF2 drive to serve what a host reads when mounting it (boot sector,
+// both FATs, root directory) and to read back CURRENT.UF2, and checks the volume is consistent:
+// every file is a contiguous cluster chain of its size, and exported files match flash.
+// Blocks whose target or checksum range wraps around the address space must be refused.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "host_stub.h"
+
+#include "flash_nrf5x.h"
+#include "uf2/uf2.h"
+
+void read_block(uint32_t block_no, uint8_t *data);
+void ghostfat_layout_reset(void);
+int write_block(uint32_t block_no, uint8_t *data, bool quiet, WriteState *state);
+bool write_state_verify(WriteState const *state);
+
+#define APP_SIZE        0x3a010 // not a multiple of the UF2 payload
+#define MOUNT_REPEAT    200
+
+typedef struct {
+  uint32_t fat_start;
+  uint32_t fat_sectors;
+  uint32_t fat_copies;
+  uint32_t root_start;
+  uint32_t data_start;
+  uint32_t total_sectors;
+} volume_t;
+
+static uint8_t _fat[2][64*512];
+
+static uint16_t rd16(uint8_t const* p) { return p[0] | (p[1] << 8); }
+static uint32_t rd32(uint8_t const* p) { return rd16(p) | (rd16(p+2) << 16); }
+
+// read what a host reads to mount the volume, return its geometry
+static volume_t mount(void)
+{
+  uint8_t sector[512];
+  volume_t vol;
+
+  read_block(0, sector);
+  HOST_CHECK( sector[510] == 0x55 && sector[511] == 0xaa );
+  HOST_CHECK( rd16(sector + 11) == 512 && sector[13] == 1 );
+
+  vol.fat_start     = rd16(sector + 14);
+  vol.fat_copies    = sector[16];
+  vol.fat_sectors   = rd16(sector + 22);
+  vol.total_sectors = rd16(sector + 19);
+  vol.root_start    = vol.fat_start + vol.fat_copies * vol.fat_sectors;
+  vol.data_start    = vol.root_start + rd16(sector + 17) * 32 / 512;
+
+  HOST_CHECK( vol.fat_copies == 2 && vol.fat_sectors * 512 <= sizeof(_fat[0]) );
+
+  for(uint32_t copy = 0; copy < vol.fat_copies; copy++)
+  {
+    for(uint32_t i = 0; i < vol.fat_sectors; i++)
+    {
+      read_block(vol.fat_start + copy*vol.fat_sectors + i, _fat[copy] + i*512);
+    }
+  }
+
+  for(uint32_t s = vol.root_start; s < vol.data_start; s++) read_block(s, sector);
+
+  return vol;
+}
+
+// read a whole file following its cluster chain, return number of bytes read
+static uint32_t read_file(volume_t const* vol, uint16_t cluster, uint8_t* buf, uint32_t bufsize)
+{
+  uint32_t count = 0;
+
+  while ( 1 )
+  {
+    HOST_CHECK( cluster >= 2 && cluster < vol->total_sectors );
+    HOST_CHECK( count + 512 <= bufsize );
+
+    read_block(vol->data_start + cluster - 2, buf + count);
+    count += 512;
+
+    uint16_t const next = rd16(_fat[0] + 2*cluster);
+    if ( next == 0xffff ) break;
+
+    // files are contiguous
+    HOST_CHECK( next == cluster + 1 );
+    cluster = next;
+  }
+
+  return count;
+}
+
+static uint8_t _file[2*1024*1024];
+
+// app_size is what exported files must hold, 256 bytes when there is no valid application
+static void check_volume(volume_t const* vol, uint32_t app_size)
+{
+  uint8_t dir[512];
+
+  HOST_CHECK( memcmp(_fat[0], _fat[1], vol->fat_sectors*512) == 0 );
+  HOST_CHECK( rd16(_fat[0]) == 0xfff8 );
+
+  read_block(vol->root_start, dir);
+  HOST_CHECK( dir[11] == 0x28 ); // volume label
+
+  uint32_t files = 0;
+
+  for(uint8_t const* d = dir + 32; d < dir + 512 && d[0]; d += 32, files++)
+  {
+    char name[12];
+    memcpy(name, d, 11);
+    name[11] = 0;
+
+    uint32_t const size = rd32(d + 28);
+    uint32_t const count = read_file(vol, rd16(d + 26), _file, sizeof(_file));
+
+    // chain is exactly as long as the file
+    HOST_CHECK( count == ((size + 511) / 512 ? (size + 511) / 512 : 1) * 512 );
+
+    if ( !memcmp(name, "CURRENT UF2", 11) )
+    {
+      uint32_t const num_blocks = (app_size + 255) / 256;
+      HOST_CHECK( size == num_blocks * 512 );
+
+      for(uint32_t i = 0; i < num_blocks; i++)
+      {
+        UF2_Block const* bl = (UF2_Block const*) (_file + i*512);
+
+        HOST_CHECK( is_uf2_block((void*) bl) );
+        HOST_CHECK( bl->blockNo == i && bl->numBlocks == num_blocks && bl->payloadSize == 256 );
+        HOST_CHECK( bl->targetAddr == USER_FLASH_START + i*256 );
+        HOST_CHECK( memcmp(bl->data, (void*) (uintptr_t) bl->targetAddr, 256) == 0 );
+      }
+    }
+    else if ( !memcmp(name, "CURRENT BIN", 11) )
+    {
+      HOST_CHECK( size == ((app_size + 255) & ~255UL) );
+      HOST_CHECK( memcmp(_file, (void*) USER_FLASH_START, size) == 0 );
+    }
+    else if ( !memcmp(name, "INFO_UF2TXT", 11) )
+    {
+      HOST_CHECK( memcmp(_file, "UF2 Bootloader", 14) == 0 );
+    }
+  }
+
+  HOST_CHECK( files >= 4 );
+}
+
+static UF2_Block make_block(uint32_t flags, uint32_t addr, uint32_t size)
+{
+  UF2_Block bl;
+  memset(&bl, 0, sizeof(bl));
+
+  bl.magicStart0 = UF2_MAGIC_START0;
+  bl.magicStart1 = UF2_MAGIC_START1;
+  bl.magicEnd    = UF2_MAGIC_END;
+  bl.flags       = flags | UF2_FLAG_FAMILYID;
+  bl.familyID    = UF2_FAMILY_ID;
+  bl.targetAddr  = addr;
+  bl.payloadSize = size;
+  bl.numBlocks   = 1;
+
+  return bl;
+}
+
+static void set_checksum(UF2_Block* bl, uint32_t addr, uint32_t size)
+{
+  UF2_Checksum cs = { .targetAddr = addr, .size = size };
+  memcpy(bl->data + sizeof(bl->data) - sizeof(cs), &cs, sizeof(cs));
+}
+
+// Blocks with ranges near the top of the address space: addr + size wraps to a small value,
+// which must not pass for a range in flash (reading it would fault)
+static void check_wrapping_blocks(void)
+{
+  WriteState state;
+  uint32_t const erase_count = flash_sim_stats.erase_count;
+
+  // payload target wraps
+  memset(&state, 0, sizeof(state));
+  UF2_Block bl = make_block(0, 0xFFFFFF00, 256);
+  write_block(0, (uint8_t*) &bl, true, &state);
+  HOST_CHECK( state.endAddr == 0 && !state.started );
+
+  // MD5 of a block already in flash, checksum range wraps
+  memset(&state, 0, sizeof(state));
+  bl = make_block(UF2_FLAG_MD5, USER_FLASH_START, 256);
+  set_checksum(&bl, 0xFFFFF000, 0x2000);
+  write_block(0, (uint8_t*) &bl, true, &state);
+  HOST_CHECK( state.numSkipped == 0 );
+
+  // whole image checksum, range wraps
+  memset(&state, 0, sizeof(state));
+  bl = make_block(UF2_FLAG_NOFLASH | UF2_FLAG_MD5, 0, 0);
+  set_checksum(&bl, 0xFFFFF000, 0x2000);
+  write_block(0, (uint8_t*) &bl, true, &state);
+  HOST_CHECK( state.hasImageChecksum && !write_state_verify(&state) );
+
+  flash_nrf5x_flush(true);
+  HOST_CHECK( flash_sim_stats.erase_count - erase_count <= 1 ); // only the valid MD5 block
+  printf("  blocks with wrapping ranges refused\n");
+}
+
+int main(void)
+{
+  flash_sim_init();
+
+  // application with a pattern, bank size not a multiple of 256
+  for(uint32_t addr = USER_FLASH_START; addr < USER_FLASH_END; addr++)
+  {
+    *((uint8_t*) (uintptr_t) addr) = (uint8_t) (addr*7 + (addr >> 8));
+  }
+
+  host_app_valid = true;
+  host_settings.bank_0      = BANK_VALID_APP;
+  host_settings.bank_0_size = APP_SIZE;
+
+  // first mount builds the layout
+  uint64_t t0 = host_time_ns();
+  volume_t const vol = mount();
+  uint64_t const first_ns = host_time_ns() - t0;
+
+  check_volume(&vol, APP_SIZE);
+
+  t0 = host_time_ns();
+  for(int i = 0; i < MOUNT_REPEAT; i++) mount();
+  uint64_t const mount_ns = (host_time_ns() - t0) / MOUNT_REPEAT;
+
+  // read back the whole volume sector by sector, as a host copying every file would
+  uint8_t sector[512];
+  t0 = host_time_ns();
+  for(uint32_t s = 0; s < vol.total_sectors; s++) read_block(s, sector);
+  uint64_t const volume_ns = host_time_ns() - t0;
+
+  uint32_t const mount_sectors = 1 + vol.fat_copies*vol.fat_sectors + (vol.data_start - vol.root_start);
+
+  printf("ghostfat: %u sectors read at mount, %u sectors on volume\n", mount_sectors, vol.total_sectors);
+  printf("  first mount        %8.1f us\n", first_ns / 1000.0);
+  printf("  mount              %8.1f us (%.0f ns per sector)\n", mount_ns / 1000.0, (double) mount_ns / mount_sectors);
+  printf("  whole volume read  %8.1f us (%.0f ns per sector)\n", volume_ns / 1000.0, (double) volume_ns / vol.total_sectors);
+
+  // application erased (DFU_BANK_0_ERASED), exports shrink to a single block on next mount
+  host_app_valid = false;
+  host_settings.bank_0      = BANK_INVALID_APP;
+  host_settings.bank_0_size = 0;
+  ghostfat_layout_reset();
+
+  volume_t const erased = mount();
+  check_volume(&erased, 256);
+  printf("  layout reset after application erase\n");
+
+  check_wrapping_blocks();
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Bootloader, board and USB driver functions used by the sources under test
+
+#include "host_stub.h"
+
+#include "boards.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "tusb.h"
+#include "portable/nordic/nrf5x/dcd_nrf5x.h"
+
+#include "flash_sim.h"
+
+bootloader_settings_t host_settings;
+bool host_app_valid;
+uint32_t host_app_address = 0x26000;
+
+//--------------------------------------------------------------------+
+// Bootloader
+//--------------------------------------------------------------------+
+void bootloader_util_settings_get(const bootloader_settings_t ** pp_bootloader_settings)
+{
+  *pp_bootloader_settings = &host_settings;
+}
+
+void bootloader_settings_get(bootloader_settings_t * const p_settings)
+{
+  *p_settings = host_settings;
+}
+
+bool bootloader_app_is_valid(uint32_t app_addr)
+{
+  (void) app_addr;
+  return host_app_valid;
+}
+
+uint32_t bootloader_app_address(void)
+{
+  return host_app_address;
+}
+
+//--------------------------------------------------------------------+
+// Board
+//--------------------------------------------------------------------+
+void led_state(uint32_t state)
+{
+  (void) state;
+}
+
+boot_stats_t const* boot_stats_get(void)
+{
+  static boot_stats_t const stats = { .reset_reason = 0, .boot_count = 1 };
+  return &stats;
+}
+
+//--------------------------------------------------------------------+
+// USB
+//--------------------------------------------------------------------+
+dcd_nrf5x_stats_t const* dcd_nrf5x_stats (uint8_t ep_addr)
+{
+  (void) ep_addr;
+  static dcd_nrf5x_stats_t const stats;
+  return &stats;
+}
+
+// provided by the tinyusb Linux port in USB/IP builds
+#if CFG_TUSB_MCU != OPT_MCU_LINUX
+uint32_t tusb_hal_millis(void)
+{
+  return (uint32_t) (host_time_ns() / 1000000);
+}
+#endif
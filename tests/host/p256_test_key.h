@@ -0,0 +1,7 @@
+// Public key of p256_test_key.pem, test only
+  0x23, 0xca, 0x90, 0xaa, 0xcb, 0xa6, 0x91, 0xa9, 0xcd, 0x9e, 0xa0, 0x4c,
+  0xbe, 0xd1, 0x34, 0xf2, 0x18, 0xa4, 0xcc, 0xdc, 0x1d, 0x23, 0x2b, 0x9b,
+  0xd8, 0x37, 0x4a, 0xd3, 0xdf, 0xc7, 0x34, 0x34, 0xc1, 0xc5, 0x4b, 0xf5,
+  0x63, 0x9a, 0x62, 0xb9, 0x4e, 0x11, 0x8d, 0x9e, 0x9d, 0xd8, 0xb4, 0x3b,
+  0x59, 0xd8, 0x58, 0xda, 0x15, 0x58, 0xcc, 0xd1, 0x4d, 0xa5, 0x18, 0x12,
+  0x80, 0xf4, 0x26, 0xdc
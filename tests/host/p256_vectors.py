@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Generate ECDSA P-256 verification vectors for p256_verify, with plain Python arithmetic.
+
+Each line is: public key X|Y, digest, signature r|s (hex, big endian) and 1 if valid, 0 if not.
+
+usage: p256_vectors.py > p256_vectors.txt
+"""
+
+import hashlib
+import random
+
+p = 0xFFFFFFFF00000001000000000000000000000000FFFFFFFFFFFFFFFFFFFFFFFF
+n = 0xFFFFFFFF00000000FFFFFFFFFFFFFFFFBCE6FAADA7179E84F3B9CAC2FC632551
+G = (0x6B17D1F2E12C4247F8BCE6E563A440F277037D812DEB33A0F4A13945D898C296,
+     0x4FE342E2FE1A7F9B8EE7EB4A7C0F9E162BCE33576B315ECECBB6406837BF51F5)
+
+
+def add(P, Q):
+    if P is None:
+        return Q
+    if Q is None:
+        return P
+    if P[0] == Q[0]:
+        if (P[1] + Q[1]) % p == 0:
+            return None
+        slope = (3 * P[0] * P[0] - 3) * pow(2 * P[1], -1, p) % p
+    else:
+        slope = (Q[1] - P[1]) * pow(Q[0] - P[0], -1, p) % p
+    x = (slope * slope - P[0] - Q[0]) % p
+    return (x, (slope * (P[0] - x) - P[1]) % p)
+
+
+def mul(k, P):
+    R = None
+    while k:
+        if k & 1:
+            R = add(R, P)
+        P = add(P, P)
+        k >>= 1
+    return R
+
+
+def sign(d, h):
+    while True:
+        k = random.randrange(1, n)
+        r = mul(k, G)[0] % n
+        if r == 0:
+            continue
+        s = pow(k, -1, n) * (h + r * d) % n
+        if s:
+            return r, s
+
+
+def b32(v):
+    return v.to_bytes(32, 'big').hex()
+
+
+def vector(Q, h, r, s, ok):
+    print(b32(Q[0]) + b32(Q[1]), (h % (1 << 256)).to_bytes(32, 'big').hex(), b32(r) + b32(s), ok)
+
+
+def main():
+    for seed in (1, 2):
+        random.seed(seed)
+        for i in range(40):
+            d = random.randrange(1, n)
+            Q = mul(d, G)
+            msg = random.randbytes(random.randrange(0, 200))
+            h = int.from_bytes(hashlib.sha256(msg).digest(), 'big')
+            if i == 0:
+                h = n + 5  # digest >= n
+            if i == 1:
+                h = 0
+            r, s = sign(d, h)
+            ok = 1
+            kind = i % 5
+            if i >= 2 and kind == 1:  # wrong s
+                s = (s + 1) % n or 1
+                ok = 0
+            if i >= 2 and kind == 2:  # wrong digest
+                h = h ^ 1
+                ok = 0
+            if i >= 2 and kind == 3:  # wrong key
+                Q = mul(d + 1, G)
+                ok = 0
+            if i >= 2 and kind == 4:  # high s, still valid
+                s = n - s
+            vector(Q, h, r, s, ok)
+
+    # r or s out of range, key not on curve
+    Q = mul(7, G)
+    vector(Q, 0, n, 1, 0)
+    vector(Q, 0, 0, 1, 0)
+    vector(Q, 0, 1, n, 0)
+    vector((Q[0], (Q[1] + 1) % p), 0, 1, 1, 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,118 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// ECDSA P-256 verification against the vectors of p256_vectors.txt (valid, wrong s, digest or
+// key, high s, digest >= n, r/s out of range, key off the curve), and time of one verification.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "p256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_CYCLES()   __rdtsc()
+#endif
+
+#define VECTOR_FILE     "p256_vectors.txt"
+#define BENCH_REPEAT    200
+
+static void from_hex(uint8_t* out, char const* hex, uint32_t len)
+{
+  HOST_CHECK( strlen(hex) == 2*len );
+  for(uint32_t i = 0; i < len; i++) HOST_CHECK( sscanf(hex + 2*i, "%2hhx", out + i) == 1 );
+}
+
+int main(void)
+{
+  FILE* file = fopen(VECTOR_FILE, "r");
+  HOST_CHECK( file != NULL );
+
+  char key_hex[256], digest_hex[128], sig_hex[256];
+  int valid;
+  uint32_t count = 0;
+
+  uint8_t key[P256_PUBLIC_KEY_LEN], digest[32], sig[P256_SIGNATURE_LEN];
+  uint8_t bench_key[P256_PUBLIC_KEY_LEN], bench_digest[32], bench_sig[P256_SIGNATURE_LEN];
+  bool has_bench = false;
+
+  while ( fscanf(file, "%255s %127s %255s %d", key_hex, digest_hex, sig_hex, &valid) == 4 )
+  {
+    from_hex(key, key_hex, sizeof(key));
+    from_hex(digest, digest_hex, sizeof(digest));
+    from_hex(sig, sig_hex, sizeof(sig));
+
+    if ( p256_ecdsa_verify(key, digest, sig) != (bool) valid )
+    {
+      fprintf(stderr, "vector %u: expected %s\n", count + 1, valid ? "valid" : "invalid");
+      return 1;
+    }
+
+    // time a valid signature of an ordinary digest
+    if ( valid && !has_bench && digest[0] )
+    {
+      memcpy(bench_key, key, sizeof(key));
+      memcpy(bench_digest, digest, sizeof(digest));
+      memcpy(bench_sig, sig, sizeof(sig));
+      has_bench = true;
+    }
+
+    count++;
+  }
+  fclose(file);
+
+  HOST_CHECK( count > 0 && has_bench );
+  printf("p256, window %u bits: %u vectors ok\n", P256_WINDOW_BITS, count);
+
+  // best of several runs, least disturbed by the host
+  uint64_t best_ns = UINT64_MAX;
+#ifdef HOST_CYCLES
+  uint64_t best_cycles = UINT64_MAX;
+#endif
+
+  for(int i = 0; i < BENCH_REPEAT; i++)
+  {
+    uint64_t const t0 = host_time_ns();
+#ifdef HOST_CYCLES
+    uint64_t const c0 = HOST_CYCLES();
+#endif
+
+    HOST_CHECK( p256_ecdsa_verify(bench_key, bench_digest, bench_sig) );
+
+#ifdef HOST_CYCLES
+    uint64_t const cycles = HOST_CYCLES() - c0;
+    if ( cycles < best_cycles ) best_cycles = cycles;
+#endif
+    uint64_t const ns = host_time_ns() - t0;
+    if ( ns < best_ns ) best_ns = ns;
+  }
+
+#ifdef HOST_CYCLES
+  printf("  verify %8.1f us, %6lu kcycles\n", best_ns / 1000.0, (unsigned long) (best_cycles / 1000));
+#else
+  printf("  verify %8.1f us\n", best_ns / 1000.0);
+#endif
+
+  return 0;
+}
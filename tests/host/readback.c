@@ -0,0 +1,355 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// Flash readback (dfu_readback.c) as the serial and BLE transports drive it: READ streams flash
+// in frames of any size, each with its address, SUMMARY reports the CRC-CCITT of every page
+// and DIGEST the size and SHA-256 of each region once hashed by dfu_readback_task(). Requests
+// outside the readable ranges, wrapping around the address space, unaligned summaries, unknown
+// ops and short requests get a single error frame. Built again with DFU_READBACK_APP=0, as
+// with encrypted images, where the application content is refused but not its CRCs.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "host_stub.h"
+
+#include "crc16.h"
+#include "sha256.h"
+#include "dfu_types.h"
+#include "bootloader.h"
+#include "flash_nrf5x.h"
+#include "dfu_readback.h"
+
+#define APP_START     0x26000
+#define APP_SIZE      50001
+#define SETTINGS_LOG  BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS
+
+static uint8_t  _frame[8192];
+static uint8_t  _payload[256*1024];
+static uint32_t _ready_count;
+
+//--------------------------------------------------------------------+
+// Bootloader: application digest cached in settings
+//--------------------------------------------------------------------+
+void bootloader_app_digest_save(uint32_t app_size, uint8_t const * p_digest)
+{
+  host_settings.app_digest_size = app_size;
+  memcpy(host_settings.app_digest, p_digest, SHA256_DIGEST_LEN);
+}
+
+static void ready_handler(void)
+{
+  _ready_count++;
+}
+
+//--------------------------------------------------------------------+
+// Helpers
+//--------------------------------------------------------------------+
+static void request(uint8_t op, uint32_t addr, uint32_t len)
+{
+  uint8_t const req[DFU_READBACK_REQUEST_LEN] =
+  {
+    op,
+    (uint8_t) addr, (uint8_t) (addr >> 8), (uint8_t) (addr >> 16), (uint8_t) (addr >> 24),
+    (uint8_t) len , (uint8_t) (len  >> 8), (uint8_t) (len  >> 16), (uint8_t) (len  >> 24)
+  };
+
+  dfu_readback_request(req, sizeof(req), ready_handler);
+}
+
+static uint32_t get32(uint8_t const* p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Frames of a READ or SUMMARY until done, each must follow the previous one. Return payload
+// length gathered into _payload
+static uint32_t stream(uint8_t op, uint32_t addr, uint16_t bufsize, uint32_t flash_per_byte_div)
+{
+  uint32_t total = 0;
+  uint32_t frames = 0;
+  uint16_t len;
+
+  while ( (len = dfu_readback_next(_frame, bufsize)) != 0 )
+  {
+    HOST_CHECK( len >= DFU_READBACK_HEADER_LEN && len <= bufsize );
+    HOST_CHECK( _frame[0] == op );
+    HOST_CHECK( _frame[1] == DFU_READBACK_STATUS_OK );
+    HOST_CHECK( get32(_frame + 2) == addr + total * flash_per_byte_div );
+
+    uint32_t const n = len - DFU_READBACK_HEADER_LEN;
+    HOST_CHECK( total + n <= sizeof(_payload) );
+    memcpy(_payload + total, _frame + DFU_READBACK_HEADER_LEN, n);
+    total += n;
+    frames++;
+  }
+
+  HOST_CHECK( frames > 0 );
+  return total;
+}
+
+// Single frame with status and no payload, nothing after it
+static void check_error(uint8_t op, uint32_t addr, uint32_t len, uint8_t status)
+{
+  request(op, addr, len);
+
+  HOST_CHECK( dfu_readback_next(_frame, 64) == DFU_READBACK_HEADER_LEN );
+  HOST_CHECK( _frame[0] == op );
+  HOST_CHECK( _frame[1] == status );
+  HOST_CHECK( get32(_frame + 2) == addr );
+  HOST_CHECK( dfu_readback_next(_frame, 64) == 0 );
+}
+
+static void check_read(uint32_t addr, uint32_t len)
+{
+  uint16_t const sizes[] = { 8, 9, 20, 64, 250, 4096 };
+
+  for(uint32_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+  {
+    request(DFU_READBACK_OP_READ, addr, len);
+    HOST_CHECK( stream(DFU_READBACK_OP_READ, addr, sizes[i], 1) == len );
+    HOST_CHECK( memcmp(_payload, (void const*) addr, len) == 0 );
+  }
+}
+
+// CRC-CCITT bit by bit, zero initial value
+static uint16_t crc_ccitt(uint8_t const* data, uint32_t len)
+{
+  uint16_t crc = 0;
+
+  for(uint32_t i = 0; i < len; i++)
+  {
+    crc ^= (uint16_t) (data[i] << 8);
+    for(int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+  }
+
+  return crc;
+}
+
+static void check_summary(uint32_t addr, uint32_t pages)
+{
+  uint16_t const sizes[] = { 8, 9, 16, 64, 4096 };
+
+  for(uint32_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+  {
+    request(DFU_READBACK_OP_SUMMARY, addr, pages*CODE_PAGE_SIZE);
+    HOST_CHECK( stream(DFU_READBACK_OP_SUMMARY, addr, sizes[i], CODE_PAGE_SIZE/2) == 2*pages );
+
+    for(uint32_t p = 0; p < pages; p++)
+    {
+      uint16_t const crc = _payload[2*p] | (_payload[2*p+1] << 8);
+      HOST_CHECK( crc == crc_ccitt((uint8_t const*) (addr + p*CODE_PAGE_SIZE), CODE_PAGE_SIZE) );
+    }
+  }
+}
+
+static void sha256(uint32_t addr, uint32_t len, uint8_t* digest)
+{
+  sha256_context_t ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, (void const*) addr, len);
+  sha256_final(&ctx, digest);
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+static void check_frames(void)
+{
+  // below the application, unaligned, one byte, empty
+  check_read(0x10003, 5001);
+  check_read(0x20000, 1);
+
+  request(DFU_READBACK_OP_READ, 0x20000, 0);
+  HOST_CHECK( dfu_readback_next(_frame, 64) == DFU_READBACK_HEADER_LEN );
+  HOST_CHECK( _frame[1] == DFU_READBACK_STATUS_OK );
+  HOST_CHECK( dfu_readback_next(_frame, 64) == 0 );
+
+  // settings log, up to its end
+  check_read(SETTINGS_LOG, 2*CODE_PAGE_SIZE);
+  check_read(BOOTLOADER_SETTINGS_ADDRESS + CODE_PAGE_SIZE - 3, 3);
+
+  // application, as long as the application may be read
+#if DFU_READBACK_APP
+  check_read(APP_START + 1, APP_SIZE);
+  check_read(BOOTLOADER_REGION_START - 7, 7);
+#else
+  check_read(APP_START - 7, 7);
+#endif
+
+  // CRCs of every page, application included
+  check_summary(0x10000, 1);
+  check_summary(APP_START, 20);
+  check_summary(BOOTLOADER_REGION_START - 3*CODE_PAGE_SIZE, 3);
+  check_summary(SETTINGS_LOG, 2);
+
+  // frame smaller than header and one page CRC, request in progress is kept
+  request(DFU_READBACK_OP_READ, 0x10000, 16);
+  HOST_CHECK( dfu_readback_next(_frame, DFU_READBACK_HEADER_LEN + 1) == 0 );
+  HOST_CHECK( stream(DFU_READBACK_OP_READ, 0x10000, 64, 1) == 16 );
+
+  // dropped
+  request(DFU_READBACK_OP_READ, 0x10000, 4096);
+  HOST_CHECK( dfu_readback_next(_frame, 64) == 64 );
+  dfu_readback_abort();
+  HOST_CHECK( dfu_readback_next(_frame, 64) == 0 );
+
+  // data still in flash cache is flushed first
+  uint8_t const pending[] = "written over UF2, not flushed yet";
+  flash_nrf5x_write(APP_START - CODE_PAGE_SIZE + 100, pending, sizeof(pending), true);
+  request(DFU_READBACK_OP_READ, APP_START - CODE_PAGE_SIZE + 100, sizeof(pending));
+  HOST_CHECK( stream(DFU_READBACK_OP_READ, APP_START - CODE_PAGE_SIZE + 100, 64, 1) == sizeof(pending) );
+  HOST_CHECK( memcmp(_payload, pending, sizeof(pending)) == 0 );
+}
+
+static void check_rejected(void)
+{
+  uint8_t const invalid_range = DFU_READBACK_STATUS_INVALID_RANGE;
+
+  // bootloader, in part or whole
+  check_error(DFU_READBACK_OP_READ, BOOTLOADER_REGION_START, 4, invalid_range);
+  check_error(DFU_READBACK_OP_READ, BOOTLOADER_REGION_START - 4, 8, invalid_range);
+  check_error(DFU_READBACK_OP_READ, SETTINGS_LOG - 4, 8, invalid_range);
+  check_error(DFU_READBACK_OP_READ, 0, BOOTLOADER_REGION_START + 1, invalid_range);
+
+  // past the settings log and the end of flash
+  check_error(DFU_READBACK_OP_READ, SETTINGS_LOG, 2*CODE_PAGE_SIZE + 1, invalid_range);
+  check_error(DFU_READBACK_OP_READ, FLASH_SIM_END - 1, 2, invalid_range);
+  check_error(DFU_READBACK_OP_READ, FLASH_SIM_END, 1, invalid_range);
+
+  // wrapping around the address space
+  check_error(DFU_READBACK_OP_READ, 0xFFFFFFF0, 0x20, invalid_range);
+  check_error(DFU_READBACK_OP_READ, 0x10, 0xFFFFFFF8, invalid_range);
+  check_error(DFU_READBACK_OP_READ, SETTINGS_LOG + 16, 0xFFFFFFF8, invalid_range);
+  check_error(DFU_READBACK_OP_SUMMARY, 0xFFFFF000, 0x2000, invalid_range);
+
+#if !DFU_READBACK_APP
+  check_error(DFU_READBACK_OP_READ, APP_START, 4, invalid_range);
+  check_error(DFU_READBACK_OP_READ, APP_START - 4, 8, invalid_range);
+#endif
+
+  // summary of whole pages only
+  check_error(DFU_READBACK_OP_SUMMARY, APP_START + 4, CODE_PAGE_SIZE, invalid_range);
+  check_error(DFU_READBACK_OP_SUMMARY, APP_START, CODE_PAGE_SIZE + 4, invalid_range);
+  check_error(DFU_READBACK_OP_SUMMARY, BOOTLOADER_REGION_START, CODE_PAGE_SIZE, invalid_range);
+
+  // digest of no region or an unknown one
+  check_error(DFU_READBACK_OP_DIGEST, 0, 0, invalid_range);
+  check_error(DFU_READBACK_OP_DIGEST, DFU_READBACK_REGION_APP | 0x08, 0, invalid_range);
+
+  // unknown op, request too short: op is echoed
+  check_error(0x7F, 0x10000, 4, DFU_READBACK_STATUS_INVALID_OP);
+
+  uint8_t const short_req[] = { DFU_READBACK_OP_READ, 0x00, 0x00, 0x01, 0x00, 0x10 };
+  dfu_readback_request(short_req, sizeof(short_req), ready_handler);
+  HOST_CHECK( dfu_readback_next(_frame, 64) == DFU_READBACK_HEADER_LEN );
+  HOST_CHECK( _frame[0] == DFU_READBACK_OP_READ && _frame[1] == DFU_READBACK_STATUS_INVALID_OP );
+  HOST_CHECK( dfu_readback_next(_frame, 64) == 0 );
+}
+
+// Application and bootloader (SoftDevice and MBR are not simulated)
+static void check_digest(void)
+{
+  uint32_t const bl_size = SETTINGS_LOG - BOOTLOADER_REGION_START;
+  uint8_t app_digest[SHA256_DIGEST_LEN], bl_digest[SHA256_DIGEST_LEN];
+
+  sha256(APP_START, APP_SIZE, app_digest);
+  sha256(BOOTLOADER_REGION_START, bl_size, bl_digest);
+
+  // hashed a chunk per task call, ready handler called once then
+  _ready_count = 0;
+  request(DFU_READBACK_OP_DIGEST, DFU_READBACK_REGION_APP | DFU_READBACK_REGION_BOOTLOADER, 0xFFFFFFFF);
+
+  uint32_t tasks = 0;
+  while ( dfu_readback_next(_frame, 128) == 0 )
+  {
+    HOST_CHECK( _ready_count == 0 && tasks < 1000 );
+    dfu_readback_task();
+    tasks++;
+  }
+
+  HOST_CHECK( _ready_count == 1 );
+  HOST_CHECK( tasks > (APP_SIZE + bl_size) / CODE_PAGE_SIZE );
+  HOST_CHECK( _frame[1] == DFU_READBACK_STATUS_OK );
+  HOST_CHECK( get32(_frame + 2) == (DFU_READBACK_REGION_APP | DFU_READBACK_REGION_BOOTLOADER) );
+  HOST_CHECK( get32(_frame + 6) == APP_SIZE );
+  HOST_CHECK( memcmp(_frame + 10, app_digest, SHA256_DIGEST_LEN) == 0 );
+  HOST_CHECK( get32(_frame + 42) == bl_size );
+  HOST_CHECK( memcmp(_frame + 46, bl_digest, SHA256_DIGEST_LEN) == 0 );
+  HOST_CHECK( dfu_readback_next(_frame, 128) == 0 );
+
+  // application digest cached, answered at once
+  HOST_CHECK( host_settings.app_digest_size == APP_SIZE );
+  HOST_CHECK( memcmp(host_settings.app_digest, app_digest, SHA256_DIGEST_LEN) == 0 );
+
+  request(DFU_READBACK_OP_DIGEST, DFU_READBACK_REGION_APP, 0);
+  HOST_CHECK( dfu_readback_next(_frame, 64) == DFU_READBACK_HEADER_LEN + 4 + SHA256_DIGEST_LEN );
+  HOST_CHECK( memcmp(_frame + 10, app_digest, SHA256_DIGEST_LEN) == 0 );
+
+  // both entries do not fit in the frame
+  _ready_count = 0;
+  request(DFU_READBACK_OP_DIGEST, DFU_READBACK_REGION_APP | DFU_READBACK_REGION_BOOTLOADER, 0);
+  for(uint32_t i = 0; i < 1000 && !_ready_count; i++) dfu_readback_task();
+
+  HOST_CHECK( dfu_readback_next(_frame, DFU_READBACK_HEADER_LEN + 2*(4 + SHA256_DIGEST_LEN) - 1) == DFU_READBACK_HEADER_LEN );
+  HOST_CHECK( _frame[1] == DFU_READBACK_STATUS_NO_MEM );
+
+  // no valid application: empty digest, not cached
+  host_settings.bank_0 = BANK_ERASED;
+  host_settings.app_digest_size = 0xFFFFFFFF;
+
+  request(DFU_READBACK_OP_DIGEST, DFU_READBACK_REGION_APP, 0);
+  for(uint32_t i = 0; i < 10 && !dfu_readback_next(_frame, 64); i++) dfu_readback_task();
+
+  sha256(APP_START, 0, app_digest);
+  HOST_CHECK( get32(_frame + 6) == 0 );
+  HOST_CHECK( memcmp(_frame + 10, app_digest, SHA256_DIGEST_LEN) == 0 );
+  HOST_CHECK( host_settings.app_digest_size == 0xFFFFFFFF );
+}
+
+int main(void)
+{
+  flash_sim_init();
+
+  uint32_t seed = 1;
+  for(uint8_t* p = (uint8_t*) FLASH_SIM_START; p < (uint8_t*) FLASH_SIM_END; p++)
+  {
+    seed = seed * 1103515245 + 12345;
+    *p = (uint8_t) (seed >> 16);
+  }
+
+  memset(&host_settings, 0xFF, sizeof(host_settings));
+  host_settings.bank_0      = BANK_VALID_APP;
+  host_settings.bank_0_size = APP_SIZE;
+
+  check_frames();
+  check_rejected();
+  check_digest();
+
+  printf("readback: frames, page CRCs, digests and range checks ok (application %s)\n",
+         DFU_READBACK_APP ? "readable" : "not readable");
+
+  return 0;
+}
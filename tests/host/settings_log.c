@@ -0,0 +1,501 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Settings log of the bootloader on simulated NOR flash: saves fill a page and move the log over
+// to the other one, with and without the SoftDevice (pstorage). Power is cut at every erase and
+// word of a save and of moving the log home, the settings in flash must then be the old or the
+// new ones. Records with a bad CRC are skipped, fields written in place are not checked by it,
+// and settings of a bootloader predating the log are read and migrated.
+//
+// bootloader.c is built into this program for its static settings writers.
+
+#include "flash_sim.h"
+
+#include "../../lib/sdk11/components/libraries/bootloader_dfu/bootloader.c"
+
+#define RECORD_WORDS  (sizeof(bootloader_settings_record_t) / 4)
+#define SLOT_COUNT    (CODE_PAGE_SIZE / BOOTLOADER_SETTINGS_RECORD_SIZE)
+
+//--------------------------------------------------------------------+
+// Board, SoftDevice and DFU functions used by bootloader.c
+//--------------------------------------------------------------------+
+static bool _ota;
+
+bool is_ota(void)
+{
+  return _ota;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+  fprintf(stderr, "error 0x%x\n", error_code);
+  exit(1);
+}
+
+// Update, DFU transport and USB functions are not reached by these tests
+#define NOT_REACHED()   do { fprintf(stderr, "%s: not expected\n", __func__); exit(1); } while (0)
+
+void app_sched_execute(void) { NOT_REACHED(); }
+ret_code_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode, app_timer_timeout_handler_t timeout_handler) { NOT_REACHED(); }
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context) { NOT_REACHED(); }
+void bootloader_util_app_start(uint32_t start_addr) { NOT_REACHED(); }
+uint32_t dfu_bl_image_swap(void) { NOT_REACHED(); }
+uint32_t dfu_bl_image_validate(void) { NOT_REACHED(); }
+uint32_t dfu_sd_image_swap(void) { NOT_REACHED(); }
+uint32_t dfu_sd_image_validate(void) { NOT_REACHED(); }
+uint32_t dfu_init(void) { NOT_REACHED(); }
+void dfu_readback_task(void) { NOT_REACHED(); }
+uint32_t dfu_transport_ble_update_start(void) { NOT_REACHED(); }
+uint32_t dfu_transport_ble_close() { NOT_REACHED(); }
+uint32_t dfu_transport_serial_update_start(void) { NOT_REACHED(); }
+uint32_t dfu_transport_serial_close(void) { NOT_REACHED(); }
+void ghostfat_layout_reset(void) { NOT_REACHED(); }
+void msc_uf2_task(void) { NOT_REACHED(); }
+bool tusb_inited(void) { NOT_REACHED(); }
+void tud_task(void) { NOT_REACHED(); }
+bool tud_cdc_n_write_flush(uint8_t itf) { NOT_REACHED(); }
+uint32_t sd_softdevice_disable(void) { NOT_REACHED(); }
+uint32_t sd_softdevice_vector_table_base_set(uint32_t address) { NOT_REACHED(); }
+
+// pstorage runs operations after they are queued, as the SoftDevice does
+typedef struct
+{
+  uint8_t         op_code;
+  uint32_t        addr;
+  uint8_t const * p_data;
+  uint32_t        size;
+} pstorage_op_t;
+
+static pstorage_op_t _pstorage_ops[4];
+static uint32_t      _pstorage_count;
+
+uint32_t pstorage_init(void)
+{
+  return NRF_SUCCESS;
+}
+
+uint32_t pstorage_register(pstorage_module_param_t * p_module_param, pstorage_handle_t * p_block_id)
+{
+  (void) p_module_param; (void) p_block_id;
+  return NRF_SUCCESS;
+}
+
+uint32_t pstorage_clear(pstorage_handle_t * p_base_id, pstorage_size_t size)
+{
+  HOST_CHECK(_pstorage_count < 4);
+  _pstorage_ops[_pstorage_count++] = (pstorage_op_t) { PSTORAGE_CLEAR_OP_CODE, p_base_id->block_id, NULL, size };
+  return NRF_SUCCESS;
+}
+
+uint32_t pstorage_store(pstorage_handle_t * p_dest, uint8_t * p_src, pstorage_size_t size, pstorage_size_t offset)
+{
+  HOST_CHECK(_pstorage_count < 4);
+  _pstorage_ops[_pstorage_count++] = (pstorage_op_t) { PSTORAGE_STORE_OP_CODE, p_dest->block_id + offset, p_src, size };
+  return NRF_SUCCESS;
+}
+
+// Run queued operations, each completes with a callback
+static void pstorage_run(void)
+{
+  for ( uint32_t i = 0; i < _pstorage_count; i++ )
+  {
+    pstorage_op_t const* op = &_pstorage_ops[i];
+
+    if ( op->op_code == PSTORAGE_CLEAR_OP_CODE )
+    {
+      nrf_nvmc_page_erase(op->addr);
+    }
+    else
+    {
+      nrf_nvmc_write_words(op->addr, (uint32_t const*) op->p_data, op->size / 4);
+    }
+
+    pstorage_callback_handler(&m_bootsettings_handle, op->op_code, NRF_SUCCESS, (uint8_t*) op->p_data, op->size);
+  }
+
+  _pstorage_count = 0;
+}
+
+//--------------------------------------------------------------------+
+// Helpers
+//--------------------------------------------------------------------+
+static uint8_t _pages[2][CODE_PAGE_SIZE];
+
+static bootloader_settings_t const* current(void)
+{
+  bootloader_settings_t const* p_settings;
+  bootloader_util_settings_get(&p_settings);
+  return p_settings;
+}
+
+// settings are the first field of a record
+static bootloader_settings_record_t const* current_record(void)
+{
+  return (bootloader_settings_record_t const*) current();
+}
+
+static bootloader_settings_record_t const* slot_record(uint32_t page, uint32_t slot)
+{
+  uint32_t const base = page ? BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS : BOOTLOADER_SETTINGS_ADDRESS;
+  return (bootloader_settings_record_t const*) (base + slot*BOOTLOADER_SETTINGS_RECORD_SIZE);
+}
+
+static void make_settings(bootloader_settings_t* p_settings, uint32_t n)
+{
+  memset(p_settings, 0xFF, sizeof(bootloader_settings_t));
+  p_settings->bank_0      = BANK_VALID_APP;
+  p_settings->bank_0_crc  = (uint16_t) (0x1000 + n);
+  p_settings->bank_0_size = 0x1000 * (n + 1);
+  p_settings->bank_1      = BANK_VALID_APP; // previous application kept, the new one is on trial
+}
+
+// Settings saved the way an update completes
+static void save(uint32_t n)
+{
+  bootloader_settings_t settings;
+  make_settings(&settings, n);
+
+  bootloader_settings_save(&settings);
+  if ( _ota ) pstorage_run();
+}
+
+static bool is_saved(bootloader_settings_t const* p_settings, uint32_t n)
+{
+  return (p_settings->bank_0_crc == (uint16_t) (0x1000 + n)) && (p_settings->bank_0_size == 0x1000 * (n + 1));
+}
+
+// Reset: RAM (the cached record) is lost, flash is kept
+static void reset(void)
+{
+  flash_sim_power_cut(0, NULL);
+  bootloader_settings_refresh();
+}
+
+// Run fn until power is lost after cut erases and word writes, then reset
+static void run_cut(void (*fn)(void), uint32_t cut)
+{
+  static jmp_buf power_lost;
+
+  if ( setjmp(power_lost) == 0 )
+  {
+    flash_sim_power_cut(cut, &power_lost);
+    fn();
+  }
+
+  reset();
+}
+
+static void log_backup(void)
+{
+  memcpy(_pages[0], (void const*) BOOTLOADER_SETTINGS_ADDRESS, CODE_PAGE_SIZE);
+  memcpy(_pages[1], (void const*) BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS, CODE_PAGE_SIZE);
+}
+
+static void log_restore(void)
+{
+  memcpy((void*) BOOTLOADER_SETTINGS_ADDRESS, _pages[0], CODE_PAGE_SIZE);
+  memcpy((void*) BOOTLOADER_MBR_PARAMS_PAGE_ADDRESS, _pages[1], CODE_PAGE_SIZE);
+  reset();
+}
+
+// Erases and words written by fn, from the log in the backup
+static uint32_t flash_ops(void (*fn)(void))
+{
+  log_restore();
+  flash_sim_stats_t const before = flash_sim_stats;
+
+  fn();
+
+  return (flash_sim_stats.erase_count - before.erase_count) + (flash_sim_stats.word_count - before.word_count);
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+// Saves append records to a page, the log moves over to the other page once it is full
+static void check_saves(bool ota)
+{
+  flash_sim_erase_all();
+  reset();
+  _ota = ota;
+
+  for ( uint32_t n = 0; n < 3*SLOT_COUNT + 1; n++ )
+  {
+    save(n);
+
+    bootloader_settings_record_t const* p_record = current_record();
+    HOST_CHECK( p_record == slot_record((n / SLOT_COUNT) % 2, n % SLOT_COUNT) );
+    HOST_CHECK( p_record->seq == n + 1 );
+    HOST_CHECK( is_saved(&p_record->settings, n) );
+    HOST_CHECK( flash_sim_stats.erase_count == n / SLOT_COUNT );
+
+    // also found after a reset
+    reset();
+    HOST_CHECK( current_record() == p_record );
+  }
+
+  // a queued save is not current before it is done
+  if ( ota )
+  {
+    bootloader_settings_t settings;
+    make_settings(&settings, 1000);
+    bootloader_settings_save(&settings);
+
+    HOST_CHECK( is_saved(current(), 3*SLOT_COUNT) );
+    pstorage_run();
+    HOST_CHECK( is_saved(current(), 1000) );
+  }
+
+  _ota = false;
+}
+
+// The record is cached until the log is written
+static void check_cache(void)
+{
+  flash_sim_erase_all();
+  reset();
+
+  save(0);
+  save(1);
+
+  bootloader_settings_record_t const* p_record = current_record();
+
+  // corrupt the current record behind the cache
+  nrf_nvmc_write_word((uint32_t) &p_record->seq, 0);
+  HOST_CHECK( current_record() == p_record );
+
+  bootloader_settings_refresh();
+  HOST_CHECK( current_record() == slot_record(0, 0) );
+
+  // in place writers keep the record current
+  save(2);
+  p_record = current_record();
+  app_trial_mark();
+  HOST_CHECK( current_record() == p_record );
+  HOST_CHECK( app_trial_count(current()) == 1 );
+}
+
+static void save_new(void)
+{
+  save(500);
+}
+
+// Power is lost after every erase and word of a save, appended and moving the log over
+static void check_save_power_cuts(void)
+{
+  for ( uint32_t saved = SLOT_COUNT / 2; saved <= SLOT_COUNT; saved += SLOT_COUNT / 2 )
+  {
+    flash_sim_erase_all();
+    reset();
+
+    for ( uint32_t n = 0; n < saved; n++ ) save(n);
+    log_backup();
+
+    uint32_t const ops = flash_ops(save_new);
+    HOST_CHECK( ops == RECORD_WORDS + ((saved == SLOT_COUNT) ? 1 : 0) );
+
+    for ( uint32_t cut = 0; cut <= ops; cut++ )
+    {
+      log_restore();
+      run_cut(save_new, cut);
+
+      bootloader_settings_record_t const* p_record = current_record();
+
+      if ( cut < ops )
+      {
+        HOST_CHECK( p_record->seq == saved );
+        HOST_CHECK( is_saved(&p_record->settings, saved - 1) );
+      }
+      else
+      {
+        HOST_CHECK( p_record->seq == saved + 1 );
+        HOST_CHECK( is_saved(&p_record->settings, 500) );
+      }
+
+      // next save after the reset is current
+      save(600);
+      HOST_CHECK( current_record()->seq > p_record->seq );
+      HOST_CHECK( is_saved(current(), 600) );
+
+      reset();
+      HOST_CHECK( is_saved(current(), 600) );
+    }
+  }
+}
+
+// Records with a bad CRC are skipped, fields written in place are left out of it
+static void check_bad_crc(void)
+{
+  flash_sim_erase_all();
+  reset();
+
+  for ( uint32_t n = 0; n < SLOT_COUNT + 2; n++ ) save(n);
+
+  // newest two records are at the start of the MBR params page
+  bootloader_settings_record_t const* p_newest = current_record();
+  HOST_CHECK( p_newest == slot_record(1, 1) );
+
+  nrf_nvmc_write_word((uint32_t) &p_newest->settings.app_trial[0], 0);
+  nrf_nvmc_write_word((uint32_t) &p_newest->settings.app_confirmed, 0);
+  nrf_nvmc_write_word((uint32_t) &p_newest->settings.app_digest_size, 0x1000);
+  reset();
+  HOST_CHECK( current_record() == p_newest );
+
+  // a bit cleared in settings, then in seq
+  nrf_nvmc_write_word((uint32_t) &p_newest->settings.bank_0_size, 0);
+  reset();
+  HOST_CHECK( current_record() == slot_record(1, 0) );
+
+  nrf_nvmc_write_word((uint32_t) &slot_record(1, 0)->seq, slot_record(1, 0)->seq & ~1UL);
+  reset();
+  HOST_CHECK( current_record() == slot_record(0, SLOT_COUNT - 1) );
+  HOST_CHECK( is_saved(current(), SLOT_COUNT - 1) );
+
+  // the full page is current again, the log moves over the bad records
+  save(700);
+  HOST_CHECK( current_record() == slot_record(1, 0) );
+  reset();
+  HOST_CHECK( is_saved(current(), 700) );
+}
+
+static void move_home(void)
+{
+  bootloader_settings_home();
+}
+
+static void leave_mbr_page(void)
+{
+  bootloader_settings_leave_mbr_page();
+}
+
+// The log is moved to the start of the settings page, where older bootloaders read settings
+static void check_home(void)
+{
+  bootloader_settings_t settings;
+
+  // log on the MBR params page, then further on the settings page
+  for ( uint32_t saved = SLOT_COUNT + 3; saved <= 2*SLOT_COUNT + 3; saved += SLOT_COUNT )
+  {
+    flash_sim_erase_all();
+    reset();
+
+    for ( uint32_t n = 0; n < saved; n++ ) save(n);
+    app_trial_mark();
+
+    memcpy(&settings, current(), sizeof(settings));
+    HOST_CHECK( (uint32_t) current() != BOOTLOADER_SETTINGS_ADDRESS );
+    log_backup();
+
+    uint32_t const ops = flash_ops(move_home);
+
+    for ( uint32_t cut = 0; cut <= ops; cut++ )
+    {
+      log_restore();
+      run_cut(move_home, cut);
+
+      // fields written in place are carried over
+      HOST_CHECK( memcmp(current(), &settings, sizeof(settings)) == 0 );
+
+      move_home();
+      HOST_CHECK( (uint32_t) current() == BOOTLOADER_SETTINGS_ADDRESS );
+      HOST_CHECK( memcmp(current(), &settings, sizeof(settings)) == 0 );
+
+      reset();
+      HOST_CHECK( (uint32_t) current() == BOOTLOADER_SETTINGS_ADDRESS );
+    }
+  }
+
+  // before an application starts, the log only leaves the MBR params page
+  flash_sim_erase_all();
+  reset();
+
+  for ( uint32_t n = 0; n < 3; n++ ) save(n);
+  log_backup();
+  HOST_CHECK( flash_ops(leave_mbr_page) == 0 );
+
+  for ( uint32_t n = 3; n < SLOT_COUNT + 3; n++ ) save(n);
+  memcpy(&settings, current(), sizeof(settings));
+  leave_mbr_page();
+  HOST_CHECK( (uint32_t) current() == BOOTLOADER_SETTINGS_ADDRESS );
+  HOST_CHECK( memcmp(current(), &settings, sizeof(settings)) == 0 );
+}
+
+// Settings written by a bootloader predating the log, at the start of the settings page
+static void check_legacy(void)
+{
+  flash_sim_erase_all();
+  reset();
+
+  // fields up to sd_image_start
+  bootloader_settings_t legacy;
+  make_settings(&legacy, 800);
+  legacy.sd_image_size  = 0;
+  legacy.bl_image_size  = 0;
+  legacy.app_image_size = 0;
+  legacy.sd_image_start = 0;
+
+  uint32_t const legacy_words = offsetof(bootloader_settings_t, app_digest) / 4;
+  nrf_nvmc_write_words(BOOTLOADER_SETTINGS_ADDRESS, (uint32_t const*) &legacy, legacy_words);
+  reset();
+
+  HOST_CHECK( (uint32_t) current() == BOOTLOADER_SETTINGS_ADDRESS );
+  HOST_CHECK( is_saved(current(), 800) );
+
+  // already home
+  log_backup();
+  HOST_CHECK( flash_ops(move_home) == 0 );
+
+  // first record goes after the legacy settings, which are kept until the log moves
+  save(801);
+  HOST_CHECK( current_record() == slot_record(0, 1) );
+  HOST_CHECK( current_record()->seq == 1 );
+  HOST_CHECK( memcmp((void const*) BOOTLOADER_SETTINGS_ADDRESS, &legacy, legacy_words*4) == 0 );
+
+  move_home();
+  HOST_CHECK( current_record() == slot_record(0, 0) );
+  HOST_CHECK( current_record()->seq == 3 );
+  HOST_CHECK( is_saved(current(), 801) );
+
+  reset();
+  HOST_CHECK( is_saved(current(), 801) );
+}
+
+int main(void)
+{
+  flash_sim_init();
+
+  check_saves(false);
+  check_saves(true);
+  check_cache();
+  check_save_power_cuts();
+  check_bad_crc();
+  check_home();
+  check_legacy();
+
+  printf("settings log: %u slots per page, record of %u words, all checks passed\n",
+         (unsigned) SLOT_COUNT, (unsigned) RECORD_WORDS);
+
+  return 0;
+}
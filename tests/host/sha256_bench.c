@@ -0,0 +1,127 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// SHA-256 against FIPS 180-2 vectors, fed in any split, and its throughput hashing 1 MB in
+// 512-byte updates (as DFU packets and flash pages are hashed) next to CRC16.
+
+#include <string.h>
+
+#include "flash_sim.h"
+#include "sha256.h"
+#include "crc16.h"
+
+#define BENCH_SIZE     (1024*1024)
+#define BENCH_UPDATE   512
+#define BENCH_REPEAT   50
+
+typedef struct
+{
+  char const* msg;
+  uint32_t    repeat;
+  char const* digest;
+} vector_t;
+
+static vector_t const _vectors[] =
+{
+  { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static uint8_t _buf[BENCH_SIZE];
+
+static void to_hex(uint8_t const* digest, char* hex)
+{
+  for(int i = 0; i < SHA256_DIGEST_LEN; i++) sprintf(hex + 2*i, "%02x", digest[i]);
+}
+
+// hash vector, feeding it chunk bytes at a time
+static void check_vector(vector_t const* v, uint32_t chunk)
+{
+  uint32_t const msg_len = strlen(v->msg);
+  uint32_t const total = msg_len * v->repeat;
+
+  HOST_CHECK( total <= sizeof(_buf) );
+  for(uint32_t i = 0; i < v->repeat; i++) memcpy(_buf + i*msg_len, v->msg, msg_len);
+
+  sha256_context_t ctx;
+  uint8_t digest[SHA256_DIGEST_LEN];
+  char hex[2*SHA256_DIGEST_LEN + 1];
+
+  sha256_init(&ctx);
+  for(uint32_t offset = 0; offset < total; offset += chunk)
+  {
+    sha256_update(&ctx, _buf + offset, (total - offset) < chunk ? (total - offset) : chunk);
+  }
+  sha256_final(&ctx, digest);
+
+  to_hex(digest, hex);
+  HOST_CHECK( strcmp(hex, v->digest) == 0 );
+}
+
+int main(void)
+{
+  uint32_t const chunks[] = { 1, 3, 55, 63, 64, 65, 512, BENCH_SIZE };
+
+  for(uint32_t i = 0; i < sizeof(_vectors)/sizeof(_vectors[0]); i++)
+  {
+    for(uint32_t c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++) check_vector(&_vectors[i], chunks[c]);
+  }
+
+  for(uint32_t i = 0; i < BENCH_SIZE; i++) _buf[i] = (uint8_t) (i*7);
+
+  sha256_context_t ctx;
+  uint8_t digest[SHA256_DIGEST_LEN];
+
+  uint64_t t0 = host_time_ns();
+  for(int k = 0; k < BENCH_REPEAT; k++)
+  {
+    sha256_init(&ctx);
+    for(uint32_t offset = 0; offset < BENCH_SIZE; offset += BENCH_UPDATE) sha256_update(&ctx, _buf + offset, BENCH_UPDATE);
+    sha256_final(&ctx, digest);
+  }
+  uint64_t const sha_ns = host_time_ns() - t0;
+
+  volatile uint16_t sink = 0;
+
+  t0 = host_time_ns();
+  for(int k = 0; k < BENCH_REPEAT; k++)
+  {
+    uint16_t crc = 0xFFFF;
+    for(uint32_t offset = 0; offset < BENCH_SIZE; offset += BENCH_UPDATE) crc = crc16_compute(_buf + offset, BENCH_UPDATE, &crc);
+    sink += crc;
+  }
+  uint64_t const crc_ns = host_time_ns() - t0;
+
+  double const mb = (double) BENCH_SIZE * BENCH_REPEAT / 1e6;
+
+  printf("FIPS 180-2 vectors ok\n");
+  printf("1 MB in %u byte updates\n", BENCH_UPDATE);
+  printf("  sha256  %6.1f MB/s\n", mb / (sha_ns / 1e9));
+  printf("  crc16   %6.1f MB/s\n", mb / (crc_ns / 1e9));
+
+  return 0;
+}
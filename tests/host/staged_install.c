@@ -0,0 +1,506 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Install of images staged by the application (dfu_staged.c), plain and LZ4 compressed: a block
+// made by the reference LZ4 library and blocks of a greedy compressor decompress to their image,
+// corrupt blocks (zero or too far offset, literals or match running too long) are refused and
+// leave bank 0 invalid. Power is cut during installation, which must then resume from
+// BANK_VALID_STAGED. The staged image CRC is checked before bank 0 is touched.
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "flash_sim.h"
+#include "host_stub.h"
+
+#include "nrf_error.h"
+#include "crc16.h"
+#include "dfu_types.h"
+#include "bootloader.h"
+#include "dfu_staged.h"
+
+#define BANK_0        DFU_BANK_0_REGION_START
+#define STAGING       DFU_BANK_1_REGION_START
+
+#define OLD_APP_SIZE  8192
+
+// LZ4 block of lz4_vector_image(), made by python lz4.block.compress(store_size=False,
+// mode='high_compression'): long literals, overlapping match of distance 1, long match
+static uint8_t const _lz4_vector[] =
+{
+  0xff, 0x28, 0x4c, 0x5a, 0x34, 0x20, 0x62, 0x6c, 0x6f, 0x63, 0x6b, 0x20, 0x64, 0x65, 0x63, 0x6f,
+  0x6d, 0x70, 0x72, 0x65, 0x73, 0x73, 0x65, 0x64, 0x20, 0x62, 0x79, 0x20, 0x74, 0x68, 0x65, 0x20,
+  0x62, 0x6f, 0x6f, 0x74, 0x6c, 0x6f, 0x61, 0x64, 0x65, 0x72, 0x20, 0x69, 0x6e, 0x74, 0x6f, 0x20,
+  0x62, 0x61, 0x6e, 0x6b, 0x20, 0x30, 0x2e, 0x20, 0x61, 0x01, 0x00, 0xff, 0x19, 0xaf, 0x30, 0x31,
+  0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x0a, 0x00, 0x15, 0x02, 0x66, 0x01, 0x02, 0x6d,
+  0x01, 0x2a, 0x31, 0x20, 0x0e, 0x00, 0xf0, 0x19, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+  0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27
+};
+
+static uint8_t _image[64*1024];
+static uint8_t _staged[80*1024];
+
+static dfu_update_status_code_t _last_status;
+static uint32_t _staged_count; // DFU_BANK_0_STAGED reported
+
+//--------------------------------------------------------------------+
+// Bootloader: settings recorded as bootloader_dfu_update_process() does
+//--------------------------------------------------------------------+
+void bootloader_dfu_update_process(dfu_update_status_t update_status)
+{
+  _last_status = update_status.status_code;
+
+  switch ( update_status.status_code )
+  {
+    case DFU_BANK_0_STAGED:
+      _staged_count++;
+      host_settings.bank_0           = BANK_VALID_STAGED;
+      host_settings.bank_0_crc       = update_status.app_crc;
+      host_settings.bank_0_size      = update_status.app_size;
+      host_settings.staged_init_size = update_status.staged_init_size;
+      host_settings.staged_flags     = update_status.staged_flags;
+    break;
+
+    case DFU_UPDATE_APP_COMPLETE:
+      host_settings.bank_0      = BANK_VALID_APP;
+      host_settings.bank_0_crc  = update_status.app_crc;
+      host_settings.bank_0_size = update_status.app_size;
+    break;
+
+    case DFU_BANK_0_ERASED:
+      host_settings.bank_0      = BANK_ERASED;
+      host_settings.bank_0_size = 0;
+    break;
+
+    default: break;
+  }
+}
+
+//--------------------------------------------------------------------+
+// LZ4 block compressor, greedy with a hash of 4 byte sequences
+//--------------------------------------------------------------------+
+static uint8_t* lz4_put_length(uint8_t* out, uint32_t len)
+{
+  while ( len >= 255 )
+  {
+    *out++ = 255;
+    len -= 255;
+  }
+  *out++ = (uint8_t) len;
+  return out;
+}
+
+// Sequence of literals then a match, the last one has no match (match_len 0)
+static uint8_t* lz4_put_sequence(uint8_t* out, uint8_t const* lit, uint32_t lit_len, uint32_t distance, uint32_t match_len)
+{
+  uint32_t const ml = match_len ? (match_len - 4) : 0;
+
+  *out++ = (uint8_t) (((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+  if ( lit_len >= 15 ) out = lz4_put_length(out, lit_len - 15);
+
+  memcpy(out, lit, lit_len);
+  out += lit_len;
+
+  if ( match_len )
+  {
+    *out++ = (uint8_t) distance;
+    *out++ = (uint8_t) (distance >> 8);
+    if ( ml >= 15 ) out = lz4_put_length(out, ml - 15);
+  }
+
+  return out;
+}
+
+static uint32_t lz4_compress(uint8_t const* src, uint32_t len, uint8_t* dst)
+{
+  static uint32_t table[1 << 12]; // position + 1 of last sequence with this hash
+  memset(table, 0, sizeof(table));
+
+  uint8_t* out = dst;
+  uint32_t anchor = 0;
+  uint32_t pos = 0;
+
+  // format rules: last 5 bytes are literals, last match starts 12 bytes before the end
+  while ( pos + 12 <= len )
+  {
+    uint32_t seq;
+    memcpy(&seq, src + pos, 4);
+
+    uint32_t const h   = (seq * 2654435761u) >> 20;
+    uint32_t const ref = table[h] - 1;
+    table[h] = pos + 1;
+
+    if ( (ref < pos) && (pos - ref <= 0xFFFF) && !memcmp(src + ref, src + pos, 4) )
+    {
+      uint32_t match_len = 4;
+      while ( (pos + match_len < len - 5) && (src[ref + match_len] == src[pos + match_len]) ) match_len++;
+
+      out = lz4_put_sequence(out, src + anchor, pos - anchor, pos - ref, match_len);
+      pos += match_len;
+      anchor = pos;
+    }
+    else
+    {
+      pos++;
+    }
+  }
+
+  out = lz4_put_sequence(out, src + anchor, len - anchor, 0, 0);
+
+  return (uint32_t) (out - dst);
+}
+
+//--------------------------------------------------------------------+
+// Helpers
+//--------------------------------------------------------------------+
+static uint32_t _rand_state = 1;
+
+static uint8_t host_rand(void)
+{
+  _rand_state = _rand_state * 1103515245 + 12345;
+  return (uint8_t) (_rand_state >> 16);
+}
+
+// Zeroed memory at a fixed address: no init RAM of the command block, WDT registers (not started)
+static void map_page(uint32_t addr)
+{
+  uintptr_t const page = addr & ~(uintptr_t) 0xFFF;
+  void* p = mmap((void*) page, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+  if ( p != (void*) page )
+  {
+    fprintf(stderr, "cannot map 0x%lx\n", (unsigned long) page);
+    exit(1);
+  }
+}
+
+static uint32_t lz4_vector_image(uint8_t* image)
+{
+  uint32_t len = 0;
+
+  char const text[] = "LZ4 block decompressed by the bootloader into bank 0. ";
+  memcpy(image, text, strlen(text));
+  len += strlen(text);
+
+  memset(image + len, 'a', 300);
+  len += 300;
+
+  for(int i = 0; i < 5; i++)
+  {
+    memcpy(image + len, "0123456789", 10);
+    len += 10;
+  }
+
+  memcpy(image + len, "bank 0 bank 1 bank 0 bank 1 ", 28);
+  len += 28;
+
+  for(int i = 0; i < 40; i++) image[len++] = (uint8_t) i;
+
+  return len;
+}
+
+// Random bytes, runs, and copies from near and far behind
+static uint32_t mixed_image(uint8_t* image, uint32_t len)
+{
+  uint32_t pos = 0;
+
+  while ( pos < len )
+  {
+    uint32_t n = 1 + host_rand() % 200;
+    if ( n > len - pos ) n = len - pos;
+
+    switch ( host_rand() % 4 )
+    {
+      case 0: for(uint32_t i = 0; i < n; i++) image[pos+i] = host_rand(); break;
+      case 1: memset(image + pos, host_rand(), n); break;
+
+      default:
+      {
+        uint32_t const distance = 1 + ((host_rand() % 2) ? host_rand() % 8 : (host_rand() << 8 | host_rand()));
+        if ( distance > pos ) { memset(image + pos, 0x5A, n); break; }
+        for(uint32_t i = 0; i < n; i++) image[pos+i] = image[pos+i - distance];
+      }
+      break;
+    }
+
+    pos += n;
+  }
+
+  return len;
+}
+
+// Previous application in bank 0, valid in settings
+static void old_app(void)
+{
+  flash_sim_erase_all();
+
+  for(uint32_t i = 0; i < OLD_APP_SIZE; i++) ((uint8_t*) BANK_0)[i] = (uint8_t) (i * 7);
+
+  memset(&host_settings, 0xFF, sizeof(host_settings));
+  host_settings.bank_0      = BANK_VALID_APP;
+  host_settings.bank_0_crc  = crc16_compute((uint8_t const*) BANK_0, OLD_APP_SIZE, NULL);
+  host_settings.bank_0_size = OLD_APP_SIZE;
+
+  // as programmed by the application before it resets
+  flash_sim_stats.erase_count = flash_sim_stats.word_count = 0;
+}
+
+static bool old_app_kept(void)
+{
+  for(uint32_t i = 0; i < OLD_APP_SIZE; i++)
+  {
+    if ( ((uint8_t const*) BANK_0)[i] != (uint8_t) (i * 7) ) return false;
+  }
+
+  return (host_settings.bank_0 == BANK_VALID_APP) && (flash_sim_stats.erase_count == 0) && (flash_sim_stats.word_count == 0);
+}
+
+// Staged data, init packet with the CRC of the image, then command block
+static void stage(uint8_t const* staged, uint32_t staged_len, uint16_t flags, uint8_t const* image, uint32_t image_len)
+{
+  memcpy((void*) STAGING, staged, staged_len);
+
+  // device type, revision, application version, any SoftDevice, CRC of the image installed
+  struct __attribute__((packed))
+  {
+    uint16_t device_type;
+    uint16_t device_rev;
+    uint32_t app_version;
+    uint16_t softdevice_len;
+    uint16_t softdevice;
+    uint16_t crc;
+  } const init = { 0x0052, 0xFFFF, 0xFFFFFFFF, 1, 0xFFFE, crc16_compute(image, image_len, NULL) };
+
+  memcpy((void*) (STAGING + ((staged_len + 3) & ~3u)), &init, sizeof(init));
+
+  dfu_staged_cmd_t* cmd = (dfu_staged_cmd_t*) DFU_STAGED_CMD_MEM;
+  cmd->magic      = DFU_STAGED_CMD_MAGIC;
+  cmd->image_size = staged_len;
+  cmd->init_size  = sizeof(init);
+  cmd->flags      = flags;
+  cmd->image_crc  = crc16_compute(staged, staged_len, NULL);
+  cmd->crc        = crc16_compute((uint8_t const*) cmd, offsetof(dfu_staged_cmd_t, crc), NULL);
+}
+
+static void check_installed(uint8_t const* image, uint32_t image_len)
+{
+  HOST_CHECK( _last_status == DFU_UPDATE_APP_COMPLETE );
+  HOST_CHECK( host_settings.bank_0 == BANK_VALID_APP );
+  HOST_CHECK( host_settings.bank_0_size == image_len );
+  HOST_CHECK( host_settings.bank_0_crc == crc16_compute(image, image_len, NULL) );
+  HOST_CHECK( memcmp((void const*) BANK_0, image, image_len) == 0 );
+
+  // rest of the last word is left erased
+  for(uint32_t i = image_len; i % 4; i++) HOST_CHECK( ((uint8_t const*) BANK_0)[i] == 0xFF );
+}
+
+//--------------------------------------------------------------------+
+// Tests
+//--------------------------------------------------------------------+
+
+// Plain and LZ4 images installed to bank 0
+static void check_round_trip(void)
+{
+  // plain, not a whole number of words or pages
+  uint32_t len = mixed_image(_image, 10001);
+  old_app();
+  stage(_image, len, 0, _image, len);
+  HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+  check_installed(_image, len);
+
+  // block of the reference library
+  len = lz4_vector_image(_image);
+  old_app();
+  stage(_lz4_vector, sizeof(_lz4_vector), DFU_STAGED_FLAG_LZ4, _image, len);
+  HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+  check_installed(_image, len);
+
+  // blocks of every size up to a few pages, matches reach back into committed pages
+  for(uint32_t size = 1; size < sizeof(_image); size = size*3 + 1)
+  {
+    len = mixed_image(_image, size);
+    uint32_t const staged_len = lz4_compress(_image, len, _staged);
+    HOST_CHECK( staged_len <= sizeof(_staged) );
+
+    old_app();
+    stage(_staged, staged_len, DFU_STAGED_FLAG_LZ4, _image, len);
+    HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+    check_installed(_image, len);
+  }
+}
+
+// Refused after output bytes, before writing any byte of the bad sequence
+static void check_refused(uint8_t const* block, uint32_t len, uint32_t output)
+{
+  old_app();
+  stage(block, len, DFU_STAGED_FLAG_LZ4, _image, 4);
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_DATA );
+
+  // bank 0 is no longer the previous application, staged data is untouched
+  HOST_CHECK( _last_status == DFU_BANK_0_ERASED );
+  HOST_CHECK( host_settings.bank_0 == BANK_ERASED );
+  HOST_CHECK( flash_sim_stats.word_count <= (output + 3) / 4 );
+  HOST_CHECK( memcmp((void const*) STAGING, block, len) == 0 );
+}
+
+// Corrupt LZ4 blocks
+static void check_corrupt(void)
+{
+  // 4 literals, then a match of offset 0 and of offset 5 (only 4 bytes output)
+  uint8_t const zero_offset[] = { 0x40, 'a', 'b', 'c', 'd', 0x00, 0x00 };
+  check_refused(zero_offset, sizeof(zero_offset), 4);
+
+  uint8_t const far_offset[] = { 0x40, 'a', 'b', 'c', 'd', 0x05, 0x00 };
+  check_refused(far_offset, sizeof(far_offset), 4);
+
+  // 15 + 16 literals announced, 4 present
+  uint8_t const long_literals[] = { 0xF0, 0x10, 'a', 'b', 'c', 'd' };
+  check_refused(long_literals, sizeof(long_literals), 4);
+
+  // literal length extension cut short, then match length extension cut short
+  uint8_t const cut_literals[] = { 0xF0, 0xFF };
+  check_refused(cut_literals, sizeof(cut_literals), 0);
+
+  uint8_t const cut_match[] = { 0x1F, 'a', 0x01, 0x00, 0xFF };
+  check_refused(cut_match, sizeof(cut_match), 1);
+
+  // run of distance 1 longer than bank 0, must stop before the staging region
+  uint32_t n = 0;
+  _staged[n++] = 0x1F;
+  _staged[n++] = 'a';
+  _staged[n++] = 0x01;
+  _staged[n++] = 0x00;
+  for(uint32_t i = 0; i <= DFU_IMAGE_MAX_SIZE_BANKED / 255; i++) _staged[n++] = 0xFF;
+  _staged[n++] = 0x00;
+  check_refused(_staged, n, DFU_IMAGE_MAX_SIZE_BANKED);
+  HOST_CHECK( ((uint8_t const*) STAGING)[-1] == 'a' );
+}
+
+// Installation from flash as left by a power cut after cut erases and word writes
+static void check_resume_at(uint8_t const* staged, uint32_t staged_len, uint16_t flags,
+                            uint8_t const* image, uint32_t image_len, uint32_t cut)
+{
+  static jmp_buf power_lost;
+
+  old_app();
+  stage(staged, staged_len, flags, image, image_len);
+
+  if ( setjmp(power_lost) == 0 )
+  {
+    flash_sim_power_cut(cut, &power_lost);
+    dfu_staged_install();
+    HOST_CHECK( false );
+  }
+
+  // recorded before bank 0 was touched, command block is consumed
+  HOST_CHECK( host_settings.bank_0 == BANK_VALID_STAGED );
+  HOST_CHECK( dfu_staged_in_progress() );
+  HOST_CHECK( ((dfu_staged_cmd_t const*) DFU_STAGED_CMD_MEM)->magic != DFU_STAGED_CMD_MAGIC );
+
+  // resumed from the settings, which are not saved again
+  _staged_count = 0;
+  HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+  HOST_CHECK( _staged_count == 0 );
+  check_installed(image, image_len);
+}
+
+static void check_resume(void)
+{
+  uint32_t const len = mixed_image(_image, 10001);
+  uint32_t const staged_len = lz4_compress(_image, len, _staged);
+
+  for(uint16_t flags = 0; flags <= DFU_STAGED_FLAG_LZ4; flags++)
+  {
+    uint8_t const* staged = flags ? _staged : _image;
+    uint32_t const size   = flags ? staged_len : len;
+
+    // erases and words of a whole install
+    old_app();
+    stage(staged, size, flags, _image, len);
+    HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+    uint32_t const ops = flash_sim_stats.erase_count + flash_sim_stats.word_count;
+
+    for(uint32_t cut = 0; cut < ops; cut++)
+    {
+      check_resume_at(staged, size, flags, _image, len, cut);
+    }
+  }
+}
+
+// Staged data and command block are checked before bank 0 is touched
+static void check_before_install(void)
+{
+  uint32_t const len = mixed_image(_image, 10001);
+
+  // staged image differs from its CRC
+  old_app();
+  stage(_image, len, 0, _image, len);
+  ((uint8_t*) STAGING)[len / 2] ^= 1;
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_DATA );
+  HOST_CHECK( old_app_kept() );
+
+  // command block CRC, then command block consumed by the first attempt
+  old_app();
+  stage(_image, len, 0, _image, len);
+  ((dfu_staged_cmd_t*) DFU_STAGED_CMD_MEM)->crc ^= 1;
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_DATA );
+  HOST_CHECK( old_app_kept() );
+
+  old_app();
+  stage(_image, len, 0, _image, len);
+  HOST_CHECK( dfu_staged_install() == NRF_SUCCESS );
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_DATA );
+
+  // image larger than bank 0
+  old_app();
+  stage(_image, len, 0, _image, len);
+  dfu_staged_cmd_t* cmd = (dfu_staged_cmd_t*) DFU_STAGED_CMD_MEM;
+  cmd->image_size = DFU_IMAGE_MAX_SIZE_BANKED + 4;
+  cmd->crc        = crc16_compute((uint8_t const*) cmd, offsetof(dfu_staged_cmd_t, crc), NULL);
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_LENGTH );
+  HOST_CHECK( old_app_kept() );
+
+  // installed image differs from the CRC of the init packet: checked once written
+  old_app();
+  stage(_image, len, 0, _image, len - 1);
+  HOST_CHECK( dfu_staged_install() == NRF_ERROR_INVALID_DATA );
+  HOST_CHECK( host_settings.bank_0 == BANK_ERASED );
+}
+
+int main(void)
+{
+  flash_sim_init();
+  map_page(DFU_STAGED_CMD_MEM);
+  map_page(NRF_WDT_BASE);
+
+  check_round_trip();
+  check_corrupt();
+  check_resume();
+  check_before_install();
+
+  printf("staged install: all checks passed\n");
+
+  return 0;
+}
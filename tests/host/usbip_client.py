@@ -0,0 +1,461 @@
+#!/usr/bin/env python3
+"""Write a UF2 image through the bootloader drive served by usbip_uf2, without root.
+
+Starts usbip_uf2 on a new (erased) flash file and talks USB/IP to it as vhci-hcd would:
+imports bus id 1-1, enumerates, then mounts the UF2 drive over MSC bulk-only transport.
+Reads the boot sector and INFO_UF2.TXT, writes a generated application as UF2 blocks,
+and checks the update is reported complete with the image CRC, that CURRENT.BIN reads it
+back, and that the flash file holds it at the application address.
+
+Then writes another application with vendor bulk DFU (START, INIT, DATA and STOP packets
+with two packets in flight) and checks it is activated and is in the flash file.
+
+Before that, checks that CDC only mode (serial only and verify only DFU) enumerates
+nothing but CDC, so that no interface can write flash.
+
+usage: usbip_client.py [--port N] usbip_uf2 flash.bin
+"""
+
+import os
+import random
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+FLASH_SIM_START = 0x10000
+APP_ADDR = 0x26000
+APP_SIZE = 50000  # not a multiple of 256, last block is partial
+
+UF2_MAGIC_START0 = 0x0A324655
+UF2_MAGIC_START1 = 0x9E5D5157
+UF2_MAGIC_END = 0x0AB16F30
+UF2_FLAG_FAMILYID = 0x00002000
+UF2_FAMILY_ID = 0xADA52840
+UF2_PAYLOAD = 256
+
+DFU_INIT_PACKET = 0x01
+DFU_START_PACKET = 0x03
+DFU_DATA_PACKET = 0x04
+DFU_STOP_DATA_PACKET = 0x05
+DFU_UPDATE_APP = 0x04
+NRF_ERROR_INVALID_LENGTH = 9
+
+USBIP_VERSION = 0x0111
+OP_REQ_DEVLIST = 0x8005
+OP_REQ_IMPORT = 0x8003
+CMD_SUBMIT = 1
+RET_SUBMIT = 3
+USBIP_EPIPE = -32  # stalled
+DEVID = (1 << 16) | 1  # busnum 1, devnum 1
+
+SCSI_INQUIRY = 0x12
+SCSI_READ_CAPACITY10 = 0x25
+SCSI_READ10 = 0x28
+SCSI_WRITE10 = 0x2A
+
+
+def check(cond, what):
+    if not cond:
+        raise SystemExit('check failed: ' + what)
+
+
+def crc16(data):
+    """CRC16-CCITT as crc16_compute() of the bootloader, initial value 0xFFFF"""
+    crc = 0xFFFF
+    for b in data:
+        crc = ((crc >> 8) & 0xFF) | ((crc << 8) & 0xFFFF)
+        crc ^= b
+        crc ^= (crc & 0xFF) >> 4
+        crc ^= (crc << 12) & 0xFFFF
+        crc ^= (crc & 0xFF) << 5
+    return crc
+
+
+def uf2_image(data, addr):
+    blocks = []
+    count = (len(data) + UF2_PAYLOAD - 1) // UF2_PAYLOAD
+    for i in range(count):
+        payload = data[i * UF2_PAYLOAD:(i + 1) * UF2_PAYLOAD]
+        hdr = struct.pack('<IIIIIIII', UF2_MAGIC_START0, UF2_MAGIC_START1, UF2_FLAG_FAMILYID,
+                          addr + i * UF2_PAYLOAD, len(payload), i, count, UF2_FAMILY_ID)
+        blocks.append(hdr + payload.ljust(476, b'\0') + struct.pack('<I', UF2_MAGIC_END))
+    return b''.join(blocks)
+
+
+class UsbipDevice:
+    def __init__(self, port):
+        self.port = port
+        self.seq = 0
+        self.sock = None
+
+    def connect(self):
+        # server may still be starting up
+        for _ in range(100):
+            try:
+                return socket.create_connection(('127.0.0.1', self.port))
+            except ConnectionRefusedError:
+                time.sleep(0.05)
+        raise SystemExit('cannot connect to 127.0.0.1:%d' % self.port)
+
+    def recv(self, n):
+        buf = b''
+        while len(buf) < n:
+            chunk = self.sock.recv(n - len(buf))
+            if not chunk:
+                raise EOFError('server closed connection')
+            buf += chunk
+        return buf
+
+    def devlist(self):
+        self.sock = self.connect()
+        self.sock.sendall(struct.pack('>HHI', USBIP_VERSION, OP_REQ_DEVLIST, 0))
+        self.recv(8)
+        devices = []
+        for _ in range(struct.unpack('>I', self.recv(4))[0]):
+            dev = self.recv(312)
+            self.recv(4 * dev[311])  # interfaces
+            devices.append((dev[256:288].rstrip(b'\0').decode(), struct.unpack('>HH', dev[300:304])))
+        self.sock.close()
+        return devices
+
+    def attach(self, busid):
+        self.sock = self.connect()
+        self.sock.sendall(struct.pack('>HHI', USBIP_VERSION, OP_REQ_IMPORT, 0) + busid.encode().ljust(32, b'\0'))
+        _, _, status = struct.unpack('>HHI', self.recv(8))
+        check(status == 0, 'import of %s' % busid)
+        self.recv(312)
+
+    def submit(self, ep, dir_in, length, setup=bytes(8), data=b''):
+        """Submit one URB and wait for its completion, return status and IN data"""
+        self.seq += 1
+        self.sock.sendall(struct.pack('>IIIIIIiiii', CMD_SUBMIT, self.seq, DEVID, int(dir_in), ep, 0,
+                                      length, 0, 0, 0) + setup + data)
+        ret = self.recv(48)
+        cmd, seq, _, _, _, status, actual = struct.unpack('>IIIIIii', ret[:28])
+        check(cmd == RET_SUBMIT and seq == self.seq, 'reply to URB %d' % self.seq)
+        return status, (self.recv(actual) if dir_in and actual > 0 else b'')
+
+    def control(self, bm_request_type, request, value, index, length, data=b''):
+        setup = struct.pack('<BBHHH', bm_request_type, request, value, index, length)
+        status, data_in = self.submit(0, bool(bm_request_type & 0x80), length, setup, data)
+        check(status == 0, 'control request %02X %02X' % (bm_request_type, request))
+        return data_in
+
+
+class MscDrive:
+    def __init__(self, dev, ep_out, ep_in):
+        self.dev = dev
+        self.ep_out = ep_out
+        self.ep_in = ep_in
+        self.tag = 0
+
+    def scsi(self, cdb, dir_in, length, data=b''):
+        self.tag += 1
+        cbw = struct.pack('<IIIBBB', 0x43425355, self.tag, length, 0x80 if dir_in else 0, 0, len(cdb))
+        self.dev.submit(self.ep_out, False, 31, data=cbw + cdb.ljust(16, b'\0'))
+
+        data_in = b''
+        if length and dir_in:
+            _, data_in = self.dev.submit(self.ep_in, True, length)
+        elif length:
+            self.dev.submit(self.ep_out, False, length, data=data)
+
+        _, csw = self.dev.submit(self.ep_in, True, 13)
+        sig, tag, _, status = struct.unpack('<IIIB', csw)
+        check(sig == 0x53425355 and tag == self.tag and status == 0, 'CSW of SCSI %02X' % cdb[0])
+        return data_in
+
+    def read(self, lba, count):
+        return self.scsi(struct.pack('>BBIBHB', SCSI_READ10, 0, lba, 0, count, 0), True, count * 512)
+
+    def write(self, lba, data):
+        count = len(data) // 512
+        self.scsi(struct.pack('>BBIBHB', SCSI_WRITE10, 0, lba, 0, count, 0), False, len(data), data)
+
+
+def class_endpoints(config, itf_class):
+    """Bulk OUT and IN endpoints of the interface of a class"""
+    pos = 0
+    in_itf = False
+    eps = {}
+    while pos < len(config):
+        length, desc_type = config[pos], config[pos + 1]
+        if desc_type == 4:  # interface
+            in_itf = (config[pos + 5] == itf_class)
+        elif desc_type == 5 and in_itf:  # endpoint
+            addr = config[pos + 2]
+            eps['in' if addr & 0x80 else 'out'] = addr & 0x7F
+        pos += length
+    return eps['out'], eps['in']
+
+
+class VendorDfu:
+    """DFU over the vendor bulk endpoint pair: one OUT transfer per packet, an IN response each"""
+
+    def __init__(self, dev, ep_out, ep_in):
+        self.dev = dev
+        self.ep_out = ep_out
+        self.ep_in = ep_in
+        self.seq = 0
+        self.sent = []  # (type, seq) of packets not answered yet
+
+    def send(self, packet_type, payload):
+        self.seq = (self.seq + 1) & 0xFF
+        packet = struct.pack('<BBH', packet_type, self.seq, 0) + payload
+        # a short packet ends the transfer, no zero length packet is needed
+        check(len(packet) % 64 != 0, 'vendor DFU packet of %d bytes ends short' % len(packet))
+        status, _ = self.dev.submit(self.ep_out, False, len(packet), data=packet)
+        check(status == 0, 'vendor DFU packet %d sent' % packet_type)
+        self.sent.append((packet_type, self.seq))
+
+    def response(self):
+        """Result of the oldest packet not answered yet"""
+        status, resp = self.dev.submit(self.ep_in, True, 8)
+        check(status == 0 and len(resp) == 8, 'vendor DFU response')
+        packet_type, seq, _, result = struct.unpack('<BBHI', resp)
+        check((packet_type, seq) == self.sent.pop(0), 'response to packet %d seq %d' % (packet_type, seq))
+        return result
+
+    def request(self, packet_type, payload):
+        self.send(packet_type, payload)
+        return self.response()
+
+
+class FatVolume:
+    def __init__(self, drive):
+        self.drive = drive
+        boot = drive.read(0, 1)
+        check(boot[510:512] == b'\x55\xAA', 'boot sector signature')
+
+        bytes_per_sector, self.sectors_per_cluster, reserved, fat_copies, root_entries = \
+            struct.unpack('<HBHBH', boot[11:19])
+        sectors_per_fat = struct.unpack('<H', boot[22:24])[0]
+        check(bytes_per_sector == 512, 'sector size')
+
+        self.root_lba = reserved + fat_copies * sectors_per_fat
+        self.root_sectors = root_entries * 32 // 512
+        self.data_lba = self.root_lba + self.root_sectors
+
+    def files(self):
+        root = self.drive.read(self.root_lba, self.root_sectors)
+        entries = {}
+        for i in range(0, len(root), 32):
+            entry = root[i:i + 32]
+            if entry[0] in (0, 0xE5) or entry[11] & 0x08:  # free or volume label
+                continue
+            entries[entry[0:11].decode()] = struct.unpack('<HI', entry[26:32])
+        return entries
+
+    def read_file(self, name):
+        cluster, size = self.files()[name]
+        lba = self.data_lba + (cluster - 2) * self.sectors_per_cluster
+        return self.drive.read(lba, (size + 511) // 512)[:size]
+
+
+class Server:
+    """usbip_uf2 running on a new (erased) flash file"""
+
+    def __init__(self, server_path, flash_path, *options):
+        if os.path.exists(flash_path):
+            os.remove(flash_path)
+        self.proc = subprocess.Popen([server_path] + list(options) + [flash_path], stdout=subprocess.PIPE,
+                                     universal_newlines=True)
+
+    def says(self, prefix):
+        """Wait for a line of server output starting with prefix"""
+        while True:
+            line = self.proc.stdout.readline()
+            check(line, 'server output "%s"' % prefix)
+            print('  server: ' + line.rstrip())
+            if line.startswith(prefix):
+                return line
+
+    def stop(self):
+        self.proc.terminate()
+        self.proc.wait()
+
+
+def interfaces(config):
+    """Interface classes of a configuration descriptor"""
+    pos = 0
+    classes = []
+    while pos < len(config):
+        if config[pos + 1] == 4:
+            classes.append(config[pos + 5])
+        pos += config[pos]
+    return classes
+
+
+def enumerate_device(dev, pid):
+    devices = dev.devlist()
+    check(devices == [('1-1', (0x239A, pid))], 'device list %s' % devices)
+
+    dev.attach('1-1')
+    dev.control(0x80, 6, 0x0100, 0, 18)  # device descriptor
+    config = dev.control(0x80, 6, 0x0200, 0, 9)
+    config = dev.control(0x80, 6, 0x0200, 0, struct.unpack('<H', config[2:4])[0])
+    dev.control(0x00, 9, 1, 0, 0)  # SET_CONFIGURATION
+    return config
+
+
+def check_cdc_only(server_path, flash_path, port):
+    """Serial only and verify only modes: nothing but CDC is enumerated"""
+    server = Server(server_path, flash_path, '--cdc-only')
+    try:
+        server.says('listening')
+
+        dev = UsbipDevice(port)
+        config = enumerate_device(dev, 0x002A)
+        server.says('mounted')
+
+        check(config[4] == 2 and interfaces(config) == [0x02, 0x0A], 'CDC only configuration %s' % interfaces(config))
+
+        # requests to the interfaces of USB DFU (3) and HF2 (4) find no driver and are stalled
+        status, _ = dev.submit(0, False, 4, struct.pack('<BBHHH', 0x21, 1, 0, 3, 4), bytes(4))  # DFU_DNLOAD
+        check(status == USBIP_EPIPE, 'DFU_DNLOAD stalled')
+        status, _ = dev.submit(0, False, 4, struct.pack('<BBHHH', 0x21, 9, 0x0200, 4, 4), bytes(4))  # SET_REPORT
+        check(status == USBIP_EPIPE, 'HID SET_REPORT stalled')
+
+        dev.sock.close()
+    finally:
+        server.stop()
+
+    print('usbip: CDC only mode enumerates CDC alone')
+
+
+def check_uf2_write(server_path, flash_path, port):
+    """Application written through the UF2 drive"""
+    server = Server(server_path, flash_path)
+    try:
+        server.says('listening')
+
+        dev = UsbipDevice(port)
+        config = enumerate_device(dev, 0x0029)
+        server.says('mounted')
+
+        drive = MscDrive(dev, *class_endpoints(config, 0x08))
+        inquiry = drive.scsi(bytes([SCSI_INQUIRY, 0, 0, 0, 36, 0]), True, 36)
+        print('inquiry: %s %s' % (inquiry[8:16].decode().strip(), inquiry[16:32].decode().strip()))
+
+        last_lba, block_size = struct.unpack('>II', drive.scsi(bytes([SCSI_READ_CAPACITY10]), True, 8))
+        check(block_size == 512, 'block size')
+
+        volume = FatVolume(drive)
+        info = volume.read_file('INFO_UF2TXT').decode(errors='replace')
+        check(info.startswith('UF2 Bootloader') and 'App: none' in info, 'INFO_UF2.TXT of an erased flash')
+
+        # application written as a host would copy a UF2 file: 4 KB transfers to free clusters at the end
+        rand = random.Random(1)
+        app = bytes(rand.getrandbits(8) for _ in range(APP_SIZE))
+        uf2 = uf2_image(app, APP_ADDR)
+        lba = last_lba + 1 - len(uf2) // 512
+
+        start = time.time()
+        for offset in range(0, len(uf2), 4096):
+            drive.write(lba + offset // 512, uf2[offset:offset + 4096])
+
+        done = server.says('update complete')
+        print('%d bytes written in %.0f ms' % (len(uf2), (time.time() - start) * 1000))
+
+        crc = crc16(app)
+        check('size %d, crc %04X' % (APP_SIZE, crc) in done, 'update of %d bytes with CRC %04X' % (APP_SIZE, crc))
+
+        # drive as the host sees it once mounted again after reset
+        info = volume.read_file('INFO_UF2TXT').decode(errors='replace')
+        check('App: valid, CRC %04X' % crc in info, 'INFO_UF2.TXT of the new application')
+
+        current = volume.read_file('CURRENT BIN')
+        check(current[:APP_SIZE] == app and current[APP_SIZE:] == b'\xFF' * (len(current) - APP_SIZE),
+              'CURRENT.BIN matches the image')
+
+        dev.sock.close()
+    finally:
+        server.stop()
+
+    with open(flash_path, 'rb') as f:
+        f.seek(APP_ADDR - FLASH_SIM_START)
+        check(f.read(APP_SIZE) == app, 'flash file holds the image at 0x%X' % APP_ADDR)
+
+    print('usbip: UF2 image written and read back over USB/IP')
+
+
+def check_vendor_dfu(server_path, flash_path, port):
+    """Application written with START, INIT, DATA and STOP packets of vendor bulk DFU"""
+    server = Server(server_path, flash_path)
+    try:
+        server.says('listening')
+
+        dev = UsbipDevice(port)
+        config = enumerate_device(dev, 0x0029)
+        server.says('mounted')
+
+        dfu = VendorDfu(dev, *class_endpoints(config, 0xFF))
+
+        rand = random.Random(2)
+        app = bytes(rand.getrandbits(8) for _ in range(APP_SIZE))
+
+        # payload must be words
+        check(dfu.request(DFU_DATA_PACKET, b'\0') == NRF_ERROR_INVALID_LENGTH, 'packet of odd length refused')
+
+        start = time.time()
+        check(dfu.request(DFU_START_PACKET, struct.pack('<IIII', DFU_UPDATE_APP, 0, 0, APP_SIZE)) == 0, 'START')
+        server.says('bank 0 erased')
+
+        # device type, revision, application version, any SoftDevice, then CRC padded to a word
+        init = struct.pack('<HHIHHH', 0x0052, 0xFFFF, 0xFFFFFFFF, 1, 0xFFFE, crc16(app)) + bytes(2)
+        check(dfu.request(DFU_INIT_PACKET, init) == 0, 'INIT')
+
+        # a page per packet, the next one is sent before the response to the previous one is read
+        # so that responses queue up on the device
+        for offset in range(0, APP_SIZE, 4096):
+            dfu.send(DFU_DATA_PACKET, app[offset:offset + 4096])
+            if len(dfu.sent) == 2:
+                check(dfu.response() == 0, 'DATA')
+        dfu.send(DFU_STOP_DATA_PACKET, b'')
+        check(dfu.response() == 0, 'DATA')
+
+        # image is activated once the response to STOP is sent
+        check(dfu.response() == 0, 'STOP')
+        done = server.says('update complete')
+        print('%d bytes sent in %.0f ms' % (APP_SIZE, (time.time() - start) * 1000))
+
+        # image was checked against the CRC of the init packet at STOP, like serial DFU no CRC is
+        # recorded for the start (0 skips the check)
+        check('size %d, crc 0000' % APP_SIZE in done, 'update of %d bytes' % APP_SIZE)
+
+        dev.sock.close()
+    finally:
+        server.stop()
+
+    with open(flash_path, 'rb') as f:
+        f.seek(APP_ADDR - FLASH_SIM_START)
+        check(f.read(APP_SIZE) == app, 'flash file holds the image at 0x%X' % APP_ADDR)
+
+    print('usbip: application written with vendor bulk DFU')
+
+
+def main():
+    args = sys.argv[1:]
+    port = 3240
+    if len(args) == 4 and args[0] == '--port':
+        port = int(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        print(__doc__)
+        sys.exit(1)
+
+    server_path, flash_path = args
+
+    # give up rather than hang if the server stops answering
+    signal.alarm(60)
+
+    check_cdc_only(server_path, flash_path, port)
+    check_uf2_write(server_path, flash_path, port)
+    check_vendor_dfu(server_path, flash_path, port)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,210 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2018 Ha Thach for Adafruit Industries
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// Bootloader USB stack (CDC, UF2 drive, HF2, USB DFU, vendor bulk DFU) exported over USB/IP by the tinyusb Linux
+// port, with flash kept in a file. The UF2 drive can then be mounted by the host kernel
+//
+//    usbip_uf2 [--cdc-only] flash.bin &
+//    usbip attach -r 127.0.0.1 -b 1-1
+//
+// or driven by usbip_client.py without root. Offset 0 of the file is flash address 0x10000.
+// Vendor bulk DFU runs the single bank DFU of the bootloader with its init packet checks.
+// A completed update is recorded in the stubbed settings and the drive is laid out again,
+// as the host would see it once mounted after the bootloader reset. Runs until killed.
+
+#include <string.h>
+#include <unistd.h>
+
+#include "tusb.h"
+#include "usb_desc.h"
+#include "bootloader.h"
+#include "dfu.h"
+#include "nrf_error.h"
+#include "pstorage.h"
+#include "app_timer.h"
+#include "app_error.h"
+#include "nrf_mbr.h"
+
+#include "flash_sim.h"
+#include "host_stub.h"
+
+extern uint16_t usb_desc_str_serial[1+16];
+
+void msc_uf2_task(void);
+void ghostfat_layout_reset(void);
+
+bool dfu_startup_packet_received;
+
+//--------------------------------------------------------------------+
+// Bootloader
+//--------------------------------------------------------------------+
+void bootloader_dfu_update_process(dfu_update_status_t update_status)
+{
+  if ( update_status.status_code == DFU_UPDATE_APP_COMPLETE )
+  {
+    host_settings.bank_0      = BANK_VALID_APP;
+    host_settings.bank_0_crc  = update_status.app_crc;
+    host_settings.bank_0_size = update_status.app_size;
+    host_app_valid = true;
+
+    ghostfat_layout_reset();
+    flash_sim_sync();
+
+    printf("update complete: size %u, crc %04X, %u pages erased\n",
+           update_status.app_size, update_status.app_crc, flash_sim_stats.erase_count);
+  }
+  else if ( update_status.status_code == DFU_BANK_0_ERASED )
+  {
+    host_settings.bank_0      = BANK_ERASED;
+    host_settings.bank_0_size = 0;
+    host_app_valid = false;
+
+    ghostfat_layout_reset();
+    flash_sim_sync();
+
+    printf("bank 0 erased\n");
+  }
+}
+
+//--------------------------------------------------------------------+
+// Board, SoftDevice and timer functions used by dfu_single_bank.c. Flash is written directly as
+// when the SoftDevice is disabled, the DFU timeout never fires
+//--------------------------------------------------------------------+
+bool is_ota(void)
+{
+  return false;
+}
+
+void app_error_handler_bare(ret_code_t error_code)
+{
+  fprintf(stderr, "error 0x%x\n", error_code);
+  exit(1);
+}
+
+uint32_t pstorage_register(pstorage_module_param_t * p_module_param, pstorage_handle_t * p_block_id)
+{
+  (void) p_module_param;
+  (void) p_block_id;
+  return NRF_SUCCESS;
+}
+
+// only used with the SoftDevice enabled (BLE DFU)
+uint32_t pstorage_clear(pstorage_handle_t * p_base_id, pstorage_size_t size)
+{
+  (void) p_base_id;
+  (void) size;
+  return NRF_ERROR_INVALID_STATE;
+}
+
+uint32_t pstorage_store(pstorage_handle_t * p_dest, uint8_t * p_src, pstorage_size_t size, pstorage_size_t offset)
+{
+  (void) p_dest;
+  (void) p_src;
+  (void) size;
+  (void) offset;
+  return NRF_ERROR_INVALID_STATE;
+}
+
+// SoftDevice and bootloader images are not swapped in
+uint32_t sd_mbr_command(sd_mbr_command_t* param)
+{
+  (void) param;
+  return NRF_ERROR_NOT_SUPPORTED;
+}
+
+ret_code_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode,
+                            app_timer_timeout_handler_t timeout_handler)
+{
+  (void) p_timer_id;
+  (void) mode;
+  (void) timeout_handler;
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+  (void) timer_id;
+  (void) timeout_ticks;
+  (void) p_context;
+  return NRF_SUCCESS;
+}
+
+ret_code_t app_timer_stop(app_timer_id_t timer_id)
+{
+  (void) timer_id;
+  return NRF_SUCCESS;
+}
+
+//--------------------------------------------------------------------+
+// tinyusb callbacks
+//--------------------------------------------------------------------+
+void tud_mount_cb(void)
+{
+  printf("mounted\n");
+}
+
+void tud_umount_cb(void)
+{
+  printf("unmounted\n");
+}
+
+int main(int argc, char* argv[])
+{
+  // --cdc-only: descriptors of serial only and verify only modes
+  bool const cdc_only = (argc == 3) && !strcmp(argv[1], "--cdc-only");
+
+  if ( argc != 2 && !cdc_only )
+  {
+    fprintf(stderr, "usage: %s [--cdc-only] flash.bin\n", argv[0]);
+    return 1;
+  }
+
+  // line buffered so that a client reading our output sees each event
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  flash_sim_init_file(argv[argc-1]);
+
+  // application already in flash from a previous run is taken as valid
+  host_app_valid = (*((uint32_t const*) host_app_address) != 0xFFFFFFFF);
+
+  char const serial[] = "0123456789ABCDEF";
+  for(uint8_t i=0; i<16; i++) usb_desc_str_serial[1+i] = serial[i];
+
+  if ( cdc_only ) usb_desc_cdc_only();
+  dfu_init();
+  tusb_init();
+  printf("listening on 127.0.0.1:%u\n", CFG_TUD_USBIP_PORT);
+
+  while (1)
+  {
+    tud_task();
+    msc_uf2_task();
+    tud_cdc_write_flush();
+
+    usleep(100);
+  }
+
+  return 0;
+}
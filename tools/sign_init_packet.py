@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Sign an init packet for a bootloader built with DFU_PUBLIC_KEY.
+
+The input is the init packet up to the signature, i.e. ending with extended init packet id 2,
+firmware length and SHA-256 of the firmware (and the initial counter block of an encrypted
+image). The ECDSA P-256 signature covers the SHA-256 of that packet followed by the image
+type byte of the DFU start packet, it is appended as r | s (32 bytes each, big endian).
+
+usage: sign_init_packet.py private.pem {application,softdevice,bootloader,sd_bl} init.bin signed.bin
+
+openssl must be in PATH.
+"""
+
+import subprocess
+import sys
+
+IMAGE_TYPES = {
+    'softdevice': 0x01,
+    'bootloader': 0x02,
+    'sd_bl': 0x03,
+    'application': 0x04,
+}
+
+
+def der_integer(der, pos):
+    """Parse a DER INTEGER at pos, return its value and the position after it"""
+    if der[pos] != 0x02:
+        raise ValueError('expected DER INTEGER')
+    length = der[pos + 1]
+    return int.from_bytes(der[pos + 2:pos + 2 + length], 'big'), pos + 2 + length
+
+
+def sign(key_file, message):
+    der = subprocess.run(['openssl', 'dgst', '-sha256', '-sign', key_file], input=message,
+                         stdout=subprocess.PIPE, check=True).stdout
+
+    # SEQUENCE { INTEGER r, INTEGER s }, short form lengths for P-256
+    if der[0] != 0x30:
+        raise ValueError('expected DER SEQUENCE')
+    r, pos = der_integer(der, 2)
+    s, pos = der_integer(der, pos)
+
+    return r.to_bytes(32, 'big') + s.to_bytes(32, 'big')
+
+
+def main():
+    if len(sys.argv) != 5 or sys.argv[2] not in IMAGE_TYPES:
+        print(__doc__)
+        sys.exit(1)
+
+    key_file, image_type, in_file, out_file = sys.argv[1:]
+
+    with open(in_file, 'rb') as f:
+        packet = f.read()
+
+    signature = sign(key_file, packet + bytes([IMAGE_TYPES[image_type]]))
+
+    with open(out_file, 'wb') as f:
+        f.write(packet + signature)
+
+
+if __name__ == '__main__':
+    main()